@@ -44,6 +44,7 @@ When analyzing in the background, various menus are disabled so the user does no
 #include "config.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -939,10 +940,12 @@ NumberMovesGame(listOLD * plGame)
 }
 
 
+static int cPrefetchDone;       /* see PrefetchChunk() */
+
 static gboolean
 UpdateProgressBar(gpointer UNUSED(unused))
 {
-    ProgressValue(MT_GetDoneTasks());
+    ProgressValue(MAX(MT_GetDoneTasks() - MT_SafeGet(&cPrefetchDone), 0));
     return TRUE;
 }
 
@@ -964,6 +967,112 @@ AnalyseMoveMT(Task * task)
     }
 }
 
+/*
+ * Ahead of the moves of a game, tasks put the 0-ply evaluations of all
+ * the plays open to the chequer moves to be analysed in the cache, a
+ * chunk of positions each, in neural net batches shared between the
+ * positions.  They are queued at high priority, so the threads take them
+ * before the moves, and the first move filter of most moves then runs
+ * from the cache; the deeper stages of the moves share out their
+ * survivors and rolls over the threads themselves.
+ *
+ * The chunks are not moves, so they are left out of the progress shown;
+ * their positions are freed once all the tasks have been waited for, as
+ * aborted tasks are never run.
+ */
+
+#define PREFETCH_CHUNK 8        /* positions per call of EvalCacheMoves() */
+
+typedef struct {
+    TanBoard *aanBoard;
+    unsigned int (*aanDice)[2];
+    cubeinfo *aci;
+    unsigned int c;
+} analysisprefetch;
+
+typedef struct {
+    Task task;
+    const analysisprefetch *pap;
+    unsigned int iFirst;
+} PrefetchTask;
+
+static GList *plPrefetch;       /* of the tasks queued since the last wait */
+
+static void
+PrefetchChunk(PrefetchTask * ppt)
+{
+    const analysisprefetch *pap = ppt->pap;
+
+    EvalCacheMoves((const TanBoard *) (pap->aanBoard + ppt->iFirst),
+                   (const unsigned int (*)[2]) (pap->aanDice + ppt->iFirst),
+                   pap->aci + ppt->iFirst, MIN(PREFETCH_CHUNK, pap->c - ppt->iFirst));
+
+    MT_SafeInc(&cPrefetchDone);
+}
+
+static void
+PrefetchFree(gpointer p)
+{
+    analysisprefetch *pap = (analysisprefetch *) p;
+
+    g_free(pap->aanBoard);
+    g_free(pap->aanDice);
+    g_free(pap->aci);
+    g_free(pap);
+}
+
+static void
+PrefetchQueue(analysisprefetch * pap)
+{
+    unsigned int i;
+
+    if (!pap->c) {
+        PrefetchFree(pap);
+        return;
+    }
+
+    plPrefetch = g_list_prepend(plPrefetch, pap);
+
+    for (i = 0; i < pap->c; i += PREFETCH_CHUNK) {
+        PrefetchTask *ppt = g_new(PrefetchTask, 1);
+
+        ppt->task.fun = (AsyncFun) PrefetchChunk;
+        ppt->task.data = ppt;
+        ppt->task.pLinkedTask = NULL;
+        ppt->pap = pap;
+        ppt->iFirst = i;
+        multi_debug("add task: analysis prefetch");
+        MT_AddTaskPriority((Task *) ppt, TASK_PRIORITY_HIGH);
+    }
+}
+
+/* Wait for the analysis tasks, showing their progress */
+static int
+AnalysisWait(int autosave)
+{
+    int result = MT_WaitForTasks(UpdateProgressBar, 250, autosave);
+
+    g_list_free_full(plPrefetch, PrefetchFree);
+    plPrefetch = NULL;
+    MT_SafeSet(&cPrefetchDone, 0);
+
+    return result;
+}
+
+static void
+PrefetchAdd(analysisprefetch * pap, const matchstate * pms, const moverecord * pmr)
+{
+    if (pmr->mt != MOVE_NORMAL || !fAnalyseMove || !afAnalysePlayers[pmr->fPlayer] ||
+        pmr->anDice[0] < 1 || cmp_evalsetup(&esAnalysisChequer, &pmr->esChequer) <= 0)
+        return;
+
+    memcpy(pap->aanBoard[pap->c], pms->anBoard, sizeof(TanBoard));
+    pap->aanDice[pap->c][0] = MAX(pmr->anDice[0], pmr->anDice[1]);
+    pap->aanDice[pap->c][1] = MIN(pmr->anDice[0], pmr->anDice[1]);
+    GetMatchStateCubeInfo(&pap->aci[pap->c], pms);
+    pap->c++;
+}
+
 static int
 AnalyzeGame(listOLD * plGame, int wait)
 {
@@ -974,15 +1083,26 @@ AnalyzeGame(listOLD * plGame, int wait)
     matchstate msAnalyse;
     unsigned int numMoves = NumberMovesGame(plGame);
     AnalyseMoveTask *pt = NULL, *pParentTask = NULL;
+    AnalyseMoveTask **apt;
+    unsigned int cTasks = 0;
+    analysisprefetch *pap = g_new(analysisprefetch, 1);
 
     /* Analyse first move record (gameinfo) */
     g_assert(pmr->mt == MOVE_GAMEINFO);
     if (AnalyzeMove(pmr, &msAnalyse, plGame, psc,
-                    &esAnalysisChequer, &esAnalysisCube, aamfAnalysis, afAnalysePlayers, NULL) < 0)
+                    &esAnalysisChequer, &esAnalysisCube, aamfAnalysis, afAnalysePlayers, NULL) < 0) {
+        g_free(pap);
         return -1;              /* Interrupted */
+    }
 
     numMoves--;                 /* Done one - the gameinfo */
 
+    apt = g_new(AnalyseMoveTask *, numMoves);
+    pap->aanBoard = g_new(TanBoard, numMoves);
+    pap->aanDice = g_malloc(numMoves * sizeof(*pap->aanDice));
+    pap->aci = g_new(cubeinfo, numMoves);
+    pap->c = 0;
+
 
     for (i = 0; i < numMoves; i++) {
         pl = pl->plNext;
@@ -1018,8 +1138,7 @@ AnalyzeGame(listOLD * plGame, int wait)
                 pt = pParentTask;
                 pParentTask = NULL;
             }
-            multi_debug("add task: analysis");
-            MT_AddTask((Task *) pt, TRUE);
+            apt[cTasks++] = pt;
         }
 
         FixMatchState(&msAnalyse, pmr);
@@ -1028,15 +1147,24 @@ AnalyzeGame(listOLD * plGame, int wait)
             SwapSides(msAnalyse.anBoard);
             msAnalyse.fMove = pmr->fPlayer;
         }
+        PrefetchAdd(pap, &msAnalyse, pmr);
         ApplyMoveRecord(&msAnalyse, plGame, pmr);
     }
     g_assert(pl->plNext == plGame);
 
+    PrefetchQueue(pap);
+
+    for (i = 0; i < cTasks; i++) {
+        multi_debug("add task: analysis");
+        MT_AddTask((Task *) apt[i], TRUE);
+    }
+    g_free(apt);
+
     if (wait) {
         int result;
 
         multi_debug("wait for all task: analysis");
-        result = MT_WaitForTasks(UpdateProgressBar, 250, fAutoSaveAnalysis);
+        result = AnalysisWait(fAutoSaveAnalysis);
 
         if (result == -1)
             IniStatcontext(psc);
@@ -1277,7 +1405,7 @@ CommandAnalyseMatch(char *UNUSED(sz))
     }
 
     multi_debug("wait for all task: analysis");
-    MT_WaitForTasks(UpdateProgressBar, 250, fAutoSaveAnalysis);
+    AnalysisWait(fAutoSaveAnalysis);
 
     ProgressEnd();
 
@@ -1306,6 +1434,379 @@ CommandAnalyseSession(char *sz)
     CommandAnalyseMatch(sz);
 }
 
+/*
+ * "analyse batch" imports, analyses and saves the files given, and the
+ * files in the directories given, in one session, so the weights, match
+ * equity table, bearoff databases and caches are only set up once and
+ * the moves of each match are shared out over all the threads.  As in
+ * the GTK batch dialog, each result is saved in an "analysed" directory
+ * next to its file, and files already analysed there are skipped.
+ *
+ * Import and save work on the global match, but analysis does not: it
+ * only needs the games of the match.  So without the GUI each imported
+ * match is taken out of the global state into a batchmatch and analysed
+ * from there while the next file is imported, and is put back only to be
+ * saved.  With the GUI, which shows the current match, the files are
+ * taken one at a time.
+ */
+
+typedef struct {
+    listOLD lMatch;             /* the games, when taken out of the global match */
+    int fDetached;
+    matchstate ms;
+    matchinfo mi;
+    char aszName[2][MAX_NAME_LEN];
+    const char *filename;
+    char *save;
+    int nMoves;
+    double tImport;             /* milliseconds */
+    double tQueued;             /* when the analysis was queued */
+} batchmatch;
+
+typedef struct {
+    GHashTable *phSaves;        /* the file each save name was taken by */
+    unsigned int cDone, cSkipped, cFailed, cConflicts;
+    int nMoves;
+} batchrun;
+
+static void
+BatchAddPath(GList ** plFiles, const char *sz)
+{
+    GDir *dir;
+    const char *filename;
+    GList *pl = NULL;
+
+    if (!g_file_test(sz, G_FILE_TEST_IS_DIR)) {
+        *plFiles = g_list_append(*plFiles, g_strdup(sz));
+        return;
+    }
+
+    if (!(dir = g_dir_open(sz, 0, NULL))) {
+        outputerr(sz);
+        return;
+    }
+
+    while ((filename = g_dir_read_name(dir)) != NULL) {
+        char *path = g_build_filename(sz, filename, NULL);
+
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+            pl = g_list_insert_sorted(pl, path, (GCompareFunc) strcmp);
+        else
+            g_free(path);
+    }
+    g_dir_close(dir);
+
+    *plFiles = g_list_concat(*plFiles, pl);
+}
+
+static char *
+BatchSaveName(const char *filename)
+{
+    char *file, *folder, *dir, *save;
+
+    DisectPath(filename, ".sgf", &file, &folder);
+    dir = g_build_filename(folder, "analysed", NULL);
+    g_free(folder);
+
+    if (!g_file_test(dir, G_FILE_TEST_EXISTS))
+        g_mkdir(dir, 0700);
+
+    if (!g_file_test(dir, G_FILE_TEST_IS_DIR)) {
+        outputerrf(_("Failed to create directory `%s'\n"), dir);
+        save = NULL;
+    } else
+        save = g_build_filename(dir, file, NULL);
+
+    g_free(file);
+    g_free(dir);
+
+    return save;
+}
+
+/* Move the nodes of the list plFrom to the head plTo, leaving plFrom empty */
+static void
+BatchMoveList(listOLD * plTo, listOLD * plFrom)
+{
+    plTo->p = NULL;
+
+    if (ListEmpty(plFrom)) {
+        plTo->plNext = plTo->plPrev = plTo;
+        return;
+    }
+
+    plTo->plNext = plFrom->plNext;
+    plTo->plPrev = plFrom->plPrev;
+    plTo->plNext->plPrev = plTo;
+    plTo->plPrev->plNext = plTo;
+    plFrom->plNext = plFrom->plPrev = plFrom;
+}
+
+/* Take the current match out of the global state, leaving no match */
+static void
+BatchDetach(batchmatch * pbm)
+{
+    int i;
+
+    BatchMoveList(&pbm->lMatch, &lMatch);
+    memcpy(&pbm->ms, &ms, sizeof(ms));
+    memcpy(&pbm->mi, &mi, sizeof(mi));
+    memset(&mi, 0, sizeof(mi)); /* the strings now belong to pbm */
+    for (i = 0; i < 2; i++)
+        memcpy(pbm->aszName[i], ap[i].szName, MAX_NAME_LEN);
+    pbm->fDetached = TRUE;
+
+    pmr_hint_destroy();
+    plGame = plLastMove = NULL;
+    ClearMatch();
+}
+
+/* Make the match of pbm the current match again; there must be none */
+static void
+BatchAttach(batchmatch * pbm)
+{
+    int i;
+
+    g_assert(ListEmpty(&lMatch));
+
+    BatchMoveList(&lMatch, &pbm->lMatch);
+    memcpy(&ms, &pbm->ms, sizeof(ms));
+    memcpy(&mi, &pbm->mi, sizeof(mi));
+    for (i = 0; i < 2; i++)
+        memcpy(ap[i].szName, pbm->aszName[i], MAX_NAME_LEN);
+    pbm->fDetached = FALSE;
+
+    plGame = ListEmpty(&lMatch) ? NULL : lMatch.plPrev->p;
+    plLastMove = plGame ? plGame->plPrev : NULL;
+}
+
+/* Import a file of the batch; NULL if it is not to be analysed */
+static batchmatch *
+BatchImport(batchrun * pbr, const char *filename, const int fDetach)
+{
+    batchmatch *pbm;
+    char *save = BatchSaveName(filename);
+    const char *szOther;
+    char *cmd;
+    double t;
+
+    if (!save) {
+        pbr->cFailed++;
+        return NULL;
+    }
+
+    if ((szOther = (const char *) g_hash_table_lookup(pbr->phSaves, save)) != NULL) {
+        outputf(_("%s: not analysed, as %s is saved to the same file %s\n"), filename, szOther, save);
+        pbr->cConflicts++;
+        g_free(save);
+        return NULL;
+    }
+    g_hash_table_insert(pbr->phSaves, g_strdup(save), (gpointer) filename);
+
+    if (g_file_test(save, G_FILE_TEST_EXISTS)) {
+        pbr->cSkipped++;
+        g_free(save);
+        return NULL;
+    }
+
+    t = get_time();
+    g_free(szCurrentFileName);
+    szCurrentFileName = NULL;
+    cmd = g_strdup_printf("\"%s\"", filename);
+    CommandImportAuto(cmd);
+    g_free(cmd);
+
+    if (!szCurrentFileName) {
+        /* an import that only warned may still have left games behind,
+         * which must not be there when the running match is put back */
+        if (fDetach) {
+            FreeMatch();
+            ClearMatch();
+            plGame = plLastMove = NULL;
+        }
+        outputf(_("%s: failed import\n"), filename);
+        pbr->cFailed++;
+        g_free(save);
+        return NULL;
+    }
+
+    CommandAnalyseClearMatch(NULL);
+
+    pbm = g_new0(batchmatch, 1);
+    pbm->filename = filename;
+    pbm->save = save;
+    pbm->nMoves = NumberMovesMatch(&lMatch);
+    pbm->tImport = get_time() - t;
+
+    if (fDetach)
+        BatchDetach(pbm);
+
+    return pbm;
+}
+
+/* Queue the analysis of all the games of the match */
+static int
+BatchQueue(batchmatch * pbm)
+{
+    listOLD *plMatch = pbm->fDetached ? &pbm->lMatch : &lMatch;
+    listOLD *pl;
+
+    pbm->tQueued = get_time();
+
+    for (pl = plMatch->plNext; pl != plMatch; pl = pl->plNext)
+        if (AnalyzeGame(pl->p, FALSE) < 0)
+            return -1;
+
+    return 0;
+}
+
+/* Wait for the analysis of pbm, the only one queued, and save it.
+ * Returns TRUE if the batch was cancelled. */
+static int
+BatchFinish(batchrun * pbr, batchmatch * pbm)
+{
+    double tAnalysed, tSaved;
+    int fDetached = pbm->fDetached;
+    int fCancelled;
+    char *cmd;
+
+    ProgressStartValue(_("Analysing match"), pbm->nMoves);
+    multi_debug("wait for all task: analysis");
+    AnalysisWait(FALSE);
+    ProgressEnd();
+    tAnalysed = get_time();
+
+    if (fDetached)
+        BatchAttach(pbm);
+
+    if ((fCancelled = fMatchCancelled) != 0) {
+        outputf(_("%s: cancelled\n"), pbm->filename);
+        MT_SafeSet(&fInterrupt, FALSE);
+        fMatchCancelled = FALSE;
+    } else {
+        cmd = g_strdup_printf("\"%s\"", pbm->save);
+        CommandSaveMatch(cmd);
+        g_free(cmd);
+        tSaved = get_time();
+
+        outputf(_("%s: %d moves; import %.2f s, analysis %.2f s, save %.2f s\n"),
+                pbm->filename, pbm->nMoves, pbm->tImport / 1000.0, (tAnalysed - pbm->tQueued) / 1000.0,
+                (tSaved - tAnalysed) / 1000.0);
+        outputx();
+
+        pbr->cDone++;
+        pbr->nMoves += pbm->nMoves;
+    }
+
+    if (fDetached) {
+        FreeMatch();
+        ClearMatch();
+        plGame = plLastMove = NULL;
+    }
+
+    g_free(pbm->save);
+    g_free(pbm);
+
+    return fCancelled;
+}
+
+/* Drop a match that was imported but will not be analysed */
+static void
+BatchFree(batchmatch * pbm)
+{
+    if (pbm->fDetached) {
+        BatchAttach(pbm);
+        FreeMatch();
+        ClearMatch();
+        plGame = plLastMove = NULL;
+    }
+
+    g_free(pbm->save);
+    g_free(pbm);
+}
+
+extern void
+CommandAnalyseBatch(char *sz)
+{
+    GList *plFiles = NULL, *pl;
+    char *pch;
+    int fConfirmNew_s, fConfirmSave_s;
+    int fOverlap = TRUE;
+    batchmatch *pbmRunning = NULL;
+    batchrun br;
+    double tStart, rElapsed;
+
+    while ((pch = NextToken(&sz)) != NULL)
+        BatchAddPath(&plFiles, pch);
+
+    if (!plFiles) {
+        outputl(_("You must specify the files or directories to analyse (see `help analyse batch')."));
+        return;
+    }
+
+    if (CheckSettings()) {
+        g_list_free_full(plFiles, g_free);
+        return;
+    }
+
+#if defined(USE_GTK)
+    fOverlap = !fX;
+#endif
+
+    memset(&br, 0, sizeof(br));
+    br.phSaves = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    fConfirmNew_s = fConfirmNew;
+    fConfirmSave_s = fConfirmSave;
+    fConfirmNew = fConfirmSave = FALSE;
+    fMatchCancelled = FALSE;
+
+    tStart = get_time();
+
+    pl = plFiles;
+    while (pl || pbmRunning) {
+        batchmatch *pbm = NULL;
+
+        /* import the next file while the last one is analysed */
+        if (pl && (fOverlap || !pbmRunning)) {
+            pbm = BatchImport(&br, (const char *) pl->data, fOverlap);
+            pl = pl->next;
+            if (!pbm && pl)
+                continue;
+        }
+
+        if (pbmRunning) {
+            int fCancelled = BatchFinish(&br, pbmRunning);
+
+            pbmRunning = NULL;
+            if (fCancelled) {
+                if (pbm)
+                    BatchFree(pbm);
+                break;
+            }
+        }
+
+        if (pbm) {
+            if (BatchQueue(pbm) < 0) {
+                /* interrupted; BatchFinish() reports it */
+                fMatchCancelled = TRUE;
+            }
+            pbmRunning = pbm;
+        }
+    }
+
+    rElapsed = (get_time() - tStart) / 1000.0;
+
+    fConfirmNew = fConfirmNew_s;
+    fConfirmSave = fConfirmSave_s;
+    g_hash_table_destroy(br.phSaves);
+    g_list_free_full(plFiles, g_free);
+
+    outputf(_("%u files analysed, %u skipped, %u failed, %u in conflict in %.1f s\n"), br.cDone, br.cSkipped,
+            br.cFailed, br.cConflicts, rElapsed);
+    if (br.cDone && rElapsed > 0.0)
+        outputf(_("%.2f files/s, %.1f moves/s\n"), br.cDone / rElapsed, br.nMoves / rElapsed);
+}
+
 
 
 extern void
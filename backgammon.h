@@ -372,6 +372,7 @@ extern int fPlayersAreSame;
 extern int fTruncEqualPlayer0;
 extern int fCubeUse;
 extern int fDisplay;
+extern int fExternalServer;
 extern int fFullScreen;
 extern int fGotoFirstGame;
 extern int fInvertMET;
@@ -379,12 +380,18 @@ extern int fJacoby;
 extern int fNextTurn;
 extern int fOutputRawboard;
 extern int fRecord;
+extern int fRolloutDeterministic;
 extern int fShowProgress;
 extern int fStyledGamelist;
 extern int fTutor;
 extern int fTutorChequer;
 extern int fTutorCube;
 extern int log_rollouts;
+extern int nExternalInFlight;
+extern int nExternalLineLength;
+extern int nExternalOutput;
+extern int nExternalQueue;
+extern int nRolloutLockstep;
 extern int nThreadPriority;
 extern int nToolbarStyle;
 extern int nTutorSkillCurrent;
@@ -532,6 +539,7 @@ extern void UpdateSettings(void);
 extern void UpdateSetting(void *p);
 extern void CommandAccept(char *);
 extern void CommandAgree(char *);
+extern void CommandAnalyseBatch(char *);
 extern void CommandAnalyseClearGame(char *);
 extern void CommandAnalyseClearMatch(char *);
 extern void CommandAnalyseClearMove(char *);
@@ -696,6 +704,8 @@ extern void CommandSetBeavers(char *);
 extern void CommandSetBoard(char *);
 extern void CommandSetBrowser(char *);
 extern void CommandSetCache(char *);
+extern void CommandSetCacheFile(char *);
+extern void CommandSetHugePages(char *);
 extern void CommandSetCalibration(char *);
 extern void CommandSetCheatEnable(char *);
 extern void CommandSetCheatPlayer(char *);
@@ -768,6 +778,11 @@ extern void CommandSetExportParametersRollout(char *);
 extern void CommandSetExportPNGSize(char *);
 extern void CommandSetExportShowBoard(char *);
 extern void CommandSetExportShowPlayer(char *);
+extern void CommandSetExternalInFlight(char *);
+extern void CommandSetExternalLineLength(char *);
+extern void CommandSetExternalOutput(char *);
+extern void CommandSetExternalQueue(char *);
+extern void CommandSetExternalServer(char *);
 extern void CommandSetFullScreen(char *);
 extern void CommandSetGameList(char *);
 extern void CommandSetGeometryAnalysis(char *);
@@ -818,6 +833,7 @@ extern void CommandSetMatchRating(char *);
 extern void CommandSetMatchRound(char *);
 extern void CommandSetMessage(char *);
 extern void CommandSetMET(char *);
+extern void CommandSetNuma(char *);
 extern void CommandSetOutputDigits(char *);
 extern void CommandSetOutputErrorRateFactor(char *);
 extern void CommandSetOutputMatchPC(char *);
@@ -861,6 +877,7 @@ extern void CommandSetRolloutChequerplay(char *);
 extern void CommandSetRolloutCubedecision(char *);
 extern void CommandSetRolloutCubeEqualChequer(char *);
 extern void CommandSetRolloutCubeful(char *);
+extern void CommandSetRolloutDeterministic(char *);
 extern void CommandSetRolloutInitial(char *);
 extern void CommandSetRolloutJsd(char *);
 extern void CommandSetRolloutJsdEnable(char *);
@@ -876,6 +893,7 @@ extern void CommandSetRolloutLatePlies(char *);
 extern void CommandSetRolloutLimit(char *);
 extern void CommandSetRolloutLimitEnable(char *);
 extern void CommandSetRolloutLimitMinGames(char *);
+extern void CommandSetRolloutLockstep(char *);
 extern void CommandSetRolloutLogEnable(char *);
 extern void CommandSetRolloutLogFile(char *);
 extern void CommandSetRolloutMaxError(char *);
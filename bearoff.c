@@ -35,6 +35,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#if defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_POSIX_FADVISE)
+#include <fcntl.h>
+#endif
 
 #define HEURISTIC_C 15
 #define HEURISTIC_P 6
@@ -256,6 +262,100 @@ HeuristicDatabase(void (*pfProgress) (unsigned int))
 }
 
 
+#if HAVE_PREAD
+
+/*
+ * Databases that are not in memory are read with pread(), which needs no
+ * lock, through a small direct mapped cache of file blocks in each thread.
+ */
+
+#define BEAROFF_BLOCK_SIZE 4096
+#define BEAROFF_CACHE_BLOCKS 64
+
+typedef struct {
+    unsigned int anId[BEAROFF_CACHE_BLOCKS];    /* bearoffcontext nId, 0 if empty */
+    unsigned int aiBlock[BEAROFF_CACHE_BLOCKS];
+    unsigned int acb[BEAROFF_CACHE_BLOCKS];     /* less than a block at end of file */
+    unsigned char aauch[BEAROFF_CACHE_BLOCKS][BEAROFF_BLOCK_SIZE];
+} bearoffblockcache;
+
+/* Read up to nBytes at offset; the number read or -1 */
+static long
+ReadBearoffBytes(const bearoffcontext * pbc, off_t offset, unsigned char *buf, size_t nBytes)
+{
+    int fd = fileno(pbc->pf);
+    size_t c = 0;
+
+    while (c < nBytes) {
+        ssize_t n = pread(fd, buf + c, nBytes - c, offset + (off_t) c);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        c += (size_t) n;
+    }
+
+    return (long) c;
+}
+
+static void
+ReadBearoffFile(const bearoffcontext * pbc, unsigned int offset, unsigned char *buf, unsigned int nBytes)
+{
+    ThreadLocalData *tld = MT_GetTLD();
+    bearoffblockcache *pboc;
+    unsigned char *pch = buf;
+    unsigned int cLeft = nBytes;
+
+    errno = 0;
+
+    if (!tld) {
+        /* no thread data to keep a cache in */
+        if (ReadBearoffBytes(pbc, offset, buf, nBytes) == (long) nBytes)
+            cLeft = 0;
+    } else {
+        if (!(pboc = (bearoffblockcache *) tld->pBearoffCache))
+            pboc = tld->pBearoffCache = g_malloc0(sizeof(bearoffblockcache));
+
+        while (cLeft) {
+            unsigned int iBlock = offset / BEAROFF_BLOCK_SIZE;
+            unsigned int iOffset = offset % BEAROFF_BLOCK_SIZE;
+            unsigned int i = (iBlock + 7 * pbc->nId) % BEAROFF_CACHE_BLOCKS;
+            unsigned int n = MIN(cLeft, BEAROFF_BLOCK_SIZE - iOffset);
+
+            if (pboc->anId[i] != pbc->nId || pboc->aiBlock[i] != iBlock) {
+                long c = ReadBearoffBytes(pbc, (off_t) iBlock * BEAROFF_BLOCK_SIZE, pboc->aauch[i],
+                                          BEAROFF_BLOCK_SIZE);
+
+                pboc->anId[i] = c < 0 ? 0 : pbc->nId;
+                pboc->aiBlock[i] = iBlock;
+                pboc->acb[i] = c < 0 ? 0 : (unsigned int) c;
+            }
+
+            if (iOffset + n > pboc->acb[i])
+                break;
+
+            memcpy(pch, pboc->aauch[i] + iOffset, n);
+            pch += n;
+            offset += n;
+            cLeft -= n;
+        }
+    }
+
+    if (cLeft) {
+        if (errno)
+            perror(_("bearoff database"));
+        else
+            fprintf(stderr, _("Error reading bearoff database"));
+
+        memset(buf, 0, nBytes);
+    }
+}
+
+#else
+
 static void
 ReadBearoffFile(const bearoffcontext * pbc, unsigned int offset, unsigned char *buf, unsigned int nBytes)
 {
@@ -268,12 +368,13 @@ ReadBearoffFile(const bearoffcontext * pbc, unsigned int offset, unsigned char *
             fprintf(stderr, _("Error reading bearoff database"));
 
         memset(buf, 0, nBytes);
-        return;
     }
 
     MT_Release();
 }
 
+#endif
+
 /* BEAROFF_GNUBG: read two sided bearoff database */
 static void
 ReadTwoSidedBearoff(const bearoffcontext * pbc, const unsigned int iPos, float ar[4], unsigned short int aus[4])
@@ -530,6 +631,8 @@ BearoffStatus(const bearoffcontext * pbc, char *sz)
 
         sz += sprintf(sz, "   - %s\n", pbc->fGammon ? _("database includes gammon distributions")
                       : _("database does not include gammon distributions"));
+        if (pbc->nHotEnd)
+            sz += sprintf(sz, "   - %s\n", _("home board positions stored first (hot-first layout)"));
         break;
     case BEAROFF_HYPERGAMMON:
     case BEAROFF_INVALID:
@@ -753,6 +856,30 @@ ReadIntoMemory(bearoffcontext * pbc)
     return pbc->p;
 }
 
+/*
+ * Ask the OS to bring in the front of a hot-first database (header,
+ * index and the distributions of the home board positions) ahead of
+ * the first lookups.
+ */
+
+static void
+PrefetchHotRegion(const bearoffcontext * pbc)
+{
+    if (!pbc->nHotEnd)
+        return;
+
+    if (pbc->p) {
+#if defined(HAVE_MADVISE) && defined(MADV_WILLNEED)
+        if (pbc->nHotEnd <= g_mapped_file_get_length(pbc->map))
+            madvise(pbc->p, pbc->nHotEnd, MADV_WILLNEED);
+#endif
+    } else {
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+        posix_fadvise(fileno(pbc->pf), 0, pbc->nHotEnd, POSIX_FADV_WILLNEED);
+#endif
+    }
+}
+
 /*
  * Check whether this is a exact bearoff file 
  *
@@ -793,10 +920,12 @@ InvalidDb(bearoffcontext * pbc)
 extern bearoffcontext *
 BearoffInit(const char *szFilename, const unsigned int bo, void (*p) (unsigned int))
 {
+    static unsigned int nLastId = 0;
     bearoffcontext *pbc;
     char sz[41];
 
     pbc = g_new0(bearoffcontext, 1);
+    pbc->nId = ++nLastId;
 
     if (bo & BO_HEURISTIC) {
         pbc->bt = BEAROFF_ONESIDED;
@@ -914,6 +1043,8 @@ BearoffInit(const char *szFilename, const unsigned int bo, void (*p) (unsigned i
         pbc->fGammon = atoi(sz + 15);
         pbc->fCompressed = atoi(sz + 17);
         pbc->fND = atoi(sz + 19);
+        if (sz[21] == 'H' && sscanf(sz + 22, "%8x", &pbc->nHotEnd) != 1)
+            pbc->nHotEnd = 0;
         break;
     case BEAROFF_HYPERGAMMON:
     case BEAROFF_INVALID:
@@ -936,6 +1067,8 @@ BearoffInit(const char *szFilename, const unsigned int bo, void (*p) (unsigned i
             }
     }
 
+    PrefetchHotRegion(pbc);
+
     return pbc;
 }
 
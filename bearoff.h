@@ -44,6 +44,8 @@ typedef struct {
     /* two sided dbs */
     int fCubeful;               /* cubeful equities included */
     FILE *pf;                   /* file pointer */
+    unsigned int nId;           /* tells databases apart in block caches */
+    unsigned int nHotEnd;       /* end of hot-first region ("-H" header), 0 if none */
     char *szFilename;           /* filename */
     GMappedFile *map;
     unsigned char *p;           /* pointer to data in memory */
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+# Copyright (C) 2026 the AUTHORS
+
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# check-makebearoff.sh - check that makebearoff writes the same databases
+# as a reference build, with one thread and with several
+#
+# Usage: check-makebearoff.sh reference-makebearoff [makebearoff [threads]]
+#
+# reference-makebearoff: a makebearoff known to be right, for instance one
+#                        built from an earlier release
+# makebearoff:           the one to check, ./makebearoff by default
+# threads:               the number of threads for the parallel runs, 4 by
+#                        default
+#
+# The reference is run without -j, so that older versions can be used.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 reference-makebearoff [makebearoff [threads]]" >&2
+    exit 2
+fi
+
+ref=$1
+new=${2:-./makebearoff}
+threads=${3:-4}
+tmp=${TMPDIR:-/tmp}/check-makebearoff.$$
+failed=0
+
+mkdir "$tmp" || exit 2
+trap 'rm -rf "$tmp"' 0 1 2 15
+
+check() {
+    if ! "$ref" "$@" -f "$tmp/ref.bd" 2> "$tmp/log"; then
+        cat "$tmp/log" >&2
+        echo "reference failed: $*" >&2
+        exit 2
+    fi
+
+    for j in 1 $threads; do
+        if ! "$new" -j $j "$@" -f "$tmp/new.bd" 2> "$tmp/log"; then
+            cat "$tmp/log" >&2
+            echo "FAIL: $* -j $j (makebearoff failed)"
+            failed=1
+        elif cmp -s "$tmp/ref.bd" "$tmp/new.bd"; then
+            echo "ok:   $* -j $j"
+        else
+            echo "FAIL: $* -j $j (different output)"
+            failed=1
+        fi
+    done
+}
+
+check -o 6
+check -o 6 -H
+check -o 6 -c
+check -o 6 -c -H
+check -o 6 -g
+check -o 6 --hot-first
+check -t 6x6
+check -t 6x6 -H
+check -t 6x6 -C
+
+exit $failed
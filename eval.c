@@ -193,6 +193,14 @@ enum {
 #define NUM_RACE_INPUTS ( HALF_RACE_INPUTS * 2 )
 #define NUM_PRUNING_INPUTS (25 * MINPPERPOINT * 2)
 
+/* The nets of the calling thread: the copy on its NUMA node when
+ * replicas are enabled, the shared ones otherwise */
+#if defined(USE_MULTITHREAD)
+#define EvalNet(id) (fNumaReplicas ? MT_GetTLD()->apnn[id] : apnnEval[id])
+#else
+#define EvalNet(id) apnnEval[id]
+#endif
+
 
 #if !defined(LOCKING_VERSION)
 
@@ -202,6 +210,7 @@ f_EvaluatePosition EvaluatePosition = EvaluatePositionNoLocking;
 f_ScoreMove ScoreMove = ScoreMoveNoLocking;
 f_GeneralCubeDecisionE GeneralCubeDecisionE = GeneralCubeDecisionENoLocking;
 f_GeneralEvaluationE GeneralEvaluationE = GeneralEvaluationENoLocking;
+f_EvalCacheMoves EvalCacheMoves = EvalCacheMovesNoLocking;
 
 #define FindnSaveBestMoves FindnSaveBestMovesNoLocking
 #define FindBestMove FindBestMoveNoLocking
@@ -214,12 +223,13 @@ f_GeneralEvaluationE GeneralEvaluationE = GeneralEvaluationENoLocking;
 #define GeneralEvaluationEPlied GeneralEvaluationEPliedNoLocking
 #define EvaluatePositionCubeful3 EvaluatePositionCubeful3NoLocking
 #define ScoreMoves ScoreMovesNoLocking
-#define ScoreMovesPruned ScoreMovesPrunedNoLocking
+#define ScoreCandidates ScoreCandidatesNoLocking
 #define FindBestMoveInEval FindBestMoveInEvalNoLocking
 #define GeneralEvaluationEPliedCubeful GeneralEvaluationEPliedCubefulNoLocking
 #define EvaluatePositionCubeful4 EvaluatePositionCubeful4NoLocking
 #define CacheAdd CacheAddNoLocking
 #define CacheLookup CacheLookupNoLocking
+#define EvalCacheMoves EvalCacheMovesNoLocking
 
 static int EvaluatePositionCache(NNState * nnStates, const TanBoard anBoard, float arOutput[],
                                  cubeinfo * const pci, const evalcontext * pecx, int nPlies, positionclass pc);
@@ -237,6 +247,11 @@ neuralnet nnContact, nnRace, nnCrashed;
 
 neuralnet nnpContact, nnpRace, nnpCrashed;
 
+neuralnet *const apnnEval[NUM_NETS] = {
+    &nnRace, &nnCrashed, &nnContact,
+    &nnpRace, &nnpCrashed, &nnpContact
+};
+
 bearoffcontext *pbcOS = NULL;
 bearoffcontext *pbcTS = NULL;
 bearoffcontext *pbc1 = NULL;
@@ -245,7 +260,23 @@ bearoffcontext *apbcHyper[3] = { NULL, NULL, NULL };
 
 evalCache cEval;
 evalCache cpEval;
+
+/*
+ * Results of searches of one ply or more are kept in csEval, apart from
+ * the far more numerous 0-ply evaluations of cEval that would otherwise
+ * push them out.  It gets an eighth of the entries of cEval.
+ */
+#define SUBTREE_CACHE_SHIFT 3
+#define SubtreeCacheSize(c) ((c) ? MAX((c) >> SUBTREE_CACHE_SHIFT, 1U << 16) : 0)
+evalCache csEval;
+
 unsigned int cCache;
+int fCacheHugePages = FALSE;
+char *szCacheFile = NULL;
+int fEvalIncremental = TRUE;
+#if defined(USE_CACHE_FILE)
+static cacheFile cfEval;
+#endif
 int fInterrupt = FALSE;
 int fMatchCancelled = FALSE;
 
@@ -508,8 +539,10 @@ EvalShutdown(void)
 
     /* destroy cache */
 
+    EvalCacheFile(NULL, 0);
     CacheDestroy(&cEval);
     CacheDestroy(&cpEval);
+    CacheDestroy(&csEval);
 
     return 0;
 
@@ -616,6 +649,7 @@ EvalInitialise(char *szWeights, char *szWeightsBinary, int fNoBearoff, void (*pf
 #endif
             exit(EXIT_FAILURE);
         }
+        SIMD_SelectKernel();
 #endif
         cCache = 0x1 << CACHE_SIZE_DEFAULT;
         if (CacheCreate(&cEval, cCache)) {
@@ -628,6 +662,11 @@ EvalInitialise(char *szWeights, char *szWeightsBinary, int fNoBearoff, void (*pf
             return;
         }
 
+        if (CacheCreate(&csEval, SubtreeCacheSize(cCache))) {
+            PrintError(_("Evaluation cache allocation failed"));
+            return;
+        }
+
         ComputeTable();
 
         rc.randrsl[0] = (ub4) time(NULL);
@@ -2108,10 +2147,10 @@ EvalRace(const TanBoard anBoard, float arOutput[], const bgvariation bgv, NNStat
 
 #if defined(USE_SIMD_INSTRUCTIONS)
     // cppcheck-suppress duplicateExpression
-    if (NeuralNetEvaluateSSE(&nnRace, arInput, arOutput, nnStates ? nnStates + (CLASS_RACE - CLASS_RACE) : NULL))
+    if (NeuralNetEvaluateSSE(EvalNet(NET_RACE), arInput, arOutput, nnStates ? nnStates + (CLASS_RACE - CLASS_RACE) : NULL))
 #else
     // cppcheck-suppress duplicateExpression
-    if (NeuralNetEvaluate(&nnRace, arInput, arOutput, nnStates ? nnStates + (CLASS_RACE - CLASS_RACE) : NULL))
+    if (NeuralNetEvaluate(EvalNet(NET_RACE), arInput, arOutput, nnStates ? nnStates + (CLASS_RACE - CLASS_RACE) : NULL))
 #endif
         return -1;
 
@@ -2132,10 +2171,10 @@ EvalContact(const TanBoard anBoard, float arOutput[], const bgvariation UNUSED(b
     CalculateContactInputs(anBoard, arInput);
 
 #if defined(USE_SIMD_INSTRUCTIONS)
-    return NeuralNetEvaluateSSE(&nnContact, arInput, arOutput,
+    return NeuralNetEvaluateSSE(EvalNet(NET_CONTACT), arInput, arOutput,
                                 nnStates ? nnStates + (CLASS_CONTACT - CLASS_RACE) : NULL);
 #else
-    return NeuralNetEvaluate(&nnContact, arInput, arOutput, nnStates ? nnStates + (CLASS_CONTACT - CLASS_RACE) : NULL);
+    return NeuralNetEvaluate(EvalNet(NET_CONTACT), arInput, arOutput, nnStates ? nnStates + (CLASS_CONTACT - CLASS_RACE) : NULL);
 #endif
 }
 
@@ -2147,10 +2186,10 @@ EvalCrashed(const TanBoard anBoard, float arOutput[], const bgvariation UNUSED(b
     CalculateCrashedInputs(anBoard, arInput);
 
 #if defined(USE_SIMD_INSTRUCTIONS)
-    return NeuralNetEvaluateSSE(&nnCrashed, arInput, arOutput,
+    return NeuralNetEvaluateSSE(EvalNet(NET_CRASHED), arInput, arOutput,
                                 nnStates ? nnStates + (CLASS_CRASHED - CLASS_RACE) : NULL);
 #else
-    return NeuralNetEvaluate(&nnCrashed, arInput, arOutput, nnStates ? nnStates + (CLASS_CRASHED - CLASS_RACE) : NULL);
+    return NeuralNetEvaluate(EvalNet(NET_CRASHED), arInput, arOutput, nnStates ? nnStates + (CLASS_CRASHED - CLASS_RACE) : NULL);
 #endif
 }
 
@@ -2241,6 +2280,90 @@ classevalfunc acef[N_CLASSES] = {
     EvalRace, EvalCrashed, EvalContact
 };
 
+/* Static evaluation of cBoards positions that all belong to class pc.
+ * The neural net classes go through NeuralNetEvaluateBatch() so the
+ * weights are read once per batch rather than once per position; the
+ * results are those of the leaf evaluation in EvaluatePositionFull()
+ * without noise.  nnStates works as for the acef[] functions. */
+
+extern int
+EvaluatePositionsBatch(const TanBoard aanBoard[], unsigned int cBoards, float aarOutput[][NUM_OUTPUTS],
+                       const positionclass pc, const bgvariation bgv, NNState * nnStates)
+{
+    SSE_ALIGN(float arInput[NUM_INPUTS]);
+    float *arBatch;
+    const neuralnet *pnn;
+    void (*pfInputs) (const TanBoard anBoard, float arInput[]);
+    unsigned int i, j;
+
+    switch (pc) {
+    case CLASS_RACE:
+        pnn = EvalNet(NET_RACE);
+        pfInputs = CalculateRaceInputs;
+        break;
+    case CLASS_CRASHED:
+        pnn = EvalNet(NET_CRASHED);
+        pfInputs = CalculateCrashedInputs;
+        break;
+    case CLASS_CONTACT:
+        pnn = EvalNet(NET_CONTACT);
+        pfInputs = CalculateContactInputs;
+        break;
+    default:
+        /* no net involved; evaluate one by one */
+        for (i = 0; i < cBoards; i++) {
+            if (acef[pc] (aanBoard[i], aarOutput[i], bgv, nnStates))
+                return -1;
+            if (pc > CLASS_GOOD)
+                SanityCheck(aanBoard[i], aarOutput[i]);
+        }
+        return 0;
+    }
+
+    arBatch = (float *) g_alloca(NN_BATCH_SIZE * pnn->cInput * sizeof(float));
+
+    for (i = 0; i < cBoards; i += NN_BATCH_SIZE) {
+        unsigned int const c = MIN(cBoards - i, NN_BATCH_SIZE);
+
+        /* the input routines need aligned storage; the batch is packed */
+        for (j = 0; j < c; j++) {
+            pfInputs(aanBoard[i + j], arInput);
+            memcpy(arBatch + j * pnn->cInput, arInput, pnn->cInput * sizeof(float));
+        }
+
+        if (NeuralNetEvaluateBatch(pnn, arBatch, aarOutput[i], c, nnStates ? nnStates + (pc - CLASS_RACE) : NULL))
+            return -1;
+
+        for (j = i; j < i + c; j++) {
+            if (pc == CLASS_RACE)
+                /* special evaluation of backgammons overrides net output */
+                EvalRaceBG(aanBoard[j], aarOutput[j], bgv);
+
+            SanityCheck(aanBoard[j], aarOutput[j]);
+        }
+    }
+
+    return 0;
+}
+
+/* The inputs of the net for class pc (CLASS_RACE, CLASS_CRASHED or
+ * CLASS_CONTACT), for benchmarking the input routines on their own */
+extern void
+CalculateInputs(const positionclass pc, const TanBoard anBoard, float arInput[])
+{
+    switch (pc) {
+    case CLASS_RACE:
+        CalculateRaceInputs(anBoard, arInput);
+        break;
+    case CLASS_CRASHED:
+        CalculateCrashedInputs(anBoard, arInput);
+        break;
+    default:
+        CalculateContactInputs(anBoard, arInput);
+        break;
+    }
+}
+
 extern float
 Noise(const evalcontext * pec, const TanBoard anBoard, int iOutput)
 {
@@ -2335,7 +2458,8 @@ EvalKey(const evalcontext * pec, const int nPlies, const cubeinfo * pci, int fCu
                   pci->fCubeOwner == pci->fMove) << 23) ^ (pci->fJacoby << 26) ^ (pci->fBeavers << 27);
 
         if (fCubefulEquity)
-            iKey ^= 0x6a47b47e;
+            /* leaves nPlies alone, the cache uses it */
+            iKey ^= 0x6a47b470;
     }
 
     return iKey;
@@ -2664,76 +2788,124 @@ ApplyMove(TanBoard anBoard, const int anMove[8], const int fCheckLegal)
     return 0;
 }
 
+/*
+ * Moves already saved are found through a per-thread hash of their
+ * position keys instead of comparing against all of them.  Slots only
+ * count if their stamp is the current one, so emptying the move list
+ * is a matter of bumping the stamp.
+ */
+
+#define MOVE_HASH_BITS 13
+#define MOVE_HASH_SIZE (1 << MOVE_HASH_BITS)
+
+#if MOVE_HASH_SIZE < 2 * MAX_INCOMPLETE_MOVES
+#error "MOVE_HASH_SIZE too small for MAX_INCOMPLETE_MOVES"
+#endif
+
+typedef struct {
+    unsigned int nStamp;
+    struct {
+        unsigned int nStamp;
+        unsigned int iMove;
+    } ae[MOVE_HASH_SIZE];
+} movehash;
+
+static void
+MoveHashClear(movehash * pmh)
+{
+    if (!++pmh->nStamp) {
+        memset(pmh->ae, 0, sizeof(pmh->ae));
+        pmh->nStamp = 1;
+    }
+}
+
+/* Returns the slot holding the move with this key, or the empty slot
+ * where it goes */
+static inline unsigned int
+MoveHashFind(const movehash * pmh, const candidatelist * pcl, const positionkey * pkey)
+{
+    unsigned int h = 0;
+    int i;
+
+    for (i = 0; i < 7; i++)
+        h = (h ^ pkey->data[i]) * 0x9E3779B1U;
+
+    for (h >>= 32 - MOVE_HASH_BITS;
+         pmh->ae[h].nStamp == pmh->nStamp && !EqualKeys(pcl->akey[pmh->ae[h].iMove], *pkey);
+         h = (h + 1) & (MOVE_HASH_SIZE - 1));
+
+    return h;
+}
+
+/* pmh is NULL for GenerateMovesRecursive(), which looks for duplicates
+ * the old way */
 static void
-SaveMoves(movelist * pml, unsigned int cMoves, unsigned int cPip, int anMoves[], const TanBoard anBoard, int fPartial)
+SaveMoves(candidatelist * pcl, movehash * pmh, unsigned int cMoves, unsigned int cPip, int anMoves[],
+          const TanBoard anBoard, int fPartial)
 {
-    unsigned int i, j;
-    move *pm;
+    unsigned int i, j, h = 0;
     positionkey key;
 
     if (fPartial) {
         /* Save all moves, even incomplete ones */
-        if (cMoves > pml->cMaxMoves)
-            pml->cMaxMoves = cMoves;
+        if (cMoves > pcl->cMaxMoves)
+            pcl->cMaxMoves = cMoves;
 
-        if (cPip > pml->cMaxPips)
-            pml->cMaxPips = cPip;
+        if (cPip > pcl->cMaxPips)
+            pcl->cMaxPips = cPip;
     } else {
         /* Save only legal moves: if the current move moves plays less
          * chequers or pips than those already found, it is illegal; if
          * it plays more, the old moves are illegal. */
-        if (cMoves < pml->cMaxMoves || cPip < pml->cMaxPips)
+        if (cMoves < pcl->cMaxMoves || cPip < pcl->cMaxPips)
             return;
 
-        if (cMoves > pml->cMaxMoves || cPip > pml->cMaxPips)
-            pml->cMoves = 0;
+        if (cMoves > pcl->cMaxMoves || cPip > pcl->cMaxPips) {
+            pcl->cMoves = 0;
+            if (pmh)
+                MoveHashClear(pmh);
+        }
 
-        pml->cMaxMoves = cMoves;
-        pml->cMaxPips = cPip;
+        pcl->cMaxMoves = cMoves;
+        pcl->cMaxPips = cPip;
     }
 
     PositionKey(anBoard, &key);
 
-    for (i = 0; i < pml->cMoves; i++) {
-
-        pm = &(pml->amMoves[i]);
-
-        if (EqualKeys(key, pm->key)) {
-            if (cMoves > pm->cMoves || cPip > pm->cPips) {
-                for (j = 0; j < cMoves * 2; j++)
-                    pm->anMove[j] = anMoves[j] > -1 ? anMoves[j] : -1;
-
-                if (cMoves < 4)
-                    pm->anMove[cMoves * 2] = -1;
+    if (pmh) {
+        h = MoveHashFind(pmh, pcl, &key);
+        i = pmh->ae[h].nStamp == pmh->nStamp ? pmh->ae[h].iMove : pcl->cMoves;
+    } else
+        for (i = 0; i < pcl->cMoves && !EqualKeys(key, pcl->akey[i]); i++);
 
-                pm->cMoves = cMoves;
-                pm->cPips = cPip;
-            }
+    if (i < pcl->cMoves) {
+        if (cMoves > pcl->acMoves[i] || cPip > pcl->acPips[i]) {
+            for (j = 0; j < 8; j++)
+                pcl->aanMove[i][j] = (signed char) (j < cMoves * 2 && anMoves[j] > -1 ? anMoves[j] : -1);
 
-            return;
+            pcl->acMoves[i] = (unsigned char) cMoves;
+            pcl->acPips[i] = (unsigned char) cPip;
         }
-    }
 
-    pm = pml->amMoves + pml->cMoves;
-
-    for (i = 0; i < cMoves * 2; i++)
-        pm->anMove[i] = anMoves[i] > -1 ? anMoves[i] : -1;
+        return;
+    }
 
-    if (cMoves < 4)
-        pm->anMove[cMoves * 2] = -1;
+    if (pmh) {
+        pmh->ae[h].nStamp = pmh->nStamp;
+        pmh->ae[h].iMove = pcl->cMoves;
+    }
 
-    CopyKey(key, pm->key);
+    for (j = 0; j < 8; j++)
+        pcl->aanMove[i][j] = (signed char) (j < cMoves * 2 && anMoves[j] > -1 ? anMoves[j] : -1);
 
-    pm->cMoves = cMoves;
-    pm->cPips = cPip;
-    pm->cmark = CMARK_NONE;
+    CopyKey(key, pcl->akey[i]);
 
-    for (i = 0; i < NUM_OUTPUTS; i++)
-        pm->arEvalMove[i] = 0.0;
+    pcl->acMoves[i] = (unsigned char) cMoves;
+    pcl->acPips[i] = (unsigned char) cPip;
 
-    pml->cMoves++;
+    pcl->cMoves++;
 
-    g_assert(pml->cMoves < MAX_INCOMPLETE_MOVES);
+    g_assert(pcl->cMoves < MAX_INCOMPLETE_MOVES);
 }
 
 static int
@@ -2756,7 +2928,7 @@ LegalMove(const TanBoard anBoard, int iSrc, int nPips)
 }
 
 static int
-GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
+GenerateMovesSub(candidatelist * pcl, int anRoll[], int nMoveDepth,
                  int iPip, int cPip, const TanBoard anBoard, int anMoves[], int fPartial)
 {
     int i, fUsed = 0;
@@ -2779,9 +2951,10 @@ GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
 
         ApplySubMove(anBoardNew, 24, anRoll[nMoveDepth], TRUE);
 
-        if (GenerateMovesSub(pml, anRoll, nMoveDepth + 1, 23, cPip +
+        if (GenerateMovesSub(pcl, anRoll, nMoveDepth + 1, 23, cPip +
                              anRoll[nMoveDepth], (ConstTanBoard) anBoardNew, anMoves, fPartial))
-            SaveMoves(pml, nMoveDepth + 1, cPip + anRoll[nMoveDepth], anMoves, (ConstTanBoard) anBoardNew, fPartial);
+            SaveMoves(pcl, NULL, nMoveDepth + 1, cPip + anRoll[nMoveDepth], anMoves, (ConstTanBoard) anBoardNew,
+                      fPartial);
 
         return fPartial;
     } else {
@@ -2794,10 +2967,10 @@ GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
 
                 ApplySubMove(anBoardNew, i, anRoll[nMoveDepth], TRUE);
 
-                if (GenerateMovesSub(pml, anRoll, nMoveDepth + 1,
+                if (GenerateMovesSub(pcl, anRoll, nMoveDepth + 1,
                                      anRoll[0] == anRoll[1] ? i : 23,
                                      cPip + anRoll[nMoveDepth], (ConstTanBoard) anBoardNew, anMoves, fPartial))
-                    SaveMoves(pml, nMoveDepth + 1, cPip +
+                    SaveMoves(pcl, NULL, nMoveDepth + 1, cPip +
                               anRoll[nMoveDepth], anMoves, (ConstTanBoard) anBoardNew, fPartial);
 
                 fUsed = 1;
@@ -2807,6 +2980,141 @@ GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
     return !fUsed || fPartial;
 }
 
+/*
+ * The same walk as GenerateMovesSub(), without recursion: the sub-moves
+ * are made and taken back on a single board, the points made by the
+ * opponent are a bit mask (hitting never changes them) and the back
+ * chequer needed for bearing off is kept up to date instead of being
+ * searched for.  Moves are found and saved in exactly the same order.
+ */
+static void
+GenerateMovesIter(candidatelist * pcl, movehash * pmh, const int anRoll[4], TanBoard anBoard, int fPartial)
+{
+    struct {
+        int iSrc;               /* source of the sub-move made at this depth */
+        int iNext;              /* next source point to try */
+        int fUsed;
+        int fHit;
+        int nBack;              /* back chequer before the sub-move */
+        unsigned int cPip;      /* pips played before this depth */
+    } af[4];
+    int anMoves[8];
+    unsigned int nBlocked = 0;
+    int nBack, d = 0, i, fSave;
+
+    for (i = 0; i < 24; i++)
+        if (anBoard[0][23 - i] >= 2)
+            nBlocked |= 1U << i;
+
+    for (nBack = 24; nBack > 0 && !anBoard[1][nBack]; nBack--);
+
+    af[0].cPip = 0;
+    af[0].iNext = 23;
+
+  enter:
+    /* start on depth d; af[d].iNext and af[d].cPip are set */
+    if (d > 3 || !anRoll[d]) {
+        fSave = TRUE;
+        goto leave;
+    }
+
+    if (anBoard[1][24]) {
+        if (nBlocked & (1U << (24 - anRoll[d]))) {
+            fSave = TRUE;
+            goto leave;
+        }
+        af[d].iNext = -1;       /* no other sub-move at this depth */
+        i = 24;
+        goto move;
+    }
+
+    af[d].fUsed = FALSE;
+
+  next:
+    /* try the remaining source points of depth d */
+    for (i = af[d].iNext; i >= 0; i--) {
+        const int iDest = i - anRoll[d];
+
+        if (!anBoard[1][i])
+            continue;
+        if (iDest >= 0 ? !(nBlocked & (1U << iDest)) : (nBack <= 5 && (i == nBack || iDest == -1)))
+            break;
+    }
+
+    if (i < 0) {
+        fSave = !af[d].fUsed || fPartial;
+        goto leave;
+    }
+
+    af[d].iNext = i - 1;
+
+  move:
+    {
+        const int iDest = i - anRoll[d];
+
+        anMoves[d * 2] = i;
+        anMoves[d * 2 + 1] = iDest;
+
+        af[d].iSrc = i;
+        af[d].nBack = nBack;
+        af[d].fHit = FALSE;
+
+        anBoard[1][i]--;
+        if (iDest >= 0) {
+            if (anBoard[0][23 - iDest]) {
+                anBoard[0][23 - iDest] = 0;
+                anBoard[0][24]++;
+                af[d].fHit = TRUE;
+            }
+            anBoard[1][iDest]++;
+        }
+        while (nBack > 0 && !anBoard[1][nBack])
+            nBack--;
+
+        if (d < 3) {
+            af[d + 1].cPip = af[d].cPip + (unsigned int) anRoll[d];
+            af[d + 1].iNext = (anRoll[0] == anRoll[1] && i != 24) ? i : 23;
+        }
+        d++;
+        if (d < 4)
+            goto enter;
+        fSave = TRUE;
+    }
+
+  leave:
+    /* depth d is done; fSave tells depth d - 1 to save its move */
+    if (d == 0)
+        return;
+    d--;
+
+    if (fSave)
+        SaveMoves(pcl, pmh, (unsigned int) d + 1, af[d].cPip + (unsigned int) anRoll[d], anMoves,
+                  (ConstTanBoard) anBoard, fPartial);
+
+    {
+        const int iDest = af[d].iSrc - anRoll[d];
+
+        anBoard[1][af[d].iSrc]++;
+        if (iDest >= 0) {
+            anBoard[1][iDest]--;
+            if (af[d].fHit) {
+                anBoard[0][23 - iDest] = 1;
+                anBoard[0][24]--;
+            }
+        }
+        nBack = af[d].nBack;
+    }
+
+    if (af[d].iSrc == 24) {
+        /* from the bar there was only one sub-move to make */
+        fSave = fPartial;
+        goto leave;
+    }
+
+    af[d].fUsed = TRUE;
+    goto next;
+}
+
 extern int
 CompareMoves(const move * pm0, const move * pm1)
 {
@@ -2866,26 +3174,160 @@ CompareMovesGeneral(const move * pm0, const move * pm1)
     return (back[0] > back[1] ? 1 : -1);
 }
 
+/* Lays out the arrays of a candidate list for c moves in the block p */
+static void
+CandidatesAt(candidatelist * pcl, void *p, const unsigned int c)
+{
+    pcl->akey = (positionkey *) p;
+    pcl->arScore = (float *) (pcl->akey + c);
+    pcl->arScore2 = pcl->arScore + c;
+    pcl->aanMove = (signed char (*)[8]) (pcl->arScore2 + c);
+    pcl->acMoves = (unsigned char *) (pcl->aanMove + c);
+    pcl->acPips = pcl->acMoves + c;
+}
+
+#define CANDIDATE_SIZE (sizeof(positionkey) + 2 * sizeof(float) + 8 + 2)
+
+/* Points pcl at the candidate buffers of the thread, empty, and returns
+ * its move hash */
+static movehash *
+CandidatesStart(candidatelist * pcl)
+{
+    ThreadLocalData *ptld = MT_GetTLD();
+    movehash *pmh;
+
+    if (!ptld->pCandidates)
+        ptld->pCandidates = g_malloc(MAX_INCOMPLETE_MOVES * CANDIDATE_SIZE);
+    CandidatesAt(pcl, ptld->pCandidates, MAX_INCOMPLETE_MOVES);
+
+    pcl->cMoves = pcl->cMaxMoves = pcl->cMaxPips = 0;
+    pcl->iMoveBest = 0;
+
+    if (!(pmh = (movehash *) ptld->pMoveHash))
+        pmh = ptld->pMoveHash = g_malloc0(sizeof(movehash));
+    MoveHashClear(pmh);
+
+    return pmh;
+}
+
+/* Full move records for the candidates, in the move buffer of the
+ * thread */
+static void
+MaterialiseMoves(movelist * pml, const candidatelist * pcl)
+{
+    unsigned int i, j;
+
+    pml->cMoves = pcl->cMoves;
+    pml->cMaxMoves = pcl->cMaxMoves;
+    pml->cMaxPips = pcl->cMaxPips;
+    pml->iMoveBest = 0;
+    pml->amMoves = MT_Get_aMoves();
+
+    for (i = 0; i < pcl->cMoves; i++) {
+        move *pm = pml->amMoves + i;
+
+        for (j = 0; j < 8; j++)
+            pm->anMove[j] = pcl->aanMove[i][j];
+
+        CopyKey(pcl->akey[i], pm->key);
+
+        pm->cMoves = pcl->acMoves[i];
+        pm->cPips = pcl->acPips[i];
+        pm->cmark = CMARK_NONE;
+
+        for (j = 0; j < NUM_OUTPUTS; j++)
+            pm->arEvalMove[j] = 0.0;
+    }
+}
+
+/* The legal moves as candidates.  Like the moves of GenerateMoves(),
+ * they live in buffers of the thread and are only good until the next
+ * call; CopyCandidates() keeps them. */
+extern int
+GenerateCandidates(candidatelist * pcl, const TanBoard anBoard, int n0, int n1, int fPartial)
+{
+
+    int anRoll[4];
+    TanBoard anBoardMove;
+    movehash *pmh = CandidatesStart(pcl);
+
+    anRoll[0] = n0;
+    anRoll[1] = n1;
+
+    anRoll[2] = anRoll[3] = ((n0 == n1) ? n0 : 0);
+
+    memcpy(anBoardMove, anBoard, sizeof(TanBoard));
+
+    GenerateMovesIter(pcl, pmh, anRoll, anBoardMove, fPartial);
+
+    if (anRoll[0] != anRoll[1]) {
+        swap(anRoll, anRoll + 1);
+
+        GenerateMovesIter(pcl, pmh, anRoll, anBoardMove, fPartial);
+    }
+
+    return pcl->cMoves;
+}
+
+extern void
+CopyCandidates(candidatelist * pclDest, const candidatelist * pclSrc)
+{
+    unsigned int const c = pclSrc->cMoves;
+
+    *pclDest = *pclSrc;
+    CandidatesAt(pclDest, g_malloc(c * CANDIDATE_SIZE), c);
+
+    memcpy(pclDest->akey, pclSrc->akey, c * sizeof(positionkey));
+    memcpy(pclDest->arScore, pclSrc->arScore, c * sizeof(float));
+    memcpy(pclDest->arScore2, pclSrc->arScore2, c * sizeof(float));
+    memcpy(pclDest->aanMove, pclSrc->aanMove, c * sizeof(pclSrc->aanMove[0]));
+    memcpy(pclDest->acMoves, pclSrc->acMoves, c);
+    memcpy(pclDest->acPips, pclSrc->acPips, c);
+}
+
+extern void
+FreeCandidates(candidatelist * pcl)
+{
+    g_free(pcl->akey);
+}
+
 extern int
 GenerateMoves(movelist * pml, const TanBoard anBoard, int n0, int n1, int fPartial)
+{
+    candidatelist cl;
+
+    GenerateCandidates(&cl, anBoard, n0, n1, fPartial);
+    MaterialiseMoves(pml, &cl);
+
+    return pml->cMoves;
+}
+
+/* The recursive generator GenerateMoves() replaced, kept as reference
+ * for `calibrate movegen' */
+extern int
+GenerateMovesRecursive(movelist * pml, const TanBoard anBoard, int n0, int n1, int fPartial)
 {
 
     int anRoll[4], anMoves[8];
+    candidatelist cl;
+
+    (void) CandidatesStart(&cl);
+
     anRoll[0] = n0;
     anRoll[1] = n1;
 
     anRoll[2] = anRoll[3] = ((n0 == n1) ? n0 : 0);
 
-    pml->cMoves = pml->cMaxMoves = pml->cMaxPips = pml->iMoveBest = 0;
-    pml->amMoves = MT_Get_aMoves();
-    GenerateMovesSub(pml, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
+    GenerateMovesSub(&cl, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
 
     if (anRoll[0] != anRoll[1]) {
         swap(anRoll, anRoll + 1);
 
-        GenerateMovesSub(pml, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
+        GenerateMovesSub(&cl, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
     }
 
+    MaterialiseMoves(pml, &cl);
+
     return pml->cMoves;
 }
 
@@ -3120,6 +3562,26 @@ EvalStatus(char *szOutput)
         if (acsf[i])
             acsf[i] (strchr(szOutput, 0));
 
+    sprintf(strchr(szOutput, 0), _(" * " "Neural net evaluation kernel" ": %s\n"), SIMD_SelectKernel());
+    switch (cEval.pages) {
+    case CACHE_PAGES_HUGETLB:
+        strcat(szOutput, _(" * " "Evaluation cache in reserved huge pages" "\n"));
+        break;
+    case CACHE_PAGES_TRANSPARENT:
+        strcat(szOutput, _(" * " "Evaluation cache in transparent huge pages" "\n"));
+        break;
+    default:
+        break;
+    }
+#if defined(USE_CACHE_FILE)
+    if (szCacheFile)
+        sprintf(strchr(szOutput, 0), _(" * " "Evaluations shared through %.256s (%u entries)" "\n"), szCacheFile,
+                cfEval.size);
+#endif
+#if defined(USE_MULTITHREAD)
+    if (fNumaReplicas && MT_GetNumaNodes() > 1)
+        sprintf(strchr(szOutput, 0), _(" * " "Neural nets replicated on %u NUMA nodes" "\n"), MT_GetNumaNodes());
+#endif
     sprintf(strchr(szOutput, 0), _(" * " "Weights file and databases installed in" ":\n   - %s\n"), getPkgDataDir());
 }
 
@@ -3176,10 +3638,80 @@ GetCubeRecommendation(const cubedecision cd)
 }
 
 
+#if defined(USE_CACHE_FILE)
+/* Cached evaluations depend on the weights and, for cubeful ones, on
+ * the match equity table */
+static uint32_t
+CacheFileVersion(void)
+{
+    struct md5_ctx ctx;
+    uint32_t auch[4];
+    int i;
+
+    md5_init_ctx(&ctx);
+
+    for (i = 0; i < NUM_NETS; i++) {
+        const neuralnet *pnn = apnnEval[i];
+
+        md5_process_bytes(pnn->arHiddenWeight, pnn->cInput * pnn->cHidden * sizeof(float), &ctx);
+        md5_process_bytes(pnn->arOutputWeight, pnn->cHidden * pnn->cOutput * sizeof(float), &ctx);
+        md5_process_bytes(pnn->arHiddenThreshold, pnn->cHidden * sizeof(float), &ctx);
+        md5_process_bytes(pnn->arOutputThreshold, pnn->cOutput * sizeof(float), &ctx);
+    }
+
+    md5_process_bytes(aafMET, sizeof(aafMET), &ctx);
+    md5_process_bytes(aafMETPostCrawford, sizeof(aafMETPostCrawford), &ctx);
+
+    md5_finish_ctx(&ctx, auch);
+
+    return auch[0];
+}
+#endif
+
+/* Share evaluations with other processes through szFile, or stop
+ * sharing if szFile is NULL */
+extern int
+EvalCacheFile(const char *szFile, unsigned int cEntries)
+{
+#if defined(USE_CACHE_FILE)
+    if (szCacheFile) {
+        csEval.pcf = NULL;
+        CacheFileClose(&cfEval);
+        g_free(szCacheFile);
+        szCacheFile = NULL;
+    }
+
+    if (!szFile)
+        return 0;
+
+    if (CacheFileOpen(&cfEval, szFile, cEntries, CacheFileVersion()))
+        return -1;
+
+    szCacheFile = g_strdup(szFile);
+    csEval.pcf = &cfEval;
+
+    return (int) cfEval.size;
+#else
+    (void) cEntries;
+    if (!szFile)
+        return 0;
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 extern void
 EvalCacheFlush(void)
 {
     CacheFlush(&cEval);
+    CacheFlush(&csEval);
+
+#if defined(USE_CACHE_FILE)
+    /* entries in the file are not flushed, only stop matching */
+    if (szCacheFile)
+        CacheFileSetVersion(&cfEval, CacheFileVersion());
+#endif
 }
 
 void
@@ -3224,33 +3756,97 @@ GetCacheMB(int size)
     if (size <= 0)
         return 0;
     else
-        return (1 << (size + 15)) * (int) sizeof(cacheNode) / (1024 * 1024);
+        return (int) ((((size_t) 1 << (size + 16)) + SubtreeCacheSize((size_t) 1 << (size + 16))) * CACHE_ENTRY_SIZE /
+                      (1024 * 1024));
 }
 
 extern int
 EvalCacheResize(unsigned int cNew)
 {
     cCache = CacheResize(&cEval, cNew);
+    CacheResize(&csEval, SubtreeCacheSize(cCache));
     return cCache;
 }
 
-#if CACHE_STATS
+/* Reallocate both caches, with or without huge pages */
 extern int
-EvalCacheStats(unsigned int *pcUsed, unsigned int *pcLookup, unsigned int *pcHit)
+EvalCacheHugePages(int f)
 {
-    CacheStats(&cEval, pcLookup, pcHit, pcUsed);
-    CacheStats(&cpEval, pcLookup + 1, pcHit + 1, pcUsed + 1);
+    unsigned int cPruning = cpEval.size;
+
+    cacheFile *pcf = csEval.pcf;
+
+    fCacheHugePages = f;
+    CacheSetHugePages(f);
+
+    CacheDestroy(&cEval);
+    CacheDestroy(&cpEval);
+    CacheDestroy(&csEval);
+
+    if (CacheCreate(&cEval, cCache) || CacheCreate(&cpEval, cPruning)
+        || CacheCreate(&csEval, SubtreeCacheSize(cCache)))
+        return -1;
+
+    csEval.pcf = pcf;
+
     return 0;
 }
-#endif
 
-extern int
-SetCubeInfoMoney(cubeinfo * pci, const int nCube, const int fCubeOwner,
-                 const int fMove, const int fJacoby, const int fBeavers, const bgvariation bgv)
+/* While f is set every position is evaluated in full, so results do not
+ * depend on what was evaluated before: incremental evaluation and the
+ * cache file are suspended and the caches are flushed. */
+extern void
+EvalDeterministic(int f)
 {
+    static cacheFile *pcfSaved = NULL;
 
-    if (nCube < 1 || fCubeOwner < -1 || fCubeOwner > 1 || fMove < 0 || fMove > 1) {     /* FIXME also illegal if nCube is not a power of 2 */
-        memset(pci, 0, sizeof(cubeinfo));
+    if (f == !fEvalIncremental)
+        return;
+
+    fEvalIncremental = !f;
+
+    if (f) {
+        pcfSaved = csEval.pcf;
+        csEval.pcf = NULL;
+        CacheFlush(&cEval);
+        CacheFlush(&cpEval);
+        CacheFlush(&csEval);
+    } else
+        csEval.pcf = pcfSaved;
+}
+
+#if CACHE_STATS
+extern int
+EvalCacheStats(unsigned int *pcUsed, unsigned int *pcLookup, unsigned int *pcHit,
+               unsigned int acLookupPly[CACHE_STATS_PLIES], unsigned int acHitPly[CACHE_STATS_PLIES])
+{
+    unsigned int cUsed, cLookup, cHit, i;
+    unsigned int acLookupSub[CACHE_STATS_PLIES], acHitSub[CACHE_STATS_PLIES];
+
+    /* the subtree cache counts as part of the regular one */
+    CacheStats(&cEval, pcLookup, pcHit, pcUsed);
+    CacheStats(&csEval, &cLookup, &cHit, &cUsed);
+    *pcLookup += cLookup;
+    *pcHit += cHit;
+    *pcUsed += cUsed;
+    CacheStats(&cpEval, pcLookup + 1, pcHit + 1, pcUsed + 1);
+    CacheStatsPly(&cEval, acLookupPly, acHitPly);
+    CacheStatsPly(&csEval, acLookupSub, acHitSub);
+    for (i = 0; i < CACHE_STATS_PLIES; i++) {
+        acLookupPly[i] += acLookupSub[i];
+        acHitPly[i] += acHitSub[i];
+    }
+    return 0;
+}
+#endif
+
+extern int
+SetCubeInfoMoney(cubeinfo * pci, const int nCube, const int fCubeOwner,
+                 const int fMove, const int fJacoby, const int fBeavers, const bgvariation bgv)
+{
+
+    if (nCube < 1 || fCubeOwner < -1 || fCubeOwner > 1 || fMove < 0 || fMove > 1) {     /* FIXME also illegal if nCube is not a power of 2 */
+        memset(pci, 0, sizeof(cubeinfo));
         return -1;
     }
 
@@ -5266,12 +5862,13 @@ DoubleType(const int fDoubled, const int fMove, const int fTurn)
 #define GeneralEvaluationEPlied GeneralEvaluationEPliedWithLocking
 #define EvaluatePositionCubeful3 EvaluatePositionCubeful3WithLocking
 #define ScoreMoves ScoreMovesWithLocking
-#define ScoreMovesPruned ScoreMovesPrunedWithLocking
+#define ScoreCandidates ScoreCandidatesWithLocking
 #define FindBestMoveInEval FindBestMoveInEvalWithLocking
 #define GeneralEvaluationEPliedCubeful GeneralEvaluationEPliedCubefulWithLocking
 #define EvaluatePositionCubeful4 EvaluatePositionCubeful4WithLocking
 #define CacheAdd CacheAddWithLocking
 #define CacheLookup CacheLookupWithLocking
+#define EvalCacheMoves EvalCacheMovesWithLocking
 
 static int EvaluatePositionCache(NNState * nnStates, const TanBoard anBoard, float arOutput[],
                                  cubeinfo * const pci, const evalcontext * pecx, int nPlies, positionclass pc);
@@ -5290,9 +5887,22 @@ static int EvaluatePositionCubeful3(NNState * nnStates, const TanBoard anBoard,
 
 /* Functions that have both locking and non-locking versions below here */
 
+/* A subtree reached again by a transposition, or by the next round of
+ * move filtering, is found in csEval instead of being searched again */
+#define CacheForPlies(n) ((n) > 0 ? &csEval : &cEval)
+
+/* Cubeful evaluations at the top of a cube decision, where the player
+ * on roll may not double, differ from those further down */
+#define EVALKEY_TOP 0x10000000
+
+/* Searches of this many plies or more spread their rolls, or their
+ * moves, over the threads; below that an item is too little work to
+ * hand out */
+#define PARALLEL_MIN_PLIES 2
+
 static int ScoreMoves(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nPlies);
-static int ScoreMovesPruned(movelist * pml, const cubeinfo * pci, const evalcontext * pec, unsigned int *bmovesi,
-                            unsigned int prune_moves);
+static int ScoreCandidates(candidatelist * pcl, const unsigned int *ai, unsigned int c, const cubeinfo * pci,
+                           const evalcontext * pec, int nPlies);
 /*
  * The pruning nets select the best MIN_PRUNE_MOVES +
  * floor(log2(number of legal moves)) moves instead of 10 as they used
@@ -5309,44 +5919,42 @@ FindBestMoveInEval(NNState * nnStates, int const nDice0, int const nDice1, const
                    TanBoard anBoardOut, cubeinfo * const pci, const evalcontext * pec)
 {
     unsigned int i;
-    movelist ml;
+    candidatelist cl;
     positionclass evalClass = CLASS_OVER;
     unsigned int bmovesi[MAX_PRUNE_MOVES];
     unsigned int prune_moves;
 
-    GenerateMoves(&ml, anBoardIn, nDice0, nDice1, FALSE);
+    GenerateCandidates(&cl, anBoardIn, nDice0, nDice1, FALSE);
 
-    if (ml.cMoves == 0) {
+    if (cl.cMoves == 0) {
         /* no legal moves */
         return;
     }
 
-    if (ml.cMoves == 1) {
+    if (cl.cMoves == 1) {
         /* forced move */
-        ml.iMoveBest = 0;
-        PositionFromKey(anBoardOut, &ml.amMoves[ml.iMoveBest].key);
+        PositionFromKey(anBoardOut, &cl.akey[0]);
         return;
     }
 
     /* LogCube() is floor(log2()) */
-    prune_moves = MIN_PRUNE_MOVES + LogCube(ml.cMoves);
+    prune_moves = MIN_PRUNE_MOVES + LogCube(cl.cMoves);
 
-    if (ml.cMoves <= prune_moves) {
-        ScoreMoves(&ml, pci, pec, 0);
-        PositionFromKey(anBoardOut, &ml.amMoves[ml.iMoveBest].key);
+    if (cl.cMoves <= prune_moves) {
+        ScoreCandidates(&cl, NULL, cl.cMoves, pci, pec, 0);
+        PositionFromKey(anBoardOut, &cl.akey[cl.iMoveBest]);
         return;
     }
 
     pci->fMove = !pci->fMove;
 
-    for (i = 0; i < ml.cMoves; i++) {
+    for (i = 0; i < cl.cMoves; i++) {
         positionclass pc;
         SSE_ALIGN(float arOutput[NUM_OUTPUTS]);
         evalcache ec;
         uint32_t l;
-        move *const pm = &ml.amMoves[i];
 
-        PositionFromKeySwapped(anBoardOut, &pm->key);
+        PositionFromKeySwapped(anBoardOut, &cl.akey[i]);
 
         pc = ClassifyPosition((ConstTanBoard) anBoardOut, VARIATION_STANDARD);
         if (i == 0) {
@@ -5356,22 +5964,21 @@ FindBestMoveInEval(NNState * nnStates, int const nDice0, int const nDice1, const
         } else if (pc != evalClass)
             break;
 
-        CopyKey(pm->key, ec.key);
+        CopyKey(cl.akey[i], ec.key);
         ec.nEvalContext = 0;
         if ((l = CacheLookup(&cpEval, &ec, arOutput, NULL)) != CACHEHIT) {
             SSE_ALIGN(float arInput[NUM_PRUNING_INPUTS]);
 
             baseInputs((ConstTanBoard) anBoardOut, arInput);
             {
-                const neuralnet *nets[] = { &nnpRace, &nnpCrashed, &nnpContact };
-                const neuralnet *n = nets[pc - CLASS_RACE];
+                const neuralnet *n = EvalNet(NET_PRUNING_RACE + pc - CLASS_RACE);
+                if (nnStates)
+                    nnStates[pc - CLASS_RACE].state =
+                        !fEvalIncremental ? NNSTATE_NONE : (i == 0) ? NNSTATE_INCREMENTAL : NNSTATE_DONE;
 #if defined(USE_SIMD_INSTRUCTIONS)
-                (void) nnStates;        /* silence compiler warning */
-                NeuralNetEvaluateSSE(n, arInput, arOutput, NULL);
+                NeuralNetEvaluateSSE(n, arInput, arOutput, nnStates ? nnStates + (pc - CLASS_RACE) : NULL);
 #else
-                if (nnStates)
-                    nnStates[pc - CLASS_RACE].state = (i == 0) ? NNSTATE_INCREMENTAL : NNSTATE_DONE;
-                NeuralNetEvaluate(n, arInput, arOutput, nnStates);
+                NeuralNetEvaluate(n, arInput, arOutput, nnStates ? nnStates + (pc - CLASS_RACE) : NULL);
 #endif
                 if (pc == CLASS_RACE)
                     /* special evaluation of backgammons
@@ -5384,18 +5991,18 @@ FindBestMoveInEval(NNState * nnStates, int const nDice0, int const nDice1, const
             ec.ar[5] = 0.f;
             CacheAdd(&cpEval, &ec, l);
         }
-        pm->rScore = UtilityME(arOutput, pci);
+        cl.arScore[i] = UtilityME(arOutput, pci);
         if (i < prune_moves) {
             bmovesi[i] = i;
-            if (pm->rScore > ml.amMoves[bmovesi[0]].rScore) {
+            if (cl.arScore[i] > cl.arScore[bmovesi[0]]) {
                 bmovesi[i] = bmovesi[0];
                 bmovesi[0] = i;
             }
-        } else if (pm->rScore < ml.amMoves[bmovesi[0]].rScore) {
+        } else if (cl.arScore[i] < cl.arScore[bmovesi[0]]) {
             unsigned int m = 0, k;
             bmovesi[0] = i;
             for (k = 1; k < prune_moves; ++k) {
-                if (ml.amMoves[bmovesi[k]].rScore > ml.amMoves[bmovesi[m]].rScore) {
+                if (cl.arScore[bmovesi[k]] > cl.arScore[bmovesi[m]]) {
                     m = k;
                 }
             }
@@ -5406,12 +6013,12 @@ FindBestMoveInEval(NNState * nnStates, int const nDice0, int const nDice1, const
 
     pci->fMove = !pci->fMove;
 
-    if (i == ml.cMoves)
-        ScoreMovesPruned(&ml, pci, pec, bmovesi, prune_moves);
+    if (i == cl.cMoves)
+        ScoreCandidates(&cl, bmovesi, prune_moves, pci, pec, 0);
     else
-        ScoreMoves(&ml, pci, pec, 0);
+        ScoreCandidates(&cl, NULL, cl.cMoves, pci, pec, 0);
 
-    PositionFromKey(anBoardOut, &ml.amMoves[ml.iMoveBest].key);
+    PositionFromKey(anBoardOut, &cl.akey[cl.iMoveBest]);
 }
 
 static int
@@ -5529,7 +6136,7 @@ EvaluatePositionCache(NNState * nnStates, const TanBoard anBoard, float arOutput
     PositionKey(anBoard, &ec.key);
 
     ec.nEvalContext = EvalKey(pecx, nPlies, pci, FALSE);
-    if ((l = CacheLookup(&cEval, &ec, arOutput, NULL)) == CACHEHIT) {
+    if ((l = CacheLookup(CacheForPlies(nPlies), &ec, arOutput, NULL)) == CACHEHIT) {
         return 0;
     }
 
@@ -5538,7 +6145,7 @@ EvaluatePositionCache(NNState * nnStates, const TanBoard anBoard, float arOutput
 
     memcpy(ec.ar, arOutput, sizeof(float) * NUM_OUTPUTS);
     ec.ar[5] = 0.f;
-    CacheAdd(&cEval, &ec, l);
+    CacheAdd(CacheForPlies(nPlies), &ec, l);
     return 0;
 }
 
@@ -5553,14 +6160,16 @@ EvaluatePosition(NNState * nnStates, const TanBoard anBoard, float arOutput[],
 }
 
 
-extern int
-ScoreMove(NNState * nnStates, move * pm, const cubeinfo * pci, const evalcontext * pec, int nPlies)
+/* The evaluation of the position after a move, from the point of view
+ * of the player making it */
+static int
+EvaluateMove(NNState * nnStates, float arEval[NUM_ROLLOUT_OUTPUTS], const positionkey * pkey, const cubeinfo * pci,
+             const evalcontext * pec, int nPlies)
 {
     TanBoard anBoardTemp;
-    SSE_ALIGN(float arEval[NUM_ROLLOUT_OUTPUTS]);
     cubeinfo ci;
 
-    PositionFromKeySwapped(anBoardTemp, &pm->key);
+    PositionFromKeySwapped(anBoardTemp, pkey);
 
     /* swap fMove in cubeinfo */
     memcpy(&ci, pci, sizeof(ci));
@@ -5574,6 +6183,17 @@ ScoreMove(NNState * nnStates, move * pm, const cubeinfo * pci, const evalcontext
     if (ci.nMatchTo)
         arEval[OUTPUT_CUBEFUL_EQUITY] = mwc2eq(arEval[OUTPUT_CUBEFUL_EQUITY], pci);
 
+    return 0;
+}
+
+extern int
+ScoreMove(NNState * nnStates, move * pm, const cubeinfo * pci, const evalcontext * pec, int nPlies)
+{
+    SSE_ALIGN(float arEval[NUM_ROLLOUT_OUTPUTS]);
+
+    if (EvaluateMove(nnStates, arEval, &pm->key, pci, pec, nPlies))
+        return -1;
+
     /* Save evaluations */
     memcpy(pm->arEvalMove, arEval, NUM_ROLLOUT_OUTPUTS * sizeof(float));
 
@@ -5591,23 +6211,255 @@ ScoreMove(NNState * nnStates, move * pm, const cubeinfo * pci, const evalcontext
     return 0;
 }
 
+static void
+CacheAddBatch(NNState * nnStates, TanBoard aanBoard[], evalcache aec[], const uint32_t al[], unsigned int c,
+              positionclass pc, bgvariation bgv)
+{
+    float aarOutput[NN_BATCH_SIZE][NUM_OUTPUTS];
+    unsigned int i;
+
+    if (EvaluatePositionsBatch((const TanBoard *) aanBoard, c, aarOutput, pc, bgv, nnStates))
+        return;
+
+    for (i = 0; i < c; i++) {
+        memcpy(aec[i].ar, aarOutput[i], sizeof(float) * NUM_OUTPUTS);
+        aec[i].ar[5] = 0.f;
+        CacheAdd(&cEval, &aec[i], al[i]);
+    }
+}
+
+/* Positions waiting to be evaluated into the cache, one batch per
+ * neural net class */
+typedef struct {
+    TanBoard aaanBoard[N_CLASSES - CLASS_RACE][NN_BATCH_SIZE];
+    evalcache aaec[N_CLASSES - CLASS_RACE][NN_BATCH_SIZE];
+    uint32_t aal[N_CLASSES - CLASS_RACE][NN_BATCH_SIZE];
+    unsigned int ac[N_CLASSES - CLASS_RACE];
+    bgvariation bgv;
+} evalbatch;
+
+/* Queue anBoard unless the cache already has it, evaluating the batch
+ * of its class when that is full */
+static void
+EvalBatchAdd(NNState * nnStates, evalbatch * peb, const TanBoard anBoard, int nEvalContext)
+{
+    SSE_ALIGN(float arOutput[NUM_OUTPUTS]);
+    positionclass pc = ClassifyPosition(anBoard, peb->bgv);
+    unsigned int n, c;
+
+    if (pc < CLASS_RACE)
+        /* no neural net involved */
+        return;
+
+    n = pc - CLASS_RACE;
+    c = peb->ac[n];
+
+    PositionKey(anBoard, &peb->aaec[n][c].key);
+    peb->aaec[n][c].nEvalContext = nEvalContext;
+
+    if ((peb->aal[n][c] = CacheLookup(&cEval, &peb->aaec[n][c], arOutput, NULL)) == CACHEHIT)
+        return;
+
+    memcpy(peb->aaanBoard[n][c], anBoard, sizeof(TanBoard));
+
+    if (++peb->ac[n] == NN_BATCH_SIZE) {
+        CacheAddBatch(nnStates, peb->aaanBoard[n], peb->aaec[n], peb->aal[n], NN_BATCH_SIZE, pc, peb->bgv);
+        peb->ac[n] = 0;
+    }
+}
+
+static void
+EvalBatchFlush(NNState * nnStates, evalbatch * peb)
+{
+    unsigned int i;
+
+    for (i = 0; i < N_CLASSES - CLASS_RACE; i++)
+        if (peb->ac[i]) {
+            CacheAddBatch(nnStates, peb->aaanBoard[i], peb->aaec[i], peb->aal[i], peb->ac[i],
+                          (positionclass) (CLASS_RACE + i), peb->bgv);
+            peb->ac[i] = 0;
+        }
+}
+
+/* Evaluate the positions after the moves ai[0..cMoves-1] (all moves if
+ * ai is NULL) in batches of the same position class and store them in
+ * the evaluation cache, where the 0-ply ScoreMove() calls that follow
+ * will find them.  The keys of the moves are cbStride bytes apart from
+ * pkey on, so that both moves and candidates can be passed. */
+
+static void
+ScoreMovesBatch(NNState * nnStates, const positionkey * pkey, size_t cbStride, const unsigned int *ai,
+                unsigned int cMoves, const cubeinfo * pci, const evalcontext * pec)
+{
+    evalbatch eb;
+    cubeinfo ci;
+    int nEvalContext;
+    unsigned int i;
+
+    if (!cCache || pec->rNoise != 0.0f || cMoves < 2)
+        return;
+
+    memcpy(&ci, pci, sizeof(ci));
+    ci.fMove = !ci.fMove;
+
+    /* the key EvaluatePositionCache() uses for the 0-ply leaves */
+    nEvalContext = EvalKey(&ecBasic, 0, &ci, FALSE);
+
+    memset(eb.ac, 0, sizeof(eb.ac));
+    eb.bgv = ci.bgv;
+
+    for (i = 0; i < cMoves; i++) {
+        const unsigned int iMove = ai ? ai[i] : i;
+        TanBoard anBoard;
+
+        PositionFromKeySwapped(anBoard, (const positionkey *) ((const char *) pkey + cbStride * iMove));
+        EvalBatchAdd(nnStates, &eb, (ConstTanBoard) anBoard, nEvalContext);
+    }
+
+    EvalBatchFlush(nnStates, &eb);
+}
+
+/* Put the 0-ply evaluations of the positions after every legal move of
+ * aanBoard[i] with the roll aanDice[i] (every roll if that is 0-0) in the
+ * evaluation cache, sharing the neural net batches between all c boards.
+ * The boards must be of the same variation. */
+
+extern void
+EvalCacheMoves(const TanBoard aanBoard[], const unsigned int aanDice[][2], const cubeinfo aci[], unsigned int c)
+{
+    evalbatch eb;
+    unsigned int i;
+
+    if (!cCache || !c)
+        return;
+
+    memset(eb.ac, 0, sizeof(eb.ac));
+    eb.bgv = aci[0].bgv;
+
+    for (i = 0; i < c; i++) {
+        cubeinfo ci;
+        int nEvalContext;
+        int n0, n1;
+
+        memcpy(&ci, &aci[i], sizeof(ci));
+        ci.fMove = !ci.fMove;
+        nEvalContext = EvalKey(&ecBasic, 0, &ci, FALSE);
+
+        for (n0 = 1; n0 <= 6; n0++)
+            for (n1 = 1; n1 <= n0; n1++) {
+                movelist ml;
+                unsigned int j;
+
+                if (aanDice[i][0] && (n0 != (int) aanDice[i][0] || n1 != (int) aanDice[i][1]))
+                    continue;
+
+                GenerateMoves(&ml, aanBoard[i], n0, n1, FALSE);
+
+                for (j = 0; j < ml.cMoves; j++) {
+                    TanBoard anBoard;
+
+                    PositionFromKeySwapped(anBoard, &ml.amMoves[j].key);
+                    EvalBatchAdd(NULL, &eb, (ConstTanBoard) anBoard, nEvalContext);
+                }
+            }
+    }
+
+    EvalBatchFlush(NULL, &eb);
+}
+
+#if defined(LOCKING_VERSION)
+/* The moves of ScoreMoves(), or the candidates of ScoreCandidates(), of
+ * a search deep enough to be shared out over the threads */
+typedef struct {
+    movelist *pml;
+    candidatelist *pcl;
+    const unsigned int *ai;
+    const cubeinfo *pci;
+    const evalcontext *pec;
+    int nPlies;
+    int *aiRet;
+} parallelscore;
+
+static SIMD_AVX_STACKALIGN void
+ScoreMoveNested(void *p, unsigned int j)
+{
+    parallelscore *pps = (parallelscore *) p;
+
+    if (pps->pml)
+        pps->aiRet[j] = ScoreMove(MT_Get_nnState(), pps->pml->amMoves + j, pps->pci, pps->pec, pps->nPlies);
+    else {
+        SSE_ALIGN(float arEval[NUM_ROLLOUT_OUTPUTS]);
+        candidatelist *pcl = pps->pcl;
+        unsigned int i = pps->ai ? pps->ai[j] : j;
+
+        if ((pps->aiRet[j] = EvaluateMove(MT_Get_nnState(), arEval, &pcl->akey[i], pps->pci, pps->pec,
+                                          pps->nPlies)) == 0) {
+            pcl->arScore[i] = (pps->pec->fCubeful) ? arEval[OUTPUT_CUBEFUL_EQUITY] : arEval[OUTPUT_EQUITY];
+            pcl->arScore2[i] = arEval[OUTPUT_EQUITY];
+        }
+    }
+}
+
+/* Score c moves of pml or candidates of pcl at once; the caller picks
+ * the best in its own order afterwards */
+static int
+ScoreMovesParallel(movelist * pml, candidatelist * pcl, const unsigned int *ai, unsigned int c,
+                   const cubeinfo * pci, const evalcontext * pec, int nPlies)
+{
+    parallelscore ps;
+    unsigned int j;
+    int r = 0;
+
+    ps.pml = pml;
+    ps.pcl = pcl;
+    ps.ai = ai;
+    ps.pci = pci;
+    ps.pec = pec;
+    ps.nPlies = nPlies;
+    ps.aiRet = g_new(int, c);
+
+    MT_ParallelFor(c, ScoreMoveNested, &ps);
+
+    for (j = 0; j < c; j++)
+        if (ps.aiRet[j] < 0)
+            r = -1;
+
+    g_free(ps.aiRet);
+
+    return r;
+}
+
+#define ScoreInParallel(nPlies, c) ((nPlies) >= PARALLEL_MIN_PLIES && (c) > 1)
+#else
+#define ScoreInParallel(nPlies, c) FALSE
+#endif
+
 static int
 ScoreMoves(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nPlies)
 {
     unsigned int i;
     int r = 0;                  /* return value */
     NNState *nnStates = MT_Get_nnState();
+    int const fParallel = ScoreInParallel(nPlies, pml->cMoves);
 
     pml->rBestScore = -99999.9f;
 
+#if defined(LOCKING_VERSION)
+    if (fParallel && ScoreMovesParallel(pml, NULL, NULL, pml->cMoves, pci, pec, nPlies) < 0)
+        return -1;
+#endif
+
     if (nPlies == 0) {
         /* start incremental evaluations */
-        nnStates[0].state = nnStates[1].state = nnStates[2].state = NNSTATE_INCREMENTAL;
+        nnStates[0].state = nnStates[1].state = nnStates[2].state =
+            fEvalIncremental ? NNSTATE_INCREMENTAL : NNSTATE_NONE;
+
+        ScoreMovesBatch(nnStates, &pml->amMoves[0].key, sizeof(move), NULL, pml->cMoves, pci, pec);
     }
 
 
     for (i = 0; i < pml->cMoves; i++) {
-        if (ScoreMove(nnStates, pml->amMoves + i, pci, pec, nPlies) < 0) {
+        if (!fParallel && ScoreMove(nnStates, pml->amMoves + i, pci, pec, nPlies) < 0) {
             r = -1;
             break;
         }
@@ -5629,43 +6481,98 @@ ScoreMoves(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nP
     return r;
 }
 
+/* ScoreMoves() for the candidates ai[0..c-1] of pcl (all of them if ai
+ * is NULL) */
 static int
-ScoreMovesPruned(movelist * pml, const cubeinfo * pci, const evalcontext * pec, unsigned int *bmovesi,
-                 unsigned int prune_moves)
+ScoreCandidates(candidatelist * pcl, const unsigned int *ai, unsigned int c, const cubeinfo * pci,
+                const evalcontext * pec, int nPlies)
 {
     unsigned int j;
     int r = 0;                  /* return value */
     NNState *nnStates = MT_Get_nnState();
+    int const fParallel = ScoreInParallel(nPlies, c);
 
-    pml->rBestScore = -99999.9f;
+    pcl->rBestScore = -99999.9f;
 
-    /* start incremental evaluations */
-    nnStates[0].state = nnStates[1].state = nnStates[2].state = NNSTATE_INCREMENTAL;
+#if defined(LOCKING_VERSION)
+    if (fParallel && ScoreMovesParallel(NULL, pcl, ai, c, pci, pec, nPlies) < 0)
+        return -1;
+#endif
 
-    for (j = 0; j < prune_moves; j++) {
+    if (nPlies == 0) {
+        /* start incremental evaluations */
+        nnStates[0].state = nnStates[1].state = nnStates[2].state =
+            fEvalIncremental ? NNSTATE_INCREMENTAL : NNSTATE_NONE;
 
-        unsigned int i = bmovesi[j];
+        ScoreMovesBatch(nnStates, pcl->akey, sizeof(positionkey), ai, c, pci, pec);
+    }
 
-        if (ScoreMove(nnStates, pml->amMoves + i, pci, pec, 0) < 0) {
-            r = -1;
-            break;
+    for (j = 0; j < c; j++) {
+        unsigned int i = ai ? ai[j] : j;
+
+        if (!fParallel) {
+            SSE_ALIGN(float arEval[NUM_ROLLOUT_OUTPUTS]);
+
+            if (EvaluateMove(nnStates, arEval, &pcl->akey[i], pci, pec, nPlies) < 0) {
+                r = -1;
+                break;
+            }
+
+            pcl->arScore[i] = (pec->fCubeful) ? arEval[OUTPUT_CUBEFUL_EQUITY] : arEval[OUTPUT_EQUITY];
+            pcl->arScore2[i] = arEval[OUTPUT_EQUITY];
         }
 
-        if ((pml->amMoves[i].rScore > pml->rBestScore) || ((pml->amMoves[i].rScore == pml->rBestScore)
-                                                           && (pml->amMoves[i].rScore2 >
-                                                               pml->amMoves[pml->iMoveBest].rScore2))) {
-            pml->iMoveBest = i;
-            pml->rBestScore = pml->amMoves[i].rScore;
+        if ((pcl->arScore[i] > pcl->rBestScore) || ((pcl->arScore[i] == pcl->rBestScore)
+                                                    && (pcl->arScore2[i] > pcl->arScore2[pcl->iMoveBest]))) {
+            pcl->iMoveBest = (int) i;
+            pcl->rBestScore = pcl->arScore[i];
         }
     }
 
-    nnStates[0].state = nnStates[1].state = nnStates[2].state = NNSTATE_NONE;
+    if (nPlies == 0) {
+        /* reset to none */
+
+        nnStates[0].state = nnStates[1].state = nnStates[2].state = NNSTATE_NONE;
+    }
 
     return r;
 }
 
 static movefilter NullFilter = { -1, 0, 0.0 };
 
+typedef struct {
+    float rScore, rScore2;
+    unsigned int i;
+} candidaterank;
+
+static int
+CompareCandidates(const candidaterank * pcr0, const candidaterank * pcr1)
+{
+
+    /* as CompareMoves() */
+    return (pcr1->rScore > pcr0->rScore || (pcr1->rScore == pcr0->rScore && pcr1->rScore2 > pcr0->rScore2)) ? 1 : -1;
+}
+
+/* Order the candidates ai[0..c-1] of pcl best first */
+static void
+SortCandidates(const candidatelist * pcl, unsigned int *ai, unsigned int c, candidaterank * acr)
+{
+    unsigned int j;
+
+    for (j = 0; j < c; j++) {
+        acr[j].rScore = pcl->arScore[ai[j]];
+        acr[j].rScore2 = pcl->arScore2[ai[j]];
+        acr[j].i = ai[j];
+    }
+
+    qsort(acr, c, sizeof(candidaterank), (cfunc) CompareCandidates);
+
+    for (j = 0; j < c; j++)
+        ai[j] = acr[j].i;
+}
+
+/* The move FindnSaveBestMoves() would put first, found with the same
+ * filters on the compact candidates instead of full moves */
 static int
 FindBestMovePlied(int anMove[8], int nDice0, int nDice1,
                   TanBoard anBoard,
@@ -5674,8 +6581,12 @@ FindBestMovePlied(int anMove[8], int nDice0, int nDice1,
 {
 
     evalcontext ec;
-    movelist ml;
-    unsigned int i;
+    candidatelist clThread, cl;
+    movefilter *mFilters;
+    unsigned int *ai;
+    candidaterank *acr;
+    unsigned int i, c, iPly;
+    int iBest;
 
     memcpy(&ec, pec, sizeof(evalcontext));
     ec.nPlies = nPlies;
@@ -5684,22 +6595,94 @@ FindBestMovePlied(int anMove[8], int nDice0, int nDice1,
         for (i = 0; i < 8; ++i)
             anMove[i] = -1;
 
-    if (FindnSaveBestMoves(&ml, nDice0, nDice1, (ConstTanBoard) anBoard, NULL, 0.0f, pci, &ec, aamf) < 0) {
-        g_free(ml.amMoves);
-        return -1;
+    GenerateCandidates(&clThread, (ConstTanBoard) anBoard, nDice0, nDice1, FALSE);
+
+    if (clThread.cMoves == 0)
+        /* no legal moves */
+        return clThread.cMaxMoves * 2;
+
+    /* Evaluations at more than 0 plies generate candidates of their
+     * own, so those of this position must be kept elsewhere */
+    if (ec.nPlies)
+        CopyCandidates(&cl, &clThread);
+    else
+        cl = clThread;
+
+    ai = g_new(unsigned int, cl.cMoves);
+    acr = g_new(candidaterank, cl.cMoves);
+
+    for (i = 0; i < cl.cMoves; i++)
+        ai[i] = i;
+    c = cl.cMoves;
+
+    mFilters = (ec.nPlies > 0 && ec.nPlies <= MAX_FILTER_PLIES) ?
+        aamf[ec.nPlies - 1] : aamf[MAX_FILTER_PLIES - 1];
+
+    for (iPly = 0; iPly < ec.nPlies; iPly++) {
+
+        movefilter *mFilter = (iPly < MAX_FILTER_PLIES) ? &mFilters[iPly] : &NullFilter;
+
+        unsigned int k;
+
+        if (mFilter->Accept < 0) {
+            continue;
+        }
+
+        if (ScoreCandidates(&cl, ai, c, pci, &ec, iPly) < 0) {
+            iBest = -1;
+            goto leave;
+        }
+
+        SortCandidates(&cl, ai, c, acr);
+
+        k = c;
+        /* we check for mFilter->Accept < 0 above */
+        c = MIN((unsigned int) mFilter->Accept, c);
+
+        {
+            unsigned int limit = MIN(k, c + mFilter->Extra);
+
+            for ( /**/; c < limit; ++c) {
+                if (cl.arScore[ai[c]] < cl.arScore[ai[0]] - mFilter->Threshold) {
+                    break;
+                }
+            }
+        }
+
+        if (c == 1 && mFilter->Accept != 1)
+            /* if there is only one move to evaluate there is no need to continue */
+            break;
     }
 
-    if (anMove) {
-        for (i = 0; i < ml.cMaxMoves * 2; i++)
-            anMove[i] = ml.amMoves[ml.iMoveBest].anMove[i];
+    if (iPly == ec.nPlies) {
+        /* evaluate moves on top ply */
+
+        if (ScoreCandidates(&cl, ai, c, pci, &ec, ec.nPlies) < 0) {
+            iBest = -1;
+            goto leave;
+        }
+
+        SortCandidates(&cl, ai, c, acr);
     }
 
-    if (ml.cMoves)
-        PositionFromKey(anBoard, &ml.amMoves[ml.iMoveBest].key);
+    iBest = (int) ai[0];
 
-    g_free(ml.amMoves);
+  leave:
+    if (iBest >= 0) {
+        if (anMove) {
+            for (i = 0; i < cl.cMaxMoves * 2; i++)
+                anMove[i] = cl.aanMove[iBest][i];
+        }
+
+        PositionFromKey(anBoard, &cl.akey[iBest]);
+    }
 
-    return ml.cMaxMoves * 2;
+    g_free(acr);
+    g_free(ai);
+    if (ec.nPlies)
+        FreeCandidates(&cl);
+
+    return iBest < 0 ? -1 : (int) cl.cMaxMoves * 2;
 }
 
 
@@ -5965,6 +6948,87 @@ GeneralEvaluationEPlied(NNState * nnStates, float arOutput[NUM_ROLLOUT_OUTPUTS],
 
 }
 
+/* The 21 rolls of an internal node of EvaluatePositionCubeful4(), each
+ * evaluated into its own slots so that they may run on several threads
+ * and still be summed in the same order */
+typedef struct {
+    SSE_ALIGN(float ar[NUM_OUTPUTS]);
+} rolloutput;
+
+typedef struct {
+    NNState *nnStates;
+    int fNested;                /* on the threads of MT_ParallelFor() */
+    const unsigned int (*anBoard)[25];
+    const cubeinfo *aci;
+    int cci;                    /* cube positions at the next ply */
+    cubeinfo *pciMove;
+    const evalcontext *pec;
+    unsigned int nPlies;
+    int usePrune;
+    rolloutput aro[21];
+    float *aarCf;               /* cci for each roll */
+    int aiRet[21];
+} cubefulrolls;
+
+/* Rolls from the loop over n0 >= n1 in order */
+static void
+RollFromIndex(unsigned int i, int *pn0, int *pn1)
+{
+    int n0;
+
+    for (n0 = 1; i >= (unsigned int) n0; n0++)
+        i -= (unsigned int) n0;
+
+    *pn0 = n0;
+    *pn1 = (int) i + 1;
+}
+
+static SIMD_AVX_STACKALIGN void
+EvaluateCubefulRoll(void *p, unsigned int iRoll)
+{
+    cubefulrolls *pcr = (cubefulrolls *) p;
+    NNState *nnStates = pcr->fNested && pcr->nnStates ? MT_Get_nnState() : pcr->nnStates;
+    cubeinfo *const pciMove = pcr->pciMove;
+    cubeinfo ciMove, ciMoveOpp;
+    TanBoard anBoardNew;
+    int i, n0, n1;
+
+    RollFromIndex(iRoll, &n0, &n1);
+
+    for (i = 0; i < 25; i++) {
+        anBoardNew[0][i] = pcr->anBoard[0][i];
+        anBoardNew[1][i] = pcr->anBoard[1][i];
+    }
+
+    if (MT_SafeGet(&fInterrupt)) {
+        errno = EINTR;
+        pcr->aiRet[iRoll] = -1;
+        return;
+    }
+
+    /* FindBestMoveInEval() flips fMove while it works */
+    ciMove = *pciMove;
+
+    if (pcr->usePrune) {
+        FindBestMoveInEval(nnStates, n0, n1, pcr->anBoard, anBoardNew, &ciMove, pcr->pec);
+    } else {
+
+        FindBestMovePlied(NULL, n0, n1, anBoardNew, &ciMove, pcr->pec, 0, defaultFilters);
+    }
+
+    SwapSides(anBoardNew);
+
+    SetCubeInfo(&ciMoveOpp,
+                pciMove->nCube, pciMove->fCubeOwner,
+                !pciMove->fMove, pciMove->nMatchTo,
+                pciMove->anScore, pciMove->fCrawford, pciMove->fJacoby, pciMove->fBeavers, pciMove->bgv);
+
+    /* Evaluate at 0-ply */
+    pcr->aiRet[iRoll] = EvaluatePositionCubeful3(nnStates, (ConstTanBoard) anBoardNew,
+                                                 pcr->aro[iRoll].ar, pcr->aarCf + iRoll * pcr->cci, pcr->aci, pcr->cci,
+                                                 &ciMoveOpp, pcr->pec, (int) pcr->nPlies - 1, FALSE);
+}
+
 static int
 EvaluatePositionCubeful4(NNState * nnStates, const TanBoard anBoard,
                          float arOutput[NUM_OUTPUTS],
@@ -5978,13 +7042,9 @@ EvaluatePositionCubeful4(NNState * nnStates, const TanBoard anBoard,
 
     int i;
     positionclass pc;
-    SSE_ALIGN(float ar[NUM_OUTPUTS]);
     float arEquity[4];
 
-    cubeinfo ciMoveOpp;
-
     float *arCf = (float *) g_alloca(2 * cci * sizeof(float));
-    float *arCfTemp = (float *) g_alloca(2 * cci * sizeof(float));
     cubeinfo *aci = (cubeinfo *) g_alloca(2 * cci * sizeof(cubeinfo));
 
     pc = ClassifyPosition(anBoard, pciMove->bgv);
@@ -5992,12 +7052,10 @@ EvaluatePositionCubeful4(NNState * nnStates, const TanBoard anBoard,
     if (pc > CLASS_OVER && nPlies > 0 && !(pc <= CLASS_PERFECT && !pciMove->nMatchTo)) {
         /* internal node; recurse */
 
-        TanBoard anBoardNew;
-        int n0, n1;
+        cubefulrolls cr;
+        unsigned int iRoll;
         float r;
 
-        int const usePrune = pec->fUsePrune && pec->rNoise == 0.0f && pciMove->bgv == VARIATION_STANDARD;
-
         for (i = 0; i < NUM_OUTPUTS; i++)
             arOutput[i] = 0.0;
 
@@ -6008,50 +7066,49 @@ EvaluatePositionCubeful4(NNState * nnStates, const TanBoard anBoard,
 
         MakeCubePos(aciCubePos, cci, fTop, aci, TRUE);
 
-        /* loop over rolls */
-
-        for (n0 = 1; n0 <= 6; n0++) {
-            for (n1 = 1; n1 <= n0; n1++) {
-                float w = (n0 == n1) ? 1.0f : 2.0f;
-
-                for (i = 0; i < 25; i++) {
-                    anBoardNew[0][i] = anBoard[0][i];
-                    anBoardNew[1][i] = anBoard[1][i];
-                }
-
-                if (MT_SafeGet(&fInterrupt)) {
-                    errno = EINTR;
-                    return -1;
-                }
-
-                if (usePrune) {
-                    FindBestMoveInEval(nnStates, n0, n1, anBoard, anBoardNew, pciMove, pec);
-                } else {
+        cr.nnStates = nnStates;
+        cr.anBoard = anBoard;
+        cr.aci = aci;
+        cr.cci = 2 * cci;
+        cr.pciMove = pciMove;
+        cr.pec = pec;
+        cr.nPlies = nPlies;
+        cr.usePrune = pec->fUsePrune && pec->rNoise == 0.0f && pciMove->bgv == VARIATION_STANDARD;
+        cr.aarCf = (float *) g_alloca(21 * 2 * cci * sizeof(float));
 
-                    FindBestMovePlied(NULL, n0, n1, anBoardNew, pciMove, pec, 0, defaultFilters);
-                }
-
-                SwapSides(anBoardNew);
-
-                SetCubeInfo(&ciMoveOpp,
-                            pciMove->nCube, pciMove->fCubeOwner,
-                            !pciMove->fMove, pciMove->nMatchTo,
-                            pciMove->anScore, pciMove->fCrawford, pciMove->fJacoby, pciMove->fBeavers, pciMove->bgv);
+        /* loop over rolls */
 
-                /* Evaluate at 0-ply */
-                if (EvaluatePositionCubeful3(nnStates, (ConstTanBoard) anBoardNew,
-                                             ar, arCfTemp, aci, 2 * cci, &ciMoveOpp, pec, nPlies - 1, FALSE))
-                    return -1;
+#if defined(LOCKING_VERSION)
+        cr.fNested = nPlies >= PARALLEL_MIN_PLIES;
+        if (cr.fNested)
+            MT_ParallelFor(21, EvaluateCubefulRoll, &cr);
+        else
+#else
+        cr.fNested = FALSE;
+#endif
+            for (iRoll = 0; iRoll < 21; iRoll++)
+                EvaluateCubefulRoll(&cr, iRoll);
 
-                /* Sum up cubeless winning chances and cubeful equities */
+        /* Sum up cubeless winning chances and cubeful equities, in the
+         * same order whichever threads did the work */
 
-                for (i = 0; i < NUM_OUTPUTS; i++)
-                    arOutput[i] += w *ar[i];
-                for (i = 0; i < 2 * cci; i++)
-                    arCf[i] += w *arCfTemp[i];
+        for (iRoll = 0; iRoll < 21; iRoll++) {
+            int n0, n1;
+            float w;
 
+            if (cr.aiRet[iRoll]) {
+                if (MT_SafeGet(&fInterrupt))
+                    errno = EINTR;
+                return -1;
             }
 
+            RollFromIndex(iRoll, &n0, &n1);
+            w = (n0 == n1) ? 1.0f : 2.0f;
+
+            for (i = 0; i < NUM_OUTPUTS; i++)
+                arOutput[i] += w *cr.aro[iRoll].ar[i];
+            for (i = 0; i < 2 * cci; i++)
+                arCf[i] += w *cr.aarCf[iRoll * 2 * cci + i];
         }
 
         /* Flip evals */
@@ -6287,6 +7344,8 @@ EvaluatePositionCubeful3(NNState * nnStates, const TanBoard anBoard,
 
     int ici;
     int fAll;
+    int nTop = fTop ? EVALKEY_TOP : 0;
+    evalCache *pc = CacheForPlies(nPlies);
     evalcache ec;
 
     if (!cCache || pec->rNoise != 0.0f)
@@ -6300,7 +7359,7 @@ EvaluatePositionCubeful3(NNState * nnStates, const TanBoard anBoard,
 
     /* check cache for existence for earlier calculation */
 
-    fAll = !fTop;               /* FIXME: fTop should be a part of EvalKey */
+    fAll = TRUE;
 
     for (ici = 0; ici < cci && fAll; ++ici) {
 
@@ -6309,9 +7368,9 @@ EvaluatePositionCubeful3(NNState * nnStates, const TanBoard anBoard,
             continue;
         }
 
-        ec.nEvalContext = EvalKey(pec, nPlies, &aciCubePos[ici], TRUE);
+        ec.nEvalContext = EvalKey(pec, nPlies, &aciCubePos[ici], TRUE) ^ nTop;
 
-        if (CacheLookup(&cEval, &ec, arOutput, arCubeful + ici) != CACHEHIT) {
+        if (CacheLookup(pc, &ec, arOutput, arCubeful + ici) != CACHEHIT) {
             fAll = FALSE;
         }
     }
@@ -6327,19 +7386,16 @@ EvaluatePositionCubeful3(NNState * nnStates, const TanBoard anBoard,
 
         /* add to cache */
 
-        if (!fTop) {
+        for (ici = 0; ici < cci; ++ici) {
+            if (aciCubePos[ici].nCube < 0)
+                continue;
 
-            for (ici = 0; ici < cci; ++ici) {
-                if (aciCubePos[ici].nCube < 0)
-                    continue;
-
-                memcpy(ec.ar, arOutput, sizeof(float) * NUM_OUTPUTS);
-                ec.ar[5] = arCubeful[ici];      /* Cubeful equity stored in slot 5 */
-                ec.nEvalContext = EvalKey(pec, nPlies, &aciCubePos[ici], TRUE);
+            memcpy(ec.ar, arOutput, sizeof(float) * NUM_OUTPUTS);
+            ec.ar[5] = arCubeful[ici];  /* Cubeful equity stored in slot 5 */
+            ec.nEvalContext = EvalKey(pec, nPlies, &aciCubePos[ici], TRUE) ^ nTop;
 
-                CacheAdd(&cEval, &ec, GetHashKey(cEval.hashMask, &ec));
+            CacheAdd(pc, &ec, GetHashKey(&ec));
 
-            }
         }
     }
 
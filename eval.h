@@ -295,6 +295,20 @@ typedef struct {
     move *amMoves;
 } movelist;
 
+/* The legal moves of a roll while they are only being scored: what
+ * every move needs, in parallel arrays, without the analysis fields
+ * of move.  The best candidates become full moves when they are kept. */
+typedef struct {
+    unsigned int cMoves;
+    unsigned int cMaxMoves, cMaxPips;
+    int iMoveBest;
+    float rBestScore;
+    positionkey *akey;
+    float *arScore, *arScore2;
+    signed char (*aanMove)[8];
+    unsigned char *acMoves, *acPips;
+} candidatelist;
+
 /* cube efficiencies */
 
 extern float rOSCubeX;
@@ -396,25 +410,48 @@ extern int
 
 extern void EvalCacheFlush(void);
 extern int EvalCacheResize(unsigned int cNew);
-extern int EvalCacheStats(unsigned int *pcUsed, unsigned int *pcLookup, unsigned int *pcHit);
+extern int EvalCacheStats(unsigned int *pcUsed, unsigned int *pcLookup, unsigned int *pcHit,
+                          unsigned int acLookupPly[CACHE_STATS_PLIES], unsigned int acHitPly[CACHE_STATS_PLIES]);
 extern double GetEvalCacheSize(void);
 void SetEvalCacheSize(unsigned int size);
 extern unsigned int GetEvalCacheEntries(void);
 extern int GetCacheMB(int size);
+extern int EvalCacheHugePages(int f);
+extern int fCacheHugePages;
+extern int EvalCacheFile(const char *szFile, unsigned int cEntries);
+extern char *szCacheFile;
+extern void EvalDeterministic(int f);
+extern int fEvalIncremental;
 
 extern evalCache cEval;
 extern evalCache cpEval;
+extern evalCache csEval;
 extern unsigned int cCache;
 
 extern int
  GenerateMoves(movelist * pml, const TanBoard anBoard, int n0, int n1, int fPartial);
 
+extern int
+ GenerateCandidates(candidatelist * pcl, const TanBoard anBoard, int n0, int n1, int fPartial);
+
+extern void CopyCandidates(candidatelist * pclDest, const candidatelist * pclSrc);
+
+extern void FreeCandidates(candidatelist * pcl);
+
+extern int
+ GenerateMovesRecursive(movelist * pml, const TanBoard anBoard, int n0, int n1, int fPartial);
+
 extern int ApplySubMove(TanBoard anBoard, const int iSrc, const int nRoll, const int fCheckLegal);
 
 extern int ApplyMove(TanBoard anBoard, const int anMove[8], const int fCheckLegal);
 
 extern positionclass ClassifyPosition(const TanBoard anBoard, const bgvariation bgv);
 
+extern int EvaluatePositionsBatch(const TanBoard aanBoard[], unsigned int cBoards, float aarOutput[][NUM_OUTPUTS],
+                                  const positionclass pc, const bgvariation bgv, NNState * nnStates);
+
+extern void CalculateInputs(const positionclass pc, const TanBoard anBoard, float arInput[]);
+
 /* internal use only */
 extern void EvalRaceBG(const TanBoard anBoard, float arOutput[], const bgvariation bgv);
 
@@ -509,6 +546,9 @@ extern void
 
 EXP_LOCK_FUN(int, ScoreMove, NNState * nnStates, move * pm, const cubeinfo * pci, const evalcontext * pec, int nPlies);
 
+EXP_LOCK_FUN(void, EvalCacheMoves, const TanBoard aanBoard[], const unsigned int aanDice[][2], const cubeinfo aci[],
+             unsigned int c);
+
 extern void
  CopyMoveList(movelist * pmlDest, const movelist * pmlSrc);
 
@@ -549,4 +589,18 @@ extern int EvaluatePerfectCubeful(const TanBoard anBoard, float arEquity[], cons
 extern neuralnet nnContact, nnRace, nnCrashed;
 extern neuralnet nnpContact, nnpRace, nnpCrashed;
 
+/* The nets in a fixed order; each half follows positionclass from
+ * CLASS_RACE */
+typedef enum {
+    NET_RACE,
+    NET_CRASHED,
+    NET_CONTACT,
+    NET_PRUNING_RACE,
+    NET_PRUNING_CRASHED,
+    NET_PRUNING_CONTACT,
+    NUM_NETS
+} netid;
+
+extern neuralnet *const apnnEval[NUM_NETS];
+
 #endif
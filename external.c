@@ -45,6 +45,8 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/un.h>
+#include <sys/select.h>
+#include <fcntl.h>
 #endif                          /* #if HAVE_SYS_SOCKET_H */
 
 #else                           /* #ifndef WIN32 */
@@ -118,9 +120,18 @@
 #include "rollout.h"
 #include "eval.h"
 #include "matchid.h"
+#include "matchequity.h"
+#include "positionid.h"
 #include "multithread.h"
 #include "lib/gnubg-types.h"
 
+/* see "set external" */
+int fExternalServer = FALSE;
+int nExternalInFlight = 64;
+int nExternalQueue = 256;
+int nExternalLineLength = 4096;
+int nExternalOutput = 1 << 20;
+
 #if HAVE_SOCKETS
 
 #ifdef WIN32
@@ -330,6 +341,8 @@ unset_scan_context(scancontext * pScanCtx, int bFreeScanner)
     pScanCtx->fError = 0;
 
     if (bFreeScanner) {
+        g_free(pScanCtx->szTag);
+        pScanCtx->szTag = NULL;
         ExtDestroyParse(pScanCtx->scanner);
         pScanCtx->scanner = NULL;
     }
@@ -351,11 +364,34 @@ ExtParse(scancontext * scanctx, const char *szCommand)
     scanctx->ExtErrorHandler = ErrorHandler;
     scanctx->fError = FALSE;
     scanctx->szError = NULL;
+    g_free(scanctx->szTag);
+    scanctx->szTag = NULL;
 
     ExtStartParse(scanctx->scanner, szCommand);
     return scanctx->fError ? NULL : scanctx;
 }
 
+/* sz with each of its lines prefixed by the tag of the request */
+static char *
+ExtTagResponse(const char *szTag, const char *sz)
+{
+    GString *gs = g_string_new(NULL);
+    const char *pch;
+
+    while (*sz) {
+        pch = strchr(sz, '\n');
+        g_string_append_printf(gs, "#%s ", szTag);
+        if (!pch) {
+            g_string_append(gs, sz);
+            break;
+        }
+        g_string_append_len(gs, sz, pch - sz + 1);
+        sz = pch + 1;
+    }
+
+    return g_string_free(gs, FALSE);
+}
+
 static char *
 ExtEvaluation(scancontext * pec)
 {
@@ -563,6 +599,832 @@ ExtFIBSBoard(scancontext * pec)
 
     return szResponse;
 }
+
+/* Append the debug description of the board in pec to gs */
+static void
+ExtDebugBoard(GString * gs, scancontext * pec)
+{
+    ProcessedFIBSBoard processedBoard;
+    GValue *optionsmapgv;
+    GValue *boarddatagv;
+    int anScore[2];
+    int fcrawford, fjacoby;
+    char *asz[7] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    char szBoard[10000];
+    char **aszLines, **aszLinesOrig;
+    char *szMatchID;
+
+    optionsmapgv = (GValue *) g_list_nth_data(g_value_get_boxed(pec->pCmdData), 1);
+    boarddatagv = (GValue *) g_list_nth_data(g_value_get_boxed(pec->pCmdData), 0);
+    g_string_append(gs, DEBUG_PREFIX);
+    g_value_tostring(gs, optionsmapgv, 0);
+    g_string_append(gs, "\n" DEBUG_PREFIX);
+    g_value_tostring(gs, boarddatagv, 0);
+    g_string_append(gs, "\n" DEBUG_PREFIX "\n");
+    ProcessFIBSBoardInfo(&pec->bi, &processedBoard);
+
+    anScore[0] = processedBoard.nScoreOpp;
+    anScore[1] = processedBoard.nScore;
+    /* If the session isn't using Crawford rule, set Crawford flag to false */
+    fcrawford = pec->fCrawfordRule ? processedBoard.fCrawford : FALSE;
+    /* Set the Jacoby flag appropriately from the external interface settings */
+    fjacoby = pec->fJacobyRule;
+
+    szMatchID = MatchID((unsigned int *) processedBoard.anDice, 1, processedBoard.nResignation,
+                        processedBoard.fDoubled, 1, processedBoard.fCubeOwner, fcrawford,
+                        processedBoard.nMatchTo, anScore, processedBoard.nCube, fjacoby, GAME_PLAYING);
+
+    DrawBoard(szBoard, (ConstTanBoard) & processedBoard.anBoard, 1, asz, szMatchID, 15);
+
+    aszLines = g_strsplit(&szBoard[0], "\n", 32);
+    aszLinesOrig = aszLines;
+    while (*aszLines) {
+        g_string_append_printf(gs, DEBUG_PREFIX "%s\n", *aszLines);
+        aszLines++;
+    }
+
+    g_string_append_printf(gs, DEBUG_PREFIX "X is %s, O is %s\n", processedBoard.szPlayer, processedBoard.szOpp);
+    if (processedBoard.nMatchTo) {
+        g_string_append_printf(gs, DEBUG_PREFIX "Match Play %s Crawford Rule\n",
+                               pec->fCrawfordRule ? "with" : "without");
+        g_string_append_printf(gs, DEBUG_PREFIX "Score: %d-%d/%d%s, ", processedBoard.nScore,
+                               processedBoard.nScoreOpp, processedBoard.nMatchTo, fcrawford ? "*" : "");
+    } else {
+        g_string_append_printf(gs, DEBUG_PREFIX "Money Session %s Jacoby Rule, %s Beavers\n",
+                               pec->fJacobyRule ? "with" : "without", pec->fBeavers ? "with" : "without");
+        g_string_append_printf(gs, DEBUG_PREFIX "Score: %d-%d, ", processedBoard.nScore, processedBoard.nScoreOpp);
+    }
+    g_string_append_printf(gs, "Roll: %d%d\n", processedBoard.anDice[0], processedBoard.anDice[1]);
+    g_string_append_printf(gs,
+                           DEBUG_PREFIX
+                           "CubeOwner: %d, Cube: %d, Turn: %c, Doubled: %d, Resignation: %d\n",
+                           processedBoard.fCubeOwner, processedBoard.nCube, 'X',
+                           processedBoard.fDoubled, processedBoard.nResignation);
+    g_string_append(gs, DEBUG_PREFIX "\n");
+
+    g_strfreev(aszLinesOrig);
+}
+
+/*
+ * The concurrent server ("set external server on").  The main thread
+ * accepts connections, reads and parses their requests and writes the
+ * answers; evaluations and FIBS board decisions run as tasks on the
+ * worker pool.  All connections share the evaluation cache of this
+ * process.  Answers are sent back to each client in the order of its
+ * requests.
+ *
+ * Nothing a client sends or fails to read grows without bound: a
+ * connection is not read from while it has nExternalQueue requests
+ * unanswered or nExternalOutput bytes of answers unsent, and text lines
+ * longer than nExternalLineLength are answered with an error and
+ * dropped.
+ */
+
+typedef struct extserver extserver;
+typedef struct extconnection extconnection;
+
+typedef struct {
+    extserver *pxs;
+    extconnection *pxc;
+    scancontext sc;             /* copy of the parsed request */
+    char *szTag;
+    char *szDebug;
+    char *szResponse;
+    int fDone;
+    int fUnordered;             /* answered as soon as it is done */
+
+    /* binary requests */
+    int fBinary;
+    guint32 nTag;
+    positionkey key;
+    cubeinfo ci;
+    evalcontext ec;
+    extstatus status;
+    float arOutput[NUM_ROLLOUT_OUTPUTS];
+} extrequest;
+
+/* Requests are handed to the workers in groups of up to this many */
+#define EXT_TASK_REQUESTS 32
+
+typedef struct {
+    unsigned int c;
+    extrequest *apxr[EXT_TASK_REQUESTS];
+} exttask;
+
+struct extconnection {
+    int h;
+    scancontext scanctx;
+    GString *gsIn;
+    GString *gsOut;
+    GQueue *pqRequests;         /* in the order they are answered */
+    int cUnordered;             /* unordered requests with a worker */
+    int fUnordered;             /* client sent "set ordered off" */
+    int fNegotiated;            /* text or binary, from the first bytes */
+    int fBinary;
+    int fSkipLine;              /* dropping the rest of a long line */
+    int fExit;                  /* client sent "exit" */
+    int fGone;                  /* client closed the connection; read by
+                                 * the workers, so only through MT_Safe */
+};
+
+struct extserver {
+    int h;
+    GList *plConnections;
+    GQueue *pqWaiting;          /* not yet handed to a worker */
+    GAsyncQueue *paqDone;       /* handed back by the workers */
+    int cInFlight;
+#ifndef WIN32
+    int afdWake[2];             /* the workers wake select() through this */
+#endif
+};
+
+static int
+ExtSetNonBlocking(int h)
+{
+#ifdef WIN32
+    u_long f = 1;
+
+    return ioctlsocket((SOCKET) h, FIONBIO, &f);
+#else
+    int f = fcntl(h, F_GETFL, 0);
+
+    return f < 0 ? -1 : fcntl(h, F_SETFL, f | O_NONBLOCK);
+#endif
+}
+
+/* TRUE if the last socket call failed only for the moment */
+static int
+ExtRetry(void)
+{
+#ifdef WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static guint32
+ExtGetWord(const char *pch)
+{
+    guint32 n;
+
+    memcpy(&n, pch, sizeof(n));
+    return GUINT32_FROM_LE(n);
+}
+
+static void
+ExtPutWord(GString * gs, guint32 n)
+{
+    n = GUINT32_TO_LE(n);
+    g_string_append_len(gs, (const char *) &n, sizeof(n));
+}
+
+static void
+ExtBinaryEvaluation(extrequest * pxr)
+{
+    TanBoard anBoard;
+
+    PositionFromKey(anBoard, &pxr->key);
+
+    if (GeneralEvaluationE(pxr->arOutput, (ConstTanBoard) anBoard, &pxr->ci, &pxr->ec))
+        pxr->status = EXT_STATUS_FAILED;
+}
+
+static void
+ExtServeRequests(void *p)
+{
+    exttask *ptask = (exttask *) p;
+    extserver *pxs = ptask->apxr[0]->pxs;
+    unsigned int i;
+
+    for (i = 0; i < ptask->c; i++) {
+        extrequest *pxr = ptask->apxr[i];
+
+        if (MT_SafeGet(&pxr->pxc->fGone))
+            ;                   /* nobody to answer */
+        else if (pxr->fBinary)
+            ExtBinaryEvaluation(pxr);
+        else if (pxr->sc.ct == COMMAND_EVALUATION)
+            pxr->szResponse = ExtEvaluation(&pxr->sc);
+        else
+            pxr->szResponse = ExtFIBSBoard(&pxr->sc);
+
+        g_async_queue_push(pxs->paqDone, pxr);
+    }
+    g_free(ptask);
+
+#ifndef WIN32
+    if (write(pxs->afdWake[1], "", 1) < 0) {
+        /* the pipe is full, select() will wake anyway */
+    }
+#endif
+}
+
+static void
+ExtFreeRequest(extrequest * pxr)
+{
+    if (pxr->sc.bi.gsName)
+        g_string_free(pxr->sc.bi.gsName, TRUE);
+    if (pxr->sc.bi.gsOpp)
+        g_string_free(pxr->sc.bi.gsOpp, TRUE);
+    g_free(pxr->szTag);
+    g_free(pxr->szDebug);
+    g_free(pxr->szResponse);
+    g_free(pxr);
+}
+
+/* Queue the answer to pxr for sending and free it */
+static void
+ExtServeAnswer(extconnection * pxc, extrequest * pxr)
+{
+    if (pxr->fBinary) {
+        unsigned int i;
+
+        ExtPutWord(pxc->gsOut, EXT_BINARY_RESPONSE_SIZE);
+        ExtPutWord(pxc->gsOut, pxr->nTag);
+        ExtPutWord(pxc->gsOut, (guint32) pxr->status);
+        for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++) {
+            guint32 n;
+
+            memcpy(&n, &pxr->arOutput[i], sizeof(n));
+            ExtPutWord(pxc->gsOut, n);
+        }
+        ExtFreeRequest(pxr);
+        return;
+    }
+
+    if (pxr->szDebug)
+        g_string_append(pxc->gsOut, pxr->szDebug);
+    if (pxr->szResponse && pxr->szTag) {
+        char *sz = ExtTagResponse(pxr->szTag, pxr->szResponse);
+
+        g_string_append(pxc->gsOut, sz);
+        g_free(sz);
+    } else if (pxr->szResponse)
+        g_string_append(pxc->gsOut, pxr->szResponse);
+
+    ExtFreeRequest(pxr);
+}
+
+/* TRUE if more requests may be taken from pxc */
+static int
+ExtServeRoom(extconnection * pxc)
+{
+    return !pxc->fExit && !MT_SafeGet(&pxc->fGone)
+        && (int) g_queue_get_length(pxc->pqRequests) + pxc->cUnordered < nExternalQueue
+        && pxc->gsOut->len < (gsize) nExternalOutput;
+}
+
+/* Queue pxr for a worker if it still needs one, and for its answer */
+static void
+ExtServeQueue(extserver * pxs, extconnection * pxc, extrequest * pxr)
+{
+    if (!pxr->fDone) {
+        g_queue_push_tail(pxs->pqWaiting, pxr);
+        if (pxc->fUnordered) {
+            pxr->fUnordered = TRUE;
+            pxc->cUnordered++;
+            return;
+        }
+    }
+
+    g_queue_push_tail(pxc->pqRequests, pxr);
+}
+
+/* Handle one line from a client; the answer is queued on the connection */
+static void
+ExtServeLine(extserver * pxs, extconnection * pxc, const char *szCommand)
+{
+    scancontext *pec = &pxc->scanctx;
+    extrequest *pxr = g_malloc0(sizeof(extrequest));
+    gchar *szOptStr;
+
+    pxr->pxs = pxs;
+    pxr->pxc = pxc;
+    pxr->fDone = TRUE;
+
+    if ((ExtParse(pec, szCommand)) == 0) {
+        /* parse error */
+        pxr->szTag = pec->szTag;
+        pec->szTag = NULL;
+        pxr->szResponse = pec->szError;
+        pec->szError = NULL;
+        unset_scan_context(pec, FALSE);
+        ExtServeQueue(pxs, pxc, pxr);
+        return;
+    }
+
+    pxr->szTag = pec->szTag;
+    pec->szTag = NULL;
+
+    switch (pec->ct) {
+    case COMMAND_HELP:
+        pxr->szResponse = g_strdup("\tNo help information available\n");
+        break;
+
+    case COMMAND_SET:
+        szOptStr = g_value_get_gstring_gchar(g_list_nth_data(pec->pCmdData, 0));
+        if (g_ascii_strcasecmp(szOptStr, KEY_STR_DEBUG) == 0) {
+            pec->fDebug = g_value_get_int(g_list_nth_data(pec->pCmdData, 1));
+            pxr->szResponse = g_strdup_printf("Debug output %s\n", pec->fDebug ? "ON" : "OFF");
+        } else if (g_ascii_strcasecmp(szOptStr, KEY_STR_NEWINTERFACE) == 0) {
+            pec->fNewInterface = g_value_get_int(g_list_nth_data(pec->pCmdData, 1));
+            pxr->szResponse = g_strdup_printf("New interface %s\n", pec->fNewInterface ? "ON" : "OFF");
+        } else if (g_ascii_strcasecmp(szOptStr, KEY_STR_ORDERED) == 0) {
+            pxc->fUnordered = !g_value_get_int(g_list_nth_data(pec->pCmdData, 1));
+            pxr->szResponse = g_strdup_printf("Ordered answers %s\n", pxc->fUnordered ? "OFF" : "ON");
+        } else {
+            pxr->szResponse = g_strdup_printf("Error: set option '%s' not supported\n", szOptStr);
+        }
+        g_list_gv_boxed_free(pec->pCmdData);
+        break;
+
+    case COMMAND_VERSION:
+        pxr->szResponse = g_strdup("Interface: " EXTERNAL_INTERFACE_VERSION "\n"
+                                   "RFBF: " RFBF_VERSION_SUPPORTED "\n"
+                                   "Engine: " WEIGHTS_VERSION "\n" "Software: " VERSION "\n");
+        break;
+
+    case COMMAND_NONE:
+        pxr->szResponse = g_strdup("Error: no command given\n");
+        break;
+
+    case COMMAND_FIBSBOARD:
+    case COMMAND_EVALUATION:
+        if (pec->fDebug) {
+            GString *gs = g_string_new(NULL);
+
+            ExtDebugBoard(gs, pec);
+            pxr->szDebug = g_string_free(gs, FALSE);
+        }
+        g_value_unsetfree(pec->pCmdData);
+
+        /* the request takes over the player names */
+        pxr->sc = *pec;
+        pec->bi.gsName = NULL;
+        pec->bi.gsOpp = NULL;
+
+        if (pec->ct == COMMAND_FIBSBOARD && GetEvalCube()->et == EVAL_ROLLOUT)
+            /* rollouts use the worker pool themselves, and would hold up
+             * every other client */
+            pxr->szResponse = g_strdup("Error: the external server does not roll out; "
+                                       "use an evaluation for cube decisions\n");
+        else
+            pxr->fDone = FALSE;
+        break;
+
+    case COMMAND_EXIT:
+        pxc->fExit = TRUE;
+        break;
+
+    default:
+        pxr->szResponse = g_strdup("Unsupported Command\n");
+    }
+
+    unset_scan_context(pec, FALSE);
+    ExtServeQueue(pxs, pxc, pxr);
+}
+
+/* Decode the binary request at pch */
+static void
+ExtServeFrame(extserver * pxs, extconnection * pxc, const char *pch)
+{
+    extrequest *pxr = g_malloc0(sizeof(extrequest));
+    guint32 an[EXT_BINARY_REQUEST_SIZE / 4];
+    int anScore[2];
+    TanBoard anBoard;
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(an); i++)
+        an[i] = ExtGetWord(pch + 4 * i);
+
+    pxr->pxs = pxs;
+    pxr->pxc = pxc;
+    pxr->fBinary = TRUE;
+    pxr->nTag = an[0];
+    for (i = 0; i < 7; i++)
+        pxr->key.data[i] = an[1 + i];
+
+    anScore[0] = (int) an[11];
+    anScore[1] = (int) an[12];
+
+    pxr->ec.fCubeful = an[16] != 0;
+    pxr->ec.nPlies = an[17] & 0xf;
+    pxr->ec.fUsePrune = an[18] != 0;
+    pxr->ec.fDeterministic = an[19] != 0;
+    memcpy(&pxr->ec.rNoise, &an[20], sizeof(float));
+
+    PositionFromKey(anBoard, &pxr->key);
+
+    /* SetCubeInfo() does not check what would overrun its tables */
+    if (!CheckPosition((ConstTanBoard) anBoard) || an[17] > 7
+        || (int) an[8] < 1 || (int) an[8] > (1 << (MAXCUBELEVEL - 1)) || (an[8] & (an[8] - 1))
+        || (int) an[10] < 0 || (int) an[10] > MAXSCORE || anScore[0] < 0 || anScore[1] < 0
+        || SetCubeInfo(&pxr->ci, (int) an[8], (int) an[9], 1, (int) an[10], anScore,
+                       an[13] != 0, an[14] != 0, an[15] != 0, bgvDefault) < 0) {
+        pxr->status = EXT_STATUS_BADREQUEST;
+        pxr->fDone = TRUE;
+    }
+
+    ExtServeQueue(pxs, pxc, pxr);
+}
+
+/* Answer the binary hello at the start of pxc's input */
+static void
+ExtServeHello(extconnection * pxc)
+{
+    char achHello[EXT_BINARY_HELLO_SIZE];
+
+    memcpy(achHello, pxc->gsIn->str, sizeof(achHello));
+    g_string_erase(pxc->gsIn, 0, sizeof(achHello));
+
+    if (memcmp(achHello, EXT_BINARY_HELLO, sizeof(EXT_BINARY_HELLO) - 1) || achHello[6] != EXT_BINARY_VERSION) {
+        achHello[6] = 0;
+        pxc->fExit = TRUE;
+    } else {
+        achHello[7] &= EXT_BINARY_UNORDERED;
+        pxc->fBinary = TRUE;
+        pxc->fUnordered = achHello[7] & EXT_BINARY_UNORDERED;
+    }
+
+    g_string_append_len(pxc->gsOut, achHello, sizeof(achHello));
+}
+
+/* Decode the complete frames read from pxc while the queue has room */
+static void
+ExtServeFrames(extserver * pxs, extconnection * pxc)
+{
+    const char *pch = pxc->gsIn->str;
+    const char *pchEnd = pxc->gsIn->str + pxc->gsIn->len;
+
+    while (ExtServeRoom(pxc) && pchEnd - pch >= 4) {
+        guint32 cb = ExtGetWord(pch);
+
+        if (cb != EXT_BINARY_REQUEST_SIZE) {
+            outputl(_("Malformed binary request on external connection."));
+            pxc->fExit = TRUE;
+            break;
+        }
+        if (pchEnd - pch < 4 + (ptrdiff_t) cb)
+            break;
+
+        ExtServeFrame(pxs, pxc, pch + 4);
+        pch += 4 + cb;
+    }
+
+    g_string_erase(pxc->gsIn, 0, pch - pxc->gsIn->str);
+}
+
+/* Answer a line that is too long, in its turn */
+static void
+ExtServeLongLine(extserver * pxs, extconnection * pxc)
+{
+    extrequest *pxr = g_malloc0(sizeof(extrequest));
+
+    pxr->pxs = pxs;
+    pxr->pxc = pxc;
+    pxr->fDone = TRUE;
+    pxr->szResponse = g_strdup_printf("Error: line longer than %d characters\n", nExternalLineLength);
+    ExtServeQueue(pxs, pxc, pxr);
+}
+
+/* Parse the complete lines or frames read from pxc while it has room */
+static void
+ExtServeInput(extserver * pxs, extconnection * pxc)
+{
+    char *pchLine;
+    char *pchEnd;
+    char *pch = NULL;
+
+    if (!pxc->fNegotiated) {
+        /* binary clients start with a NUL that no text line has */
+        if (!pxc->gsIn->len || (pxc->gsIn->str[0] == '\0' && pxc->gsIn->len < EXT_BINARY_HELLO_SIZE))
+            return;
+        pxc->fNegotiated = TRUE;
+        if (pxc->gsIn->str[0] == '\0')
+            ExtServeHello(pxc);
+    }
+
+    if (pxc->fBinary) {
+        ExtServeFrames(pxs, pxc);
+        return;
+    }
+
+    pchLine = pxc->gsIn->str;
+    pchEnd = pxc->gsIn->str + pxc->gsIn->len;
+
+    if (pxc->fSkipLine) {
+        if (!(pch = memchr(pchLine, '\n', (size_t) (pchEnd - pchLine)))) {
+            g_string_truncate(pxc->gsIn, 0);
+            return;
+        }
+        pxc->fSkipLine = FALSE;
+        pchLine = pch + 1;
+    }
+
+    while (ExtServeRoom(pxc) && (pch = memchr(pchLine, '\n', (size_t) (pchEnd - pchLine)))) {
+        if (pch - pchLine > nExternalLineLength)
+            ExtServeLongLine(pxs, pxc);
+        else {
+            /* the lexer wants the terminating \n */
+            gchar *szCommand = g_strndup(pchLine, (gsize) (pch - pchLine) + 1);
+
+            ExtServeLine(pxs, pxc, szCommand);
+            g_free(szCommand);
+        }
+        pchLine = pch + 1;
+    }
+
+    if (!pch && pchEnd - pchLine > nExternalLineLength && ExtServeRoom(pxc)) {
+        /* no end in sight; drop it up to its \n */
+        ExtServeLongLine(pxs, pxc);
+        pxc->fSkipLine = TRUE;
+        pchLine = pchEnd;
+    }
+
+    g_string_erase(pxc->gsIn, 0, pchLine - pxc->gsIn->str);
+}
+
+/* Hand waiting requests to the workers, several to a task when many wait */
+static void
+ExtServeDispatch(extserver * pxs)
+{
+    while (pxs->cInFlight < nExternalInFlight && !g_queue_is_empty(pxs->pqWaiting)) {
+        unsigned int c = g_queue_get_length(pxs->pqWaiting) / MT_GetNumThreads();
+        exttask *ptask = g_malloc(sizeof(exttask));
+
+        c = CLAMP(c, 1, EXT_TASK_REQUESTS);
+        c = MIN(c, (unsigned int) (nExternalInFlight - pxs->cInFlight));
+        for (ptask->c = 0; ptask->c < c; ptask->c++)
+            ptask->apxr[ptask->c] = g_queue_pop_head(pxs->pqWaiting);
+        pxs->cInFlight += (int) c;
+
+#if defined(USE_MULTITHREAD)
+        mt_add_tasks(1, ExtServeRequests, ptask, NULL);
+#else
+        ExtServeRequests(ptask);
+#endif
+    }
+}
+
+/* Collect finished requests and queue the answers that are next in line */
+static void
+ExtServeCollect(extserver * pxs)
+{
+    extrequest *pxr;
+    GList *pl;
+
+    while ((pxr = g_async_queue_try_pop(pxs->paqDone)) != NULL) {
+        pxs->cInFlight--;
+        if (pxr->fUnordered) {
+            pxr->pxc->cUnordered--;
+            ExtServeAnswer(pxr->pxc, pxr);
+        } else
+            pxr->fDone = TRUE;
+    }
+
+    for (pl = pxs->plConnections; pl; pl = pl->next) {
+        extconnection *pxc = pl->data;
+
+        while ((pxr = g_queue_peek_head(pxc->pqRequests)) != NULL && pxr->fDone)
+            ExtServeAnswer(pxc, g_queue_pop_head(pxc->pqRequests));
+    }
+}
+
+static void
+ExtServeAccept(extserver * pxs)
+{
+    struct sockaddr_in saRemote;
+    socklen_t saLen = sizeof(saRemote);
+    extconnection *pxc;
+    int hPeer;
+
+    if ((hPeer = accept(pxs->h, (struct sockaddr *) &saRemote, &saLen)) < 0) {
+        if (!ExtRetry())
+            SockErr("accept");
+        return;
+    }
+#ifndef WIN32
+    if (hPeer >= FD_SETSIZE) {
+        outputf(_("Refused connection from %s: too many connections.\n"), inet_ntoa(saRemote.sin_addr));
+        closesocket(hPeer);
+        return;
+    }
+#endif
+    if (ExtSetNonBlocking(hPeer) < 0) {
+        SockErr("accept");
+        closesocket(hPeer);
+        return;
+    }
+
+    pxc = g_malloc0(sizeof(extconnection));
+    pxc->h = hPeer;
+    ExtInitParse(&pxc->scanctx.scanner);
+    pxc->gsIn = g_string_new(NULL);
+    pxc->gsOut = g_string_new(NULL);
+    pxc->pqRequests = g_queue_new();
+    pxs->plConnections = g_list_append(pxs->plConnections, pxc);
+
+    outputf(_("Accepted connection from %s.\n"), inet_ntoa(saRemote.sin_addr));
+    outputx();
+}
+
+static void
+ExtServeRead(extconnection * pxc)
+{
+    char ach[65536];
+#ifdef WIN32
+    int n = recv((SOCKET) pxc->h, ach, sizeof(ach), 0);
+#else
+    ssize_t n = recv(pxc->h, ach, sizeof(ach), 0);
+#endif
+
+    if (n > 0)
+        g_string_append_len(pxc->gsIn, ach, (gssize) n);
+    else if (n == 0 || !ExtRetry())
+        MT_SafeSet(&pxc->fGone, TRUE);
+}
+
+static void
+ExtServeWrite(extconnection * pxc)
+{
+#ifdef WIN32
+    int n = send((SOCKET) pxc->h, pxc->gsOut->str, (int) pxc->gsOut->len, 0);
+#else
+    ssize_t n = send(pxc->h, pxc->gsOut->str, pxc->gsOut->len, 0);
+#endif
+
+    if (n > 0)
+        g_string_erase(pxc->gsOut, 0, (gssize) n);
+    else if (!ExtRetry())
+        MT_SafeSet(&pxc->fGone, TRUE);
+}
+
+/* Close pxc once nothing is left to do for it; TRUE if it was closed */
+static int
+ExtServeClose(extconnection * pxc)
+{
+    if (pxc->cUnordered
+        || (!MT_SafeGet(&pxc->fGone) && !(pxc->fExit && g_queue_is_empty(pxc->pqRequests) && !pxc->gsOut->len)))
+        return FALSE;
+
+    if (MT_SafeGet(&pxc->fGone)) {
+        /* answers that can no longer be sent; requests still with a
+         * worker are freed when they come back */
+        extrequest *pxr;
+        GQueue *pq = g_queue_new();
+
+        while ((pxr = g_queue_pop_head(pxc->pqRequests)) != NULL)
+            if (pxr->fDone)
+                ExtFreeRequest(pxr);
+            else
+                g_queue_push_tail(pq, pxr);
+
+        g_queue_free(pxc->pqRequests);
+        pxc->pqRequests = pq;
+
+        if (!g_queue_is_empty(pq))
+            return FALSE;
+    }
+
+    closesocket(pxc->h);
+    unset_scan_context(&pxc->scanctx, TRUE);
+    g_string_free(pxc->gsIn, TRUE);
+    g_string_free(pxc->gsOut, TRUE);
+    g_queue_free(pxc->pqRequests);
+    g_free(pxc);
+
+    outputl(_("External connection closed."));
+    return TRUE;
+}
+
+static void
+ExternalServe(int h)
+{
+    extserver xs;
+    int fStop = FALSE;
+#ifndef WIN32
+    psighandler sh;
+#endif
+
+    memset(&xs, 0, sizeof(xs));
+    xs.h = h;
+    xs.pqWaiting = g_queue_new();
+    xs.paqDone = g_async_queue_new();
+
+#ifndef WIN32
+    if (pipe(xs.afdWake) < 0) {
+        outputerr("pipe");
+        g_queue_free(xs.pqWaiting);
+        g_async_queue_unref(xs.paqDone);
+        return;
+    }
+    fcntl(xs.afdWake[1], F_SETFL, O_NONBLOCK);
+    PortableSignal(SIGPIPE, SIG_IGN, &sh, FALSE);
+#endif
+    ExtSetNonBlocking(h);
+
+    while (!fStop || xs.cInFlight || xs.plConnections) {
+        fd_set fdsRead, fdsWrite;
+        struct timeval tv;
+        int hMax = h;
+        GList *pl, *plNext;
+
+        if (!fStop) {
+            for (pl = xs.plConnections; pl; pl = pl->next)
+                ExtServeInput(&xs, pl->data);
+            ExtServeDispatch(&xs);
+        } else {
+            extrequest *pxr;
+
+            /* drop the requests that have not reached a worker */
+            while ((pxr = g_queue_pop_head(xs.pqWaiting)) != NULL)
+                if (pxr->fUnordered) {
+                    pxr->pxc->cUnordered--;
+                    ExtFreeRequest(pxr);
+                } else
+                    pxr->fDone = TRUE;
+        }
+        ExtServeCollect(&xs);
+
+        FD_ZERO(&fdsRead);
+        FD_ZERO(&fdsWrite);
+        if (!fStop)
+            FD_SET(h, &fdsRead);
+#ifndef WIN32
+        FD_SET(xs.afdWake[0], &fdsRead);
+        hMax = MAX(hMax, xs.afdWake[0]);
+#endif
+        for (pl = xs.plConnections; pl; pl = pl->next) {
+            extconnection *pxc = pl->data;
+
+            if (MT_SafeGet(&pxc->fGone))
+                continue;
+            if (!fStop && ExtServeRoom(pxc))
+                FD_SET(pxc->h, &fdsRead);
+            if (pxc->gsOut->len)
+                FD_SET(pxc->h, &fdsWrite);
+            hMax = MAX(hMax, pxc->h);
+        }
+
+        tv.tv_sec = 0;
+#ifdef WIN32
+        /* nothing wakes select() when a worker finishes */
+        tv.tv_usec = xs.cInFlight ? 1000 : UI_UPDATETIME * 1000;
+#else
+        tv.tv_usec = UI_UPDATETIME * 1000;
+#endif
+        if (select(hMax + 1, &fdsRead, &fdsWrite, NULL, &tv) < 0) {
+            if (!ExtRetry()) {
+                SockErr("select");
+                fStop = TRUE;
+            }
+            FD_ZERO(&fdsRead);
+            FD_ZERO(&fdsWrite);
+        }
+#ifndef WIN32
+        if (FD_ISSET(xs.afdWake[0], &fdsRead)) {
+            char ach[256];
+
+            if (read(xs.afdWake[0], ach, sizeof(ach)) < 0) {
+                /* nothing to drain */
+            }
+        }
+#endif
+        if (FD_ISSET(h, &fdsRead))
+            ExtServeAccept(&xs);
+
+        for (pl = xs.plConnections; pl; pl = plNext) {
+            extconnection *pxc = pl->data;
+
+            plNext = pl->next;
+            if (FD_ISSET(pxc->h, &fdsRead))
+                ExtServeRead(pxc);
+            if (FD_ISSET(pxc->h, &fdsWrite))
+                ExtServeWrite(pxc);
+            if (fStop)
+                MT_SafeSet(&pxc->fGone, TRUE);
+            if (ExtServeClose(pxc))
+                xs.plConnections = g_list_delete_link(xs.plConnections, pl);
+        }
+
+        ProcessEvents();
+        if (MT_SafeGet(&fInterrupt))
+            fStop = TRUE;
+    }
+
+    g_queue_free(xs.pqWaiting);
+    g_async_queue_unref(xs.paqDone);
+#ifndef WIN32
+    PortableSignalRestore(SIGPIPE, &sh);
+    close(xs.afdWake[0]);
+    close(xs.afdWake[1]);
+#endif
+#if defined(USE_MULTITHREAD)
+    /* all our tasks are done; this resets the task counters */
+    MT_WaitForTasks(NULL, 0, FALSE);
+#endif
+}
 #endif
 
 extern void
@@ -618,6 +1480,19 @@ CommandExternal(char *sz)
 
         g_free(psa);
 
+        if (fExternalServer) {
+            if (listen(h, SOMAXCONN) < 0)
+                SockErr("listen");
+            else {
+                outputf(_("Serving external connections from %s...\n"), sz);
+                outputx();
+                ExternalServe(h);
+            }
+            closesocket(h);
+            ExtDestroyParse(scanctx.scanner);
+            return;
+        }
+
         if (listen(h, 1) < 0) {
             SockErr("listen");
             closesocket(h);
@@ -666,7 +1541,6 @@ CommandExternal(char *sz)
                 /* parse error */
                 szResponse = scanctx.szError;
             } else {
-                ProcessedFIBSBoard processedBoard;
                 gchar *szOptStr;
 
                 switch (scanctx.ct) {
@@ -682,6 +1556,12 @@ CommandExternal(char *sz)
                     } else if (g_ascii_strcasecmp(szOptStr, KEY_STR_NEWINTERFACE) == 0) {
                         scanctx.fNewInterface = g_value_get_int(g_list_nth_data(scanctx.pCmdData, 1));
                         szResponse = g_strdup_printf("New interface %s\n", scanctx.fNewInterface ? "ON" : "OFF");
+                    } else if (g_ascii_strcasecmp(szOptStr, KEY_STR_ORDERED) == 0) {
+                        /* one request at a time is always in order */
+                        if (g_value_get_int(g_list_nth_data(scanctx.pCmdData, 1)))
+                            szResponse = g_strdup("Ordered answers ON\n");
+                        else
+                            szResponse = g_strdup("Error: unordered answers need \"set external server on\"\n");
                     } else {
                         szResponse = g_strdup_printf("Error: set option '%s' not supported\n", szOptStr);
                     }
@@ -703,77 +1583,11 @@ CommandExternal(char *sz)
                 case COMMAND_FIBSBOARD:
                 case COMMAND_EVALUATION:
                     if (scanctx.fDebug) {
-                        GValue *optionsmapgv;
-                        GValue *boarddatagv;
-                        GString *dbgStr;
-                        int anScore[2];
-                        int fcrawford, fjacoby;
-                        char *asz[7] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
-                        char szBoard[10000];
-                        char **aszLines, **aszLinesOrig;
-                        char *szMatchID;
-
-                        optionsmapgv = (GValue *) g_list_nth_data(g_value_get_boxed(scanctx.pCmdData), 1);
-                        boarddatagv = (GValue *) g_list_nth_data(g_value_get_boxed(scanctx.pCmdData), 0);
-                        dbgStr = g_string_new(DEBUG_PREFIX);
-                        g_value_tostring(dbgStr, optionsmapgv, 0);
-                        g_string_append(dbgStr, "\n" DEBUG_PREFIX);
-                        g_value_tostring(dbgStr, boarddatagv, 0);
-                        g_string_append(dbgStr, "\n" DEBUG_PREFIX "\n");
-                        ExternalWrite(hPeer, dbgStr->str, strlen(dbgStr->str));
-                        ProcessFIBSBoardInfo(&scanctx.bi, &processedBoard);
-
-                        anScore[0] = processedBoard.nScoreOpp;
-                        anScore[1] = processedBoard.nScore;
-                        /* If the session isn't using Crawford rule, set Crawford flag to false */
-                        fcrawford = scanctx.fCrawfordRule ? processedBoard.fCrawford : FALSE;
-                        /* Set the Jacoby flag appropriately from the external interface settings */
-                        fjacoby = scanctx.fJacobyRule;
-
-                        szMatchID = MatchID((unsigned int *) processedBoard.anDice, 1, processedBoard.nResignation,
-                                            processedBoard.fDoubled, 1, processedBoard.fCubeOwner, fcrawford,
-                                            processedBoard.nMatchTo, anScore, processedBoard.nCube, fjacoby,
-                                            GAME_PLAYING);
-
-                        DrawBoard(szBoard, (ConstTanBoard) & processedBoard.anBoard, 1, asz, szMatchID, 15);
-
-                        aszLines = g_strsplit(&szBoard[0], "\n", 32);
-                        aszLinesOrig = aszLines;
-                        while (*aszLines) {
-                            ExternalWrite(hPeer, DEBUG_PREFIX, strlen(DEBUG_PREFIX));
-                            ExternalWrite(hPeer, *aszLines, strlen(*aszLines));
-                            ExternalWrite(hPeer, "\n", 1);
-                            aszLines++;
-                        }
-
-                        dbgStr = g_string_assign(dbgStr, "");
-                        g_string_append_printf(dbgStr, DEBUG_PREFIX "X is %s, O is %s\n", processedBoard.szPlayer,
-                                               processedBoard.szOpp);
-                        if (processedBoard.nMatchTo) {
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Match Play %s Crawford Rule\n",
-                                                   scanctx.fCrawfordRule ? "with" : "without");
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Score: %d-%d/%d%s, ", processedBoard.nScore,
-                                                   processedBoard.nScoreOpp, processedBoard.nMatchTo,
-                                                   fcrawford ? "*" : "");
-                        } else {
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Money Session %s Jacoby Rule, %s Beavers\n",
-                                                   scanctx.fJacobyRule ? "with" : "without",
-                                                   scanctx.fBeavers ? "with" : "without");
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Score: %d-%d, ", processedBoard.nScore,
-                                                   processedBoard.nScoreOpp);
-                        }
-                        g_string_append_printf(dbgStr, "Roll: %d%d\n",
-                                               processedBoard.anDice[0], processedBoard.anDice[1]);
-                        g_string_append_printf(dbgStr,
-                                               DEBUG_PREFIX
-                                               "CubeOwner: %d, Cube: %d, Turn: %c, Doubled: %d, Resignation: %d\n",
-                                               processedBoard.fCubeOwner, processedBoard.nCube, 'X',
-                                               processedBoard.fDoubled, processedBoard.nResignation);
-                        g_string_append(dbgStr, DEBUG_PREFIX "\n");
-                        ExternalWrite(hPeer, dbgStr->str, strlen(dbgStr->str));
+                        GString *dbgStr = g_string_new(NULL);
 
+                        ExtDebugBoard(dbgStr, &scanctx);
+                        ExternalWrite(hPeer, dbgStr->str, dbgStr->len);
                         g_string_free(dbgStr, TRUE);
-                        g_strfreev(aszLinesOrig);
                     }
                     g_value_unsetfree(scanctx.pCmdData);
 
@@ -795,6 +1609,13 @@ CommandExternal(char *sz)
                 unset_scan_context(&scanctx, FALSE);
             }
 
+            if (szResponse && scanctx.szTag) {
+                char *szTagged = ExtTagResponse(scanctx.szTag, szResponse);
+
+                g_free(szResponse);
+                szResponse = szTagged;
+            }
+
             if (szResponse) {
                 /* outputf("%s", szResponse); */
                 if (ExternalWrite(hPeer, szResponse, strlen(szResponse)))
@@ -47,6 +47,7 @@ extern void ExtDestroyParse(void *scancontext);
 #define KEY_STR_NEWINTERFACE "newinterface"
 #define KEY_STR_DEBUG "debug"
 #define KEY_STR_PROMPT "prompt"
+#define KEY_STR_ORDERED "ordered"
 
 typedef enum {
     COMMAND_NONE = 0,
@@ -163,6 +164,7 @@ typedef struct scancontext {
     int fDebug;
     int fNewInterface;
     char *szError;
+    char *szTag;                /* "#tag" the answer is prefixed with */
 
     /* command type */
     cmdtype ct;
@@ -207,6 +209,35 @@ typedef struct scancontext {
 #define EXTERNAL_INTERFACE_VERSION "2"
 #define RFBF_VERSION_SUPPORTED "0"
 
+/*
+ * Binary frames for the concurrent server.  A client that opens its
+ * connection with the 8 byte hello "\0GNUBG" <version> <flags> sends and
+ * receives frames instead of text lines.  The server answers with the
+ * hello it accepts, with version 0 if it refuses the connection.
+ * Every field is a 32 bit little endian word; floats are IEEE singles.
+ *
+ * request:  length of the rest (84), tag, positionkey (7 words),
+ *           nCube, fCubeOwner, nMatchTo, anScore[0], anScore[1],
+ *           fCrawford, fJacoby, fBeavers,
+ *           fCubeful, nPlies, fUsePrune, fDeterministic, rNoise
+ * response: length of the rest (36), tag, extstatus,
+ *           the NUM_ROLLOUT_OUTPUTS outputs of the evaluation
+ *
+ * The player on roll is player 1 of the key, scores and cube owner.
+ */
+#define EXT_BINARY_HELLO "\0GNUBG"
+#define EXT_BINARY_HELLO_SIZE 8
+#define EXT_BINARY_VERSION 1
+#define EXT_BINARY_UNORDERED 1  /* hello flag: answers as soon as done */
+#define EXT_BINARY_REQUEST_SIZE 84
+#define EXT_BINARY_RESPONSE_SIZE 36
+
+typedef enum {
+    EXT_STATUS_OK = 0,
+    EXT_STATUS_BADREQUEST = 1,
+    EXT_STATUS_FAILED = 2
+} extstatus;
+
 extern int ExternalSocket(struct sockaddr **ppsa, socklen_t *pcb, char *sz);
 extern int ExternalRead(int h, char *pch, size_t cch);
 extern int ExternalWrite(int h, char *pch, size_t cch);
@@ -131,9 +131,11 @@ void yyerror(scancontext *scanner, const char *str)
 %token FIBSBOARD FIBSBOARDEND EVALUATION
 %token CRAWFORDRULE JACOBYRULE RESIGNATION BEAVERS
 %token CUBE CUBEFUL CUBELESS DETERMINISTIC NOISE PLIES PRUNE
+%token ORDERED TAG
 
 %type <boolean>     E_BOOLEAN
 %type <str>         E_STRING
+%type <str>         TAG
 %type <character>   E_CHARACTER
 %type <intnum>      E_INTEGER
 %type <floatnum>    E_FLOAT
@@ -170,6 +172,16 @@ void yyerror(scancontext *scanner, const char *str)
 %%
 
 commands:
+    request
+    |
+    TAG
+        {
+            extcmd->szTag = g_string_free($1, FALSE);
+        }
+    request
+    ;
+
+request:
     EOL
         {
             extcmd->ct = COMMAND_NONE;
@@ -276,6 +288,11 @@ setcommand:
         {
             $$ = create_str2gvalue_tuple (KEY_STR_PROMPT, $2);
         }
+    |
+    ORDERED boolean_type
+        {
+            $$ = create_str2gvalue_tuple (KEY_STR_ORDERED, $2);
+        }
     ;
     
 command:
@@ -634,6 +634,9 @@ static char const *aszBuildInfo[] = {
 #else
     N_("NEON supported."),
 #endif
+#if defined(USE_SIMD_DISPATCH)
+    N_("AVX2 and AVX-512 selected at runtime."),
+#endif
 #endif
     NULL
 };
@@ -3292,10 +3295,14 @@ SaveEvaluationSettings(FILE * pf)
     SaveEvalSetupSettings(pf, "set evaluation chequerplay", &esEvalChequer);
     SaveEvalSetupSettings(pf, "set evaluation cubedecision", &esEvalCube);
     SaveMoveFilterSettings(pf, "set evaluation movefilter", aamfEval);
+    fprintf(pf, "set hugepages %s\n", fCacheHugePages ? "on" : "off");
     fprintf(pf, "set cache %u\n", GetEvalCacheEntries());
+    if (szCacheFile)
+        fprintf(pf, "set cachefile \"%s\"\n", szCacheFile);
     fprintf(pf, "set matchequitytable \"%s\"\n", miCurrent.szFileName);
     fprintf(pf, "set invert matchequitytable %s\n", fInvertMET ? "on" : "off");
 #if defined(USE_MULTITHREAD)
+    fprintf(pf, "set numa %s\n", fNumaReplicas ? "on" : "off");
     fprintf(pf, "set threads %u\n", MT_GetNumThreads());
 #endif
 }
@@ -3430,6 +3437,13 @@ CommandSaveSettings(char *szParam)
     SavePlayerSettings(pf);
     SaveRNGSettings(pf, "set", rngCurrent, rngctxCurrent);
     SaveRolloutSettings(pf, "set rollout", &rcRollout);
+    fprintf(pf, "set rollout deterministic %s\n", fRolloutDeterministic ? "on" : "off");
+    fprintf(pf, "set rollout lockstep %d\n", nRolloutLockstep);
+    fprintf(pf, "set external server %s\n", fExternalServer ? "on" : "off");
+    fprintf(pf, "set external inflight %d\n", nExternalInFlight);
+    fprintf(pf, "set external queue %d\n", nExternalQueue);
+    fprintf(pf, "set external linelength %d\n", nExternalLineLength);
+    fprintf(pf, "set external output %d\n", nExternalOutput);
     SaveImportExportSettings(pf);
     SaveSoundSettings(pf);
     RelationalSaveSettings(pf);
@@ -22,86 +22,155 @@
 
 #include <stdlib.h>
 #include <string.h>
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#endif
 
 #include "cache.h"
+
+#if defined(USE_CACHE_FILE)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "positionid.h"
 
 #if defined(USE_MULTITHREAD)
 #include "multithread.h"
 
-#if defined(__GNUC__) && ( \
-    (( __GNUC__ * 100 + __GNUC_MINOR__ >= 401 ) \
-      && (defined (__i486) || defined (__x86_64))) \
-  || (( __GNUC__ * 100 + __GNUC_MINOR__ >= 404 ) \
-      && defined (__i386))			 \
-  )
+#if defined(__GNUC__)
 
-static inline void
-cache_lock(evalCache * pc, uint32_t k)
-{
-    while (__sync_lock_test_and_set(&(pc->entries[k].lock), 1))
-        while (__sync_fetch_and_add(&pc->entries[k].lock, 0))
-            __asm__ __volatile__ ("pause":::"memory");
-}
+#define seq_get(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define seq_recheck(p) (__atomic_thread_fence(__ATOMIC_ACQUIRE), __atomic_load_n(p, __ATOMIC_RELAXED))
+#define seq_begin_write(p, s) __atomic_compare_exchange_n(p, &(s), (s) + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+#define seq_end_write(p, s) __atomic_store_n(p, (s) + 2, __ATOMIC_RELEASE)
+#define info_get(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define info_set(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
 
-static inline void
-cache_unlock(evalCache * pc, uint32_t k)
-{
-    __sync_lock_release(&(pc->entries[k].lock));
-}
+#else	/* no suitable intrinsics: glib atomics are full barriers */
 
-#else	/* not x86 or older gcc: no suitable intrinsics */
+#define seq_get(p) g_atomic_int_get(p)
+#define seq_recheck(p) g_atomic_int_get(p)
+#define seq_begin_write(p, s) g_atomic_int_compare_and_exchange(p, s, (s) + 1)
+#define seq_end_write(p, s) g_atomic_int_set(p, (s) + 2)
+#define info_get(p) (*(volatile uint32_t *) (p))
+#define info_set(p, v) (*(volatile uint32_t *) (p) = (v))
 
-static inline void
-WaitForLock(volatile int *lock)
-{
-    do {
-        MT_SafeDec(lock);
-    } while (MT_SafeIncCheck(lock));
-}
+#endif
 
-static inline void
-cache_lock(evalCache * pc, uint32_t k)
-{
-    if (MT_SafeIncCheck(&(pc->entries[k].lock)))
-        WaitForLock(&(pc->entries[k].lock));
-}
+#endif                          /* USE_MULTITHREAD */
 
-static inline void
-cache_unlock(evalCache * pc, uint32_t k)
+/*
+ * Layout of cacheTag.info:
+ * Bit 31   : entry in use
+ * Bit 12-30: hash bits 12-30 of the entry
+ * Bit 08-11: depth (plies)
+ * Bit 00-07: age, counting insertions into the bucket
+ */
+#define INFO_USED 0x80000000u
+#define INFO_HASH 0x7ffff000u
+#define INFO_DEPTH(i) (((i) >> 8) & 0x0fu)
+#define INFO_AGE(i) ((i) & 0xffu)
+
+/* EvalKey() keeps the number of plies in the low bits of nEvalContext */
+#define EntryDepth(e) ((uint32_t) (e)->nEvalContext & 0x0fu)
+
+/* An entry survives this many more insertions into its bucket per ply
+ * of search behind it, as it is that much more expensive to recompute */
+#define DEPTH_BONUS 4
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+/* explicit huge pages must be mapped in multiples of their size */
+#define HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+#endif
+
+static int fHugePages = 0;
+
+extern void
+CacheSetHugePages(int f)
 {
-    MT_SafeDec(&(pc->entries[k].lock));
+    fHugePages = f;
 }
 
+/*
+ * A large cache is hit at random, so almost every lookup misses the TLB
+ * with 4 kB pages.  When asked, try pages from the huge page pool first,
+ * then transparent huge pages, and settle for plain malloc().
+ */
+static void *
+CacheAlloc(evalCache * pc, size_t cb)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+    if (fHugePages) {
+        void *p;
+#if defined(MAP_HUGETLB)
+        size_t cbHuge = (cb + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+        p = mmap(NULL, cbHuge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            pc->pages = CACHE_PAGES_HUGETLB;
+            pc->cbMemory = cbHuge;
+            return p;
+        }
+#endif
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+        p = mmap(NULL, cb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            /* only a hint; the kernel may still use small pages */
+            madvise(p, cb, MADV_HUGEPAGE);
+            pc->pages = CACHE_PAGES_TRANSPARENT;
+            pc->cbMemory = cb;
+            return p;
+        }
+#endif
+    }
 #endif
 
-#endif                          /* USE_MULTITHREAD */
-
+    pc->pages = CACHE_PAGES_NORMAL;
+    pc->cbMemory = cb;
+    return malloc(cb);
+}
 
 int
 CacheCreate(evalCache * pc, unsigned int s)
 {
+    unsigned int cBuckets;
+
 #if CACHE_STATS
-    pc->cLookup = 0;
-    pc->cHit = 0;
+    memset(pc->acLookup, 0, sizeof(pc->acLookup));
+    memset(pc->acHit, 0, sizeof(pc->acHit));
     pc->nAdds = 0;
 #endif
 
     if (s > 1u << 31)
         return -1;
 
+    pc->pcf = NULL;
+
     pc->size = s;
     /* adjust size to smallest power of 2 GE to s */
     while ((s & (s - 1)) != 0)
         s &= (s - 1);
 
     pc->size = (s < pc->size) ? 2 * s : s;
-    pc->hashMask = (pc->size >> 1) - 1;
 
-    pc->entries = (cacheNode *) malloc((pc->size / 2) * sizeof(*pc->entries));
-    if (pc->entries == NULL)
+    cBuckets = pc->size / CACHE_WAYS;
+    if (cBuckets == 0)
+        cBuckets = 1;
+    pc->hashMask = cBuckets - 1;
+
+    /* one block: the buckets, aligned to a cache line, then the entries */
+    pc->pMemory = CacheAlloc(pc, cBuckets * (sizeof(cacheBucket) + CACHE_WAYS * sizeof(cacheNodeDetail)) + 64);
+    if (pc->pMemory == NULL)
         return -1;
 
+    pc->buckets = (cacheBucket *) (((size_t) pc->pMemory + 63) & ~(size_t) 63);
+    pc->entries = (cacheNodeDetail *) (pc->buckets + cBuckets);
+
     CacheFlush(pc);
     return 0;
 }
@@ -109,7 +178,7 @@ CacheCreate(evalCache * pc, unsigned int s)
 /* MurmurHash3  https://code.google.com/p/smhasher/wiki/MurmurHash */
 
 extern uint32_t
-GetHashKey(uint32_t hashMask, const cacheNodeDetail * restrict e)
+GetHashKey(const cacheNodeDetail * restrict e)
 {
     uint32_t hash = (uint32_t) e->nEvalContext;
     int i;
@@ -142,103 +211,414 @@ GetHashKey(uint32_t hashMask, const cacheNodeDetail * restrict e)
     hash *= 0xc2b2ae35;
     hash ^= hash >> 16;
 
-    return (hash & hashMask);
+    /* 31 bits, so that it can never be CACHEHIT */
+    return hash >> 1;
+}
+
+/* Pick the way of the bucket to overwrite: a free one if any, otherwise
+ * the oldest, where each ply of depth counts as DEPTH_BONUS insertions
+ * younger.  *puAge is set to the age of the new entry. */
+
+static unsigned int
+CacheVictim(const cacheBucket * pb, uint32_t * puAge)
+{
+    uint32_t aInfo[CACHE_WAYS];
+    uint32_t uNewest = 0;
+    int fUsed = 0, iFree = -1, nBest = -1;
+    unsigned int i, iVictim = 0;
+
+    for (i = 0; i < CACHE_WAYS; i++) {
+#if defined(USE_MULTITHREAD)
+        aInfo[i] = info_get(&pb->tags[i].info);
+#else
+        aInfo[i] = pb->tags[i].info;
+#endif
+        if (!(aInfo[i] & INFO_USED))
+            iFree = (int) i;
+        else if (!fUsed || (int8_t) (INFO_AGE(aInfo[i]) - uNewest) > 0) {
+            /* ages wrap around, but within a bucket they never spread
+             * over more than half of the range */
+            uNewest = INFO_AGE(aInfo[i]);
+            fUsed = 1;
+        }
+    }
+
+    *puAge = (uNewest + 1) & 0xffu;
+
+    if (iFree >= 0)
+        return (unsigned int) iFree;
+
+    for (i = 0; i < CACHE_WAYS; i++) {
+        int n = (int) ((uNewest - INFO_AGE(aInfo[i])) & 0xffu) - DEPTH_BONUS * (int) INFO_DEPTH(aInfo[i]);
+
+        if (n > nBest) {
+            nBest = n;
+            iVictim = i;
+        }
+    }
+
+    return iVictim;
+}
+
+static inline uint32_t
+EntryInfo(const cacheNodeDetail * e, uint32_t l, uint32_t uAge)
+{
+    return INFO_USED | (l & INFO_HASH) | (EntryDepth(e) << 8) | uAge;
+}
+
+static inline void
+CacheHit(const cacheNodeDetail * pnd, float *arOut, float *arCubeful)
+{
+    memcpy(arOut, pnd->ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
+    if (arCubeful)
+        *arCubeful = pnd->ar[5];        /* Cubeful equity stored in slot 5 */
+}
+
+#if defined(USE_CACHE_FILE)
+
+/*
+ * The file starts with a header, then the slots in buckets of
+ * CACHE_FILE_WAYS.  Other processes may write any slot at any time, so
+ * every access goes through the same sequence counter protocol as the
+ * in-process cache, with atomics even in a single threaded build.
+ *
+ * A process that dies while writing a slot leaves its sequence counter
+ * odd, and nobody uses that slot again while the file is shared.  Each
+ * process holds a read lock on LOCK_USERS as long as it has the file
+ * mapped, so the first one to open it after all the others are gone
+ * knows that no write is in progress, and releases those slots.
+ */
+#define CACHE_FILE_MAGIC "gnubgc1"
+#define LOCK_OPEN 0             /* held while the file is checked or created */
+#define LOCK_USERS 1            /* held by every process that has it mapped */
+
+typedef struct {
+    char szMagic[8];
+    uint32_t cSlots;
+    uint32_t cbSlot;
+    char achPad[48];
+} cacheFileHeader;
+
+static int
+CacheFileLock(int fd, short type, off_t iByte, int fWait)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = iByte;
+    fl.l_len = 1;
+
+    return fcntl(fd, fWait ? F_SETLKW : F_SETLK, &fl);
+}
+
+/* Release the slots left half written by processes that died */
+static void
+CacheFileRecover(const cacheFile * pcf)
+{
+    unsigned int i;
+
+    for (i = 0; i < pcf->size; i++)
+        if (pcf->slots[i].seq & 1) {
+            pcf->slots[i].version = 0;
+            pcf->slots[i].seq++;
+        }
+}
+
+extern int
+CacheFileOpen(cacheFile * pcf, const char *szFile, unsigned int size, uint32_t version)
+{
+    cacheFileHeader h;
+    struct stat st;
+    unsigned int cSlots;
+    int fd, fCreate, fAlone, err;
+
+    if ((fd = open(szFile, O_RDWR | O_CREAT, 0666)) < 0)
+        return -1;
+
+    if (CacheFileLock(fd, F_WRLCK, LOCK_OPEN, 1) < 0 || fstat(fd, &st) < 0)
+        goto error;
+
+    if ((fCreate = st.st_size == 0) != 0) {
+        /* a new file, or one left empty by a failed creation */
+        for (cSlots = CACHE_FILE_WAYS; cSlots < size && cSlots < 1u << 31; cSlots <<= 1);
+
+        memset(&h, 0, sizeof(h));
+        memcpy(h.szMagic, CACHE_FILE_MAGIC, sizeof(h.szMagic));
+        h.cSlots = cSlots;
+        h.cbSlot = sizeof(cacheFileSlot);
+
+        if (ftruncate(fd, (off_t) (sizeof(h) + (size_t) cSlots * sizeof(cacheFileSlot))) < 0
+            || pwrite(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h)) {
+            /* leave it empty, for the next one to try again */
+            err = errno;
+            if (ftruncate(fd, 0) == 0)
+                errno = err;
+            goto error;
+        }
+    } else if (pread(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h)
+               && !memcmp(h.szMagic, CACHE_FILE_MAGIC, sizeof(h.szMagic)) && h.cbSlot == sizeof(cacheFileSlot)
+               && h.cSlots >= CACHE_FILE_WAYS && (h.cSlots & (h.cSlots - 1)) == 0
+               && (size_t) st.st_size == sizeof(h) + (size_t) h.cSlots * sizeof(cacheFileSlot)) {
+        /* whoever created it chose the size */
+        cSlots = h.cSlots;
+    } else {
+        /* never overwrite what is not ours, nor a file others may map */
+        errno = EINVAL;
+        goto error;
+    }
+
+    pcf->cbMap = sizeof(h) + (size_t) cSlots * sizeof(cacheFileSlot);
+    pcf->pMap = mmap(NULL, pcf->cbMap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (pcf->pMap == MAP_FAILED)
+        goto error;
+
+    pcf->slots = (cacheFileSlot *) ((char *) pcf->pMap + sizeof(h));
+    pcf->size = cSlots;
+    pcf->hashMask = cSlots / CACHE_FILE_WAYS - 1;
+    pcf->fd = fd;
+    CacheFileSetVersion(pcf, version);
+
+    /* a write lock on LOCK_USERS can only be had if nobody else has it
+     * mapped, and is then turned into our read lock */
+    fAlone = CacheFileLock(fd, F_WRLCK, LOCK_USERS, 0) == 0;
+    if (fAlone && !fCreate)
+        CacheFileRecover(pcf);
+
+    if (CacheFileLock(fd, F_RDLCK, LOCK_USERS, 1) < 0 || CacheFileLock(fd, F_UNLCK, LOCK_OPEN, 1) < 0) {
+        err = errno;
+        munmap(pcf->pMap, pcf->cbMap);
+        errno = err;
+        goto error;
+    }
+
+    return 0;
+
+  error:
+    err = errno;
+    close(fd);                  /* also drops the locks */
+    errno = err;
+    return -1;
+}
+
+extern void
+CacheFileClose(const cacheFile * pcf)
+{
+    munmap(pcf->pMap, pcf->cbMap);
+    close(pcf->fd);
+}
+
+extern void
+CacheFileSetVersion(cacheFile * pcf, uint32_t version)
+{
+    /* 0 is what the slots of a new file hold */
+    pcf->version = version ? version : 1;
+}
+
+static int
+CacheFileLookup(const cacheFile * pcf, const cacheNodeDetail * e, uint32_t l, cacheNodeDetail * pnd)
+{
+    cacheFileSlot *const ps = pcf->slots + (l & pcf->hashMask) * CACHE_FILE_WAYS;
+    unsigned int i;
+
+    for (i = 0; i < CACHE_FILE_WAYS; i++) {
+        int const seq = __atomic_load_n(&ps[i].seq, __ATOMIC_ACQUIRE);
+
+        if ((seq & 1) || __atomic_load_n(&ps[i].version, __ATOMIC_RELAXED) != pcf->version)
+            continue;
+
+        *pnd = ps[i].nd;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ps[i].seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        if (EqualKeys(pnd->key, e->key) && pnd->nEvalContext == e->nEvalContext)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void
+CacheFileAdd(const cacheFile * pcf, const cacheNodeDetail * e, uint32_t l)
+{
+    cacheFileSlot *const ps = pcf->slots + (l & pcf->hashMask) * CACHE_FILE_WAYS;
+    unsigned int i, iVictim = 0;
+    int seq;
+
+    /* an entry from other weights, else the shallower one */
+    for (i = 0; i < CACHE_FILE_WAYS; i++) {
+        if (__atomic_load_n(&ps[i].version, __ATOMIC_RELAXED) != pcf->version) {
+            iVictim = i;
+            break;
+        }
+        if (EntryDepth(&ps[i].nd) < EntryDepth(&ps[iVictim].nd))
+            iVictim = i;
+    }
+
+    seq = __atomic_load_n(&ps[iVictim].seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&ps[iVictim].seq, &seq, seq + 1, 0,
+                                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    ps[iVictim].nd = *e;
+    __atomic_store_n(&ps[iVictim].version, pcf->version, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&ps[iVictim].seq, seq + 2, __ATOMIC_RELEASE);
 }
 
+#endif                          /* USE_CACHE_FILE */
+
+static void CacheStoreWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l);
+static void CacheStoreNoLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l);
 
 uint32_t
 CacheLookupWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, float * restrict arOut, float * restrict arCubeful)
 {
-    uint32_t const l = GetHashKey(pc->hashMask, e);
+    uint32_t const l = GetHashKey(e);
+    uint32_t const iBucket = l & pc->hashMask;
+    cacheBucket *const pb = pc->buckets + iBucket;
+    unsigned int i;
 
 #if CACHE_STATS
+    unsigned int const iPly = EntryDepth(e) < CACHE_STATS_PLIES ? EntryDepth(e) : CACHE_STATS_PLIES - 1;
 #if defined(USE_MULTITHREAD)
-    MT_SafeInc(&pc->cLookup);
+    MT_SafeInc(&pc->acLookup[iPly]);
 #else
-    ++pc->cLookup;
+    ++pc->acLookup[iPly];
 #endif
 #endif
 
+    for (i = 0; i < CACHE_WAYS; i++) {
 #if defined(USE_MULTITHREAD)
-    cache_lock(pc, l);
-#endif
+        cacheNodeDetail nd;
+        int const seq = seq_get(&pb->tags[i].seq);
 
-    if (!EqualKeys(pc->entries[l].nd_primary.key, e->key) || pc->entries[l].nd_primary.nEvalContext != e->nEvalContext) {       /* Not in primary slot */
-        if (!EqualKeys(pc->entries[l].nd_secondary.key, e->key) || pc->entries[l].nd_secondary.nEvalContext != e->nEvalContext) {       /* Cache miss */
-#if defined(USE_MULTITHREAD)
-            cache_unlock(pc, l);
-#endif
-            return l;
-        } else {                /* Found in second slot, promote "hot" entry */
-            cacheNodeDetail tmp = pc->entries[l].nd_primary;
+        if ((seq & 1) || (info_get(&pb->tags[i].info) & (INFO_USED | INFO_HASH)) != (INFO_USED | (l & INFO_HASH)))
+            continue;
 
-            pc->entries[l].nd_primary = pc->entries[l].nd_secondary;
-            pc->entries[l].nd_secondary = tmp;
-        }
-    }
-    /* Cache hit */
-    memcpy(arOut, pc->entries[l].nd_primary.ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
-    if (arCubeful)
-        *arCubeful = pc->entries[l].nd_primary.ar[5];   /* Cubeful equity stored in slot 5 */
+        nd = pc->entries[iBucket * CACHE_WAYS + i];
 
-#if defined(USE_MULTITHREAD)
-    cache_unlock(pc, l);
+        if (seq_recheck(&pb->tags[i].seq) != seq)
+            /* overwritten while we were reading it */
+            continue;
+
+        if (!EqualKeys(nd.key, e->key) || nd.nEvalContext != e->nEvalContext)
+            continue;
+
+        CacheHit(&nd, arOut, arCubeful);
+#else
+        const cacheNodeDetail *pnd = pc->entries + iBucket * CACHE_WAYS + i;
+
+        if ((pb->tags[i].info & (INFO_USED | INFO_HASH)) != (INFO_USED | (l & INFO_HASH)))
+            continue;
+
+        if (!EqualKeys(pnd->key, e->key) || pnd->nEvalContext != e->nEvalContext)
+            continue;
+
+        CacheHit(pnd, arOut, arCubeful);
 #endif
 
 #if CACHE_STATS
 #if defined(USE_MULTITHREAD)
-    MT_SafeInc(&pc->cHit);
+        MT_SafeInc(&pc->acHit[iPly]);
 #else
-    ++pc->cHit;
+        ++pc->acHit[iPly];
+#endif
 #endif
+        return CACHEHIT;
+    }
+
+    /* Cache miss; the file may have it from another process */
+#if defined(USE_CACHE_FILE)
+    if (pc->pcf && EntryDepth(e) >= CACHE_FILE_MIN_DEPTH) {
+        cacheNodeDetail nd;
+
+        if (CacheFileLookup(pc->pcf, e, l, &nd)) {
+            CacheHit(&nd, arOut, arCubeful);
+            CacheStoreWithLocking(pc, &nd, l);
+            return CACHEHIT;
+        }
+    }
 #endif
 
-    return CACHEHIT;
+    return l;
 }
 
 uint32_t
 CacheLookupNoLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, float *restrict arOut, float * restrict arCubeful)
 {
-    uint32_t const l = GetHashKey(pc->hashMask, e);
+    uint32_t const l = GetHashKey(e);
+    uint32_t const iBucket = l & pc->hashMask;
+    const cacheBucket *const pb = pc->buckets + iBucket;
+    unsigned int i;
 
 #if CACHE_STATS
-    ++pc->cLookup;
+    unsigned int const iPly = EntryDepth(e) < CACHE_STATS_PLIES ? EntryDepth(e) : CACHE_STATS_PLIES - 1;
+
+    ++pc->acLookup[iPly];
 #endif
-    if (!EqualKeys(pc->entries[l].nd_primary.key, e->key) || pc->entries[l].nd_primary.nEvalContext != e->nEvalContext) {       /* Not in primary slot */
-        if (!EqualKeys(pc->entries[l].nd_secondary.key, e->key) || pc->entries[l].nd_secondary.nEvalContext != e->nEvalContext) {       /* Cache miss */
-            return l;
-        } else {                /* Found in second slot, promote "hot" entry */
-            cacheNodeDetail tmp = pc->entries[l].nd_primary;
-
-            pc->entries[l].nd_primary = pc->entries[l].nd_secondary;
-            pc->entries[l].nd_secondary = tmp;
-        }
-    }
 
-    /* Cache hit */
-    memcpy(arOut, pc->entries[l].nd_primary.ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
-    if (arCubeful)
-        *arCubeful = pc->entries[l].nd_primary.ar[5];   /* Cubeful equity stored in slot 5 */
+    for (i = 0; i < CACHE_WAYS; i++) {
+        const cacheNodeDetail *pnd = pc->entries + iBucket * CACHE_WAYS + i;
+
+        if ((pb->tags[i].info & (INFO_USED | INFO_HASH)) != (INFO_USED | (l & INFO_HASH)))
+            continue;
+
+        if (!EqualKeys(pnd->key, e->key) || pnd->nEvalContext != e->nEvalContext)
+            continue;
+
+        /* Cache hit */
+        CacheHit(pnd, arOut, arCubeful);
 
 #if CACHE_STATS
-    ++pc->cHit;
+        ++pc->acHit[iPly];
+#endif
+        return CACHEHIT;
+    }
+
+    /* Cache miss; the file may have it from another process */
+#if defined(USE_CACHE_FILE)
+    if (pc->pcf && EntryDepth(e) >= CACHE_FILE_MIN_DEPTH) {
+        cacheNodeDetail nd;
+
+        if (CacheFileLookup(pc->pcf, e, l, &nd)) {
+            CacheHit(&nd, arOut, arCubeful);
+            CacheStoreNoLocking(pc, &nd, l);
+            return CACHEHIT;
+        }
+    }
 #endif
 
-    return CACHEHIT;
+    return l;
 }
 
-void
-CacheAddWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
+static void
+CacheStoreWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
 {
+    uint32_t const iBucket = l & pc->hashMask;
+    cacheBucket *const pb = pc->buckets + iBucket;
+    uint32_t uAge;
+    unsigned int const i = CacheVictim(pb, &uAge);
+
 #if defined(USE_MULTITHREAD)
-    cache_lock(pc, l);
-#endif
+    int seq = seq_get(&pb->tags[i].seq);
 
-    pc->entries[l].nd_secondary = pc->entries[l].nd_primary;
-    pc->entries[l].nd_primary = *e;
+    /* Another thread is writing this entry: rather than wait for it,
+     * let its result stand and drop ours */
+    if ((seq & 1) || !seq_begin_write(&pb->tags[i].seq, seq))
+        return;
 
-#if defined(USE_MULTITHREAD)
-    cache_unlock(pc, l);
+    pc->entries[iBucket * CACHE_WAYS + i] = *e;
+    info_set(&pb->tags[i].info, EntryInfo(e, l, uAge));
+
+    seq_end_write(&pb->tags[i].seq, seq);
+#else
+    pc->entries[iBucket * CACHE_WAYS + i] = *e;
+    pb->tags[i].info = EntryInfo(e, l, uAge);
 #endif
 
 #if CACHE_STATS
@@ -250,34 +630,72 @@ CacheAddWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e,
 #endif
 }
 
-/* CacheAddNoLocking() is inlined and in cache.h */
+static void
+CacheStoreNoLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
+{
+    uint32_t const iBucket = l & pc->hashMask;
+    cacheBucket *const pb = pc->buckets + iBucket;
+    uint32_t uAge;
+    unsigned int const i = CacheVictim(pb, &uAge);
+
+    pc->entries[iBucket * CACHE_WAYS + i] = *e;
+    pb->tags[i].info = EntryInfo(e, l, uAge);
+
+#if CACHE_STATS
+    ++pc->nAdds;
+#endif
+}
 
 void
-CacheDestroy(const evalCache * pc)
+CacheAddWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
 {
-    free(pc->entries);
+    CacheStoreWithLocking(pc, e, l);
+
+#if defined(USE_CACHE_FILE)
+    if (pc->pcf && EntryDepth(e) >= CACHE_FILE_MIN_DEPTH)
+        CacheFileAdd(pc->pcf, e, l);
+#endif
 }
 
 void
-CacheFlush(const evalCache * pc)
+CacheAddNoLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
 {
-    unsigned int k;
-    for (k = 0; k < pc->size / 2; ++k) {
-        pc->entries[k].nd_primary.key.data[0] = (unsigned int) -1;
-        pc->entries[k].nd_secondary.key.data[0] = (unsigned int) -1;
-#if defined(USE_MULTITHREAD)
-        pc->entries[k].lock = 0;
+    CacheStoreNoLocking(pc, e, l);
+
+#if defined(USE_CACHE_FILE)
+    if (pc->pcf && EntryDepth(e) >= CACHE_FILE_MIN_DEPTH)
+        CacheFileAdd(pc->pcf, e, l);
 #endif
+}
+
+void
+CacheDestroy(const evalCache * pc)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+    if (pc->pages != CACHE_PAGES_NORMAL) {
+        munmap(pc->pMemory, pc->cbMemory);
+        return;
     }
+#endif
+    free(pc->pMemory);
+}
+
+void
+CacheFlush(const evalCache * pc)
+{
+    memset(pc->buckets, 0, (pc->hashMask + 1) * sizeof(cacheBucket));
 }
 
 int
 CacheResize(evalCache * pc, unsigned int cNew)
 {
     if (cNew != pc->size) {
+        cacheFile *pcf = pc->pcf;
+
         CacheDestroy(pc);
         if (CacheCreate(pc, cNew) != 0)
             return -1;
+        pc->pcf = pcf;
     }
 
     return (int) pc->size;
@@ -287,13 +705,24 @@ CacheResize(evalCache * pc, unsigned int cNew)
 void
 CacheStats(const evalCache * pc, unsigned int *pcLookup, unsigned int *pcHit, unsigned int *pcUsed)
 {
+    unsigned int i;
+
     if (pcLookup)
-        *pcLookup = pc->cLookup;
+        for (*pcLookup = 0, i = 0; i < CACHE_STATS_PLIES; i++)
+            *pcLookup += pc->acLookup[i];
 
     if (pcHit)
-        *pcHit = pc->cHit;
+        for (*pcHit = 0, i = 0; i < CACHE_STATS_PLIES; i++)
+            *pcHit += pc->acHit[i];
 
     if (pcUsed)
         *pcUsed = pc->nAdds;
 }
+
+void
+CacheStatsPly(const evalCache * pc, unsigned int acLookup[CACHE_STATS_PLIES], unsigned int acHit[CACHE_STATS_PLIES])
+{
+    memcpy(acLookup, pc->acLookup, sizeof(pc->acLookup));
+    memcpy(acHit, pc->acHit, sizeof(pc->acHit));
+}
 #endif
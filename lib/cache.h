@@ -23,6 +23,7 @@
 
 #include "config.h"
 
+#include <stddef.h>
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #else
@@ -34,33 +35,90 @@ typedef unsigned int uint32_t;
 /* Set to calculate simple cache stats */
 #define CACHE_STATS 0
 
+/* Lookups and hits are counted separately for 0, 1, ... plies */
+#define CACHE_STATS_PLIES 8
+
+/* Entries per bucket; the tags of a bucket fill one cache line */
+#define CACHE_WAYS 8
+
 typedef struct {
     positionkey key;
     int nEvalContext;
     float ar[6];
 } cacheNodeDetail;
 
+/*
+ * seq is a sequence counter, odd while the entry is being written.
+ * Lookups never lock: they read seq before and after copying an entry
+ * and ignore it if it changed.  info holds the upper bits of the hash
+ * of the entry, its depth in plies and its age within the bucket.
+ */
 typedef struct {
-    cacheNodeDetail nd_primary;
-    cacheNodeDetail nd_secondary;
-#if defined(USE_MULTITHREAD)
-    int lock;
-#endif
-} cacheNode;
+    int seq;
+    uint32_t info;
+} cacheTag;
+
+typedef struct {
+    cacheTag tags[CACHE_WAYS];
+} cacheBucket;
+
+/* memory used per entry, tag and data */
+#define CACHE_ENTRY_SIZE (sizeof(cacheNodeDetail) + sizeof(cacheTag))
 
 /* name used in eval.c */
 typedef cacheNodeDetail evalcache;
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(__GNUC__)
+#define USE_CACHE_FILE 1
+#endif
+
+/*
+ * A second level cache in a file mapped by several processes.  Only
+ * evaluations of one ply or more go there; 0-ply ones are cheaper to
+ * redo than to fetch.  version identifies the weights and match
+ * equity table the entry was computed with.
+ */
+typedef struct {
+    int seq;
+    uint32_t version;
+    cacheNodeDetail nd;
+} cacheFileSlot;
+
+typedef struct {
+    cacheFileSlot *slots;
+    void *pMap;
+    size_t cbMap;
+    int fd;                     /* kept open for its lock */
+    unsigned int size;
+    uint32_t hashMask;
+    uint32_t version;
+} cacheFile;
+
+#define CACHE_FILE_WAYS 2
+#define CACHE_FILE_MIN_DEPTH 1
+
+/* how the memory of a cache was obtained */
+typedef enum {
+    CACHE_PAGES_NORMAL,         /* malloc() */
+    CACHE_PAGES_TRANSPARENT,    /* mmap() and madvise(MADV_HUGEPAGE) */
+    CACHE_PAGES_HUGETLB         /* mmap() from the reserved huge page pool */
+} cachePages;
+
 typedef struct {
-    cacheNode *entries;
+    cacheBucket *buckets;
+    cacheNodeDetail *entries;
+    void *pMemory;
+    size_t cbMemory;
+    cachePages pages;
+    cacheFile *pcf;             /* consulted on a miss, if not NULL */
 
     unsigned int size;
     uint32_t hashMask;
 
 #if CACHE_STATS
     unsigned int nAdds;
-    unsigned int cLookup;
-    unsigned int cHit;
+    unsigned int acLookup[CACHE_STATS_PLIES];
+    unsigned int acHit[CACHE_STATS_PLIES];
 #endif
 } evalCache;
 
@@ -68,6 +126,18 @@ typedef struct {
 int CacheCreate(evalCache * pc, unsigned int size);
 int CacheResize(evalCache * pc, unsigned int cNew);
 
+/* Ask for huge pages in caches created from now on */
+void CacheSetHugePages(int f);
+
+#if defined(USE_CACHE_FILE)
+/* Size is only used if the file has to be created, which is only done
+ * if it is empty.  Fails with errno EINVAL if it is not a cache file of
+ * this build. */
+int CacheFileOpen(cacheFile * pcf, const char *szFile, unsigned int size, uint32_t version);
+void CacheFileClose(const cacheFile * pcf);
+void CacheFileSetVersion(cacheFile * pcf, uint32_t version);
+#endif
+
 #define CACHEHIT ((uint32_t)-1)
 
 /* returns a value which is passed to CacheAdd (if a miss) */
@@ -75,28 +145,21 @@ unsigned int CacheLookupWithLocking(evalCache * pc, const cacheNodeDetail * e, f
 unsigned int CacheLookupNoLocking(evalCache * pc, const cacheNodeDetail * e, float *arOut, float *arCubeful);
 
 void CacheAddWithLocking(evalCache * pc, const cacheNodeDetail * e, uint32_t l);
-
-static inline void
-CacheAddNoLocking(evalCache * pc, const cacheNodeDetail * e, const uint32_t l)
-{
-    pc->entries[l].nd_secondary = pc->entries[l].nd_primary;
-    pc->entries[l].nd_primary = *e;
-#if CACHE_STATS
-    ++pc->nAdds;
-#endif
-}
+void CacheAddNoLocking(evalCache * pc, const cacheNodeDetail * e, uint32_t l);
 
 void CacheFlush(const evalCache * pc);
 void CacheDestroy(const evalCache * pc);
 
 #if CACHE_STATS
 void CacheStats(const evalCache * pc, unsigned int *pcLookup, unsigned int *pcHit, unsigned int *pcUsed);
+void CacheStatsPly(const evalCache * pc, unsigned int acLookup[CACHE_STATS_PLIES],
+                   unsigned int acHit[CACHE_STATS_PLIES]);
 #endif
 
 #if defined(HAVE_FUNC_ATTRIBUTE_PURE)
-uint32_t GetHashKey(uint32_t hashMask, const cacheNodeDetail * e) __attribute((pure));
+uint32_t GetHashKey(const cacheNodeDetail * e) __attribute((pure));
 #else
-uint32_t GetHashKey(uint32_t hashMask, const cacheNodeDetail * e);
+uint32_t GetHashKey(const cacheNodeDetail * e);
 #endif
 
 #endif
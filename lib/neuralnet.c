@@ -80,44 +80,27 @@ NeuralNetDestroy(neuralnet * pnn)
     pnn->arOutputThreshold = 0;
 }
 
-#if !defined(USE_SIMD_INSTRUCTIONS)
-
-/* separate context for race, crashed, contact
- * -1: regular eval
- * 0: save base
- * 1: from base
- */
-
-static inline NNEvalType
-NNevalAction(NNState * pnState)
+/* Make pnnDst an independent copy of pnnSrc, in memory allocated by the
+ * calling thread */
+extern int
+NeuralNetCopy(neuralnet * pnnDst, const neuralnet * pnnSrc)
 {
-    if (!pnState)
-        return NNEVAL_NONE;
+    if (NeuralNetCreate(pnnDst, pnnSrc->cInput, pnnSrc->cHidden, pnnSrc->cOutput,
+                        pnnSrc->rBetaHidden, pnnSrc->rBetaOutput))
+        return -1;
 
-    switch (pnState->state) {
-    case NNSTATE_NONE:
-        {
-            /* incremental evaluation not useful */
-            return NNEVAL_NONE;
-        }
-    case NNSTATE_INCREMENTAL:
-        {
-            /* next call should return FROMBASE */
-            pnState->state = NNSTATE_DONE;
+    pnnDst->nTrained = pnnSrc->nTrained;
 
-            /* starting a new context; save base in the hope it will be useful */
-            return NNEVAL_SAVE;
-        }
-    case NNSTATE_DONE:
-        {
-            /* context hit!  use the previously computed base */
-            return NNEVAL_FROMBASE;
-        }
-    }
-    /* never reached */
-    return NNEVAL_NONE;         /* for the picky compiler */
+    memcpy(pnnDst->arHiddenWeight, pnnSrc->arHiddenWeight, pnnSrc->cHidden * pnnSrc->cInput * sizeof(float));
+    memcpy(pnnDst->arOutputWeight, pnnSrc->arOutputWeight, pnnSrc->cOutput * pnnSrc->cHidden * sizeof(float));
+    memcpy(pnnDst->arHiddenThreshold, pnnSrc->arHiddenThreshold, pnnSrc->cHidden * sizeof(float));
+    memcpy(pnnDst->arOutputThreshold, pnnSrc->arOutputThreshold, pnnSrc->cOutput * sizeof(float));
+
+    return 0;
 }
 
+#if !defined(USE_SIMD_INSTRUCTIONS)
+
 static void
 Evaluate(const neuralnet * pnn, const float arInput[], float ar[], float arOutput[], float *saveAr)
 {
@@ -259,6 +242,87 @@ NeuralNetEvaluate(const neuralnet * pnn, float arInput[], float arOutput[], NNSt
     }
     return 0;
 }
+
+/* Evaluate cBatch positions, their inputs stored one after the other
+ * in arInput[].  Each row of hidden weights is applied to the whole
+ * batch before moving on to the next input.  Once pnState holds a
+ * base, only the inputs differing from it are applied. */
+extern int
+NeuralNetEvaluateBatch(const neuralnet * pnn, float arInput[], float arOutput[], unsigned int cBatch,
+                       NNState * pnState)
+{
+    const unsigned int cHidden = pnn->cHidden;
+    float *ar = (float *) g_alloca(NN_BATCH_SIZE * cHidden * sizeof(float));
+    const float *arBaseInput = NULL;
+    const float *arBase = pnn->arHiddenThreshold;
+
+    if (pnState && pnState->state == NNSTATE_INCREMENTAL && cBatch) {
+        /* the first position becomes the base for the rest */
+        NeuralNetEvaluate(pnn, arInput, arOutput, pnState);
+        arInput += pnn->cInput;
+        arOutput += pnn->cOutput;
+        cBatch--;
+    }
+
+    if (NNevalAction(pnState) == NNEVAL_FROMBASE && pnState->cSavedIBase == pnn->cInput) {
+        arBaseInput = pnState->savedIBase;
+        arBase = pnState->savedBase;
+    }
+
+    while (cBatch) {
+        unsigned int const c = MIN(cBatch, NN_BATCH_SIZE);
+        const float *prWeightRow = pnn->arHiddenWeight;
+        unsigned int i, j, k;
+
+        /* Calculate activity at hidden nodes */
+        for (k = 0; k < c; k++)
+            for (i = 0; i < cHidden; i++)
+                ar[k * cHidden + i] = arBase[i];
+
+        for (i = 0; i < pnn->cInput; i++, prWeightRow += cHidden)
+            for (k = 0; k < c; k++) {
+                float ari = arInput[k * pnn->cInput + i];
+                const float *prWeight = prWeightRow;
+                float *pr = ar + k * cHidden;
+
+                if (arBaseInput)
+                    ari -= arBaseInput[i];
+
+                if (ari == 0.0f)
+                    continue;
+
+                if (ari == 1.0f)
+                    for (j = cHidden; j; j--)
+                        *pr++ += *prWeight++;
+                else
+                    for (j = cHidden; j; j--)
+                        *pr++ += *prWeight++ * ari;
+            }
+
+        /* Calculate activity at output nodes */
+        for (k = 0; k < c; k++) {
+            float *pr = ar + k * cHidden;
+            const float *prWeight = pnn->arOutputWeight;
+
+            for (i = 0; i < cHidden; i++)
+                pr[i] = sigmoid(-pnn->rBetaHidden * pr[i]);
+
+            for (i = 0; i < pnn->cOutput; i++) {
+                float r = pnn->arOutputThreshold[i];
+
+                for (j = 0; j < cHidden; j++)
+                    r += pr[j] * *prWeight++;
+
+                arOutput[k * pnn->cOutput + i] = sigmoid(-pnn->rBetaOutput * r);
+            }
+        }
+
+        arInput += c * pnn->cInput;
+        arOutput += c * pnn->cOutput;
+        cBatch -= c;
+    }
+    return 0;
+}
 #endif
 
 extern int
@@ -569,3 +633,57 @@ SIMD_Supported(void)
 
 #endif
 #endif
+
+#if defined(USE_SIMD_DISPATCH)
+f_NeuralNetEvaluateSSE NeuralNetEvaluateSSE = NeuralNetEvaluateSSEBase;
+f_NeuralNetEvaluateBatch NeuralNetEvaluateBatch = NeuralNetEvaluateBatchBase;
+#endif
+
+/* Point the neural net evaluation at the widest kernel this CPU can run
+ * and return its name.  Without USE_SIMD_DISPATCH there is only the one
+ * chosen at compile time. */
+extern const char *
+SIMD_SelectKernel(void)
+{
+#if defined(USE_SIMD_DISPATCH)
+    static const char *szKernel = NULL;
+
+    if (szKernel)
+        return szKernel;
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f")) {
+        NeuralNetEvaluateSSE = NeuralNetEvaluateSSEAVX512;
+        NeuralNetEvaluateBatch = NeuralNetEvaluateBatchAVX512;
+        szKernel = "AVX-512";
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        NeuralNetEvaluateSSE = NeuralNetEvaluateSSEAVX2;
+        NeuralNetEvaluateBatch = NeuralNetEvaluateBatchAVX2;
+        szKernel = "AVX2/FMA";
+    } else {
+        NeuralNetEvaluateSSE = NeuralNetEvaluateSSEBase;
+        NeuralNetEvaluateBatch = NeuralNetEvaluateBatchBase;
+#if defined(USE_FMA3)
+        szKernel = "AVX/FMA";
+#elif defined(USE_AVX)
+        szKernel = "AVX";
+#else
+        szKernel = "SSE2";
+#endif
+    }
+    return szKernel;
+#elif !defined(USE_SIMD_INSTRUCTIONS)
+    return "none";
+#elif defined(USE_FMA3)
+    return "AVX/FMA";
+#elif defined(USE_AVX)
+    return "AVX";
+#elif defined(USE_SSE2)
+    return "SSE2";
+#elif defined(USE_NEON)
+    return "NEON";
+#else
+    return "SSE";
+#endif
+}
@@ -53,21 +53,80 @@ typedef struct {
     NNStateType state;
     float *savedBase;
     float *savedIBase;
-#if !defined(USE_SIMD_INSTRUCTIONS)
     unsigned int cSavedIBase;
-#endif
 } NNState;
 
+/* separate context for race, crashed, contact
+ * -1: regular eval
+ * 0: save base
+ * 1: from base
+ */
+
+static inline NNEvalType
+NNevalAction(NNState * pnState)
+{
+    if (!pnState)
+        return NNEVAL_NONE;
+
+    switch (pnState->state) {
+    case NNSTATE_NONE:
+        {
+            /* incremental evaluation not useful */
+            return NNEVAL_NONE;
+        }
+    case NNSTATE_INCREMENTAL:
+        {
+            /* next call should return FROMBASE */
+            pnState->state = NNSTATE_DONE;
+
+            /* starting a new context; save base in the hope it will be useful */
+            return NNEVAL_SAVE;
+        }
+    case NNSTATE_DONE:
+        {
+            /* context hit!  use the previously computed base */
+            return NNEVAL_FROMBASE;
+        }
+    }
+    /* never reached */
+    return NNEVAL_NONE;         /* for the picky compiler */
+}
+
+/* Largest number of positions NeuralNetEvaluateBatch() keeps in
+ * flight; bigger batches are split into chunks of this size.  With an
+ * incremental NNState only the inputs that differ from the saved base
+ * are applied to the hidden layer, as in NeuralNetEvaluate() */
+#define NN_BATCH_SIZE 16
+
 extern void NeuralNetDestroy(neuralnet * pnn);
+extern int NeuralNetCopy(neuralnet * pnnDst, const neuralnet * pnnSrc);
 #if !defined(USE_SIMD_INSTRUCTIONS)
 extern int NeuralNetEvaluate(const neuralnet * pnn, float arInput[], float arOutput[], NNState * pnState);
-#else
+extern int NeuralNetEvaluateBatch(const neuralnet * pnn, float arInput[], float arOutput[], unsigned int cBatch,
+                                  NNState * pnState);
+#elif !defined(USE_SIMD_DISPATCH)
 extern int NeuralNetEvaluateSSE(const neuralnet * pnn, float arInput[], float arOutput[], NNState * pnState);
+extern int NeuralNetEvaluateBatch(const neuralnet * pnn, float arInput[], float arOutput[], unsigned int cBatch,
+                                  NNState * pnState);
+#else
+/* One copy of each kernel per instruction set; NeuralNetEvaluateSSE
+ * and NeuralNetEvaluateBatch point to the ones SIMD_SelectKernel() picked */
+#define EXP_SIMD_FUN(ret, name, ...) \
+	typedef ret (*f_##name)( __VA_ARGS__); \
+	extern f_##name name; \
+	extern ret name##Base( __VA_ARGS__); \
+	extern ret name##AVX2( __VA_ARGS__); \
+	extern ret name##AVX512( __VA_ARGS__)
+
+EXP_SIMD_FUN(int, NeuralNetEvaluateSSE, const neuralnet * pnn, float arInput[], float arOutput[], NNState * pnState);
+EXP_SIMD_FUN(int, NeuralNetEvaluateBatch, const neuralnet * pnn, float arInput[], float arOutput[],
+             unsigned int cBatch, NNState * pnState);
 #endif
 extern int NeuralNetLoad(neuralnet * pnn, FILE * pf);
 extern int NeuralNetLoadBinary(neuralnet * pnn, FILE * pf);
 extern int NeuralNetSaveBinary(const neuralnet * pnn, FILE * pf);
 extern int SIMD_Supported(void);
+extern const char *SIMD_SelectKernel(void);
 
 /* Try to determine whether we are 64-bit or 32-bit */
 #if defined(_WIN32) || defined(_WIN64)
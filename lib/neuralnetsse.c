@@ -21,6 +21,31 @@
 #include "config.h"
 #include "common.h"
 
+/*
+ * neuralnetavx2.c and neuralnetavx512.c include this file to build
+ * extra copies of the kernels for wider vector units.  The best one
+ * the CPU supports is picked at run time by SIMD_SelectKernel().
+ */
+#if defined(NN_KERNEL_AVX2) || defined(NN_KERNEL_AVX512)
+#undef USE_SSE2
+#undef USE_NEON
+#undef USE_AVX
+#undef USE_FMA3
+#define USE_AVX 1
+#define USE_FMA3 1
+#define USE_AVX2 1
+#if defined(NN_KERNEL_AVX512)
+#define USE_AVX512 1
+#define NN_KERNEL(f) f ## AVX512
+#else
+#define NN_KERNEL(f) f ## AVX2
+#endif
+#elif defined(USE_SIMD_DISPATCH)
+#define NN_KERNEL(f) f ## Base
+#else
+#define NN_KERNEL(f) f
+#endif
+
 #if defined(USE_SIMD_INSTRUCTIONS)
 
 #define DEBUG_SSE 0
@@ -42,6 +67,8 @@
 #include <glib.h>
 #include "sigmoid.h"
 
+#if !defined(USE_AVX2)
+
 #if defined(HAVE_NEON)
 #include <signal.h>
 #include <setjmp.h>
@@ -54,7 +81,7 @@ sse_malloc(size_t size)
     void *ptr = NULL;
     int ret;
     
-    ret = posix_memalign(&ptr, ALIGN_SIZE, size);
+    ret = posix_memalign(&ptr, MALLOC_ALIGN_SIZE, size);
     
     if (ret == 0)
         return (float *)ptr;
@@ -67,9 +94,9 @@ sse_malloc(size_t size)
     return NULL;
 
 #elif defined(HAVE__ALIGNED_MALLOC)
-    return (float *) _aligned_malloc(size, ALIGN_SIZE);
+    return (float *) _aligned_malloc(size, MALLOC_ALIGN_SIZE);
 #else
-    return (float *) _mm_malloc(size, ALIGN_SIZE);
+    return (float *) _mm_malloc(size, MALLOC_ALIGN_SIZE);
 #endif
 }
 
@@ -119,13 +146,19 @@ CheckNEON(void)
 }
 #endif
 
+#endif                          /* !USE_AVX2 */
+
 #if defined(USE_AVX) || defined(USE_SSE2) || defined(USE_NEON)
 #include <stdint.h>
 
 static const union {
     float f[VEC_SIZE];
     float_vector ps;
-#if defined(USE_AVX)
+#if defined(USE_AVX512)
+} ones = { {
+1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
+1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f}};
+#elif defined(USE_AVX)
 } ones = { {
 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f}};
 #else
@@ -136,7 +169,11 @@ static const union {
 static const union {
     float f[VEC_SIZE];
     float_vector ps;
-#if defined(USE_AVX)
+#if defined(USE_AVX512)
+} tens = { {
+10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f,
+10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f}};
+#elif defined(USE_AVX)
 } tens = { {
 10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f, 10.0f}};
 #else
@@ -144,6 +181,7 @@ static const union {
 10.0f, 10.0f, 10.0f, 10.0f}};
 #endif
 
+#if !defined(USE_AVX512)
 static const union {
     int32_t i32[VEC_SIZE];
     float_vector ps;
@@ -154,6 +192,7 @@ static const union {
 } abs_mask = { {
 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF}};
 #endif
+#endif
 
 static inline float_vector
 sigmoid_positive_ps(float_vector xin)
@@ -163,8 +202,12 @@ sigmoid_positive_ps(float_vector xin)
         int32_t i32[VEC_SIZE];
     } i;
     float_vector ex;
+#if !defined(USE_AVX2)
     float *ex_elem = (float *) &ex;
-#if defined(USE_AVX)
+#endif
+#if defined(USE_AVX512)
+    float_vector x1 = _mm512_min_ps(xin, tens.ps);
+#elif defined(USE_AVX)
     float_vector x1 = _mm256_min_ps(xin, tens.ps);
 #elif defined(HAVE_SSE)
     float_vector x1 = _mm_min_ps(xin, tens.ps);
@@ -173,7 +216,10 @@ sigmoid_positive_ps(float_vector xin)
     float_vector rec;
 #endif
 
-#if defined(USE_AVX)
+#if defined(USE_AVX512)
+    x1 = _mm512_mul_ps(x1, tens.ps);
+    i.i = _mm512_cvttps_epi32(x1);
+#elif defined(USE_AVX)
     x1 = _mm256_mul_ps(x1, tens.ps);
     i.i = _mm256_cvttps_epi32(x1);
 #elif defined(HAVE_SSE)
@@ -183,6 +229,11 @@ sigmoid_positive_ps(float_vector xin)
     x1 = vmulq_f32(x1, tens.ps);
     i.i = vcvtq_s32_f32(x1);
 #endif
+#if defined(USE_AVX512)
+    ex = _mm512_i32gather_ps(i.i, e, 4);
+#elif defined(USE_AVX2)
+    ex = _mm256_i32gather_ps(e, i.i, 4);
+#else
     ex_elem[0] = e[i.i32[0]];
     ex_elem[1] = e[i.i32[1]];
     ex_elem[2] = e[i.i32[2]];
@@ -193,8 +244,18 @@ sigmoid_positive_ps(float_vector xin)
     ex_elem[6] = e[i.i32[6]];
     ex_elem[7] = e[i.i32[7]];
 #endif
+#endif
 
-#if defined(USE_AVX)
+#if defined(USE_AVX512)
+    x1 = _mm512_sub_ps(x1, _mm512_cvtepi32_ps(i.i));
+    x1 = _mm512_add_ps(x1, tens.ps);
+    x1 = _mm512_fmadd_ps(x1, ex, ones.ps);
+#ifdef __FAST_MATH__
+    return _mm512_rcp14_ps(x1);
+#else
+    return _mm512_div_ps(ones.ps, x1);
+#endif
+#elif defined(USE_AVX)
     x1 = _mm256_sub_ps(x1, _mm256_cvtepi32_ps(i.i));
     x1 = _mm256_add_ps(x1, tens.ps);
 #if defined(USE_FMA3)
@@ -239,7 +300,13 @@ sigmoid_positive_ps(float_vector xin)
 static inline float_vector
 sigmoid_ps(float_vector xin)
 {
-#if defined(USE_AVX)
+#if defined(USE_AVX512)
+    __mmask16 mask = _mm512_cmp_ps_mask(xin, _mm512_setzero_ps(), _CMP_LT_OS);
+    float_vector c;
+    xin = _mm512_abs_ps(xin);
+    c = sigmoid_positive_ps(xin);
+    return _mm512_mask_blend_ps(mask, _mm512_sub_ps(ones.ps, c), c);
+#elif defined(USE_AVX)
     float_vector mask = _mm256_cmp_ps(xin, _mm256_setzero_ps(), _CMP_LT_OS);
     float_vector c;
     xin = _mm256_and_ps(xin, abs_mask.ps);      /* Abs. value by clearing signbit */
@@ -264,6 +331,7 @@ sigmoid_ps(float_vector xin)
 #endif                          // USE_SSE2 or USE_AVX
 
 #if defined(USE_SSE2)
+#define VEC_SET1(x) _mm_set1_ps(x)
 #define INPUT_ADD() \
 for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE) { \
     vec0 = _mm_load_ps(pr); \
@@ -280,7 +348,24 @@ for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE
     _mm_store_ps(pr, sum); \
 }
 #endif
-#if defined(USE_AVX)
+#if defined(USE_AVX512)
+#define VEC_SET1(x) _mm512_set1_ps(x)
+#define INPUT_ADD() \
+for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE) { \
+    vec0 = _mm512_load_ps(pr); \
+    vec1 = _mm512_load_ps(prWeight); \
+    sum = _mm512_add_ps(vec0, vec1); \
+    _mm512_store_ps(pr, sum); \
+}
+#define INPUT_MULTADD() \
+for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE) { \
+    vec0 = _mm512_load_ps(pr); \
+    vec1 = _mm512_load_ps(prWeight); \
+    sum = _mm512_fmadd_ps(vec1, scalevec, vec0); \
+    _mm512_store_ps(pr, sum); \
+}
+#elif defined(USE_AVX)
+#define VEC_SET1(x) _mm256_set1_ps(x)
 #define INPUT_ADD() \
 for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE) { \
     vec0 = _mm256_load_ps(pr); \
@@ -308,6 +393,7 @@ for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE
 #endif
 #endif
 #if defined(USE_NEON)
+#define VEC_SET1(x) vdupq_n_f32(x)
 #define INPUT_ADD() \
 for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE) { \
     vec0 = vld1q_f32(pr); \
@@ -325,8 +411,10 @@ for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE
 }
 #endif
 
+/* Squash the hidden layer activities in ar[] and calculate the output
+ * layer.  Shared by the single position and the batch evaluation. */
 static void
-EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], float arOutput[])
+EvaluateOutputSSE(const neuralnet * restrict pnn, float ar[], float arOutput[])
 {
     const unsigned int cHidden = pnn->cHidden;
     unsigned int i, j;
@@ -338,6 +426,138 @@ EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], f
 #else
     float_vector vec0, vec1, vec3, scalevec, sum;
 #endif
+#endif
+
+#if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
+    scalevec = VEC_SET1(pnn->rBetaHidden);
+
+    for (par = ar, i = (cHidden >> LOG2VEC_SIZE); i; i--, par += VEC_SIZE) {
+#if defined(USE_AVX512)
+        float_vector vec = _mm512_load_ps(par);
+        vec = _mm512_mul_ps(vec, scalevec);
+        vec = sigmoid_ps(vec);
+        _mm512_store_ps(par, vec);
+#elif defined(USE_AVX)
+        float_vector vec = _mm256_load_ps(par);
+        vec = _mm256_mul_ps(vec, scalevec);
+        vec = sigmoid_ps(vec);
+        _mm256_store_ps(par, vec);
+#elif defined(HAVE_SSE)
+        float_vector vec = _mm_load_ps(par);
+        vec = _mm_mul_ps(vec, scalevec);
+        vec = sigmoid_ps(vec);
+        _mm_store_ps(par, vec);
+#else
+        float_vector vec = vld1q_f32(par);
+        vec = vmulq_f32(vec, scalevec);
+        vec = sigmoid_ps(vec);
+        vst1q_f32(par, vec);
+#endif
+    }
+#else
+    for (i = 0; i < cHidden; i++)
+        ar[i] = sigmoid(-pnn->rBetaHidden * ar[i]);
+#endif
+
+    /* Calculate activity at output nodes */
+    prWeight = pnn->arOutputWeight;
+
+    for (i = 0; i < pnn->cOutput; i++) {
+
+#if defined(USE_AVX512)
+        float r;
+#elif defined(USE_AVX)
+        SSE_ALIGN(float r[8]);
+#else
+        float r;
+#endif
+        float *pr = ar;
+#if defined(USE_AVX512)
+        sum = _mm512_setzero_ps();
+#elif defined(USE_AVX)
+        sum = _mm256_setzero_ps();
+#elif defined(HAVE_SSE)
+        sum = _mm_setzero_ps();
+#else
+        sum = vdupq_n_f32(0.0f);
+#endif
+        for (j = (cHidden >> LOG2VEC_SIZE); j; j--, prWeight += VEC_SIZE, pr += VEC_SIZE) {
+#if defined(USE_AVX512)
+            vec0 = _mm512_load_ps(pr);
+            vec1 = _mm512_load_ps(prWeight);
+            sum = _mm512_fmadd_ps(vec0, vec1, sum);
+#elif defined(USE_AVX)
+            vec0 = _mm256_load_ps(pr);  /* Eight floats into vec0 */
+            vec1 = _mm256_load_ps(prWeight);    /* Eight weights into vec1 */
+#if defined(USE_FMA3)
+            sum = _mm256_fmadd_ps(vec0, vec1, sum);
+#else
+            vec3 = _mm256_mul_ps(vec0, vec1);   /* Multiply */
+            sum = _mm256_add_ps(sum, vec3);     /* Add */
+#endif
+#elif defined(HAVE_SSE)
+            vec0 = _mm_load_ps(pr);     /* Four floats into vec0 */
+            vec1 = _mm_load_ps(prWeight);       /* Four weights into vec1 */
+            vec3 = _mm_mul_ps(vec0, vec1);      /* Multiply */
+            sum = _mm_add_ps(sum, vec3);        /* Add */
+#else
+            vec0 = vld1q_f32(pr);     /* Four floats into vec0 */
+            vec1 = vld1q_f32(prWeight);       /* Four weights into vec1 */
+            vec3 = vmulq_f32(vec0, vec1);      /* Multiply */
+            sum = vaddq_f32(sum, vec3);        /* Add */
+#endif
+        }
+
+#if defined(USE_AVX512)
+        r = _mm512_reduce_add_ps(sum);
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
+#elif defined(USE_AVX)
+        vec0 = _mm256_hadd_ps(sum, sum);
+        vec1 = _mm256_hadd_ps(vec0, vec0);
+        _mm256_store_ps(r, vec1);
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r[0] + r[4] + pnn->arOutputThreshold[i]));
+#elif defined(HAVE_SSE)
+        vec0 = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+        vec1 = _mm_add_ps(sum, vec0);
+        vec0 = _mm_shuffle_ps(vec1, vec1, _MM_SHUFFLE(1, 1, 3, 3));
+        sum = _mm_add_ps(vec1, vec0);
+        _mm_store_ss(&r, sum);
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
+
+#else
+       {
+       float32x2_t vec0_h, vec0_l, vec1;
+
+       vec0_h = vget_high_f32(sum);
+       vec0_l = vget_low_f32(sum);
+       vec1 = vpadd_f32(vec0_h, vec0_l);
+       vec1 = vpadd_f32(vec1, vec1);
+       vst1_lane_f32(&r, vec1, 0);
+
+       arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
+       }
+#endif
+    }
+#if defined(USE_AVX)
+    _mm256_zeroupper();
+#endif
+}
+
+static void
+EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], float arOutput[], float *saveAr)
+{
+    const unsigned int cHidden = pnn->cHidden;
+    unsigned int i, j;
+    float *prWeight;
+#if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
+#if defined(USE_FMA3)
+    float_vector vec0, vec1, scalevec, sum;
+#else
+    float_vector vec0, vec1, vec3, scalevec, sum;
+#endif
 #endif
 
     /* Calculate activity at hidden nodes */
@@ -387,21 +607,14 @@ EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], f
             else {
                 float *pr = ar;
 
-#if defined(USE_FMA3)
-                scalevec = _mm256_set1_ps(ari);
-                INPUT_MULTADD();
-#elif defined(USE_NEON)
-                scalevec = vdupq_n_f32(ari);
+#if defined(USE_FMA3) || defined(USE_NEON)
+                scalevec = VEC_SET1(ari);
                 INPUT_MULTADD();
 #else
                 if (unlikely(ari == 1.0f)) {
                     INPUT_ADD();
                 } else {
-#if defined(USE_AVX)
-                    scalevec = _mm256_set1_ps(ari);
-#elif defined(HAVE_SSE)
-                    scalevec = _mm_set1_ps(ari);
-#endif
+                    scalevec = VEC_SET1(ari);
                     INPUT_MULTADD();
                 }
 #endif
@@ -417,13 +630,7 @@ EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], f
                 else {
                     float *pr = ar;
 
-#if defined(USE_AVX)
-                    scalevec = _mm256_set1_ps(ari);
-#elif defined(HAVE_SSE)
-                    scalevec = _mm_set1_ps(ari);
-#else
-                    scalevec = vdupq_n_f32(ari);
-#endif
+                    scalevec = VEC_SET1(ari);
                     INPUT_MULTADD();
                 }
             }
@@ -437,148 +644,151 @@ EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], f
                 prWeight += cHidden;
             else {
                 float *pr = ar;
-#if defined(USE_FMA3)
-                scalevec = _mm256_set1_ps(ari);
-                INPUT_MULTADD();
-#elif defined(USE_NEON)
-                scalevec = vdupq_n_f32(ari);
+#if defined(USE_FMA3) || defined(USE_NEON)
+                scalevec = VEC_SET1(ari);
                 INPUT_MULTADD();
 #else
                 if (likely(ari == 1.0f)) {
                     INPUT_ADD();
                 } else {
-#if defined(USE_AVX)
-                    scalevec = _mm256_set1_ps(ari);
-#elif defined(HAVE_SSE)
-                    scalevec = _mm_set1_ps(ari);
-#endif
+                    scalevec = VEC_SET1(ari);
                     INPUT_MULTADD();
                 }
 #endif
             }
         }
 
-#if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
-#if defined(USE_AVX)
-    scalevec = _mm256_set1_ps(pnn->rBetaHidden);
-#elif defined(HAVE_SSE)
-    scalevec = _mm_set1_ps(pnn->rBetaHidden);
-#else
-    scalevec = vdupq_n_f32(pnn->rBetaHidden);
-#endif
-
-    for (par = ar, i = (cHidden >> LOG2VEC_SIZE); i; i--, par += VEC_SIZE) {
-#if defined(USE_AVX)
-        float_vector vec = _mm256_load_ps(par);
-        vec = _mm256_mul_ps(vec, scalevec);
-        vec = sigmoid_ps(vec);
-        _mm256_store_ps(par, vec);
-#elif defined(HAVE_SSE)
-        float_vector vec = _mm_load_ps(par);
-        vec = _mm_mul_ps(vec, scalevec);
-        vec = sigmoid_ps(vec);
-        _mm_store_ps(par, vec);
-#else
-        float_vector vec = vld1q_f32(par);
-        vec = vmulq_f32(vec, scalevec);
-        vec = sigmoid_ps(vec);
-        vst1q_f32(par, vec);
-#endif
-    }
-#else
-    for (i = 0; i < cHidden; i++)
-        ar[i] = sigmoid(-pnn->rBetaHidden * ar[i]);
-#endif
-
-    /* Calculate activity at output nodes */
-    prWeight = pnn->arOutputWeight;
+    if (saveAr)
+        memcpy(saveAr, ar, cHidden * sizeof(*saveAr));
 
-    for (i = 0; i < pnn->cOutput; i++) {
+    EvaluateOutputSSE(pnn, ar, arOutput);
+}
 
-#if defined(USE_AVX)
-        SSE_ALIGN(float r[8]);
-#else
-        float r;
-#endif
-        float *pr = ar;
-#if defined(USE_AVX)
-        sum = _mm256_setzero_ps();
-#elif defined(HAVE_SSE)
-        sum = _mm_setzero_ps();
-#else
-        sum = vdupq_n_f32(0.0f);
-#endif
-        for (j = (cHidden >> LOG2VEC_SIZE); j; j--, prWeight += VEC_SIZE, pr += VEC_SIZE) {
-#if defined(USE_AVX)
-            vec0 = _mm256_load_ps(pr);  /* Eight floats into vec0 */
-            vec1 = _mm256_load_ps(prWeight);    /* Eight weights into vec1 */
+/* Evaluate cBatch positions at once.  The hidden layer is accumulated
+ * input by input across the whole batch, so each row of weights is
+ * fetched from memory once per batch instead of once per position.
+ * With arBaseInput[] the hidden layer starts from arBase[], the sums
+ * saved for those inputs, and only the differences are applied. */
+static void
+EvaluateBatchSSE(const neuralnet * restrict pnn, const float arInput[], const float *arBaseInput,
+                 const float *arBase, float ar[], float arOutput[], unsigned int cBatch)
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cInput = pnn->cInput;
+    const float *prWeightRow = pnn->arHiddenWeight;
+    unsigned int i, j, k;
+#if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
 #if defined(USE_FMA3)
-            sum = _mm256_fmadd_ps(vec0, vec1, sum);
+    float_vector vec0, vec1, scalevec, sum;
 #else
-            vec3 = _mm256_mul_ps(vec0, vec1);   /* Multiply */
-            sum = _mm256_add_ps(sum, vec3);     /* Add */
+    float_vector vec0, vec1, vec3, scalevec, sum;
 #endif
-#elif defined(HAVE_SSE)
-            vec0 = _mm_load_ps(pr);     /* Four floats into vec0 */
-            vec1 = _mm_load_ps(prWeight);       /* Four weights into vec1 */
-            vec3 = _mm_mul_ps(vec0, vec1);      /* Multiply */
-            sum = _mm_add_ps(sum, vec3);        /* Add */
-#else
-            vec0 = vld1q_f32(pr);     /* Four floats into vec0 */
-            vec1 = vld1q_f32(prWeight);       /* Four weights into vec1 */
-            vec3 = vmulq_f32(vec0, vec1);      /* Multiply */
-            sum = vaddq_f32(sum, vec3);        /* Add */
 #endif
-        }
 
-#if defined(USE_AVX)
-        vec0 = _mm256_hadd_ps(sum, sum);
-        vec1 = _mm256_hadd_ps(vec0, vec0);
-        _mm256_store_ps(r, vec1);
+    /* Calculate activity at hidden nodes */
+    for (k = 0; k < cBatch; k++)
+        memcpy(ar + k * cHidden, arBase, cHidden * sizeof(float));
 
-        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r[0] + r[4] + pnn->arOutputThreshold[i]));
-#elif defined(HAVE_SSE)
-        vec0 = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
-        vec1 = _mm_add_ps(sum, vec0);
-        vec0 = _mm_shuffle_ps(vec1, vec1, _MM_SHUFFLE(1, 1, 3, 3));
-        sum = _mm_add_ps(vec1, vec0);
-        _mm_store_ss(&r, sum);
+    for (i = 0; i < cInput; i++, prWeightRow += cHidden) {
+        for (k = 0; k < cBatch; k++) {
+            float ari = arInput[k * cInput + i];
+            float *pr;
+            const float *prWeight;
 
-        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
+            if (arBaseInput)
+                ari -= arBaseInput[i];
 
-#else
-       {
-       float32x2_t vec0_h, vec0_l, vec1;
+            if (likely(ari == 0.0f))
+                continue;
 
-       vec0_h = vget_high_f32(sum);
-       vec0_l = vget_low_f32(sum);
-       vec1 = vpadd_f32(vec0_h, vec0_l);
-       vec1 = vpadd_f32(vec1, vec1);
-       vst1_lane_f32(&r, vec1, 0);
+            pr = ar + k * cHidden;
+            prWeight = prWeightRow;
 
-       arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
-       }
-#endif
+            if (ari == 1.0f) {
+                INPUT_ADD();
+            } else {
+                scalevec = VEC_SET1(ari);
+                INPUT_MULTADD();
+            }
+        }
     }
-#if defined(USE_AVX)
-    _mm256_zeroupper();
-#endif
-}
 
+    for (k = 0; k < cBatch; k++)
+        EvaluateOutputSSE(pnn, ar + k * cHidden, arOutput + k * pnn->cOutput);
+}
 
 extern int
-NeuralNetEvaluateSSE(const neuralnet * restrict pnn, /*lint -e{818} */ float arInput[],
-                     float arOutput[], NNState * UNUSED(pnState))
+NN_KERNEL(NeuralNetEvaluateSSE) (const neuralnet * restrict pnn, /*lint -e{818} */ float arInput[],
+                                 float arOutput[], NNState * pnState)
 {
     SSE_ALIGN(float ar[pnn->cHidden]);
 
+#if defined(USE_AVX512)
+    /* The smallest pruning net is narrower than a 512 bit vector */
+    if (pnn->cHidden & (VEC_SIZE - 1))
+        return NeuralNetEvaluateSSEAVX2(pnn, arInput, arOutput, pnState);
+#endif
+
 #if DEBUG_SSE
     g_assert(sse_aligned(arOutput));
     g_assert(sse_aligned(ar));
     g_assert(sse_aligned(arInput));
 #endif
 
-    EvaluateSSE(pnn, arInput, ar, arOutput);
+    switch (NNevalAction(pnState)) {
+    case NNEVAL_NONE:
+        EvaluateSSE(pnn, arInput, ar, arOutput, NULL);
+        break;
+    case NNEVAL_SAVE:
+        pnState->cSavedIBase = pnn->cInput;
+        memcpy(pnState->savedIBase, arInput, pnn->cInput * sizeof(float));
+        EvaluateSSE(pnn, arInput, ar, arOutput, pnState->savedBase);
+        break;
+    case NNEVAL_FROMBASE:
+        if (pnState->cSavedIBase != pnn->cInput)
+            EvaluateSSE(pnn, arInput, ar, arOutput, NULL);
+        else
+            EvaluateBatchSSE(pnn, arInput, pnState->savedIBase, pnState->savedBase, ar, arOutput, 1);
+        break;
+    }
+    return 0;
+}
+
+extern int
+NN_KERNEL(NeuralNetEvaluateBatch) (const neuralnet * restrict pnn, float arInput[], float arOutput[],
+                                   unsigned int cBatch, NNState * pnState)
+{
+    SSE_ALIGN(float ar[NN_BATCH_SIZE * pnn->cHidden]);
+    const float *arBaseInput = NULL;
+    const float *arBase = pnn->arHiddenThreshold;
+
+#if defined(USE_AVX512)
+    if (pnn->cHidden & (VEC_SIZE - 1))
+        return NeuralNetEvaluateBatchAVX2(pnn, arInput, arOutput, cBatch, pnState);
+#endif
+
+    if (pnState && pnState->state == NNSTATE_INCREMENTAL && cBatch) {
+        /* the first position becomes the base for the rest */
+        NN_KERNEL(NeuralNetEvaluateSSE) (pnn, arInput, arOutput, pnState);
+        arInput += pnn->cInput;
+        arOutput += pnn->cOutput;
+        cBatch--;
+    }
+
+    if (NNevalAction(pnState) == NNEVAL_FROMBASE && pnState->cSavedIBase == pnn->cInput) {
+        arBaseInput = pnState->savedIBase;
+        arBase = pnState->savedBase;
+    }
+
+    while (cBatch) {
+        unsigned int const c = MIN(cBatch, NN_BATCH_SIZE);
+
+        EvaluateBatchSSE(pnn, arInput, arBaseInput, arBase, ar, arOutput, c);
+
+        arInput += c * pnn->cInput;
+        arOutput += c * pnn->cOutput;
+        cBatch -= c;
+    }
     return 0;
 }
 
@@ -26,7 +26,13 @@
 #include <stdlib.h>
 #include "common.h"
 
-#if defined(USE_AVX)
+#if defined(USE_AVX512)
+#define ALIGN_SIZE 64
+#define VEC_SIZE 16
+#define LOG2VEC_SIZE 4
+#define float_vector __m512
+#define int_vector __m512i
+#elif defined(USE_AVX)
 #define ALIGN_SIZE 32
 #define VEC_SIZE 8
 #define LOG2VEC_SIZE 3
@@ -52,6 +58,14 @@
 #endif
 #endif
 
+/* Weights are shared by all the kernels SIMD_SelectKernel() may pick,
+ * so allocate them for the widest one */
+#if defined(USE_SIMD_DISPATCH)
+#define MALLOC_ALIGN_SIZE 64
+#else
+#define MALLOC_ALIGN_SIZE ALIGN_SIZE
+#endif
+
 #if defined(_MSC_VER)
 #define SSE_ALIGN(D) __declspec(align(ALIGN_SIZE)) D
 #else
@@ -31,6 +31,9 @@
 #include <errno.h>
 #include <locale.h>
 #include <glib/gstdio.h>
+#if defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#endif
 
 #include "eval.h"
 #include "positionid.h"
@@ -57,9 +60,6 @@ typedef struct {
     xhashent *phe;
 } xhash;
 
-
-static long cLookup;
-
 static int
 XhashPosition(xhash * ph, const int iKey)
 {
@@ -161,138 +161,247 @@ XhashLookup(xhash * ph, const unsigned int iKey)
 }
 
 
-static int
-OSLookup(const unsigned int iPos,
-         const int UNUSED(nPoints),
-         unsigned short int aProb[64], const int fGammon, const int fCompress, FILE * pfOutput, FILE * pfTmp)
-{
+/*
+ * The database is built in an image of the output file: the file itself
+ * mapped into memory where possible, otherwise a buffer that is written
+ * out at the end.  Positions are looked up straight in the image, so no
+ * temporary files or cache of earlier positions are needed.  The image
+ * starts at the beginning of the file, so a run writes one database.
+ */
 
-    unsigned int i, j;
-    unsigned char ac[128];
+typedef struct {
+    unsigned char *p;
+    size_t cb;
+    int fMapped;
+} dbimage;
 
-    g_assert(pfOutput != stdin);
+static void
+OpenImage(dbimage * pdi, FILE * output, const guint64 cb)
+{
+    if (cb > G_MAXSIZE) {
+        g_printerr(_("The database is too large (%" G_GUINT64_FORMAT " bytes) for this system\n"), cb);
+        exit(3);
+    }
 
-    if (fCompress) {
+    pdi->cb = (size_t) cb;
+    pdi->fMapped = FALSE;
 
-        long iOffset;
-        size_t nBytes;
-        unsigned int ioff, nz, ioffg = 0, nzg = 0;
-        unsigned short int us;
-        unsigned int index_entry_size = fGammon ? 8 : 6;
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+    if (!ftruncate(fileno(output), (off_t) cb)) {
+        void *p = mmap(NULL, cb, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(output), 0);
 
-        /* find offsets and no. of non-zero elements */
+        if (p != MAP_FAILED) {
+            pdi->p = (unsigned char *) p;
+            pdi->fMapped = TRUE;
+            return;
+        }
+    }
+#else
+    (void) output;
+#endif
+
+    if (!(pdi->p = (unsigned char *) g_try_malloc0(pdi->cb))) {
+        g_printerr(_("Not enough memory for the %" G_GUINT64_FORMAT " bytes of the database\n"), cb);
+        exit(3);
+    }
+}
 
-        if (fseek(pfOutput, 40 + iPos * index_entry_size, SEEK_SET) < 0) {
+static void
+CloseImage(dbimage * pdi, FILE * output, const size_t cb)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+    if (pdi->fMapped) {
+        if (munmap(pdi->p, pdi->cb) < 0 || ftruncate(fileno(output), (off_t) cb) < 0) {
             perror("output file");
-            exit(-1);
+            exit(3);
         }
+        return;
+    }
+#endif
 
-        if (fread(ac, 1, index_entry_size, pfOutput) < index_entry_size) {
-            if (errno)
-                perror("output file");
-            else
-                g_printerr(_("Error reading output file\n"));
-            exit(-1);
-        }
+    if (fwrite(pdi->p, 1, cb, output) != cb) {
+        perror("output file");
+        exit(3);
+    }
+    g_free(pdi->p);
+}
 
-        iOffset = ac[0] | ac[1] << 8 | ac[2] << 16 | ac[3] << 24;
 
-        nz = ac[4];
-        ioff = ac[5];
+/*
+ * Positions are generated in layers that depend only on earlier layers.
+ * The main thread and nThreads - 1 workers share out the positions of
+ * a layer and wait for each other before starting on the next one.
+ */
 
-        if (fGammon) {
-            nzg = ac[6];
-            ioffg = ac[7];
-        }
+typedef void (*layerfun) (void *pData, unsigned int i);
 
-        /* re-position at EOF */
+static int nThreads = 1;
 
-        if (fseek(pfOutput, 0L, SEEK_END) < 0) {
-            perror("output file");
-            exit(-1);
-        }
+#if defined(USE_MULTITHREAD)
+static struct {
+    Mutex lock;
+    Cond cond;
+    GThread *apThread[MAX_NUMTHREADS];
+    unsigned int iLayer;        /* bumped for every layer handed out */
+    unsigned int cBusy;         /* workers still on the current layer */
+    int fExit;
+    layerfun fun;
+    void *pData;
+    int c;                      /* positions in the current layer */
+    int iNext;                  /* next position to hand out */
+} pool;
 
-        /* read distributions */
+static void
+WorkLayer(void)
+{
+    int i;
 
-        iOffset = 2 * iOffset;
+    while ((i = MT_SafeIncCheck(&pool.iNext)) < pool.c)
+        pool.fun(pool.pData, (unsigned int) i);
+}
 
-        nBytes = 2 * (nz + nzg);
+static gpointer
+LayerWorker(gpointer p)
+{
+    ThreadLocalData *ptld = (ThreadLocalData *) p;
+    unsigned int iLayer = 0;
 
-        if (fseek(pfTmp, iOffset, SEEK_SET) < 0) {
-            perror("fseek'ing temporary file");
-            exit(-1);
-        }
+    TLSSetValue(td.tlsItem, (size_t) ptld);
 
-        /* read data */
+    Mutex_Lock(&pool.lock);
+    for (;;) {
+        while (pool.iLayer == iLayer && !pool.fExit)
+            Cond_Wait(&pool.cond, &pool.lock);
+        if (pool.fExit)
+            break;
+        iLayer = pool.iLayer;
+        Mutex_Release(&pool.lock);
 
-        if (fread(ac, 1, nBytes, pfTmp) < nBytes) {
-            if (errno)
-                perror("reading temporary file");
-            else
-                g_printerr(_("Error reading temporary file"));
-            exit(-1);
-        }
+        WorkLayer();
 
-        memset(aProb, 0, 128);
+        Mutex_Lock(&pool.lock);
+        if (!--pool.cBusy)
+            Cond_Broadcast(&pool.cond);
+    }
+    Mutex_Release(&pool.lock);
 
-        i = 0;
-        for (j = 0; j < nz; ++j, i += 2) {
-            us = (unsigned short) (ac[i] | ac[i + 1] << 8);
-            aProb[ioff + j] = us;
-        }
+    for (int i = 0; i < 3; i++) {
+        g_free(ptld->pnnState[i].savedBase);
+        g_free(ptld->pnnState[i].savedIBase);
+    }
+    g_free(ptld->pnnState);
+    g_free(ptld->aMoves);
+    g_free(ptld->pBearoffCache);
+    g_free(ptld->pMoveHash);
+    g_free(ptld->pCandidates);
+    g_free(ptld);
+
+    return NULL;
+}
 
-        /* if ( fGammon ) */
-        for (j = 0; j < nzg; ++j, i += 2) {
-            us = (unsigned short) (ac[i] | ac[i + 1] << 8);
-            aProb[32 + ioffg + j] = us;
-        }
+static void
+StartWorkers(void)
+{
+    InitMutex(&pool.lock);
+    InitCond(&pool.cond);
 
-        /* re-position at EOF */
+    for (int i = 1; i < nThreads; i++) {
+        ThreadLocalData *ptld = MT_CreateThreadLocalData(i);
 
-        if (fseek(pfTmp, 0L, SEEK_END) < 0) {
-            perror("fseek'ing to EOF on temporary file");
-            exit(-1);
+#if GLIB_CHECK_VERSION (2,32,0)
+        if (!(pool.apThread[i] = g_thread_try_new(NULL, LayerWorker, ptld, NULL))) {
+#else
+        if (!(pool.apThread[i] = g_thread_create(LayerWorker, ptld, TRUE, NULL))) {
+#endif
+            g_printerr(_("Failed to create thread\n"));
+            exit(2);
         }
+    }
+}
 
-    } else {
-
-        /* look up position by seeking */
+static void
+StopWorkers(void)
+{
+    Mutex_Lock(&pool.lock);
+    pool.fExit = TRUE;
+    Cond_Broadcast(&pool.cond);
+    Mutex_Release(&pool.lock);
 
-        if (fseek(pfOutput, 40 + iPos * (fGammon ? 128 : 64), SEEK_SET) < 0) {
-            g_printerr(_("Error seeking in pfOutput\n"));
-            exit(-1);
-        }
+    for (int i = 1; i < nThreads; i++)
+        g_thread_join(pool.apThread[i]);
 
-        /* read distribution */
+    FreeMutex(&pool.lock);
+    FreeCond(&pool.cond);
+}
+#endif
 
-        if (fread(ac, 1, fGammon ? 128U : 64U, pfOutput) < (fGammon ? 128U : 64U)) {
-            g_printerr(_("Error reading from pfOutput\n"));
-            exit(-1);
-        }
+static void
+RunLayer(layerfun fun, void *pData, const unsigned int c)
+{
+#if defined(USE_MULTITHREAD)
+    if (nThreads > 1 && c > 1) {
+        Mutex_Lock(&pool.lock);
+        pool.fun = fun;
+        pool.pData = pData;
+        pool.c = (int) c;
+        pool.iNext = 0;
+        pool.cBusy = (unsigned int) nThreads - 1;
+        pool.iLayer++;
+        Cond_Broadcast(&pool.cond);
+        Mutex_Release(&pool.lock);
+
+        WorkLayer();
+
+        Mutex_Lock(&pool.lock);
+        while (pool.cBusy)
+            Cond_Wait(&pool.cond, &pool.lock);
+        Mutex_Release(&pool.lock);
+        return;
+    }
+#endif
 
-        /* save distribution */
+    for (unsigned int i = 0; i < c; i++)
+        fun(pData, i);
+}
 
-        i = 0;
-        for (j = 0; j < 32; ++j, i += 2)
-            aProb[j] = (unsigned short) (ac[i] | ac[i + 1] << 8);
 
-        if (fGammon)
-            for (j = 0; j < 32; ++j, i += 2)
-                aProb[j + 32] = (unsigned short) (ac[i] | ac[i + 1] << 8);
+/*
+ * One-sided databases keep the distributions in position order, each in
+ * 32 (or 64 with gammons) little endian shorts as in an uncompressed
+ * file, until they are compressed at the end.
+ */
 
-        /* position cursor at end of file */
+typedef struct {
+    unsigned int nOS;
+    int fGammon;
+    bearoffcontext *pbc;
+    unsigned char *pDist;       /* distributions by position id */
+    unsigned int cbDist;        /* bytes per position */
+    const unsigned int *aiPos;  /* positions of the current layer */
+} osgen;
 
-        if (fseek(pfOutput, 0L, SEEK_END) < 0) {
-            g_printerr(_("Error seeking to end!\n"));
-            exit(-1);
-        }
+static void
+GetOS(const osgen * pog, const unsigned int iPos, unsigned short int aProb[64])
+{
+    const unsigned char *pch = pog->pDist + (size_t) iPos * pog->cbDist;
+    unsigned int i;
 
-    }
+    memset(aProb, 0, 128);
 
-    ++cLookup;
+    for (i = 0; i < pog->cbDist / 2; ++i, pch += 2)
+        aProb[i] = (unsigned short) (pch[0] | pch[1] << 8);
+}
 
-    return 0;
+static void
+PutOS(const osgen * pog, const unsigned int iPos, const unsigned short int aProb[64])
+{
+    unsigned char *pch = pog->pDist + (size_t) iPos * pog->cbDist;
+    unsigned int i;
 
+    for (i = 0; i < pog->cbDist / 2; ++i) {
+        *pch++ = aProb[i] & 0xFF;
+        *pch++ = aProb[i] >> 8;
+    }
 }
 
 
@@ -343,8 +452,7 @@ RollsOS(const unsigned short int aus[32])
 
 static void
 BearOff(int nId, unsigned int nPoints,
-        unsigned short int aOutProb[64],
-        const int fGammon, xhash * ph, bearoffcontext * pbc, const int fCompress, FILE * pfOutput, FILE * pfTmp)
+        unsigned short int aOutProb[64], const int fGammon, const osgen * pog, bearoffcontext * pbc)
 {
 #if !defined(G_DISABLE_ASSERT)
     int iBest;
@@ -433,12 +541,10 @@ BearOff(int nId, unsigned int nPoints,
                     pusj[0] = 0xFFFF;
                     pusj[32] = 0xFFFF;
 
-                } else if (!(pusj = XhashLookup(ph, j))) {
-                    /* look up in file generated so far */
+                } else {
+                    /* look up in the layers generated so far */
                     pusj = ausj;
-                    OSLookup(j, nPoints, pusj, fGammon, fCompress, pfOutput, pfTmp);
-
-                    XhashAdd(ph, j, pusj, fGammon ? 128 : 64);
+                    GetOS(pog, j, pusj);
                 }
 
                 /* find best move to win */
@@ -502,45 +608,44 @@ BearOff(int nId, unsigned int nPoints,
 
 
 static void
-WriteOS(const unsigned short int aus[32], const int fCompress, FILE * output)
+WriteOS(const unsigned short int aus[32], unsigned char **ppuch)
 {
 
     unsigned int iIdx, nNonZero;
     unsigned int j;
+    unsigned char *puch = *ppuch;
 
-    if (fCompress)
-        CalcIndex(aus, &iIdx, &nNonZero);
-    else {
-        iIdx = 0;
-        nNonZero = 32;
-    }
+    CalcIndex(aus, &iIdx, &nNonZero);
 
     for (j = iIdx; j < iIdx + nNonZero; j++) {
-        putc(aus[j] & 0xFF, output);
-        putc(aus[j] >> 8, output);
+        *puch++ = aus[j] & 0xFF;
+        *puch++ = aus[j] >> 8;
     }
 
+    *ppuch = puch;
+
 }
 
 static void
-WriteIndex(unsigned int *pnpos, const unsigned short int aus[64], const int fGammon, FILE * output)
+WriteIndex(unsigned int *pnpos, const unsigned short int aus[64], const int fGammon, unsigned char **ppuch)
 {
 
     unsigned int iIdx, nNonZero;
+    unsigned char *puch = *ppuch;
 
     /* write offset */
 
-    putc(*pnpos & 0xFF, output);
-    putc((*pnpos >> 8) & 0xFF, output);
-    putc((*pnpos >> 16) & 0xFF, output);
-    putc((*pnpos >> 24) & 0xFF, output);
+    *puch++ = *pnpos & 0xFF;
+    *puch++ = (*pnpos >> 8) & 0xFF;
+    *puch++ = (*pnpos >> 16) & 0xFF;
+    *puch++ = (*pnpos >> 24) & 0xFF;
 
     /* write index and number of non-zero elements */
 
     CalcIndex(aus, &iIdx, &nNonZero);
 
-    putc(nNonZero & 0xFF, output);
-    putc(iIdx & 0xFF, output);
+    *puch++ = nNonZero & 0xFF;
+    *puch++ = iIdx & 0xFF;
 
     *pnpos += nNonZero;
 
@@ -548,10 +653,12 @@ WriteIndex(unsigned int *pnpos, const unsigned short int aus[64], const int fGam
 
     if (fGammon) {
         CalcIndex(aus + 32, &iIdx, &nNonZero);
-        putc(nNonZero & 0xFF, output);
-        putc(iIdx & 0xFF, output);
+        *puch++ = nNonZero & 0xFF;
+        *puch++ = iIdx & 0xFF;
         *pnpos += nNonZero;
     }
+
+    *ppuch = puch;
 }
 
 static void
@@ -570,127 +677,272 @@ WriteFloat(const float r, FILE * output)
 
 
 
+static void
+BearOffLayer(void *p, const unsigned int i)
+{
+    const osgen *pog = (const osgen *) p;
+    unsigned short int aus[64];
+
+    BearOff(pog->aiPos[i], pog->nOS, aus, pog->fGammon, pog, pog->pbc);
+    PutOS(pog, pog->aiPos[i], aus);
+}
+
+
 /*
  * Generate one sided bearoff database
  *
+ * The positions are generated in layers of equal pip count, as a move
+ * always leads to a position with fewer pips.  The distributions are
+ * kept uncompressed in the image of the output file and compressed in
+ * place at the end:
+ *
  * ! fCompress:
- *   write database directly to stdout
+ *   header, distributions
  *
  * fCompress:
- *   write index directly to stdout
- *   and write actual db to tmp file
- *   the tmp file is concatenated to the index when
- *   the generation is done.
+ *   header, index, distributions (as far as non-zero)
  *
  */
 
 
 static int
 generate_os(const int nOS, const int fHeader,
-            const int fCompress, const int fGammon, const int nHashSize, bearoffcontext * pbc, FILE * output)
+            const int fCompress, const int fGammon, bearoffcontext * pbc, FILE * output)
 {
 
-    int i;
-    int n;
+    unsigned int i;
+    unsigned int n;
     unsigned short int aus[64];
-    xhash h;
-    FILE *pfTmp = NULL;
     unsigned int npos;
-    char *tmpfile = NULL;
+    unsigned int cbHeader = fHeader ? 40 : 0;
+    unsigned int cbIndex;
+    unsigned int acLayer[15 * 13 + 2] = { 0 };
+    unsigned char *auchPips;
+    unsigned int *aiPos;
+    unsigned int nPips;
+    size_t cb;
+    dbimage di;
+    osgen og;
     int fTTY = isatty(STDERR_FILENO);
 
-    /* initialise xhash */
+    n = Combination(nOS + 15, nOS);
+    cbIndex = fCompress ? n * (fGammon ? 8 : 6) : 0;
 
-    if (XhashCreate(&h, nHashSize / (fGammon ? 128 : 64))) {
-        g_printerr(_("Error creating xhash with %d elements\n"), nHashSize / (fGammon ? 128 : 64));
-        exit(2);
-    }
+    og.nOS = nOS;
+    og.fGammon = fGammon;
+    og.pbc = pbc;
+    og.cbDist = fGammon ? 128 : 64;
 
-    XhashStatus(&h);
+    OpenImage(&di, output, cbHeader + cbIndex + (guint64) n * og.cbDist);
+    og.pDist = di.p + cbHeader + cbIndex;
 
     /* write header */
 
     if (fHeader) {
         char sz[41];
         sprintf(sz, "gnubg-OS-%02d-15-%1d-%1d-0xxxxxxxxxxxxxxxxxxx\n", nOS, fGammon, fCompress);
-        fputs(sz, output);
+        memcpy(di.p, sz, 40);
     }
 
-    if (fCompress) {
-        pfTmp = GetTemporaryFile(NULL, &tmpfile);
-        if (pfTmp == NULL) {
-            g_printerr(_("Error creating temporary file\n"));
-            exit(2);
-        }
+    /* sort the positions into layers by pip count */
+
+    auchPips = g_new(unsigned char, n);
+    aiPos = g_new(unsigned int, n);
+
+    for (i = 0; i < n; ++i) {
+        unsigned int anBoard[25];
+        int j;
+
+        PositionFromBearoff(anBoard, i, nOS, 15);
+        for (j = 0, nPips = 0; j < nOS; ++j)
+            nPips += anBoard[j] * (j + 1);
+        auchPips[i] = (unsigned char) nPips;
+        acLayer[nPips + 1]++;
     }
+    for (nPips = 1; nPips < G_N_ELEMENTS(acLayer); nPips++)
+        acLayer[nPips] += acLayer[nPips - 1];
+    for (i = 0; i < n; ++i)
+        aiPos[acLayer[auchPips[i]]++] = i;
+    for (nPips = G_N_ELEMENTS(acLayer) - 1; nPips > 0; nPips--)
+        acLayer[nPips] = acLayer[nPips - 1];
+    acLayer[0] = 0;
 
+    g_free(auchPips);
 
-    /* loop trough bearoff positions */
+    /* loop through the layers */
 
-    n = Combination(nOS + 15, nOS);
-    npos = 0;
+    for (nPips = 0; nPips <= 15 * (unsigned int) nOS; ++nPips) {
 
+        og.aiPos = aiPos + acLayer[nPips];
+        RunLayer(BearOffLayer, &og, acLayer[nPips + 1] - acLayer[nPips]);
 
-    for (i = 0; i < n; ++i) {
+        if (fTTY)
+            g_printerr("%u/%u\r", acLayer[nPips + 1], n);
 
-        if (i)
-            BearOff(i, nOS, aus, fGammon, &h, pbc, fCompress, output, pfTmp);
-        else {
-            memset(aus, 0, 128);
-            aus[0] = 0xFFFF;
-            aus[32] = 0xFFFF;
+    }
+    putc('\n', stderr);
+
+    g_free(aiPos);
+
+    /* compress in place: the compressed distributions of the positions up
+     * to i never take more room than the uncompressed ones */
+
+    if (fCompress) {
+
+        unsigned char *puchIndex = di.p + cbHeader;
+        unsigned char *puchData = og.pDist;
+
+        for (i = 0, npos = 0; i < n; ++i) {
+            GetOS(&og, i, aus);
+
+            WriteIndex(&npos, aus, fGammon, &puchIndex);
+
+            WriteOS(aus, &puchData);
+            if (fGammon)
+                WriteOS(aus + 32, &puchData);
         }
-        if (!(i % 100) && fTTY)
-            g_printerr("%d/%d\r", i, n);
 
-        WriteOS(aus, fCompress, fCompress ? pfTmp : output);
-        if (fGammon)
-            WriteOS(aus + 32, fCompress, fCompress ? pfTmp : output);
+        cb = (size_t) (puchData - di.p);
+
+    } else
+        cb = di.cb;
+
+    CloseImage(&di, output, cb);
+
+    return 0;
+
+}
+
 
-        XhashAdd(&h, i, aus, fGammon ? 128 : 64);
+/*
+ * Rewrite a compressed one-sided database so that the distributions of
+ * the positions with all chequers in the home board come first, ordered
+ * by pip count, followed by the others in the same order.  Both groups
+ * start on a page boundary and the header records where the first ends
+ * ("-H" and its file offset in hex), so that gnubg can prefetch header,
+ * index and hot distributions in one go.  Readers that do not know the
+ * "-H" mark find the distributions through the index as always.
+ */
 
-        if (fCompress)
-            WriteIndex(&npos, aus, fGammon, output);
+#define BEAROFF_PAGE_SIZE 4096
+#define COLD_KEY (15 * 13 + 1)
 
+static void
+RelayoutOS(const int nOS, const int fGammon, FILE * output)
+{
+    unsigned int const nPos = Combination(nOS + 15, nOS);
+    unsigned int const index_entry_size = fGammon ? 8 : 6;
+    unsigned int const nBase = 40 + nPos * index_entry_size;
+    unsigned int const nHome = MIN(nOS, 6);
+    unsigned int acKey[2 * COLD_KEY + 1] = { 0 };
+    unsigned short *ausKey = g_new(unsigned short, nPos);
+    unsigned int *aiOrder = g_new(unsigned int, nPos);
+    unsigned int *aiOffset = g_new(unsigned int, nPos);
+    unsigned int i, nPad, nHotEnd, nEnd;
+    unsigned char *puch;
+    long cb;
+
+    /* read back the database */
+
+    if (fflush(output) || fseek(output, 0L, SEEK_END) < 0 || (cb = ftell(output)) < 0 || fseek(output, 0L, SEEK_SET) < 0) {
+        perror("output file");
+        exit(3);
+    }
+    puch = g_malloc((gsize) cb);
+    if (fread(puch, 1, (size_t) cb, output) < (size_t) cb) {
+        perror("output file");
+        exit(3);
     }
 
-    if (fCompress) {
+    /* order the positions by (not in home board, pip count, id) */
 
-        char ac[256];
-        size_t u;
-        /* write contents of pfTmp to output */
+    for (i = 0; i < nPos; i++) {
+        unsigned int anBoard[25];
+        unsigned int j, nPips = 0, fHot = TRUE;
 
-        errno = 0;
-        rewind(pfTmp);
-        if (errno != 0) {
-            g_printerr(_("Error rewinding '%s'\n"), tmpfile);
-            exit(3);
+        PositionFromBearoff(anBoard, i, nOS, 15);
+        for (j = 0; j < (unsigned int) nOS; j++) {
+            nPips += anBoard[j] * (j + 1);
+            if (j >= nHome && anBoard[j])
+                fHot = FALSE;
         }
+        ausKey[i] = (unsigned short) ((fHot ? 0 : COLD_KEY) + nPips);
+        acKey[ausKey[i] + 1]++;
+    }
+    for (i = 1; i < G_N_ELEMENTS(acKey); i++)
+        acKey[i] += acKey[i - 1];
+    for (i = 0; i < nPos; i++)
+        aiOrder[acKey[ausKey[i]]++] = i;
 
-        while (!feof(pfTmp) && (u = fread(ac, 1, sizeof(ac), pfTmp))) {
-            if (fwrite(ac, 1, u, output) != u) {
-                g_printerr(_("Error writing to '%s'\n"), tmpfile);
-                exit(3);
+    /* place them, padding each group to a page unless that makes the
+     * offsets fail the sanity check of the readers */
+
+    for (nPad = BEAROFF_PAGE_SIZE;; nPad = 2) {
+        unsigned int n = ((nBase + nPad - 1) / nPad * nPad - nBase) / 2;
+
+        nHotEnd = 0;
+        for (i = 0; i < nPos; i++) {
+            unsigned char *pch = puch + 40 + aiOrder[i] * index_entry_size;
+
+            if (!nHotEnd && ausKey[aiOrder[i]] >= COLD_KEY) {
+                nHotEnd = nBase + 2 * n;
+                n = ((nHotEnd + nPad - 1) / nPad * nPad - nBase) / 2;
             }
+            aiOffset[aiOrder[i]] = n;
+            n += pch[4] + (fGammon ? pch[6] : 0);
         }
+        nEnd = nBase + 2 * n;
+        if (!nHotEnd)
+            nHotEnd = nEnd;
 
-        if (ferror(pfTmp))
-            exit(3);
+        if (n <= 64 * nPos || nPad == 2)
+            break;
+    }
 
-        fclose(pfTmp);
+    /* write it out again */
+
+    if (fseek(output, 0L, SEEK_SET) < 0) {
+        perror("output file");
+        exit(3);
+    }
 
-        g_unlink(tmpfile);
-        g_free(tmpfile);
+    fwrite(puch, 1, 20, output);
+    fprintf(output, "-H%08x%.9s\n", nHotEnd, "xxxxxxxxx");
 
+    for (i = 0; i < nPos; i++) {
+        unsigned char *pch = puch + 40 + i * index_entry_size;
+
+        putc(aiOffset[i] & 0xFF, output);
+        putc((aiOffset[i] >> 8) & 0xFF, output);
+        putc((aiOffset[i] >> 16) & 0xFF, output);
+        putc((aiOffset[i] >> 24) & 0xFF, output);
+        fwrite(pch + 4, 1, index_entry_size - 4, output);
     }
-    putc('\n', stderr);
 
-    XhashStatus(&h);
+    for (i = 0; i < nPos; i++) {
+        unsigned char *pch = puch + 40 + aiOrder[i] * index_entry_size;
+        unsigned int iOld = (unsigned int) (pch[0] | pch[1] << 8 | pch[2] << 16 | pch[3] << 24);
+        long iNew = nBase + 2 * (long) aiOffset[aiOrder[i]];
 
-    XhashDestroy(&h);
+        while (ftell(output) < iNew)
+            putc(0, output);
+        fwrite(puch + nBase + 2 * iOld, 1, 2 * (pch[4] + (fGammon ? pch[6] : 0)), output);
+    }
 
-    return 0;
+    while (ftell(output) < (long) nEnd)
+        putc(0, output);
+
+    if (fflush(output)) {
+        perror("output file");
+        exit(3);
+    }
+
+    g_printerr("%-37s: %12u\n", _("Hot region ends at"), nHotEnd);
 
+    g_free(puch);
+    g_free(aiOffset);
+    g_free(aiOrder);
+    g_free(ausKey);
 }
 
 
@@ -908,67 +1160,30 @@ CubeEquity(const short int siND, const short int siDT, const short int siDP)
 
 }
 
-static int
-CalcPosition(const int i, const int j, const int n)
-{
-
-    int k;
-
-    if (i + j < n)
-        k = (i + j) * (i + j + 1) / 2 + j;
-    else
-        k = n * n - CalcPosition(n - 1 - i, n - 1 - j, n - 1) - 1;
-
-#if 0
-    if (n == 6) {
-        g_printerr("%2d ", k);
-        if (j == n - 1)
-            g_printerr("\n");
-    }
-#endif
-
-    return k;
-
-}
-
+/*
+ * Two-sided databases are generated in the image of the output file
+ * with the equities in their final place: row nUs, column nThem.
+ * Position (nUs, nThem) depends only on positions (nThem, j) with j <
+ * nUs, so the layers are the positions of equal nUs + nThem.
+ */
 
+typedef struct {
+    int nTSP, nTSC, n, fCubeful;
+    bearoffcontext *pbc;
+    unsigned char *p;           /* equities */
+    int nSum;                   /* nUs + nThem of the current layer */
+    int nThemFirst;             /* nThem of its first position */
+} tsgen;
 
 static void
-TSLookup(const int nUs, const int nThem,
-         const int UNUSED(nTSP), const int UNUSED(nTSC),
-         short int arEquity[4], const int n, const int fCubeful, FILE * pfTmp)
+TSLookup(const tsgen * ptg, const int nUs, const int nThem, short int arEquity[4])
 {
 
-    int iPos = CalcPosition(nUs, nThem, n);
-    unsigned char ac[8];
+    const unsigned char *pch = ptg->p + ((size_t) nUs * ptg->n + nThem) * (ptg->fCubeful ? 8 : 2);
     int i;
 
-    /* seek to position */
-
-    if (fseek(pfTmp, iPos * (fCubeful ? 8 : 2), SEEK_SET) < 0) {
-        perror("temporary file");
-        exit(-1);
-    }
-
-    if (fread(ac, 1, 8, pfTmp) < 8) {
-        if (errno)
-            perror("temporary file");
-        else
-            g_printerr(_("Error reading temporary file\n"));
-        exit(-1);
-    }
-
-    /* re-position at EOF */
-
-    if (fseek(pfTmp, 0L, SEEK_END) < 0) {
-        perror("temporary file");
-        exit(-1);
-    }
-
-    for (i = 0; i < (fCubeful ? 4 : 1); ++i)
-        arEquity[i] = (unsigned short) ((ac[2 * i] | ac[2 * i + 1] << 8) - 0x8000);
-
-    ++cLookup;
+    for (i = 0; i < (ptg->fCubeful ? 4 : 1); ++i)
+        arEquity[i] = (unsigned short) ((pch[2 * i] | pch[2 * i + 1] << 8) - 0x8000);
 
 }
 
@@ -985,7 +1200,7 @@ TSLookup(const int nUs, const int nThem,
 static void
 BearOff2(int nUs, int nThem,
          const int nTSP, const int nTSC,
-         short int asiEquity[4], const int n, const int fCubeful, xhash * ph, bearoffcontext * pbc, FILE * pfTmp)
+         short int asiEquity[4], const int fCubeful, const tsgen * ptg, bearoffcontext * pbc)
 {
 
     int j, anRoll[2];
@@ -1061,17 +1276,9 @@ BearOff2(int nUs, int nThem,
                 g_assert(j >= 0);
                 g_assert(j < nUs);
 
-                if (!nThem) {
-                    asij[0] = asij[1] = asij[2] = asij[3] = EQUITY_P1;
-                } else if (!j) {
-                    asij[0] = asij[1] = asij[2] = asij[3] = EQUITY_M1;
-                }
-                if (!(psij = XhashLookup(ph, n * nThem + j))) {
-                    /* lookup in file */
-                    psij = asij;
-                    TSLookup(nThem, j, nTSP, nTSC, psij, n, fCubeful, pfTmp);
-                    XhashAdd(ph, n * nThem + j, psij, fCubeful ? 8 : 2);
-                }
+                /* look up in the layers generated so far */
+                psij = asij;
+                TSLookup(ptg, nThem, j, psij);
 
                 /* cubeless */
 
@@ -1142,127 +1349,81 @@ BearOff2(int nUs, int nThem,
 
 
 static void
-WriteEquity(FILE * pf, const short int si)
+WriteEquity(unsigned char *puch, const short int si)
 {
 
     unsigned short int us = (unsigned short int) (si + 0x8000);
 
-    putc(us & 0xFF, pf);
-    putc((us >> 8) & 0xFF, pf);
+    puch[0] = us & 0xFF;
+    puch[1] = (us >> 8) & 0xFF;
+
+}
+
+static void
+BearOff2Layer(void *p, const unsigned int i)
+{
+    const tsgen *ptg = (const tsgen *) p;
+    int nThem = ptg->nThemFirst + (int) i;
+    int nUs = ptg->nSum - nThem;
+    unsigned char *puch = ptg->p + ((size_t) nUs * ptg->n + nThem) * (ptg->fCubeful ? 8 : 2);
+    short int asiEquity[4];
+    int k;
+
+    BearOff2(nUs, nThem, ptg->nTSP, ptg->nTSC, asiEquity, ptg->fCubeful, ptg, ptg->pbc);
 
+    for (k = 0; k < (ptg->fCubeful ? 4 : 1); ++k)
+        WriteEquity(puch + 2 * k, asiEquity[k]);
 }
 
 static void
 generate_ts(const int nTSP, const int nTSC,
-            const int fHeader, const int fCubeful, const int nHashSize, bearoffcontext * pbc, FILE * output)
+            const int fHeader, const int fCubeful, bearoffcontext * pbc, FILE * output)
 {
 
-    int i, j, k;
-    int iPos;
     int n;
-    short int asiEquity[4];
-    xhash h;
-    FILE *pfTmp;
-    unsigned char ac[8];
-    char *tmpfile;
+    unsigned int cbHeader = fHeader ? 40 : 0;
+    unsigned int iPos;
+    dbimage di;
+    tsgen tg;
     int fTTY = isatty(STDERR_FILENO);
 
-    pfTmp = GetTemporaryFile(NULL, &tmpfile);
-    if (pfTmp == NULL) {
-        g_printerr(_("Error creating temporary file\n"));
-        exit(2);
-    }
-
-    /* initialise xhash */
+    n = Combination(nTSP + nTSC, nTSC);
 
-    if (XhashCreate(&h, nHashSize / (fCubeful ? 8 : 2))) {
-        g_printerr(_("Error creating xhash with %d elements\n"), nHashSize / (fCubeful ? 8 : 2));
-        exit(2);
-    }
+    tg.nTSP = nTSP;
+    tg.nTSC = nTSC;
+    tg.n = n;
+    tg.fCubeful = fCubeful;
+    tg.pbc = pbc;
 
-    XhashStatus(&h);
+    OpenImage(&di, output, cbHeader + (guint64) n * n * (fCubeful ? 8 : 2));
+    tg.p = di.p + cbHeader;
 
     /* write header information */
 
     if (fHeader) {
         char sz[41];
         sprintf(sz, "gnubg-TS-%02d-%02d-%1dxxxxxxxxxxxxxxxxxxxxxxx\n", nTSP, nTSC, fCubeful);
-        fputs(sz, output);
+        memcpy(di.p, sz, 40);
     }
 
 
     /* generate bearoff database */
 
-    n = Combination(nTSP + nTSC, nTSC);
     iPos = 0;
 
+    for (tg.nSum = 0; tg.nSum <= 2 * n - 2; ++tg.nSum) {
 
-    /* positions above diagonal */
-
-    for (i = 0; i < n; i++) {
-        for (j = 0; j <= i; j++, ++iPos) {
-
-            BearOff2(i - j, j, nTSP, nTSC, asiEquity, n, fCubeful, &h, pbc, pfTmp);
-
-            for (k = 0; k < (fCubeful ? 4 : 1); ++k)
-                WriteEquity(pfTmp, asiEquity[k]);
-
-            XhashAdd(&h, (i - j) * n + j, asiEquity, fCubeful ? 8 : 2);
+        tg.nThemFirst = MAX(0, tg.nSum - n + 1);
+        RunLayer(BearOff2Layer, &tg, (unsigned int) (MIN(tg.nSum, n - 1) - tg.nThemFirst + 1));
 
-        }
+        iPos += (unsigned int) (MIN(tg.nSum, n - 1) - tg.nThemFirst + 1);
         if (fTTY)
-            g_printerr("%d/%d\r", iPos, n * n);
-    }
-
-    /* positions below diagonal */
-
-    for (i = 0; i < n; i++) {
-        for (j = i + 1; j < n; j++, ++iPos) {
-
-            BearOff2(i + n - j, j, nTSP, nTSC, asiEquity, n, fCubeful, &h, pbc, pfTmp);
-
-            for (k = 0; k < (fCubeful ? 4 : 1); ++k)
-                WriteEquity(pfTmp, asiEquity[k]);
-
-            XhashAdd(&h, (i + n - j) * n + j, asiEquity, fCubeful ? 8 : 2);
-
-        }
-        if (fTTY)
-            g_printerr("%d/%d\r", iPos, n * n);
+            g_printerr("%u/%u\r", iPos, (unsigned int) (n * n));
     }
 
     putc('\n', stderr);
-    XhashStatus(&h);
-
-    XhashDestroy(&h);
-
-    /* sort file from ordering:
-     * 
-     * 136       123
-     * 258  to   456 
-     * 479       789 
-     * 
-     */
-
-    for (i = 0; i < n; ++i) {
-        for (j = 0; j < n; ++j) {
-            unsigned int count = fCubeful ? 8 : 2;
-
-            k = CalcPosition(i, j, n);
-
-            fseek(pfTmp, count * k, SEEK_SET);
-            if (fread(ac, 1, count, pfTmp) != count || fwrite(ac, 1, count, output) != count) {
-                g_printerr(_("failed to read from or write to database file\n"));
-                exit(3);
-            }
-        }
-
-    }
-
-    fclose(pfTmp);
 
-    g_unlink(tmpfile);
-    g_free(tmpfile);
+    CloseImage(&di, output, di.cb);
 
 }
 
@@ -1279,6 +1440,7 @@ main(int argc, char **argv)
     static int fCubeful = TRUE;
     static char *szOldBearoff = NULL;
     static int fND = FALSE;
+    static int fHotFirst = FALSE;
     static char *szOutput = NULL;
     static char *szTwoSided = NULL;
 
@@ -1293,7 +1455,9 @@ main(int argc, char **argv)
         {"one-sided", 'o', 0, G_OPTION_ARG_INT, &nOS,
          N_("Number of points (P) for one-sided database"), "P"},
         {"xhash-size", 's', 0, G_OPTION_ARG_INT, &nHashSize,
-         N_("Use cache of size N bytes"), "N"},
+         N_("Use cache of size N bytes for normal distribution databases"), "N"},
+        {"threads", 'j', 0, G_OPTION_ARG_INT, &nThreads,
+         N_("Generate with N threads (default: number of processors)"), "N"},
         {"old-bearoff", 'O', 0, G_OPTION_ARG_STRING, &szOldBearoff,
          N_("Reuse already generated bearoff database \"filename\""), "filename"},
         {"no-header", 'H', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &fHeader,
@@ -1304,6 +1468,8 @@ main(int argc, char **argv)
          N_("Do not use compression scheme for one-sided databases"), NULL},
         {"no-gammon", 'g', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &fGammon,
          N_("Do not include gammon distribution for one-sided databases"), NULL},
+        {"hot-first", 0, 0, G_OPTION_ARG_NONE, &fHotFirst,
+         N_("Store home board positions first and page aligned in one-sided databases"), NULL},
         {"normal-dist", 'n', 0, G_OPTION_ARG_NONE, &fND,
          N_("Approximate one-sided bearoff database with normal distributions"), NULL},
         {"outfile", 'f', 0, G_OPTION_ARG_STRING, &szOutput,
@@ -1324,6 +1490,10 @@ main(int argc, char **argv)
 
     g_set_printerr_handler(print_utf8_to_locale);
 
+#if defined(USE_MULTITHREAD) && GLIB_CHECK_VERSION (2,36,0)
+    nThreads = (int) g_get_num_processors();
+#endif
+
     context = g_option_context_new(NULL);
     g_option_context_add_main_entries(context, ao, PACKAGE);
     g_option_context_parse(context, &argc, &argv, &error);
@@ -1341,11 +1511,22 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    if (nOS && nTSP && nTSC) {
+        g_printerr(_("One-sided and two-sided databases must be written to separate files\n"));
+        exit(EXIT_FAILURE);
+    }
+
     if (!(outfile = g_fopen(szOutput, "w+b"))) {
         perror(szOutput);
         return EXIT_FAILURE;
     }
 
+    nThreads = CLAMP(nThreads, 1, MAX_NUMTHREADS);
+#if defined(USE_MULTITHREAD)
+    if (nThreads > 1)
+        StartWorkers();
+#endif
+
     /* one sided database */
 
     if (nOS) {
@@ -1362,7 +1543,11 @@ main(int argc, char **argv)
         g_printerr("%-37s: %12s\n", _("Include gammon distributions"), fGammon ? _("yes") : _("no"));
         g_printerr("%-37s: %12s\n", _("Use compression scheme"), fCompress ? _("yes") : _("no"));
         g_printerr("%-37s: %12s\n", _("Write header"), fHeader ? _("yes") : _("no"));
-        g_printerr("%-37s: %12d\n", _("Size of cache"), nHashSize);
+        g_printerr("%-37s: %12s\n", _("Hot-first layout"), fHotFirst ? _("yes") : _("no"));
+        if (fND)
+            g_printerr("%-37s: %12d\n", _("Size of cache"), nHashSize);
+        else
+            g_printerr("%-37s: %12d\n", _("Number of threads"), nThreads);
         g_printerr("%-37s: %12s %s\n", _("Reuse old bearoff database"), szOldBearoff ? _("yes") : _("no"),
                 szOldBearoff ? szOldBearoff : "");
 
@@ -1394,12 +1579,16 @@ main(int argc, char **argv)
         if (fND) {
             generate_nd(nOS, nHashSize, fHeader, pbc, outfile);
         } else {
-            generate_os(nOS, fHeader, fCompress, fGammon, nHashSize, pbc, outfile);
+            generate_os(nOS, fHeader, fCompress, fGammon, pbc, outfile);
+            if (fHotFirst) {
+                if (fHeader && fCompress)
+                    RelayoutOS(nOS, fGammon, outfile);
+                else
+                    g_printerr(_("Hot-first layout needs a compressed database with header; ignored\n"));
+            }
         }
 
         BearoffClose(pbc);
-
-        g_printerr(_("Number of re-reads while generating: %ld\n"), cLookup);
     }
 
     /*
@@ -1426,7 +1615,7 @@ main(int argc, char **argv)
         g_printerr("%-37s: %12d\n", _("Number of one-sided positions"), n);
         g_printerr("%-37s: %12d\n", _("Total number of positions"), n * n);
         g_printerr("%-37s: %.0f %s (%.1f MB)\n", _("Size of resulting file"), r, _("bytes"), r / 1048576.0);
-        g_printerr("%-37s: %12d\n", _("Size of xhash"), nHashSize);
+        g_printerr("%-37s: %12d\n", _("Number of threads"), nThreads);
         g_printerr("%-37s: %12s %s\n", _("Reuse old bearoff database"), szOldBearoff ? _("yes") : _("no"),
                 szOldBearoff ? szOldBearoff : "");
         /* initialise old bearoff database */
@@ -1443,16 +1632,19 @@ main(int argc, char **argv)
             exit(2);
         }
 
-        generate_ts(nTSP, nTSC, fHeader, fCubeful, nHashSize, pbc, outfile);
+        generate_ts(nTSP, nTSC, fHeader, fCubeful, pbc, outfile);
 
         /* close old bearoff database */
 
         BearoffClose(pbc);
 
-        g_printerr(_("Number of re-reads while generating: %ld\n"), cLookup);
-
     }
 
+#if defined(USE_MULTITHREAD)
+    if (nThreads > 1)
+        StopWorkers();
+#endif
+
     fclose(outfile);
     return 0;
 
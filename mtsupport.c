@@ -24,10 +24,12 @@
 #include "multithread.h"
 
 #include <stdlib.h>
-#if defined (DEBUG_MULTITHREADED)
 #include <stdio.h>
-#endif
 #include <string.h>
+#if defined(USE_MULTITHREAD) && defined(HAVE_SCHED_H) && defined(HAVE_SCHED_SETAFFINITY)
+#include <sched.h>
+#define USE_NUMA_BINDING 1
+#endif
 
 #include "lib/simd.h"
 
@@ -49,11 +51,160 @@ MT_CreateThreadLocalData(int id)
     tld->pnnState[CLASS_CONTACT - CLASS_RACE].savedIBase = g_malloc0(nnContact.cInput * sizeof(float));
 
     tld->aMoves = (move *) g_malloc0(sizeof(move) * MAX_INCOMPLETE_MOVES);
+    tld->pBearoffCache = NULL;
+    tld->pMoveHash = NULL;
+    tld->pCandidates = NULL;
+    tld->fParallelItem = FALSE;
+
+    for (int i = 0; i < NUM_NETS; i++)
+        tld->apnn[i] = apnnEval[i];
+
+    /* workers are spread round-robin over the nodes and bind themselves
+     * in MT_BindThreadLocalData() once running */
+#if defined(USE_MULTITHREAD)
+    tld->iNumaNode = (fNumaReplicas && id >= 0 && MT_GetNumaNodes() > 1) ? id % (int) MT_GetNumaNodes() : -1;
+#else
+    tld->iNumaNode = -1;
+#endif
+
     return tld;
 }
 
 #if defined(USE_MULTITHREAD)
 
+int fNumaReplicas = FALSE;
+
+#if defined(USE_NUMA_BINDING)
+
+#define MAX_NUMA_NODES 64
+
+static unsigned int cNumaNodes = 0;     /* 0 until probed */
+static cpu_set_t acsNumaNode[MAX_NUMA_NODES];
+static neuralnet aannReplica[MAX_NUMA_NODES][NUM_NETS];
+static int afReplica[MAX_NUMA_NODES];
+
+static Mutex replicaLock;
+
+/* Read a cpulist such as "0-7,16-23" */
+static int
+ReadCpuList(FILE * pf, cpu_set_t * pcs)
+{
+    unsigned int lo, hi, i;
+    int c;
+
+    CPU_ZERO(pcs);
+
+    while (fscanf(pf, "%u", &lo) == 1) {
+        hi = lo;
+        if ((c = fgetc(pf)) == '-') {
+            if (fscanf(pf, "%u", &hi) != 1)
+                break;
+            c = fgetc(pf);
+        }
+        for (i = lo; i <= hi && i < CPU_SETSIZE; i++)
+            CPU_SET(i, pcs);
+        if (c != ',')
+            break;
+    }
+
+    return CPU_COUNT(pcs);
+}
+
+/* The nodes with processors, as listed by Linux in sysfs */
+extern unsigned int
+MT_GetNumaNodes(void)
+{
+    unsigned int n;
+
+    if (cNumaNodes)
+        return cNumaNodes;
+
+    for (n = 0; n < MAX_NUMA_NODES && cNumaNodes < MAX_NUMA_NODES; n++) {
+        char sz[64];
+        FILE *pf;
+
+        sprintf(sz, "/sys/devices/system/node/node%u/cpulist", n);
+        if ((pf = fopen(sz, "r")) == NULL)
+            continue;
+        if (ReadCpuList(pf, &acsNumaNode[cNumaNodes]) > 0)
+            cNumaNodes++;
+        fclose(pf);
+    }
+
+    if (cNumaNodes == 0)
+        cNumaNodes = 1;
+
+    return cNumaNodes;
+}
+
+/*
+ * Called by a worker thread before its first task.  The thread is
+ * restricted to the processors of its node and evaluates with a copy of
+ * the nets made there, so that the weights come from local memory.
+ */
+extern void
+MT_BindThreadLocalData(ThreadLocalData * tld)
+{
+    int n = tld->iNumaNode;
+
+    if (n < 0 || sched_setaffinity(0, sizeof(cpu_set_t), &acsNumaNode[n]) != 0)
+        return;
+
+    Mutex_Lock(&replicaLock);
+
+    if (!afReplica[n]) {
+        int i;
+
+        for (i = 0; i < NUM_NETS; i++)
+            if (NeuralNetCopy(&aannReplica[n][i], apnnEval[i]))
+                break;
+
+        if (i == NUM_NETS)
+            afReplica[n] = TRUE;
+        else
+            while (i--)
+                NeuralNetDestroy(&aannReplica[n][i]);
+    }
+
+    if (afReplica[n])
+        for (int i = 0; i < NUM_NETS; i++)
+            tld->apnn[i] = &aannReplica[n][i];
+
+    Mutex_Release(&replicaLock);
+}
+
+/* Only to be called when no worker thread is running */
+extern void
+MT_FreeNumaReplicas(void)
+{
+    for (unsigned int n = 0; n < MAX_NUMA_NODES; n++)
+        if (afReplica[n]) {
+            for (int i = 0; i < NUM_NETS; i++)
+                NeuralNetDestroy(&aannReplica[n][i]);
+            afReplica[n] = FALSE;
+        }
+}
+
+#else                           /* !USE_NUMA_BINDING */
+
+extern unsigned int
+MT_GetNumaNodes(void)
+{
+    return 1;
+}
+
+extern void
+MT_BindThreadLocalData(ThreadLocalData * UNUSED(tld))
+{
+}
+
+extern void
+MT_FreeNumaReplicas(void)
+{
+}
+
+#endif
+
 #if defined(DEBUG_MULTITHREADED) && defined(WIN32)
 unsigned int mainThreadID;
 #endif
@@ -218,13 +369,123 @@ FreeMutex(Mutex * mutex)
 }
 #endif
 
+#if GLIB_CHECK_VERSION (2,32,0)
+extern void
+InitCond(Cond * pCond)
+{
+    g_cond_init(pCond);
+}
+
+extern void
+FreeCond(Cond * cond)
+{
+    g_cond_clear(cond);
+}
+
+extern void
+Cond_Wait(Cond * cond, Mutex * mutex)
+{
+    g_cond_wait(cond, mutex);
+}
+
+/* FALSE if ms milliseconds went by without a signal */
+extern gboolean
+Cond_TimedWait(Cond * cond, Mutex * mutex, int ms)
+{
+    return g_cond_wait_until(cond, mutex, g_get_monotonic_time() + ms * G_TIME_SPAN_MILLISECOND);
+}
+
+extern void
+Cond_Signal(Cond * cond)
+{
+    g_cond_signal(cond);
+}
+
+extern void
+Cond_Broadcast(Cond * cond)
+{
+    g_cond_broadcast(cond);
+}
+#else
+extern void
+InitCond(Cond * pCond)
+{
+    *pCond = g_cond_new();
+}
+
+extern void
+FreeCond(Cond * cond)
+{
+    g_cond_free(*cond);
+}
+
+extern void
+Cond_Wait(Cond * cond, Mutex * mutex)
+{
+    g_cond_wait(*cond, *mutex);
+}
+
+extern gboolean
+Cond_TimedWait(Cond * cond, Mutex * mutex, int ms)
+{
+    GTimeVal tv;
+
+    g_get_current_time(&tv);
+    g_time_val_add(&tv, ms * 1000L);
+    return g_cond_timed_wait(*cond, *mutex, &tv);
+}
+
+extern void
+Cond_Signal(Cond * cond)
+{
+    g_cond_signal(*cond);
+}
+
+extern void
+Cond_Broadcast(Cond * cond)
+{
+    g_cond_broadcast(*cond);
+}
+#endif
+
+/* While td.fCountLockWaits is set by `calibrate scaling', the locks that
+ * had to wait are counted and timed.  lockWaitLock is only ever taken
+ * here and nothing else is locked while it is held. */
 extern void
 Mutex_Lock(Mutex * mutex)
 {
+    double t;
+
 #if GLIB_CHECK_VERSION (2,32,0)
+    if (!MT_SafeGet(&td.fCountLockWaits)) {
+        g_mutex_lock(mutex);
+        return;
+    }
+    if (g_mutex_trylock(mutex))
+        return;
+    t = get_time();
     g_mutex_lock(mutex);
+    t = get_time() - t;
+
+    g_mutex_lock(&td.lockWaitLock);
+    td.cLockWaits++;
+    td.rLockWaitMs += t;
+    g_mutex_unlock(&td.lockWaitLock);
 #else
+    if (!MT_SafeGet(&td.fCountLockWaits)) {
+        g_mutex_lock(*mutex);
+        return;
+    }
+    if (g_mutex_trylock(*mutex))
+        return;
+    t = get_time();
     g_mutex_lock(*mutex);
+    t = get_time() - t;
+
+    g_mutex_lock(td.lockWaitLock);
+    td.cLockWaits++;
+    td.rLockWaitMs += t;
+    g_mutex_unlock(td.lockWaitLock);
 #endif
 }
 
@@ -249,8 +510,22 @@ MT_InitThreads(void)
     td.tasks = NULL;
     MT_SafeSet(&td.doneTasks, 0);
     td.addedTasks = 0;
-    td.totalTasks = -1;
-    InitManualEvent(&td.activity);
+    MT_SafeSet(&td.totalTasks, -1);
+    td.queues = (TaskQueue *) g_malloc(sizeof(TaskQueue) * MAX_NUMTHREADS);
+    for (unsigned int i = 0; i < MAX_NUMTHREADS; i++) {
+        InitMutex(&td.queues[i].lock);
+        for (int p = 0; p < TASK_PRIORITIES; p++) {
+            td.queues[i].apq[p] = g_queue_new();
+            td.queues[i].acTasks[p] = 0;
+        }
+    }
+    td.queuedTasks = 0;
+    td.nextQueue = 0;
+    InitCond(&td.workCond);
+    InitMutex(&td.doneLock);
+    InitCond(&td.doneCond);
+    InitMutex(&td.parallelLock);
+    InitCond(&td.parallelCond);
     TLSCreate(&td.tlsItem);
     TLSSetValue(td.tlsItem, (size_t) MT_CreateThreadLocalData(-1));
 
@@ -259,6 +534,10 @@ MT_InitThreads(void)
 #endif
     InitMutex(&td.multiLock);
     InitMutex(&td.queueLock);
+    InitMutex(&td.lockWaitLock);
+#if defined(USE_NUMA_BINDING)
+    InitMutex(&replicaLock);
+#endif
     InitManualEvent(&td.syncStart);
     InitManualEvent(&td.syncEnd);
 #if !GLIB_CHECK_VERSION (2,32,0)
@@ -280,6 +559,9 @@ CloseThread(void *UNUSED(unused))
     pnnState = pTLD->pnnState;
 
     g_free(pTLD->aMoves);
+    g_free(pTLD->pBearoffCache);
+    g_free(pTLD->pMoveHash);
+    g_free(pTLD->pCandidates);
 
     for (int i = 0; i < 3; i++) {
         g_free(pnnState[i].savedBase);
@@ -296,10 +578,25 @@ extern void
 MT_Close(void)
 {
     MT_CloseThreads();
+    MT_FreeNumaReplicas();
 
-    FreeManualEvent(td.activity);
+    for (unsigned int i = 0; i < MAX_NUMTHREADS; i++) {
+        FreeMutex(&td.queues[i].lock);
+        for (int p = 0; p < TASK_PRIORITIES; p++)
+            g_queue_free(td.queues[i].apq[p]);
+    }
+    g_free(td.queues);
+    FreeCond(&td.workCond);
+    FreeMutex(&td.doneLock);
+    FreeCond(&td.doneCond);
+    FreeMutex(&td.parallelLock);
+    FreeCond(&td.parallelCond);
     FreeMutex(&td.multiLock);
     FreeMutex(&td.queueLock);
+    FreeMutex(&td.lockWaitLock);
+#if defined(USE_NUMA_BINDING)
+    FreeMutex(&replicaLock);
+#endif
 
     FreeManualEvent(td.syncStart);
     FreeManualEvent(td.syncEnd);
@@ -389,6 +686,9 @@ MT_Close(void)
         return;
 
     g_free(td.tld->aMoves);
+    g_free(td.tld->pBearoffCache);
+    g_free(td.tld->pMoveHash);
+    g_free(td.tld->pCandidates);
     pnnState = td.tld->pnnState;
     for (i = 0; i < 3; i++) {
         g_free(pnnState[i].savedBase);
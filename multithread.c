@@ -61,7 +61,18 @@ MT_CloseThreads(void)
 static void
 MT_TaskDone(Task * pt)
 {
-    MT_SafeInc(&td.doneTasks);
+    if (pt && pt->priority == TASK_PRIORITY_NESTED) {
+        /* not one of the tasks MT_WaitForTasks() counts */
+        g_free(pt);
+        return;
+    }
+
+    /* wake MT_WaitForTasks() when the last one is done */
+    if (MT_SafeIncValue(&td.doneTasks) == MT_SafeGet(&td.totalTasks)) {
+        Mutex_Lock(&td.doneLock);
+        Cond_Signal(&td.doneCond);
+        Mutex_Release(&td.doneLock);
+    }
 
     if (pt) {
         g_free(pt->pLinkedTask);
@@ -70,39 +81,80 @@ MT_TaskDone(Task * pt)
 }
 
 static Task *
-MT_GetTask(void)
+MT_PopTask(TaskQueue * pq, taskpriority p, gboolean fSteal)
 {
-    Task *task = NULL;
+    Task *task;
 
-    multi_debug("get task asks lock (queueLock)");
-    Mutex_Lock(&td.queueLock);
-    multi_debug("get task gets lock (queueLock)");
+    if (MT_SafeGet(&pq->acTasks[p]) == 0)
+        return NULL;
+
+    Mutex_Lock(&pq->lock);
+    task = (Task *) (fSteal ? g_queue_pop_tail(pq->apq[p]) : g_queue_pop_head(pq->apq[p]));
+    if (task)
+        MT_SafeDec(&pq->acTasks[p]);
+    Mutex_Release(&pq->lock);
+
+    return task;
+}
+
+/* The most urgent task of priority pLowest or more, from the queue of
+ * worker id if it has one */
+static Task *
+MT_GetTask(int id, taskpriority pLowest)
+{
+    unsigned int const n = td.numThreads;
+    unsigned int const iOwn = id < 0 ? 0 : (unsigned int) id;
+    int p;
+
+    if (MT_SafeGet(&td.queuedTasks) == 0)
+        return NULL;
+
+    for (p = TASK_PRIORITIES - 1; p >= (int) pLowest; p--) {
+        unsigned int i;
+
+        for (i = 0; i < n; i++) {
+            Task *task = MT_PopTask(td.queues + (iOwn + i) % n, (taskpriority) p, i != 0);
 
-    if (g_list_length(td.tasks) > 0) {
-        task = (Task *) g_list_first(td.tasks)->data;
-        td.tasks = g_list_delete_link(td.tasks, g_list_first(td.tasks));
-        if (g_list_length(td.tasks) == 0) {
-            ResetManualEvent(td.activity);
+            if (task) {
+                MT_SafeDec(&td.queuedTasks);
+                return task;
+            }
         }
     }
 
-    Mutex_Release(&td.queueLock);
-    multi_debug("get task unlocks (queueLock)");
-
-    return task;
+    return NULL;
 }
 
 extern void
 MT_AbortTasks(void)
 {
-    Task *task;
-    /* Remove tasks from list */
-    while ((task = MT_GetTask()) != NULL)
-        MT_TaskDone(task);
+    unsigned int i;
+    int p;
+
+    /* Remove tasks from all queues.  Nested ones are left to finish
+     * the tasks they belong to, which will see fInterrupt themselves. */
+    for (i = 0; i < MAX_NUMTHREADS; i++)
+        for (p = 0; p < TASK_PRIORITY_NESTED; p++) {
+            Task *task;
+
+            while ((task = MT_PopTask(td.queues + i, (taskpriority) p, FALSE)) != NULL) {
+                MT_SafeDec(&td.queuedTasks);
+                MT_TaskDone(task);
+            }
+        }
 
     MT_SafeSet(&td.result, -1);
 }
 
+static void
+MT_WaitForWork(void)
+{
+    Mutex_Lock(&td.queueLock);
+    while (MT_SafeGet(&td.queuedTasks) == 0)
+        Cond_Wait(&td.workCond, &td.queueLock);
+    Mutex_Release(&td.queueLock);
+}
+
 static SIMD_STACKALIGN gpointer
 MT_WorkerThreadFunction(void *tld)
 {
@@ -123,19 +175,26 @@ MT_WorkerThreadFunction(void *tld)
 #endif
     {
         ThreadLocalData *pTLD = (ThreadLocalData *) tld;
+        AsyncFun fun;
+
         TLSSetValue(td.tlsItem, (size_t) pTLD);
+        MT_BindThreadLocalData(pTLD);
 
         MT_SafeInc(&td.result);
         MT_TaskDone(NULL);      /* Thread created */
+        /* Run tasks until this thread gets one of the CloseThread() tasks.
+         * Testing closingThreads instead would let a thread that has just
+         * finished an earlier task quit without taking its CloseThread() */
         do {
             Task *task;
-            WaitForManualEvent(td.activity);
-            task = MT_GetTask();
-            if (task) {
-                task->fun(task->data);
-                MT_TaskDone(task);
-            }
-        } while (MT_SafeCompare(&td.closingThreads, FALSE));
+
+            while ((task = MT_GetTask(pTLD->id, TASK_PRIORITY_NORMAL)) == NULL)
+                MT_WaitForWork();
+
+            fun = task->fun;
+            task->fun(task->data);
+            MT_TaskDone(task);
+        } while (fun != CloseThread);
 
 #if 0
 #if __GNUC__ && defined(WIN32)
@@ -205,6 +264,7 @@ MT_SetNumThreads(unsigned int num)
             ScoreMove = ScoreMoveNoLocking;
             FindBestMove = FindBestMoveNoLocking;
             FindnSaveBestMoves = FindnSaveBestMovesNoLocking;
+            EvalCacheMoves = EvalCacheMovesNoLocking;
             BasicCubefulRollout = BasicCubefulRolloutNoLocking;
         } else {                /* Locking version of evals */
             EvaluatePosition = EvaluatePositionWithLocking;
@@ -213,11 +273,29 @@ MT_SetNumThreads(unsigned int num)
             ScoreMove = ScoreMoveWithLocking;
             FindBestMove = FindBestMoveWithLocking;
             FindnSaveBestMoves = FindnSaveBestMovesWithLocking;
+            EvalCacheMoves = EvalCacheMovesWithLocking;
             BasicCubefulRollout = BasicCubefulRolloutWithLocking;
         }
     }
 }
 
+/* Threads pick their node when created, so restart them */
+extern void
+MT_SetNumaReplicas(int f)
+{
+    if (f == fNumaReplicas)
+        return;
+
+    if (td.numThreads != 0)
+        MT_CloseThreads();
+
+    fNumaReplicas = f;
+    MT_FreeNumaReplicas();
+
+    if (td.numThreads != 0)
+        MT_CreateThreads();
+}
+
 extern void
 MT_StartThreads(void)
 {
@@ -232,70 +310,206 @@ MT_StartThreads(void)
     }
 }
 
-void
-MT_AddTask(Task * pt, gboolean lock)
+/* Spread tasks over the workers; idle ones will steal them anyway */
+static void
+MT_QueueTask(Task * pt)
 {
-    if (lock) {
-        multi_debug("add task asks lock (queueLock)");
-        Mutex_Lock(&td.queueLock);
-        multi_debug("add task gets lock (queueLock)");
-    }
-    if (td.addedTasks == 0)
-        MT_SafeSet(&td.result, 0);          /* Reset result for new tasks */
-    td.addedTasks++;
-    td.tasks = g_list_append(td.tasks, pt);
-    if (g_list_length(td.tasks) == 1) { /* New tasks */
-        SetManualEvent(td.activity);
-    }
-    if (lock) {
-        Mutex_Release(&td.queueLock);
-        multi_debug("add task unlocks");
+    TaskQueue *pq = td.queues + ((unsigned int) MT_SafeIncCheck(&td.nextQueue) % td.numThreads);
+
+    if (pt->priority != TASK_PRIORITY_NESTED) {
+        if (td.addedTasks == 0)
+            MT_SafeSet(&td.result, 0);      /* Reset result for new tasks */
+        td.addedTasks++;
     }
+
+    Mutex_Lock(&pq->lock);
+    g_queue_push_tail(pq->apq[pt->priority], pt);
+    MT_SafeInc(&pq->acTasks[pt->priority]);
+    Mutex_Release(&pq->lock);
+
+    MT_SafeInc(&td.queuedTasks);
+}
+
+extern void
+MT_AddTaskPriority(Task * pt, taskpriority priority)
+{
+    pt->priority = priority;
+    MT_QueueTask(pt);
+
+    Mutex_Lock(&td.queueLock);
+    Cond_Signal(&td.workCond);
+    Mutex_Release(&td.queueLock);
+}
+
+/* Linked tasks run in sequence in one worker, so start them first.
+ * lock is no longer needed; each queue has its own. */
+void
+MT_AddTask(Task * pt, gboolean UNUSED(lock))
+{
+    MT_AddTaskPriority(pt, pt->pLinkedTask ? TASK_PRIORITY_HIGH : TASK_PRIORITY_NORMAL);
 }
 
 extern void
 mt_add_tasks(unsigned int num_tasks, AsyncFun pFun, void *taskData, gpointer linked)
 {
     unsigned int i;
-    {
-#if defined(DEBUG_MULTITHREADED)
-        multi_debug("add %u task%s asks lock (queueLock)", num_tasks, (num_tasks > 1 ? "s" : ""));
-        Mutex_Lock(&td.queueLock);
-        multi_debug("add tasks gets lock (queueLock)");
-#else
-        Mutex_Lock(&td.queueLock);
-#endif
-    }
+
+    multi_debug("add tasks");
+
     for (i = 0; i < num_tasks; i++) {
         Task *pt = (Task *) g_malloc(sizeof(Task));
         pt->fun = pFun;
         pt->data = taskData;
         pt->pLinkedTask = linked;
-        MT_AddTask(pt, FALSE);
+        pt->priority = linked ? TASK_PRIORITY_HIGH : TASK_PRIORITY_NORMAL;
+        MT_QueueTask(pt);
+    }
+
+    Mutex_Lock(&td.queueLock);
+    Cond_Broadcast(&td.workCond);
+    Mutex_Release(&td.queueLock);
+}
+
+/*
+ * MT_ParallelFor() runs fun(pData, i) for i < c on the calling thread and
+ * on up to c - 1 idle workers, and returns when all are done.  It may be
+ * called from a task, and from the nested calls: the helpers are queued
+ * ahead of all other tasks, and every item is run by whoever took it, so
+ * a caller never depends on a helper to finish.  While the items others
+ * took are running, the caller sleeps on parallelCond, woken when a job
+ * is done or helpers are queued.  It then runs one item of another job,
+ * but not from inside such an item, so neither its stack nor the time
+ * before it sees its own job done can grow without bound.  The job lives
+ * until the last of its helper tasks has been run, as those may only
+ * start after the loop is over.
+ */
+typedef struct {
+    parallelfun fun;
+    void *pData;
+    int c;
+    int iNext;                  /* next item to hand out */
+    int cLeft;                  /* items not finished */
+    int cRef;                   /* the caller and helpers yet to run */
+} paralleljob;
+
+static void
+ParallelWake(void)
+{
+    Mutex_Lock(&td.parallelLock);
+    Cond_Broadcast(&td.parallelCond);
+    Mutex_Release(&td.parallelLock);
+}
+
+/* Run the next item of ppj; FALSE if none was left */
+static int
+ParallelRunOne(paralleljob * ppj)
+{
+    int i;
+
+    if ((i = MT_SafeIncCheck(&ppj->iNext)) >= ppj->c)
+        return FALSE;
+
+    ppj->fun(ppj->pData, (unsigned int) i);
+    if (MT_SafeDecCheck(&ppj->cLeft))
+        ParallelWake();
+
+    return TRUE;
+}
+
+static void
+ParallelRelease(paralleljob * ppj)
+{
+    if (MT_SafeDecCheck(&ppj->cRef))
+        g_free(ppj);
+}
+
+static void
+ParallelHelper(void *p)
+{
+    while (ParallelRunOne((paralleljob *) p));
+    ParallelRelease((paralleljob *) p);
+}
+
+extern void
+MT_ParallelFor(unsigned int c, parallelfun fun, void *pData)
+{
+    unsigned int cHelpers = MIN(c, td.numThreads);
+    ThreadLocalData *ptld;
+    paralleljob *ppj;
+    unsigned int i;
+
+    if (cHelpers < 2) {
+        for (i = 0; i < c; i++)
+            fun(pData, i);
+        return;
+    }
+
+    /* the caller is one of the threads */
+    cHelpers--;
+
+    ppj = g_new(paralleljob, 1);
+    ppj->fun = fun;
+    ppj->pData = pData;
+    ppj->c = (int) c;
+    ppj->iNext = 0;
+    ppj->cLeft = (int) c;
+    ppj->cRef = (int) cHelpers + 1;
+
+    for (i = 0; i < cHelpers; i++) {
+        Task *pt = (Task *) g_malloc(sizeof(Task));
+
+        pt->fun = ParallelHelper;
+        pt->data = ppj;
+        pt->pLinkedTask = NULL;
+        pt->priority = TASK_PRIORITY_NESTED;
+        MT_QueueTask(pt);
     }
+
+    Mutex_Lock(&td.queueLock);
+    Cond_Broadcast(&td.workCond);
     Mutex_Release(&td.queueLock);
-    multi_debug("add tasks unlocks (queueLock)");
+    ParallelWake();
+
+    while (ParallelRunOne(ppj));
+
+    ptld = MT_GetTLD();
+    Mutex_Lock(&td.parallelLock);
+    while (MT_SafeGet(&ppj->cLeft)) {
+        Task *pt;
+
+        if (ptld->fParallelItem || (pt = MT_GetTask(ptld->id, TASK_PRIORITY_NESTED)) == NULL) {
+            Cond_Wait(&td.parallelCond, &td.parallelLock);
+            continue;
+        }
+
+        Mutex_Release(&td.parallelLock);
+        g_assert(pt->fun == ParallelHelper);
+        ptld->fParallelItem = TRUE;
+        /* the rest of that job is left to its caller and helpers */
+        ParallelRunOne((paralleljob *) pt->data);
+        ParallelRelease((paralleljob *) pt->data);
+        ptld->fParallelItem = FALSE;
+        g_free(pt);
+        Mutex_Lock(&td.parallelLock);
+    }
+    Mutex_Release(&td.parallelLock);
+
+    ParallelRelease(ppj);
 }
 
+/* TRUE when all tasks are done, FALSE if time ms passed first */
 static gboolean
 WaitForAllTasks(int time)
 {
-    int j = 0;
+    gboolean fDone;
 
-    while (!MT_SafeCompare(&td.doneTasks, td.totalTasks)) {
-        
-        // if (pmrCurAnn != NULL) {
-        //     g_message("in the loop: pmrCurAnn exists");
-        // }
-        // SetAnnotation(pmrCurAnn);
-        // ChangeGame(NULL);
-        if (j == 10)
-            return FALSE;       /* Not done yet */
+    Mutex_Lock(&td.doneLock);
+    while (!(fDone = MT_SafeCompare(&td.doneTasks, MT_SafeGet(&td.totalTasks))))
+        if (!Cond_TimedWait(&td.doneCond, &td.doneLock, time))
+            break;
+    Mutex_Release(&td.doneLock);
 
-        j++;
-        g_usleep(100 * time);
-    }
-    return TRUE;
+    return fDone;
 }
 
 int
@@ -317,7 +531,7 @@ MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
     int i=0;
 
     /* Set total tasks to wait for */
-    td.totalTasks = td.addedTasks;
+    MT_SafeSet(&td.totalTasks, td.addedTasks);
 #if defined(USE_GTK)
         // g_message("MT_WaitForTasks\n");
     GTKSuspendInput();
@@ -432,7 +646,7 @@ MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
 
     MT_SafeSet(&td.doneTasks, 0);
     td.addedTasks = 0;
-    td.totalTasks = -1;
+    MT_SafeSet(&td.totalTasks, -1);
 
 #if defined(USE_GTK)
     GTKResumeInput();
@@ -515,6 +729,13 @@ MT_AddTask(Task * pt, gboolean lock)
     td.tasks = g_list_append(td.tasks, pt);
 }
 
+void
+MT_AddTaskPriority(Task * pt, taskpriority priority)
+{
+    (void) priority;            /* run in the order added */
+    MT_AddTask(pt, FALSE);
+}
+
 void
 mt_add_tasks(unsigned int num_tasks, AsyncFun pFun, void *taskData, gpointer linked)
 {
@@ -534,6 +755,15 @@ MT_GetDoneTasks(void)
     return MT_SafeGet(&td.doneTasks);
 }
 
+extern void
+MT_ParallelFor(unsigned int c, parallelfun fun, void *pData)
+{
+    unsigned int i;
+
+    for (i = 0; i < c; i++)
+        fun(pData, i);
+}
+
 int
 MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
 {
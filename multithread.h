@@ -45,10 +45,22 @@ void multi_debug(const char *str, ...);
 #define multi_debug(x)
 #endif
 
+/* Tasks of higher priority are started first */
+typedef enum {
+    TASK_PRIORITY_NORMAL,
+    TASK_PRIORITY_HIGH,
+    TASK_PRIORITY_NESTED,       /* parts of a running task, see MT_ParallelFor() */
+    TASK_PRIORITIES
+} taskpriority;
+
+/* The body of a loop MT_ParallelFor() shares out: item i of pData */
+typedef void (*parallelfun) (void *pData, unsigned int i);
+
 typedef struct Task {
     AsyncFun fun;
     void *data;
     struct Task *pLinkedTask;
+    taskpriority priority;
 } Task;
 
 typedef struct {
@@ -63,6 +75,12 @@ typedef struct {
     int id;
     move *aMoves;
     NNState *pnnState;
+    const neuralnet *apnn[NUM_NETS];
+    int iNumaNode;              /* -1 if the thread is not bound to a node */
+    void *pBearoffCache;        /* see ReadBearoffFile() */
+    void *pMoveHash;            /* see SaveMoves() */
+    void *pCandidates;          /* see GenerateCandidates() */
+    int fParallelItem;          /* running an item for MT_ParallelFor() while waiting */
 } ThreadLocalData;
 
 typedef struct {
@@ -78,10 +96,23 @@ typedef GPrivate *TLSItem;
 
 #if GLIB_CHECK_VERSION (2,32,0)
 typedef GMutex Mutex;
+typedef GCond Cond;
 #else
 typedef GMutex *Mutex;
+typedef GCond *Cond;
 #endif
 
+/*
+ * Each worker owns a queue per priority.  It takes tasks from the front
+ * of its own queues and, when they are empty, steals from the back of
+ * the others'.
+ */
+typedef struct {
+    Mutex lock;
+    GQueue *apq[TASK_PRIORITIES];
+    int acTasks[TASK_PRIORITIES];
+} TaskQueue;
+
 typedef struct {
     GList *tasks;
     int doneTasks;
@@ -89,9 +120,16 @@ typedef struct {
     ThreadLocalData *tld;
 
 #if defined(USE_MULTITHREAD)
-    ManualEvent activity;
+    TaskQueue *queues;
+    int queuedTasks;
+    int nextQueue;
+    Mutex queueLock;            /* with workCond, for idle workers */
+    Cond workCond;
+    Mutex doneLock;             /* with doneCond, for MT_WaitForTasks() */
+    Cond doneCond;
+    Mutex parallelLock;         /* with parallelCond, for MT_ParallelFor() */
+    Cond parallelCond;
     TLSItem tlsItem;
-    Mutex queueLock;
     Mutex multiLock;
     ManualEvent syncStart;
     ManualEvent syncEnd;
@@ -101,13 +139,20 @@ typedef struct {
 
     int closingThreads;
     unsigned int numThreads;
+
+    int fCountLockWaits;        /* set while `calibrate scaling' runs */
+    Mutex lockWaitLock;         /* for the two below */
+    unsigned int cLockWaits;    /* Mutex_Lock() calls that had to wait */
+    double rLockWaitMs;         /* milliseconds they spent waiting */
 #endif
 } ThreadData;
 
 extern int MT_GetDoneTasks(void);
 extern void MT_AbortTasks(void);
 extern void MT_AddTask(Task * pt, gboolean lock);
+extern void MT_AddTaskPriority(Task * pt, taskpriority priority);
 extern void mt_add_tasks(unsigned int num_tasks, AsyncFun pFun, void *taskData, gpointer linked);
+extern void MT_ParallelFor(unsigned int c, parallelfun fun, void *pData);
 extern int MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave);
 extern void MT_InitThreads(void);
 extern void MT_Close(void);
@@ -129,6 +174,12 @@ extern void InitManualEvent(ManualEvent * pME);
 extern void FreeManualEvent(ManualEvent ME);
 extern void InitMutex(Mutex * pMutex);
 extern void FreeMutex(Mutex * mutex);
+extern void InitCond(Cond * pCond);
+extern void FreeCond(Cond * cond);
+extern void Cond_Wait(Cond * cond, Mutex * mutex);
+extern gboolean Cond_TimedWait(Cond * cond, Mutex * mutex, int ms);
+extern void Cond_Signal(Cond * cond);
+extern void Cond_Broadcast(Cond * cond);
 
 #define TLSGet(item) *((size_t*)g_private_get(item))
 
@@ -147,6 +198,12 @@ extern void MT_SetResultFailed(void);
 extern void TLSCreate(TLSItem * pItem);
 extern unsigned int MT_GetNumThreads(void);
 
+extern int fNumaReplicas;
+extern void MT_SetNumaReplicas(int f);
+extern unsigned int MT_GetNumaNodes(void);
+extern void MT_BindThreadLocalData(ThreadLocalData * tld);
+extern void MT_FreeNumaReplicas(void);
+
 #define MT_GetTLD() ((ThreadLocalData *)TLSGet(td.tlsItem))
 #define MT_GetThreadID() ((ThreadLocalData *)TLSGet(td.tlsItem))->id
 #define MT_Get_nnState() ((ThreadLocalData *)TLSGet(td.tlsItem))->pnnState
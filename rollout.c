@@ -20,6 +20,7 @@
 
 #include <errno.h>
 #include <isaac.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -47,6 +48,8 @@ f_BasicCubefulRollout BasicCubefulRollout = BasicCubefulRolloutNoLocking;
 #define BasicCubefulRollout BasicCubefulRolloutNoLocking
 
 int log_rollouts = 0;
+int fRolloutDeterministic = FALSE;
+int nRolloutLockstep = 0;
 char *log_file_name = 0;
 static unsigned int initial_game_count;
 
@@ -217,23 +220,23 @@ QuasiRandomSeed(perArray * pArray, int n)
     pArray->nPermutationSeed = n;
 }
 
-static int nSkip;
+/* *pnSkip counts the doubles skipped in the first roll of a rotated
+ * rollout of the initial position; it belongs to the one trial, so
+ * the dice of a trial don't depend on the others. */
 
 extern int
 RolloutDice(int iTurn, int iGame,
             int fInitial,
-            unsigned int anDice[2], rng * rngx, void *rngctx, const int fRotate, const perArray * dicePerms)
+            unsigned int anDice[2], rng * rngx, void *rngctx, const int fRotate, const perArray * dicePerms,
+            int *pnSkip)
 {
 
     if (fInitial && !iTurn) {
         /* rollout of initial position: no doubles allowed */
         if (fRotate) {
 
-            if (!iGame)
-                MT_SafeSet(&nSkip, 0);
-
-            for (;; MT_SafeInc(&nSkip)) {
-                unsigned int j = dicePerms->aaanPermutation[0][0][(iGame + MT_SafeGet(&nSkip)) % 36];
+            for (;; (*pnSkip)++) {
+                unsigned int j = dicePerms->aaanPermutation[0][0][(iGame + *pnSkip) % 36];
 
                 anDice[0] = j / 6 + 1;
                 anDice[1] = j % 6 + 1;
@@ -258,7 +261,7 @@ RolloutDice(int iTurn, int iGame,
          k;                     /* 36**i */
 
         for (i = 0, j = 0, k = 1; i < 6 && i <= (unsigned int) iTurn; i++, k *= 36)
-            j = dicePerms->aaanPermutation[i][iTurn][((iGame + MT_SafeGet(&nSkip)) / k + j) % 36];
+            j = dicePerms->aaanPermutation[i][iTurn][((iGame + *pnSkip) / k + j) % 36];
 
         anDice[0] = j / 6 + 1;
         anDice[1] = j % 6 + 1;
@@ -300,93 +303,76 @@ static volatile unsigned int initial_game_count;
 static void initRolloutstat(rolloutstat * prs);
 #endif
 
-/* called with 
- * cube decision                  move rollout
- * aanBoard       2 copies of same board         1 board
- * aarOutput      2 arrays for eval              1 array
- * iTurn          player on roll                 same
- * iGame          game number                    same
- * cubeinfo       2 structs for double/nodouble  1 cubeinfo
- * or take/pass
- * CubeDecTop     array of 2 boolean             1 boolean
- * (TRUE if a cube decision is valid on turn 0)
- * cci            2 (number of rollouts to do)   1
- * prc            1 rollout context              same
- * aarsStatistics 2 arrays of stats for the      NULL
- * two alternatives of 
- * cube rollouts 
- * 
- * returns -1 on error/interrupt, fInterrupt TRUE if stopped by user
- * aarOutput array(s) contain results
- */
-
-extern int
-BasicCubefulRollout(unsigned int aanBoard[][2][25],
-                    float aarOutput[][NUM_ROLLOUT_OUTPUTS],
-                    int iTurn, int iGame,
-                    const cubeinfo aci[], int afCubeDecTop[], unsigned int cci,
-                    rolloutcontext * prc,
-                    rolloutstat aarsStatistics[][2],
-                    int nBasisCube, perArray * dicePerms, rngcontext * rngctxRollout, FILE * logfp)
-{
-
-    unsigned int anDice[2];
-    unsigned int cUnfinished = cci;
-    cubeinfo *pci;
-    cubedecision cd;
-    int *pf;
-    unsigned int i, j, k, ici;
-    evalcontext ec;
-
-    positionclass pc, pcBefore;
-    unsigned int nPipsBefore = 0, nPipsAfter, nPipsDice;
-    unsigned int anPips[2];
-    int afClosedBoard[2];
-
-    float arDouble[NUM_CUBEFUL_OUTPUTS];
-    float aar[2][NUM_ROLLOUT_OUTPUTS];
-
-    unsigned int aiBar[2];
-
-    int afClosedOut[2] = { FALSE, FALSE };
-    int afHit[2] = { FALSE, FALSE };
-
-    float rDP;
-    float r;
-
-    int nTruncate = prc->fDoTruncate ? prc->nTruncate : 0x7fffffff;
-
-    int nLateEvals = prc->fLateEvals ? prc->nLate : 0x7fffffff;
-
-    int useVarRedn = prc->fVarRedn;
-
-    /* Make local copy of cubeinfo struct, since it
-     * may be modified */
-    cubeinfo *pciLocal = g_alloca(cci * sizeof(cubeinfo));
-    int *pfFinished = g_alloca(cci * sizeof(int));
-    float (*aarVarRedn)[NUM_ROLLOUT_OUTPUTS] = g_alloca(cci * NUM_ROLLOUT_OUTPUTS * sizeof(float));
-
+/* The state of one rollout trial between turns, see
+ * BasicCubefulRollout() for the parameters.  The turns of several
+ * trials can be interleaved by stepping them with RolloutGameCube(),
+ * RolloutGameDice() and RolloutGameMove() while RolloutGameRunning(),
+ * and finishing each with RolloutGameEnd(). */
+typedef struct {
+    unsigned int (*aanBoard)[2][25];
+    float (*aarOutput)[NUM_ROLLOUT_OUTPUTS];
+    int iTurn;
+    int iGame;
+    const cubeinfo *aci;
+    int *afCubeDecTop;
+    unsigned int cci;
+    rolloutcontext *prc;
+    rolloutstat(*aarsStatistics)[2];
+    int nBasisCube;
+    perArray *dicePerms;
+    rngcontext *rngctxRollout;
+    FILE *logfp;
+
+    /* local copy of aci, since it may be modified */
+    cubeinfo *pciLocal;
+    int *pfFinished;
+    float (*aarVarRedn)[NUM_ROLLOUT_OUTPUTS];
+    unsigned int cUnfinished;
+    int afClosedOut[2];
+    int afHit[2];
+    int nTruncate;
+    int nLateEvals;
     /* variables for variance reduction */
-
     evalcontext aecVarRedn[2];
     evalcontext aecZero[2];
-    float arMean[NUM_ROLLOUT_OUTPUTS];
-    unsigned int aaanBoard[6][6][2][25];
-    int aanMoves[6][6][8];
-#if defined(USE_SIMD_INSTRUCTIONS)
-#define NUM_ROLLOUT_OUTPUTS_PADDED (NUM_ROLLOUT_OUTPUTS + VEC_SIZE - (NUM_ROLLOUT_OUTPUTS % VEC_SIZE))
-    SSE_ALIGN(float aaar[6][6][NUM_ROLLOUT_OUTPUTS_PADDED]);
-#else
-    float aaar[6][6][NUM_ROLLOUT_OUTPUTS];
-#endif
-
-    evalcontext ecCubeless0ply = { FALSE, 0, FALSE, TRUE, 0.0 };
-    evalcontext ecCubeful0ply = { TRUE, 0, FALSE, TRUE, 0.0 };
-
-    /* local pointers to the eval contexts to use */
-    evalcontext *pecCube[2], *pecChequer[2];
+    unsigned int anDice[2];
+    int nSkip;                  /* see RolloutDice() */
+} rolloutgame;
 
-    if (useVarRedn) {
+static void
+RolloutGameStart(rolloutgame * prg, unsigned int aanBoard[][2][25], float aarOutput[][NUM_ROLLOUT_OUTPUTS],
+                 int iTurn, int iGame, const cubeinfo aci[], int afCubeDecTop[], unsigned int cci,
+                 rolloutcontext * prc, rolloutstat aarsStatistics[][2], int nBasisCube, perArray * dicePerms,
+                 rngcontext * rngctxRollout, FILE * logfp,
+                 cubeinfo * pciLocal, int *pfFinished, float (*aarVarRedn)[NUM_ROLLOUT_OUTPUTS])
+{
+    unsigned int i, ici;
+
+    prg->aanBoard = aanBoard;
+    prg->aarOutput = aarOutput;
+    prg->iTurn = iTurn;
+    prg->iGame = iGame;
+    prg->aci = aci;
+    prg->afCubeDecTop = afCubeDecTop;
+    prg->cci = cci;
+    prg->prc = prc;
+    prg->aarsStatistics = aarsStatistics;
+    prg->nBasisCube = nBasisCube;
+    prg->dicePerms = dicePerms;
+    prg->rngctxRollout = rngctxRollout;
+    prg->logfp = logfp;
+    prg->nSkip = 0;
+
+    prg->pciLocal = pciLocal;
+    prg->pfFinished = pfFinished;
+    prg->aarVarRedn = aarVarRedn;
+    prg->cUnfinished = cci;
+    prg->afClosedOut[0] = prg->afClosedOut[1] = FALSE;
+    prg->afHit[0] = prg->afHit[1] = FALSE;
+    prg->nTruncate = prc->fDoTruncate ? prc->nTruncate : 0x7fffffff;
+    prg->nLateEvals = prc->fLateEvals ? prc->nLate : 0x7fffffff;
+
+    if (prc->fVarRedn) {
 
         /*
          * Create evaluation context one ply deep
@@ -397,12 +383,12 @@ BasicCubefulRollout(unsigned int aanBoard[][2][25],
                 aarVarRedn[ici][i] = 0.0f;
 
         for (i = 0; i < 2; i++) {
-            aecZero[i] = aecVarRedn[i] = prc->aecChequer[i];
-            aecZero[i].nPlies = 0;
-            if (aecVarRedn[i].nPlies)
-                aecVarRedn[i].nPlies--;
-            aecZero[i].fDeterministic = aecVarRedn[i].fDeterministic = 1;
-            aecZero[i].rNoise = aecVarRedn[i].rNoise = 0.0f;
+            prg->aecZero[i] = prg->aecVarRedn[i] = prc->aecChequer[i];
+            prg->aecZero[i].nPlies = 0;
+            if (prg->aecVarRedn[i].nPlies)
+                prg->aecVarRedn[i].nPlies--;
+            prg->aecZero[i].fDeterministic = prg->aecVarRedn[i].fDeterministic = 1;
+            prg->aecZero[i].rNoise = prg->aecVarRedn[i].rNoise = 0.0f;
         }
 
     }
@@ -411,391 +397,456 @@ BasicCubefulRollout(unsigned int aanBoard[][2][25],
         pfFinished[ici] = TRUE;
 
     memcpy(pciLocal, aci, cci * sizeof(cubeinfo));
+}
 
-    while ((!nTruncate || iTurn < nTruncate) && cUnfinished) {
-        if (iTurn < nLateEvals) {
-            pecCube[0] = prc->aecCube;
-            pecCube[1] = prc->aecCube + 1;
-            pecChequer[0] = prc->aecChequer;
-            pecChequer[1] = prc->aecChequer + 1;
-        } else {
-            pecCube[0] = prc->aecCubeLate;
-            pecCube[1] = prc->aecCubeLate + 1;
-            pecChequer[0] = prc->aecChequerLate;
-            pecChequer[1] = prc->aecChequerLate + 1;
-        }
-
-        /* Cube decision */
-
-        for (ici = 0, pci = pciLocal, pf = pfFinished; ici < cci; ici++, pci++, pf++) {
+static int
+RolloutGameRunning(const rolloutgame * prg)
+{
+    return (!prg->nTruncate || prg->iTurn < prg->nTruncate) && prg->cUnfinished;
+}
 
-            /* check for truncation at bearoff databases */
+/* Truncation at the bearoff databases and cube decisions of this turn */
+static int
+RolloutGameCube(rolloutgame * prg)
+{
+    rolloutcontext *prc = prg->prc;
+    const evalcontext *aecCube = (prg->iTurn < prg->nLateEvals) ? prc->aecCube : prc->aecCubeLate;
+    const int iTurn = prg->iTurn;
+    cubeinfo *pci;
+    cubedecision cd;
+    int *pf;
+    unsigned int i, ici;
+    positionclass pc;
+    float arDouble[NUM_CUBEFUL_OUTPUTS];
+    float aar[2][NUM_ROLLOUT_OUTPUTS];
+    float rDP;
 
-            pc = ClassifyPosition((ConstTanBoard) aanBoard[ici], pci->bgv);
+    evalcontext ecCubeless0ply = { FALSE, 0, FALSE, TRUE, 0.0 };
+    evalcontext ecCubeful0ply = { TRUE, 0, FALSE, TRUE, 0.0 };
 
-            if (prc->fTruncBearoff2 && pc <= CLASS_PERFECT &&
-                prc->fCubeful && *pf && !pci->nMatchTo && ((afCubeDecTop[ici] && !prc->fInitial) || iTurn > 0)) {
+    for (ici = 0, pci = prg->pciLocal, pf = prg->pfFinished; ici < prg->cci; ici++, pci++, pf++) {
+        unsigned int (*anBoard)[25] = prg->aanBoard[ici];
+        float *arOutput = prg->aarOutput[ici];
 
-                /* truncate at two sided bearoff if money game */
+        /* check for truncation at bearoff databases */
 
-                if (GeneralEvaluationE(aarOutput[ici], (ConstTanBoard) aanBoard[ici], pci, &ecCubeful0ply) < 0)
-                    return -1;
+        pc = ClassifyPosition((ConstTanBoard) anBoard, pci->bgv);
 
-                if (iTurn & 1)
-                    InvertEvaluationR(aarOutput[ici], pci);
+        if (prc->fTruncBearoff2 && pc <= CLASS_PERFECT &&
+            prc->fCubeful && *pf && !pci->nMatchTo && ((prg->afCubeDecTop[ici] && !prc->fInitial) || iTurn > 0)) {
 
-                *pf = FALSE;
-                cUnfinished--;
+            /* truncate at two sided bearoff if money game */
 
-            } else if (((prc->fTruncBearoff2 && pc <= CLASS_PERFECT) ||
-                        (prc->fTruncBearoffOS && pc <= CLASS_BEAROFF_OS)) && !prc->fCubeful && *pf) {
+            if (GeneralEvaluationE(arOutput, (ConstTanBoard) anBoard, pci, &ecCubeful0ply) < 0)
+                return -1;
 
-                /* cubeless rollout, requested to truncate at bearoff db */
+            if (iTurn & 1)
+                InvertEvaluationR(arOutput, pci);
 
-                if (GeneralEvaluationE(aarOutput[ici], (ConstTanBoard) aanBoard[ici], pci, &ecCubeless0ply) < 0)
-                    return -1;
+            *pf = FALSE;
+            prg->cUnfinished--;
 
-                /* rollout result is for player on play (even iTurn).
-                 * This point is pre play, so if opponent is on roll, invert */
+        } else if (((prc->fTruncBearoff2 && pc <= CLASS_PERFECT) ||
+                    (prc->fTruncBearoffOS && pc <= CLASS_BEAROFF_OS)) && !prc->fCubeful && *pf) {
 
-                if (iTurn & 1)
-                    InvertEvaluationR(aarOutput[ici], pci);
+            /* cubeless rollout, requested to truncate at bearoff db */
 
-                *pf = FALSE;
-                cUnfinished--;
+            if (GeneralEvaluationE(arOutput, (ConstTanBoard) anBoard, pci, &ecCubeless0ply) < 0)
+                return -1;
 
-            }
+            /* rollout result is for player on play (even iTurn).
+             * This point is pre play, so if opponent is on roll, invert */
 
-            if (*pf) {
+            if (iTurn & 1)
+                InvertEvaluationR(arOutput, pci);
 
-                if (prc->fCubeful && GetDPEq(NULL, &rDP, pci) && (iTurn > 0 || (afCubeDecTop[ici] && !prc->fInitial))) {
+            *pf = FALSE;
+            prg->cUnfinished--;
 
-                    if (GeneralCubeDecisionE(aar, (ConstTanBoard) aanBoard[ici], pci, pecCube[pci->fMove], 0) < 0)
-                        return -1;
+        }
 
-                    cd = FindCubeDecision(arDouble, aar, pci);
+        if (*pf) {
 
-                    switch (cd) {
+            if (prc->fCubeful && GetDPEq(NULL, &rDP, pci) && (iTurn > 0 || (prg->afCubeDecTop[ici] && !prc->fInitial))) {
 
-                    case DOUBLE_TAKE:
-                    case DOUBLE_BEAVER:
-                    case REDOUBLE_TAKE:
-                        if (logfp) {
-                            log_cube(logfp, "double", pci->fMove);
-                            log_cube(logfp, "take", !pci->fMove);
-                        }
+                if (GeneralCubeDecisionE(aar, (ConstTanBoard) anBoard, pci, &aecCube[pci->fMove], 0) < 0)
+                    return -1;
 
-                        /* update statistics */
-                        if (aarsStatistics)
-                            MT_SafeInc(&aarsStatistics[ici][pci->fMove].acDoubleTake[LogCubeClamped(pci->nCube)]);
+                cd = FindCubeDecision(arDouble, aar, pci);
 
-                        SetCubeInfo(pci, 2 * pci->nCube, !pci->fMove, pci->fMove, pci->nMatchTo,
-                                    pci->anScore, pci->fCrawford, pci->fJacoby, pci->fBeavers, pci->bgv);
+                switch (cd) {
 
-                        break;
+                case DOUBLE_TAKE:
+                case DOUBLE_BEAVER:
+                case REDOUBLE_TAKE:
+                    if (prg->logfp) {
+                        log_cube(prg->logfp, "double", pci->fMove);
+                        log_cube(prg->logfp, "take", !pci->fMove);
+                    }
 
-                    case DOUBLE_PASS:
-                    case REDOUBLE_PASS:
-                        if (logfp) {
-                            log_cube(logfp, "double", pci->fMove);
-                            log_cube(logfp, "drop", !pci->fMove);
-                        }
+                    /* update statistics */
+                    if (prg->aarsStatistics)
+                        MT_SafeInc(&prg->aarsStatistics[ici][pci->fMove].acDoubleTake[LogCubeClamped(pci->nCube)]);
 
-                        *pf = FALSE;
-                        cUnfinished--;
+                    SetCubeInfo(pci, 2 * pci->nCube, !pci->fMove, pci->fMove, pci->nMatchTo,
+                                pci->anScore, pci->fCrawford, pci->fJacoby, pci->fBeavers, pci->bgv);
 
-                        /* assign outputs */
+                    break;
 
-                        for (i = 0; i <= OUTPUT_EQUITY; i++)
-                            aarOutput[ici][i] = aar[0][i];
+                case DOUBLE_PASS:
+                case REDOUBLE_PASS:
+                    if (prg->logfp) {
+                        log_cube(prg->logfp, "double", pci->fMove);
+                        log_cube(prg->logfp, "drop", !pci->fMove);
+                    }
 
-                        /* 
-                         * assign equity for double, pass:
-                         * - mwc for match play
-                         * - normalized equity for money play (i.e, rDP=1)
-                         */
+                    *pf = FALSE;
+                    prg->cUnfinished--;
 
-                        aarOutput[ici][OUTPUT_CUBEFUL_EQUITY] = rDP;
+                    /* assign outputs */
 
-                        /* invert evaluations if required */
+                    for (i = 0; i <= OUTPUT_EQUITY; i++)
+                        arOutput[i] = aar[0][i];
 
-                        if (iTurn & 1)
-                            InvertEvaluationR(aarOutput[ici], pci);
+                    /*
+                     * assign equity for double, pass:
+                     * - mwc for match play
+                     * - normalized equity for money play (i.e, rDP=1)
+                     */
 
-                        /* update statistics */
+                    arOutput[OUTPUT_CUBEFUL_EQUITY] = rDP;
 
-                        if (aarsStatistics) {
-                            MT_SafeInc(&aarsStatistics[ici][pci->fMove].acDoubleDrop[LogCubeClamped(pci->nCube)]);
-                            MT_SafeInc(&aarsStatistics[ici][pci->fMove].acWin[LogCubeClamped(pci->nCube)]);
-                        }
+                    /* invert evaluations if required */
 
-                        break;
+                    if (iTurn & 1)
+                        InvertEvaluationR(arOutput, pci);
 
-                    case NODOUBLE_TAKE:
-                    case TOOGOOD_TAKE:
-                    case TOOGOOD_PASS:
-                    case NODOUBLE_BEAVER:
-                    case NO_REDOUBLE_TAKE:
-                    case TOOGOODRE_TAKE:
-                    case TOOGOODRE_PASS:
-                    case NO_REDOUBLE_BEAVER:
-                    case OPTIONAL_DOUBLE_BEAVER:
-                    case OPTIONAL_DOUBLE_TAKE:
-                    case OPTIONAL_REDOUBLE_TAKE:
-                    case OPTIONAL_DOUBLE_PASS:
-                    case OPTIONAL_REDOUBLE_PASS:
-                    case NODOUBLE_DEADCUBE:
-                    case NO_REDOUBLE_DEADCUBE:
-                    case NOT_AVAILABLE:
-                    default:
-
-                        /* no op */
-                        break;
+                    /* update statistics */
 
+                    if (prg->aarsStatistics) {
+                        MT_SafeInc(&prg->aarsStatistics[ici][pci->fMove].acDoubleDrop[LogCubeClamped(pci->nCube)]);
+                        MT_SafeInc(&prg->aarsStatistics[ici][pci->fMove].acWin[LogCubeClamped(pci->nCube)]);
                     }
-                }               /* cube */
-            }
-        }                       /* loop over ci */
 
-        /* Chequer play */
-
-        if (RolloutDice(iTurn, iGame, prc->fInitial, anDice,
-                        &prc->rngRollout, rngctxRollout, prc->fRotate, dicePerms) < 0)
-            return -1;
+                    break;
 
-        if (anDice[0] < anDice[1])
-            swap_us(anDice, anDice + 1);
+                case NODOUBLE_TAKE:
+                case TOOGOOD_TAKE:
+                case TOOGOOD_PASS:
+                case NODOUBLE_BEAVER:
+                case NO_REDOUBLE_TAKE:
+                case TOOGOODRE_TAKE:
+                case TOOGOODRE_PASS:
+                case NO_REDOUBLE_BEAVER:
+                case OPTIONAL_DOUBLE_BEAVER:
+                case OPTIONAL_DOUBLE_TAKE:
+                case OPTIONAL_REDOUBLE_TAKE:
+                case OPTIONAL_DOUBLE_PASS:
+                case OPTIONAL_REDOUBLE_PASS:
+                case NODOUBLE_DEADCUBE:
+                case NO_REDOUBLE_DEADCUBE:
+                case NOT_AVAILABLE:
+                default:
+
+                    /* no op */
+                    break;
 
+                }
+            }                   /* cube */
+        }
+    }                           /* loop over ci */
 
-        for (ici = 0, pci = pciLocal, pf = pfFinished; ici < cci; ici++, pci++, pf++) {
+    return 0;
+}
 
-            if (*pf) {
+static int
+RolloutGameDice(rolloutgame * prg)
+{
+    if (RolloutDice(prg->iTurn, prg->iGame, prg->prc->fInitial, prg->anDice,
+                    &prg->prc->rngRollout, prg->rngctxRollout, prg->prc->fRotate, prg->dicePerms,
+                    &prg->nSkip) < 0)
+        return -1;
 
-                /* Save number of chequers on bar */
+    if (prg->anDice[0] < prg->anDice[1])
+        swap_us(prg->anDice, prg->anDice + 1);
 
-                for (i = 0; i < 2; i++)
-                    aiBar[i] = aanBoard[ici][i][24];
+    return 0;
+}
 
-                /* Save number of pips (for bearoff only) */
+/* Chequer play for the roll of this turn */
+static int
+RolloutGameMove(rolloutgame * prg)
+{
+    rolloutcontext *prc = prg->prc;
+    const int iTurn = prg->iTurn;
+    const unsigned int *anDice = prg->anDice;
+    evalcontext *aecCube = (iTurn < prg->nLateEvals) ? prc->aecCube : prc->aecCubeLate;
+    evalcontext *aecChequer = (iTurn < prg->nLateEvals) ? prc->aecChequer : prc->aecChequerLate;
+    cubeinfo *pci;
+    int *pf;
+    unsigned int i, j, k, ici;
 
-                pcBefore = ClassifyPosition((ConstTanBoard) aanBoard[ici], pci->bgv);
-                if (aarsStatistics && pcBefore <= CLASS_BEAROFF1) {
-                    PipCount((ConstTanBoard) aanBoard[ici], anPips);
-                    nPipsBefore = anPips[1];
-                }
+    positionclass pc, pcBefore;
+    unsigned int nPipsBefore = 0, nPipsAfter, nPipsDice;
+    unsigned int anPips[2];
+    int afClosedBoard[2];
 
-                /* Find best move :-) */
+    unsigned int aiBar[2];
 
-                if (useVarRedn) {
+    float r;
 
-                    /* Variance reduction */
+    int useVarRedn = prc->fVarRedn;
 
-                    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
-                        arMean[i] = 0.0f;
+    float arMean[NUM_ROLLOUT_OUTPUTS];
+    unsigned int aaanBoard[6][6][2][25];
+    int aanMoves[6][6][8];
+#if defined(USE_SIMD_INSTRUCTIONS)
+#define NUM_ROLLOUT_OUTPUTS_PADDED (NUM_ROLLOUT_OUTPUTS + VEC_SIZE - (NUM_ROLLOUT_OUTPUTS % VEC_SIZE))
+    SSE_ALIGN(float aaar[6][6][NUM_ROLLOUT_OUTPUTS_PADDED]);
+#else
+    float aaar[6][6][NUM_ROLLOUT_OUTPUTS];
+#endif
 
-                    for (i = 0; i < 6; i++)
-                        for (j = 0; j <= i; j++) {
+    for (ici = 0, pci = prg->pciLocal, pf = prg->pfFinished; ici < prg->cci; ici++, pci++, pf++) {
 
-                            if (prc->fInitial && !iTurn && j == i)
-                                /* no doubles possible for first roll when rolling
-                                 * out as initial position */
-                                continue;
+        if (*pf) {
+            unsigned int (*anBoard)[25] = prg->aanBoard[ici];
+            rolloutstat *ars = prg->aarsStatistics ? prg->aarsStatistics[ici] : NULL;
 
-                            memcpy(&aaanBoard[i][j][0][0], &aanBoard[ici][0][0], 2 * 25 * sizeof(int));
+            /* Save number of chequers on bar */
 
-                            /* Find the best move for each roll on ply 0 only */
+            for (i = 0; i < 2; i++)
+                aiBar[i] = anBoard[i][24];
 
-                            if (FindBestMove(aanMoves[i][j], i + 1, j + 1,
-                                             aaanBoard[i][j], pci, &aecZero[pci->fMove], defaultFilters) < 0)
-                                return -1;
+            /* Save number of pips (for bearoff only) */
 
-                            SwapSides(aaanBoard[i][j]);
+            pcBefore = ClassifyPosition((ConstTanBoard) anBoard, pci->bgv);
+            if (ars && pcBefore <= CLASS_BEAROFF1) {
+                PipCount((ConstTanBoard) anBoard, anPips);
+                nPipsBefore = anPips[1];
+            }
 
-                            /* re-evaluate the chosen move at ply n-1 */
+            /* Find best move :-) */
 
-                            pci->fMove = !pci->fMove;
-                            if (GeneralEvaluationE(aaar[i][j],
-                                                   (ConstTanBoard) aaanBoard[i][j], pci, &aecVarRedn[pci->fMove]) < 0)
-                                return -1;
-                            pci->fMove = !pci->fMove;
+            if (useVarRedn) {
 
-                            if (!(iTurn & 1))
-                                InvertEvaluationR(aaar[i][j], pci);
+                /* Variance reduction */
 
-                            /* Calculate arMean: the n-ply evaluation of the position */
+                for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
+                    arMean[i] = 0.0f;
 
-                            for (k = 0; k < NUM_ROLLOUT_OUTPUTS; k++)
-                                arMean[k] += ((i == j) ? aaar[i][j][k] : (aaar[i][j][k] * 2.0f));
+                for (i = 0; i < 6; i++)
+                    for (j = 0; j <= i; j++) {
 
-                        }
+                        if (prc->fInitial && !iTurn && j == i)
+                            /* no doubles possible for first roll when rolling
+                             * out as initial position */
+                            continue;
 
-                    if (prc->fInitial && !iTurn)
-                        /* no doubles ... */
-                        for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
-                            arMean[i] /= 30.0f;
-                    else
-                        for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
-                            arMean[i] /= 36.0f;
+                        memcpy(&aaanBoard[i][j][0][0], &anBoard[0][0], 2 * 25 * sizeof(int));
 
-                    /* Find best move */
+                        /* Find the best move for each roll on ply 0 only */
 
-                    if (pecChequer[pci->fMove]->nPlies ||
-                        prc->fCubeful != pecChequer[pci->fMove]->fCubeful || pecChequer[pci->fMove]->rNoise > 0.0f)
+                        if (FindBestMove(aanMoves[i][j], i + 1, j + 1,
+                                         aaanBoard[i][j], pci, &prg->aecZero[pci->fMove], defaultFilters) < 0)
+                            return -1;
 
-                        /* the user requested n-ply (n>0). Another call to
-                         * FindBestMove is required */
+                        SwapSides(aaanBoard[i][j]);
 
-                        FindBestMove(aanMoves[anDice[0] - 1][anDice[1] - 1],
-                                     anDice[0], anDice[1],
-                                     aanBoard[ici], pci,
-                                     pecChequer[pci->fMove],
-                                     (iTurn < nLateEvals) ? prc->aaamfChequer[pci->fMove] : prc->aaamfLate[pci->fMove]);
+                        /* re-evaluate the chosen move at ply n-1 */
 
-                    else {
+                        pci->fMove = !pci->fMove;
+                        if (GeneralEvaluationE(aaar[i][j],
+                                               (ConstTanBoard) aaanBoard[i][j], pci, &prg->aecVarRedn[pci->fMove]) < 0)
+                            return -1;
+                        pci->fMove = !pci->fMove;
 
-                        /* 0-ply play: best move is already recorded */
+                        if (!(iTurn & 1))
+                            InvertEvaluationR(aaar[i][j], pci);
 
-                        memcpy(&aanBoard[ici][0][0],
-                               &aaanBoard[anDice[0] - 1][anDice[1] - 1][0][0], 2 * 25 * sizeof(int));
+                        /* Calculate arMean: the n-ply evaluation of the position */
 
-                        SwapSides(aanBoard[ici]);
+                        for (k = 0; k < NUM_ROLLOUT_OUTPUTS; k++)
+                            arMean[k] += ((i == j) ? aaar[i][j][k] : (aaar[i][j][k] * 2.0f));
 
                     }
 
+                if (prc->fInitial && !iTurn)
+                    /* no doubles ... */
+                    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
+                        arMean[i] /= 30.0f;
+                else
+                    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
+                        arMean[i] /= 36.0f;
 
-                    /* Accumulate variance reduction terms */
+                /* Find best move */
 
-                    if (pci->nMatchTo)
-                        for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
-                            aarVarRedn[ici][i] += arMean[i] - aaar[anDice[0] - 1][anDice[1] - 1][i];
-                    else {
-                        for (i = 0; i <= OUTPUT_EQUITY; i++)
-                            aarVarRedn[ici][i] += arMean[i] - aaar[anDice[0] - 1][anDice[1] - 1][i];
+                if (aecChequer[pci->fMove].nPlies ||
+                    prc->fCubeful != aecChequer[pci->fMove].fCubeful || aecChequer[pci->fMove].rNoise > 0.0f)
 
-                        r = arMean[OUTPUT_CUBEFUL_EQUITY] - aaar[anDice[0] - 1][anDice[1] - 1]
-                            [OUTPUT_CUBEFUL_EQUITY];
-                        aarVarRedn[ici][OUTPUT_CUBEFUL_EQUITY] += r * (float) (pci->nCube / aci[ici].nCube);
-                    }
-
-                } else {
-
-                    /* no variance reduction */
+                    /* the user requested n-ply (n>0). Another call to
+                     * FindBestMove is required */
 
                     FindBestMove(aanMoves[anDice[0] - 1][anDice[1] - 1],
                                  anDice[0], anDice[1],
-                                 aanBoard[ici], pci,
-                                 pecChequer[pci->fMove],
-                                 (iTurn < nLateEvals) ? prc->aaamfChequer[pci->fMove] : prc->aaamfLate[pci->fMove]);
+                                 anBoard, pci,
+                                 &aecChequer[pci->fMove],
+                                 (iTurn < prg->nLateEvals) ? prc->aaamfChequer[pci->fMove] : prc->aaamfLate[pci->fMove]);
+
+                else {
+
+                    /* 0-ply play: best move is already recorded */
+
+                    memcpy(&anBoard[0][0], &aaanBoard[anDice[0] - 1][anDice[1] - 1][0][0], 2 * 25 * sizeof(int));
+
+                    SwapSides(anBoard);
 
                 }
 
-                if (logfp) {
-                    log_move(logfp, aanMoves[anDice[0] - 1][anDice[1] - 1], pci->fMove, anDice[0], anDice[1]);
+
+                /* Accumulate variance reduction terms */
+
+                if (pci->nMatchTo)
+                    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
+                        prg->aarVarRedn[ici][i] += arMean[i] - aaar[anDice[0] - 1][anDice[1] - 1][i];
+                else {
+                    for (i = 0; i <= OUTPUT_EQUITY; i++)
+                        prg->aarVarRedn[ici][i] += arMean[i] - aaar[anDice[0] - 1][anDice[1] - 1][i];
+
+                    r = arMean[OUTPUT_CUBEFUL_EQUITY] - aaar[anDice[0] - 1][anDice[1] - 1]
+                        [OUTPUT_CUBEFUL_EQUITY];
+                    prg->aarVarRedn[ici][OUTPUT_CUBEFUL_EQUITY] += r * (float) (pci->nCube / prg->aci[ici].nCube);
                 }
 
-                /* Save hit statistics */
+            } else {
 
-                /* FIXME: record double hit, triple hits etc. ? */
+                /* no variance reduction */
 
-                if (aarsStatistics && !afHit[pci->fMove] && (aiBar[0] < aanBoard[ici][0][24])) {
-                    MT_SafeInc(&aarsStatistics[ici][pci->fMove].nOpponentHit);
-                    MT_SafeAdd(&aarsStatistics[ici][pci->fMove].rOpponentHitMove, iTurn);
-                    afHit[pci->fMove] = TRUE;
+                FindBestMove(aanMoves[anDice[0] - 1][anDice[1] - 1],
+                             anDice[0], anDice[1],
+                             anBoard, pci,
+                             &aecChequer[pci->fMove],
+                             (iTurn < prg->nLateEvals) ? prc->aaamfChequer[pci->fMove] : prc->aaamfLate[pci->fMove]);
 
-                }
+            }
 
-                if (MT_SafeGet(&fInterrupt))
-                    return -1;
+            if (prg->logfp) {
+                log_move(prg->logfp, aanMoves[anDice[0] - 1][anDice[1] - 1], pci->fMove, anDice[0], anDice[1]);
+            }
 
-                /* Calculate number of wasted pips */
+            /* Save hit statistics */
 
-                pc = ClassifyPosition((ConstTanBoard) aanBoard[ici], pci->bgv);
+            /* FIXME: record double hit, triple hits etc. ? */
 
-                if (aarsStatistics && pc <= CLASS_BEAROFF1 && pcBefore <= CLASS_BEAROFF1) {
+            if (ars && !prg->afHit[pci->fMove] && (aiBar[0] < anBoard[0][24])) {
+                MT_SafeInc(&ars[pci->fMove].nOpponentHit);
+                MT_SafeAdd(&ars[pci->fMove].rOpponentHitMove, iTurn);
+                prg->afHit[pci->fMove] = TRUE;
 
-                    PipCount((ConstTanBoard) aanBoard[ici], anPips);
-                    nPipsAfter = anPips[1];
-                    nPipsDice = anDice[0] + anDice[1];
-                    if (anDice[0] == anDice[1])
-                        nPipsDice *= 2;
+            }
 
-                    MT_SafeInc(&aarsStatistics[ici][pci->fMove].nBearoffMoves);
-                    MT_SafeAdd(&aarsStatistics[ici][pci->fMove].nBearoffPipsLost,
-                               nPipsDice - (nPipsBefore - nPipsAfter));
+            if (MT_SafeGet(&fInterrupt))
+                return -1;
 
-                }
+            /* Calculate number of wasted pips */
 
-                /* Opponent closed out */
+            pc = ClassifyPosition((ConstTanBoard) anBoard, pci->bgv);
 
-                if (aarsStatistics && !afClosedOut[pci->fMove]
-                    && aanBoard[ici][0][24]) {
+            if (ars && pc <= CLASS_BEAROFF1 && pcBefore <= CLASS_BEAROFF1) {
 
-                    /* opponent is on bar */
+                PipCount((ConstTanBoard) anBoard, anPips);
+                nPipsAfter = anPips[1];
+                nPipsDice = anDice[0] + anDice[1];
+                if (anDice[0] == anDice[1])
+                    nPipsDice *= 2;
 
-                    ClosedBoard(afClosedBoard, (ConstTanBoard) aanBoard[ici]);
+                MT_SafeInc(&ars[pci->fMove].nBearoffMoves);
+                MT_SafeAdd(&ars[pci->fMove].nBearoffPipsLost, nPipsDice - (nPipsBefore - nPipsAfter));
 
-                    if (afClosedBoard[pci->fMove]) {
-                        MT_SafeInc(&aarsStatistics[ici][pci->fMove].nOpponentClosedOut);
-                        MT_SafeAdd(&aarsStatistics[ici][pci->fMove].rOpponentClosedOutMove, iTurn);
-                        afClosedOut[pci->fMove] = TRUE;
-                    }
+            }
 
-                }
+            /* Opponent closed out */
 
+            if (ars && !prg->afClosedOut[pci->fMove]
+                && anBoard[0][24]) {
 
-                /* check if game is over */
+                /* opponent is on bar */
 
-                if (pc == CLASS_OVER) {
-                    if (GeneralEvaluationE(aarOutput[ici], (ConstTanBoard) aanBoard[ici], pci, pecCube[pci->fMove]) < 0)
-                        return -1;
+                ClosedBoard(afClosedBoard, (ConstTanBoard) anBoard);
 
-                    /* Since the game is over: cubeless equity = cubeful equity
-                     * (convert to mwc for match play) */
+                if (afClosedBoard[pci->fMove]) {
+                    MT_SafeInc(&ars[pci->fMove].nOpponentClosedOut);
+                    MT_SafeAdd(&ars[pci->fMove].rOpponentClosedOutMove, iTurn);
+                    prg->afClosedOut[pci->fMove] = TRUE;
+                }
 
-                    aarOutput[ici][OUTPUT_CUBEFUL_EQUITY] =
-                        (pci->nMatchTo) ? eq2mwc(aarOutput[ici][OUTPUT_EQUITY], pci) : aarOutput[ici][OUTPUT_EQUITY];
+            }
 
-                    if (iTurn & 1)
-                        InvertEvaluationR(aarOutput[ici], pci);
 
-                    *pf = FALSE;
-                    cUnfinished--;
+            /* check if game is over */
 
-                    /* update statistics */
+            if (pc == CLASS_OVER) {
+                float *arOutput = prg->aarOutput[ici];
 
-                    if (aarsStatistics)
-                        switch (GameStatus((ConstTanBoard) aanBoard[ici], pci->bgv)) {
-                        case 1:
-                            MT_SafeInc(&aarsStatistics[ici][pci->fMove].acWin[LogCubeClamped(pci->nCube)]);
-                            break;
-                        case 2:
-                            MT_SafeInc(&aarsStatistics[ici][pci->fMove].acWinGammon[LogCubeClamped(pci->nCube)]);
-                            break;
-                        case 3:
-                            MT_SafeInc(&aarsStatistics[ici][pci->fMove].acWinBackgammon[LogCubeClamped(pci->nCube)]);
-                            break;
-                        }
+                if (GeneralEvaluationE(arOutput, (ConstTanBoard) anBoard, pci, &aecCube[pci->fMove]) < 0)
+                    return -1;
 
-                }
+                /* Since the game is over: cubeless equity = cubeful equity
+                 * (convert to mwc for match play) */
+
+                arOutput[OUTPUT_CUBEFUL_EQUITY] =
+                    (pci->nMatchTo) ? eq2mwc(arOutput[OUTPUT_EQUITY], pci) : arOutput[OUTPUT_EQUITY];
+
+                if (iTurn & 1)
+                    InvertEvaluationR(arOutput, pci);
+
+                *pf = FALSE;
+                prg->cUnfinished--;
 
-                /* Invert board and more */
+                /* update statistics */
 
-                SwapSides(aanBoard[ici]);
+                if (ars)
+                    switch (GameStatus((ConstTanBoard) anBoard, pci->bgv)) {
+                    case 1:
+                        MT_SafeInc(&ars[pci->fMove].acWin[LogCubeClamped(pci->nCube)]);
+                        break;
+                    case 2:
+                        MT_SafeInc(&ars[pci->fMove].acWinGammon[LogCubeClamped(pci->nCube)]);
+                        break;
+                    case 3:
+                        MT_SafeInc(&ars[pci->fMove].acWinBackgammon[LogCubeClamped(pci->nCube)]);
+                        break;
+                    }
 
-                SetCubeInfo(pci, pci->nCube, pci->fCubeOwner,
-                            !pci->fMove, pci->nMatchTo,
-                            pci->anScore, pci->fCrawford, pci->fJacoby, pci->fBeavers, pci->bgv);
             }
-        }
 
-        iTurn++;
+            /* Invert board and more */
 
-    }                           /* loop truncate */
+            SwapSides(anBoard);
 
+            SetCubeInfo(pci, pci->nCube, pci->fCubeOwner,
+                        !pci->fMove, pci->nMatchTo,
+                        pci->anScore, pci->fCrawford, pci->fJacoby, pci->fBeavers, pci->bgv);
+        }
+    }
 
-    /* evaluation at truncation */
+    prg->iTurn++;
 
-    for (ici = 0, pci = pciLocal, pf = pfFinished; ici < cci; ici++, pci++, pf++) {
+    return 0;
+}
+
+/* Evaluation at truncation and the final outputs */
+static int
+RolloutGameEnd(rolloutgame * prg)
+{
+    rolloutcontext *prc = prg->prc;
+    cubeinfo *pci;
+    int *pf;
+    unsigned int i, ici;
+    evalcontext ec;
+
+    for (ici = 0, pci = prg->pciLocal, pf = prg->pfFinished; ici < prg->cci; ici++, pci++, pf++) {
+        float *arOutput = prg->aarOutput[ici];
 
         if (*pf) {
 
@@ -806,11 +857,11 @@ BasicCubefulRollout(unsigned int aanBoard[][2][25],
 
             /* evaluation at truncation */
 
-            if (GeneralEvaluationE(aarOutput[ici], (ConstTanBoard) aanBoard[ici], pci, &ec) < 0)
+            if (GeneralEvaluationE(arOutput, (ConstTanBoard) prg->aanBoard[ici], pci, &ec) < 0)
                 return -1;
 
-            if (iTurn & 1)
-                InvertEvaluationR(aarOutput[ici], pci);
+            if (prg->iTurn & 1)
+                InvertEvaluationR(arOutput, pci);
 
         }
 
@@ -818,16 +869,16 @@ BasicCubefulRollout(unsigned int aanBoard[][2][25],
          * all variance reduction terms */
 
         if (!pci->nMatchTo)
-            aarOutput[ici][OUTPUT_CUBEFUL_EQUITY] *= (float) (pci->nCube / aci[ici].nCube);
+            arOutput[OUTPUT_CUBEFUL_EQUITY] *= (float) (pci->nCube / prg->aci[ici].nCube);
 
-        if (useVarRedn)
+        if (prc->fVarRedn)
             for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
-                aarOutput[ici][i] += aarVarRedn[ici][i];
+                arOutput[i] += prg->aarVarRedn[ici][i];
 
         /* multiply money equities */
 
         if (!pci->nMatchTo)
-            aarOutput[ici][OUTPUT_CUBEFUL_EQUITY] *= (float) (aci[ici].nCube / nBasisCube);
+            arOutput[OUTPUT_CUBEFUL_EQUITY] *= (float) (prg->aci[ici].nCube / prg->nBasisCube);
 
 
 
@@ -843,6 +894,53 @@ BasicCubefulRollout(unsigned int aanBoard[][2][25],
     return 0;
 }
 
+/* called with
+ * cube decision                  move rollout
+ * aanBoard       2 copies of same board         1 board
+ * aarOutput      2 arrays for eval              1 array
+ * iTurn          player on roll                 same
+ * iGame          game number                    same
+ * cubeinfo       2 structs for double/nodouble  1 cubeinfo
+ * or take/pass
+ * CubeDecTop     array of 2 boolean             1 boolean
+ * (TRUE if a cube decision is valid on turn 0)
+ * cci            2 (number of rollouts to do)   1
+ * prc            1 rollout context              same
+ * aarsStatistics 2 arrays of stats for the      NULL
+ * two alternatives of
+ * cube rollouts
+ *
+ * returns -1 on error/interrupt, fInterrupt TRUE if stopped by user
+ * aarOutput array(s) contain results
+ */
+
+extern int
+BasicCubefulRollout(unsigned int aanBoard[][2][25],
+                    float aarOutput[][NUM_ROLLOUT_OUTPUTS],
+                    int iTurn, int iGame,
+                    const cubeinfo aci[], int afCubeDecTop[], unsigned int cci,
+                    rolloutcontext * prc,
+                    rolloutstat aarsStatistics[][2],
+                    int nBasisCube, perArray * dicePerms, rngcontext * rngctxRollout, FILE * logfp)
+{
+    rolloutgame rg;
+
+    /* Make local copy of cubeinfo struct, since it
+     * may be modified */
+    cubeinfo *pciLocal = g_alloca(cci * sizeof(cubeinfo));
+    int *pfFinished = g_alloca(cci * sizeof(int));
+    float (*aarVarRedn)[NUM_ROLLOUT_OUTPUTS] = g_alloca(cci * NUM_ROLLOUT_OUTPUTS * sizeof(float));
+
+    RolloutGameStart(&rg, aanBoard, aarOutput, iTurn, iGame, aci, afCubeDecTop, cci, prc, aarsStatistics,
+                     nBasisCube, dicePerms, rngctxRollout, logfp, pciLocal, pfFinished, aarVarRedn);
+
+    while (RolloutGameRunning(&rg))
+        if (RolloutGameCube(&rg) < 0 || RolloutGameDice(&rg) < 0 || RolloutGameMove(&rg) < 0)
+            return -1;
+
+    return RolloutGameEnd(&rg);
+}
+
 #if !defined(LOCKING_VERSION)
 
 /* called with a collection of moves or a cube decision to be rolled out.
@@ -919,6 +1017,35 @@ comp_jsdinfo_order(const void *a, const void *b)
     return 0;
 }
 
+/* Running count, mean and sum of squared deviations (Welford) of the
+ * outputs of one alternative.  Each thread accumulates its trials
+ * locally and merges them into armRollout in batches. */
+typedef struct {
+    unsigned int n;
+    double arMean[NUM_ROLLOUT_OUTPUTS];
+    double arM2[NUM_ROLLOUT_OUTPUTS];
+} rolloutmoments;
+
+/* Merge batches after this many trials per alternative or this many
+ * milliseconds, whichever comes first */
+#if defined(USE_MULTITHREAD)
+#define ROLLOUT_BATCH_TRIALS 8
+#else
+#define ROLLOUT_BATCH_TRIALS 1
+#endif
+#define ROLLOUT_BATCH_MS 250.0
+
+/* Deterministic rollouts run in blocks of this many trials per
+ * alternative; the stopping rules are checked between blocks */
+#define ROLLOUT_BLOCK_TRIALS 144
+
+/* One trial of a deterministic rollout block */
+typedef struct {
+    int alt;
+    int trial;
+    float ar[NUM_ROLLOUT_OUTPUTS];
+} rollouttrial;
+
 /* Lots of shared variables - should probably not be globals... */
 static int cGames;
 static cubeinfo *aciLocal;
@@ -926,8 +1053,7 @@ static int show_jsds;
 
 static float (*aarMu)[NUM_ROLLOUT_OUTPUTS];
 static float (*aarSigma)[NUM_ROLLOUT_OUTPUTS];
-static float (*aarResult)[NUM_ROLLOUT_OUTPUTS];
-static float (*aarVariance)[NUM_ROLLOUT_OUTPUTS];
+static rolloutmoments *armRollout;
 static int *fNoMore;
 static jsdinfo *ajiJSD;
 
@@ -942,6 +1068,9 @@ static int ro_fInvert;
 static int ro_NextTrial;
 static unsigned int *altGameCount;
 static int *altTrialCount;
+static rollouttrial *ro_artBlock;
+static int ro_cBlock;
+static int ro_NextBlockTrial;
 
 static void
 check_jsds(int *active)
@@ -1124,25 +1253,387 @@ check_sds(int *active)
 
 }
 
+static void
+AddTrial(rolloutmoments * prm, const float ar[NUM_ROLLOUT_OUTPUTS])
+{
+    unsigned int j;
+
+    prm->n++;
+    for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++) {
+        double rDelta = ar[j] - prm->arMean[j];
+
+        prm->arMean[j] += rDelta / prm->n;
+        prm->arM2[j] += rDelta * (ar[j] - prm->arMean[j]);
+    }
+}
+
+static void
+MergeMoments(rolloutmoments * prmDst, const rolloutmoments * prmSrc)
+{
+    unsigned int n = prmDst->n + prmSrc->n;
+    unsigned int j;
+
+    if (prmSrc->n == 0)
+        return;
+
+    /* Chan et al. pairwise update */
+    for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++) {
+        double rDelta = prmSrc->arMean[j] - prmDst->arMean[j];
+
+        prmDst->arMean[j] += rDelta * prmSrc->n / n;
+        prmDst->arM2[j] += prmSrc->arM2[j] + rDelta * rDelta * prmDst->n * prmSrc->n / n;
+    }
+    prmDst->n = n;
+}
+
+/* Update the published results of all alternatives from armRollout and
+ * check the stopping conditions.  Returns TRUE if the rollout should stop.
+ * Must be called with the exclusive lock held. */
+static int
+UpdateRolloutResults(void)
+{
+    int active_alternatives = ro_alternatives;
+    int alt;
+    unsigned int j;
+
+    for (alt = 0; alt < ro_alternatives; ++alt) {
+        const rolloutmoments *prm = &armRollout[alt];
+        rolloutcontext *prc = &ro_apes[alt]->rc;
+
+        altGameCount[alt] = prm->n;
+
+        for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++) {
+            aarMu[alt][j] = (float) prm->arMean[j];
+
+            if (j < OUTPUT_EQUITY) {
+                if (aarMu[alt][j] < 0.0f)
+                    aarMu[alt][j] = 0.0f;
+                else if (aarMu[alt][j] > 1.0f)
+                    aarMu[alt][j] = 1.0f;
+            }
+
+            /* for n == 1 the variance is not defined */
+            aarSigma[alt][j] = prm->n > 1 ? (float) sqrt(prm->arM2[j] / (prm->n - 1) / prm->n) : 0.0f;
+        }
+
+        /* For normal alternatives nGamesDone and altGameCount will be equal. For cube decisions,
+         * however, the double and nodouble alternatives are counted as the threads merge their
+         * batches and may be apart by the trials still pending in them. So we cheat a little bit,
+         * but it would be better if the two alternatives weren't linked */
+        if (prc->nGamesDone < altGameCount[alt])
+            prc->nGamesDone = altGameCount[alt];
+    }
+
+    /* check stopping conditions */
+    /* Stop rolling out moves whose Equity is more than a user selected multiple of the joint standard
+     * deviation of the equity difference with the best move in the list. */
+    if (show_jsds) {
+        check_jsds(&active_alternatives);
+    }
+    if (rcRollout.fStopOnSTD) {
+        check_sds(&active_alternatives);
+    }
+
+    return (active_alternatives < 2 && rcRollout.fStopOnJsd) || active_alternatives < 1;
+}
+
+/* Merge a thread's pending trials into the shared results and check the
+ * stopping conditions.  Returns TRUE if the rollout should stop. */
+static int
+MergeRolloutBatch(rolloutmoments * armLocal)
+{
+    int fStop;
+    int alt;
+
+    multi_debug("exclusive lock: merge rollout batch");
+    MT_Exclusive();
+
+    for (alt = 0; alt < ro_alternatives; ++alt) {
+        MergeMoments(&armRollout[alt], &armLocal[alt]);
+        memset(&armLocal[alt], 0, sizeof(rolloutmoments));
+    }
+    fStop = UpdateRolloutResults();
+
+    MT_Release();
+    multi_debug("exclusive release: merge rollout batch");
+
+    return fStop;
+}
+
+/* Roll out one trial of alternative alt */
+static void
+RolloutTrial(int alt, int trial, float (*paar)[NUM_ROLLOUT_OUTPUTS], perArray * pdicePerms, rngcontext * rngctx)
+{
+    TanBoard anBoardEval;
+    FILE *logfp = NULL;
+    rolloutcontext *prc = &ro_apes[alt]->rc;
+
+    /* get the dice generator set up... */
+    if (prc->fRotate)
+        QuasiRandomSeed(pdicePerms, (int) prc->nSeed);
+
+    /* ... and the RNG */
+    if (prc->rngRollout != RNG_MANUAL)
+        InitRNGSeed((unsigned int) (prc->nSeed + (trial << 8)), prc->rngRollout, rngctx);
+
+    memcpy(&anBoardEval, ro_apBoard[alt], sizeof(anBoardEval));
+
+    /* roll something out */
+    if (log_rollouts && log_file_name) {
+        char *log_name = g_strdup_printf("%s-%7.7d-%c.sgf", log_file_name, trial, alt + 'a');
+        logfp = log_game_start(log_name, ro_apci[alt], prc->fCubeful, anBoardEval);
+        g_free(log_name);
+    }
+    BasicCubefulRollout(&anBoardEval, paar, 0, trial, ro_apci[alt],
+                        ro_apCubeDecTop[alt], 1, prc,
+                        ro_aarsStatistics ? ro_aarsStatistics + alt : NULL,
+                        aciLocal[ro_fCubeRollout ? 0 : alt].nCube, pdicePerms, rngctx, logfp);
+
+    if (logfp) {
+        log_game_over(logfp);
+    }
+
+    if (ro_fInvert)
+        InvertEvaluationR(*paar, ro_apci[alt]);
+}
+
+/* Games that one thread plays side by side, see RolloutTrialsLockstep() */
+typedef struct {
+    unsigned int cMax;
+    rolloutgame *arg;
+    TanBoard *aanBoard;
+    cubeinfo *aci;
+    int *afFinished;
+    float (*aarVarRedn)[NUM_ROLLOUT_OUTPUTS];
+    rngcontext **arngctx;
+    FILE **alogfp;
+    int *afStep;
+    /* the moves to evaluate together */
+    TanBoard *aanBoardMoves;
+    unsigned int (*aanDiceMoves)[2];
+    cubeinfo *aciMoves;
+    /* quasi random dice, one per seed */
+    perArray **apPerms;
+    int cPerms;
+} rolloutlockstep;
+
+/* Storage for the lockstep trials of a thread, or NULL if lockstep
+ * rollouts are off or not possible with the current settings */
+static rolloutlockstep *
+LockstepCreate(void)
+{
+    rolloutlockstep *pls;
+    unsigned int i;
+    int alt;
+
+    if (nRolloutLockstep < 2)
+        return NULL;
+
+    /* manual dice must be asked for in the order the games are played */
+    for (alt = 0; alt < ro_alternatives; ++alt)
+        if (ro_apes[alt]->rc.rngRollout == RNG_MANUAL)
+            return NULL;
+
+    pls = g_new0(rolloutlockstep, 1);
+    /* room for a whole trial cycle on top of the batch */
+    pls->cMax = (unsigned int) (nRolloutLockstep + ro_alternatives);
+    pls->arg = g_new(rolloutgame, pls->cMax);
+    pls->aanBoard = g_new(TanBoard, pls->cMax);
+    pls->aci = g_new(cubeinfo, pls->cMax);
+    pls->afFinished = g_new(int, pls->cMax);
+    pls->aarVarRedn = g_malloc(pls->cMax * NUM_ROLLOUT_OUTPUTS * sizeof(float));
+    pls->arngctx = g_new(rngcontext *, pls->cMax);
+    pls->alogfp = g_new(FILE *, pls->cMax);
+    pls->afStep = g_new(int, pls->cMax);
+    pls->aanBoardMoves = g_new(TanBoard, pls->cMax);
+    pls->aanDiceMoves = g_malloc(pls->cMax * 2 * sizeof(unsigned int));
+    pls->aciMoves = g_new(cubeinfo, pls->cMax);
+    pls->apPerms = g_new0(perArray *, ro_alternatives);
+
+    for (i = 0; i < pls->cMax; ++i)
+        pls->arngctx[i] = CopyRNGContext(rngctxRollout);
+
+    return pls;
+}
+
+static void
+LockstepDestroy(rolloutlockstep * pls)
+{
+    unsigned int i;
+    int n;
+
+    if (!pls)
+        return;
+
+    for (i = 0; i < pls->cMax; ++i)
+        g_free(pls->arngctx[i]);
+    for (n = 0; n < pls->cPerms; ++n)
+        g_free(pls->apPerms[n]);
+
+    g_free(pls->arg);
+    g_free(pls->aanBoard);
+    g_free(pls->aci);
+    g_free(pls->afFinished);
+    g_free(pls->aarVarRedn);
+    g_free(pls->arngctx);
+    g_free(pls->alogfp);
+    g_free(pls->afStep);
+    g_free(pls->aanBoardMoves);
+    g_free(pls->aanDiceMoves);
+    g_free(pls->aciMoves);
+    g_free(pls->apPerms);
+    g_free(pls);
+}
+
+static perArray *
+LockstepPerms(rolloutlockstep * pls, int nSeed)
+{
+    perArray *pPerms;
+    int n;
+
+    for (n = 0; n < pls->cPerms; ++n)
+        if (pls->apPerms[n]->nPermutationSeed == nSeed)
+            return pls->apPerms[n];
+
+    pPerms = g_new(perArray, 1);
+    pPerms->nPermutationSeed = -1;
+    QuasiRandomSeed(pPerms, nSeed);
+
+    return pls->apPerms[pls->cPerms++] = pPerms;
+}
+
+/* Roll out the trials aprt[0..c-1] in lockstep.  Every turn the cube
+ * decisions and dice of all unfinished games come first, then the
+ * positions after all their candidate moves are evaluated into the
+ * cache in shared neural net batches, and then each game plays its move
+ * as RolloutTrial() would, finding the evaluations in the cache.  Each
+ * game counts the doubles skipped in its own first roll, so rolling the
+ * dice of all the games before any moves does not change them. */
+static void
+RolloutTrialsLockstep(rolloutlockstep * pls, rollouttrial * aprt[], unsigned int c)
+{
+    unsigned int i;
+    int fError = FALSE;
+
+    g_assert(c <= pls->cMax);
+
+    for (i = 0; i < c; ++i) {
+        rollouttrial *prt = aprt[i];
+        int alt = prt->alt;
+        rolloutcontext *prc = &ro_apes[alt]->rc;
+
+        if (prc->rngRollout != RNG_MANUAL)
+            InitRNGSeed((unsigned int) (prc->nSeed + (prt->trial << 8)), prc->rngRollout, pls->arngctx[i]);
+
+        memcpy(pls->aanBoard[i], ro_apBoard[alt], sizeof(TanBoard));
+
+        pls->alogfp[i] = NULL;
+        if (log_rollouts && log_file_name) {
+            char *log_name = g_strdup_printf("%s-%7.7d-%c.sgf", log_file_name, prt->trial, alt + 'a');
+            pls->alogfp[i] = log_game_start(log_name, ro_apci[alt], prc->fCubeful, pls->aanBoard[i]);
+            g_free(log_name);
+        }
+
+        RolloutGameStart(&pls->arg[i], &pls->aanBoard[i], &prt->ar, 0, prt->trial, ro_apci[alt],
+                         ro_apCubeDecTop[alt], 1, prc, ro_aarsStatistics ? ro_aarsStatistics + alt : NULL,
+                         aciLocal[ro_fCubeRollout ? 0 : alt].nCube,
+                         prc->fRotate ? LockstepPerms(pls, (int) prc->nSeed) : NULL,
+                         pls->arngctx[i], pls->alogfp[i], &pls->aci[i], &pls->afFinished[i], &pls->aarVarRedn[i]);
+    }
+
+    while (!fError) {
+        unsigned int cMoves = 0, cStep = 0;
+
+        for (i = 0; i < c && !fError; ++i) {
+            rolloutgame *prg = &pls->arg[i];
+            const cubeinfo *pci = prg->pciLocal;
+            const evalcontext *aecChequer;
+
+            if (!(pls->afStep[i] = RolloutGameRunning(prg)))
+                continue;
+
+            cStep++;
+
+            if (RolloutGameCube(prg) < 0 || RolloutGameDice(prg) < 0) {
+                fError = TRUE;
+                break;
+            }
+
+            if (!prg->pfFinished[0])
+                continue;
+
+            /* the 0-ply candidates that RolloutGameMove() will look at */
+            aecChequer = (prg->iTurn < prg->nLateEvals) ? prg->prc->aecChequer : prg->prc->aecChequerLate;
+            if (!prg->prc->fVarRedn && aecChequer[pci->fMove].rNoise > 0.0f)
+                continue;
+
+            memcpy(pls->aanBoardMoves[cMoves], prg->aanBoard[0], sizeof(TanBoard));
+            memcpy(&pls->aciMoves[cMoves], pci, sizeof(cubeinfo));
+            if (prg->prc->fVarRedn)
+                pls->aanDiceMoves[cMoves][0] = pls->aanDiceMoves[cMoves][1] = 0;
+            else {
+                pls->aanDiceMoves[cMoves][0] = prg->anDice[0];
+                pls->aanDiceMoves[cMoves][1] = prg->anDice[1];
+            }
+            cMoves++;
+        }
+
+        if (fError || !cStep)
+            break;
+
+        EvalCacheMoves((const TanBoard *) pls->aanBoardMoves, (const unsigned int (*)[2]) pls->aanDiceMoves,
+                       pls->aciMoves, cMoves);
+
+        for (i = 0; i < c; ++i)
+            if (pls->afStep[i] && RolloutGameMove(&pls->arg[i]) < 0) {
+                fError = TRUE;
+                break;
+            }
+    }
+
+    for (i = 0; i < c; ++i) {
+        if (!fError) {
+            if (RolloutGameEnd(&pls->arg[i]) < 0)
+                fError = TRUE;
+            else if (ro_fInvert)
+                InvertEvaluationR(aprt[i]->ar, ro_apci[aprt[i]->alt]);
+        }
+
+        if (pls->alogfp[i])
+            log_game_over(pls->alogfp[i]);
+    }
+}
+
 extern void
 RolloutLoopMT(void *UNUSED(unused))
 {
-    TanBoard anBoardEval;
     float aar[NUM_ROLLOUT_OUTPUTS];
-    int active_alternatives;
-    unsigned int j;
     int alt;
-    FILE *logfp = NULL;
-    rolloutcontext *prc = NULL;
     /* Each thread gets a copy of the rngctxRollout */
     rngcontext *rngctxMTRollout = CopyRNGContext(rngctxRollout);
     perArray dicePerms;
+    rolloutmoments *armLocal = g_alloca(ro_alternatives * sizeof(rolloutmoments));
+    int cBatch = 0;
+    double rBatchStart = get_time();
+    rolloutlockstep *pls = LockstepCreate();
+    rollouttrial *art = NULL;
+    rollouttrial **aprt = NULL;
+    unsigned int cTrials = 0;
+    unsigned int i;
     dicePerms.nPermutationSeed = -1;
 
+    memset(armLocal, 0, ro_alternatives * sizeof(rolloutmoments));
+
+    if (pls) {
+        art = g_new(rollouttrial, pls->cMax);
+        aprt = g_new(rollouttrial *, pls->cMax);
+        for (i = 0; i < pls->cMax; ++i)
+            aprt[i] = &art[i];
+    }
+
     /* ============ begin rollout loop ============= */
 
     while (MT_SafeIncValue(&ro_NextTrial) <= cGames) {
-        active_alternatives = ro_alternatives;
 
         for (alt = 0; alt < ro_alternatives; ++alt) {
             int trial = MT_SafeIncValue(&altTrialCount[alt]) - 1;
@@ -1152,112 +1643,123 @@ RolloutLoopMT(void *UNUSED(unused))
                 continue;
             }
 
+            if (pls) {
+                /* collect the trials of a few cycles and play them together */
+                art[cTrials].alt = alt;
+                art[cTrials].trial = trial;
+                cTrials++;
+                continue;
+            }
 
-            prc = &ro_apes[alt]->rc;
+            RolloutTrial(alt, trial, &aar, &dicePerms, rngctxMTRollout);
 
-            /* get the dice generator set up... */
-            if (prc->fRotate)
-                QuasiRandomSeed(&dicePerms, (int) prc->nSeed);
+            if (MT_SafeGet(&fInterrupt))
+                break;
 
-            MT_SafeSet(&nSkip, 0);      /* not multi-thread safe do quasi random dice for initial positions */
+            AddTrial(&armLocal[alt], aar);
+        }                       /* for (alt = 0; alt < ro_alternatives; ++alt) */
 
-            /* ... and the RNG */
-            if (prc->rngRollout != RNG_MANUAL)
-                InitRNGSeed((unsigned int) (prc->nSeed + (trial << 8)), prc->rngRollout, rngctxMTRollout);
+        if (pls && cTrials >= (unsigned int) nRolloutLockstep) {
+            RolloutTrialsLockstep(pls, aprt, cTrials);
+            if (!MT_SafeGet(&fInterrupt))
+                for (i = 0; i < cTrials; ++i)
+                    AddTrial(&armLocal[art[i].alt], art[i].ar);
+            cTrials = 0;
+        }
 
-            memcpy(&anBoardEval, ro_apBoard[alt], sizeof(anBoardEval));
+        if (MT_SafeGet(&fInterrupt))
+            break;
 
-            /* roll something out */
-            if (log_rollouts && log_file_name) {
-                char *log_name = g_strdup_printf("%s-%7.7d-%c.sgf", log_file_name, trial, alt + 'a');
-                logfp = log_game_start(log_name, ro_apci[alt], prc->fCubeful, anBoardEval);
-                g_free(log_name);
-            }
-            BasicCubefulRollout(&anBoardEval, &aar, 0, trial, ro_apci[alt],
-                                ro_apCubeDecTop[alt], 1, prc,
-                                ro_aarsStatistics ? ro_aarsStatistics + alt : NULL,
-                                aciLocal[ro_fCubeRollout ? 0 : alt].nCube, &dicePerms, rngctxMTRollout, logfp);
+#if !defined(USE_MULTITHREAD)
+        ProcessEvents();
+#endif
 
-            if (logfp) {
-                log_game_over(logfp);
+        if (++cBatch >= ROLLOUT_BATCH_TRIALS || get_time() - rBatchStart >= ROLLOUT_BATCH_MS) {
+            if (MergeRolloutBatch(armLocal)) {
+                multi_debug("rollout done early");
+                break;
             }
+            cBatch = 0;
+            rBatchStart = get_time();
+        }
+    }
 
-            if (MT_SafeGet(&fInterrupt))
-                break;
+    /* play the last lockstep trials */
+    if (cTrials && !MT_SafeGet(&fInterrupt)) {
+        RolloutTrialsLockstep(pls, aprt, cTrials);
+        if (!MT_SafeGet(&fInterrupt))
+            for (i = 0; i < cTrials; ++i)
+                AddTrial(&armLocal[art[i].alt], art[i].ar);
+    }
 
-            multi_debug("exclusive lock: update result for alternative");
-            MT_Exclusive();
-            altGameCount[alt]++;
+    /* hand in whatever completed trials are still pending */
+    MergeRolloutBatch(armLocal);
 
-            if (ro_fInvert)
-                InvertEvaluationR(aar, ro_apci[alt]);
+    g_free(aprt);
+    g_free(art);
+    LockstepDestroy(pls);
+    g_free(rngctxMTRollout);
+}
 
-            /* apply the results */
-            for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++) {
-                float rMuNew;
+/* Worker for deterministic rollouts: roll out the trials of the current
+ * block in any order, each into its own slot */
+static void
+RolloutBlockMT(void *UNUSED(unused))
+{
+    rngcontext *rngctxMTRollout = CopyRNGContext(rngctxRollout);
+    perArray dicePerms;
+    rolloutlockstep *pls = LockstepCreate();
+    int i;
 
-                aarResult[alt][j] += aar[j];
-                rMuNew = aarResult[alt][j] / (float) altGameCount[alt];
+    dicePerms.nPermutationSeed = -1;
 
-                if (altGameCount[alt] > 1) {    /* for i == 0 aarVariance is not defined */
-                    float rDelta = rMuNew - aarMu[alt][j];
+    if (pls) {
+        rollouttrial **aprt = g_new(rollouttrial *, pls->cMax);
+        unsigned int c;
 
-                    aarVariance[alt][j] =
-                        aarVariance[alt][j] * (1.0f - 1.0f / (float) (altGameCount[alt] - 1)) +
-                        (float) (altGameCount[alt]) * rDelta * rDelta;
-                }
-
-                aarMu[alt][j] = rMuNew;
+        do {
+            for (c = 0; c < (unsigned int) nRolloutLockstep; ++c) {
+                if ((i = MT_SafeIncValue(&ro_NextBlockTrial) - 1) >= ro_cBlock)
+                    break;
+                aprt[c] = &ro_artBlock[i];
+            }
+            if (c)
+                RolloutTrialsLockstep(pls, aprt, c);
+        } while (c == (unsigned int) nRolloutLockstep && !MT_SafeGet(&fInterrupt));
 
-                if (j < OUTPUT_EQUITY) {
-                    if (aarMu[alt][j] < 0.0f)
-                        aarMu[alt][j] = 0.0f;
-                    else if (aarMu[alt][j] > 1.0f)
-                        aarMu[alt][j] = 1.0f;
-                }
+        g_free(aprt);
+        LockstepDestroy(pls);
+    } else
+        while ((i = MT_SafeIncValue(&ro_NextBlockTrial) - 1) < ro_cBlock) {
+            rollouttrial *prt = &ro_artBlock[i];
 
-                aarSigma[alt][j] = sqrtf(aarVariance[alt][j] / (float) altGameCount[alt]);
-            }                   /* for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++ ) */
+            RolloutTrial(prt->alt, prt->trial, &prt->ar, &dicePerms, rngctxMTRollout);
 
-            /* For normal alternatives nGamesDone and altGameCount will be equal. For cube decisions,
-             * however, the two may differ by the number of threads minus 1. So we cheat a little bit, but
-             * it would be better if the double and nodouble alternatives weren't linked */
-            if (prc->nGamesDone < altGameCount[alt])
-                prc->nGamesDone = altGameCount[alt];
+            if (MT_SafeGet(&fInterrupt))
+                break;
+        }
 
-            MT_Release();
-            multi_debug("exclusive release: update result for alternative");
+    g_free(rngctxMTRollout);
+}
 
-        }                       /* for (alt = 0; alt < ro_alternatives; ++alt) */
+/* Add the trials of a completed block in alternative and trial order */
+static int
+MergeRolloutBlock(void)
+{
+    int fStop;
+    int i;
 
-        if (MT_SafeGet(&fInterrupt))
-            break;
+    multi_debug("exclusive lock: merge rollout block");
+    MT_Exclusive();
 
-        /* we've rolled everything out for this trial, check stopping conditions */
-        /* Stop rolling out moves whose Equity is more than a user selected multiple of the joint standard
-         * deviation of the equity difference with the best move in the list. */
+    for (i = 0; i < ro_cBlock; ++i)
+        AddTrial(&armRollout[ro_artBlock[i].alt], ro_artBlock[i].ar);
+    fStop = UpdateRolloutResults();
 
-#if !defined(USE_MULTITHREAD)
-        ProcessEvents();
-#endif
+    MT_Release();
+    multi_debug("exclusive release: merge rollout block");
 
-        multi_debug("exclusive lock: rollout cycle update");
-        MT_Exclusive();
-        if (show_jsds) {
-            check_jsds(&active_alternatives);
-        }
-        if (rcRollout.fStopOnSTD) {
-            check_sds(&active_alternatives);
-        }
-        if ((active_alternatives < 2 && rcRollout.fStopOnJsd) || active_alternatives < 1) {
-            multi_debug("exclusive release: rollout done early");
-            MT_Release();
-            break;
-        }
-        multi_debug("exclusive release: rollout cycle update");
-        MT_Release();
-    }
-    g_free(rngctxMTRollout);
+    return fStop;
 }
 
 static rolloutprogressfunc *ro_pfProgress;
@@ -1286,6 +1788,69 @@ UpdateProgress(gpointer UNUSED(unused))
     return TRUE;
 }
 
+/* Roll out in blocks that end at fixed trial numbers.  The trials of a
+ * block are shared out between the threads, and then merged in a fixed
+ * order, so the results do not depend on the number of threads or on
+ * their scheduling. */
+static void
+RolloutDeterministic(void)
+{
+    guint as_source = 0;
+
+    ro_artBlock = g_new(rollouttrial, ro_alternatives * ROLLOUT_BLOCK_TRIALS);
+
+    EvalDeterministic(TRUE);
+
+    /* MT_WaitForTasks() would save after every block */
+    if (fAutoSaveRollout)
+        as_source = g_timeout_add(nAutoSaveTime * 60000, save_autosave, NULL);
+
+    for (;;) {
+        unsigned int nFirst = UINT_MAX;
+        unsigned int nEnd, n;
+        int alt;
+
+        for (alt = 0; alt < ro_alternatives; ++alt)
+            if (!fNoMore[alt] && altGameCount[alt] < nFirst)
+                nFirst = altGameCount[alt];
+
+        if (nFirst >= (unsigned int) cGames)
+            break;
+
+        nEnd = MIN((unsigned int) cGames, (nFirst / ROLLOUT_BLOCK_TRIALS + 1) * ROLLOUT_BLOCK_TRIALS);
+
+        ro_cBlock = 0;
+        for (alt = 0; alt < ro_alternatives; ++alt) {
+            if (fNoMore[alt])
+                continue;
+            for (n = altGameCount[alt]; n < nEnd; ++n) {
+                ro_artBlock[ro_cBlock].alt = alt;
+                ro_artBlock[ro_cBlock].trial = (int) n;
+                ro_cBlock++;
+            }
+        }
+        ro_NextBlockTrial = 0;
+
+        multi_debug("rollout adding block");
+        mt_add_tasks(MIN(MT_GetNumThreads(), (unsigned int) ro_cBlock), RolloutBlockMT, NULL, NULL);
+        MT_WaitForTasks(UpdateProgress, 2000, FALSE);
+
+        /* an interrupted block is thrown away */
+        if (MT_SafeGet(&fInterrupt) || MergeRolloutBlock())
+            break;
+    }
+
+    if (fAutoSaveRollout) {
+        g_source_remove(as_source);
+        save_autosave(NULL);
+    }
+
+    EvalDeterministic(FALSE);
+
+    g_free(ro_artBlock);
+    ro_artBlock = NULL;
+}
+
 extern int
 RolloutGeneral(ConstTanBoard * apBoard,
                float (*apOutput[])[NUM_ROLLOUT_OUTPUTS],
@@ -1324,8 +1889,7 @@ RolloutGeneral(ConstTanBoard * apBoard,
 
     aarMu = g_alloca(alternatives * NUM_ROLLOUT_OUTPUTS * sizeof(float));
     aarSigma = g_alloca(alternatives * NUM_ROLLOUT_OUTPUTS * sizeof(float));
-    aarResult = g_alloca(alternatives * NUM_ROLLOUT_OUTPUTS * sizeof(float));
-    aarVariance = g_alloca(alternatives * NUM_ROLLOUT_OUTPUTS * sizeof(float));
+    armRollout = g_alloca(alternatives * sizeof(rolloutmoments));
 
     if (ms.nMatchTo == 0)
         fOutputMWC = 0;
@@ -1392,8 +1956,9 @@ RolloutGeneral(ConstTanBoard * apBoard,
 
             /* initialise internal variables */
             for (j = 0; j < NUM_ROLLOUT_OUTPUTS; ++j) {
-                aarResult[alt][j] = aarVariance[alt][j] = aarMu[alt][j] = aarSigma[alt][j] = 0.0f;
+                aarMu[alt][j] = aarSigma[alt][j] = 0.0f;
             }
+            memset(&armRollout[alt], 0, sizeof(rolloutmoments));
         } else {
             int nGames = prc->nGamesDone;
 
@@ -1411,13 +1976,14 @@ RolloutGeneral(ConstTanBoard * apBoard,
             if (nGames < nFirstTrial)
                 nFirstTrial = nGames;
             /* restore internal variables from input values */
+            armRollout[alt].n = nGames;
             for (j = 0; j < NUM_ROLLOUT_OUTPUTS; ++j) {
-                float r;
+                double r;
 
                 r = aarMu[alt][j] = (*apOutput[alt])[j];
-                aarResult[alt][j] = r * (float) nGames;
+                armRollout[alt].arMean[j] = r;
                 r = aarSigma[alt][j] = (*apStdDev[alt])[j];
-                aarVariance[alt][j] = r * r * (float) nGames;
+                armRollout[alt].arM2[j] = nGames > 1 ? r * r * nGames * (nGames - 1) : 0.0;
             }
         }
 
@@ -1476,12 +2042,16 @@ RolloutGeneral(ConstTanBoard * apBoard,
     UpdateProgress(NULL);
 
     if (active_alternatives > 1 || (!rcRollout.fStopOnJsd && active_alternatives > 0)) {
-        multi_debug("rollout adding tasks");
-        mt_add_tasks(MT_GetNumThreads(), RolloutLoopMT, NULL, NULL);
+        if (fRolloutDeterministic)
+            RolloutDeterministic();
+        else {
+            multi_debug("rollout adding tasks");
+            mt_add_tasks(MT_GetNumThreads(), RolloutLoopMT, NULL, NULL);
 
-        multi_debug("rollout waiting for tasks to complete");
-        MT_WaitForTasks(UpdateProgress, 2000, fAutoSaveRollout);
-        multi_debug("rollout finished waiting for tasks to complete");
+            multi_debug("rollout waiting for tasks to complete");
+            MT_WaitForTasks(UpdateProgress, 2000, fAutoSaveRollout);
+            multi_debug("rollout finished waiting for tasks to complete");
+        }
     }
 
     /* Make sure final output is up to date */
@@ -1701,7 +2271,6 @@ GeneralCubeDecisionR(float aarOutput[2][NUM_ROLLOUT_OUTPUTS],
         return -1;
 
     pes->rc.nGamesDone = nTrials;
-    pes->rc.nSkip = MT_SafeGet(&nSkip);
 
     return 0;
 }
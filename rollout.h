@@ -148,7 +148,7 @@ EXP_LOCK_FUN(int, BasicCubefulRollout, unsigned int aanBoard[][2][25], float aar
 extern void log_cube(FILE * logfp, const char *action, int side);
 extern void log_move(FILE * logfp, const int *anMove, int side, int die0, int die1);
 extern int RolloutDice(int iTurn, int iGame, int fInitial, unsigned int anDice[2], rng * rngx, void *rngctx,
-                       const int fRotate, const perArray * dicePerms);
+                       const int fRotate, const perArray * dicePerms, int *pnSkip);
 extern void ClosedBoard(int afClosedBoard[2], const TanBoard anBoard);
 extern void InvertStdDev(float ar[NUM_ROLLOUT_OUTPUTS]);
 #endif
@@ -672,7 +672,67 @@ CommandSetCache(char *sz)
         outputerr(_("Evaluation cache allocation failed"));
 }
 
+extern void
+CommandSetCacheFile(char *sz)
+{
+    char *szFile = NextToken(&sz);
+    int n;
+
+    if (!szFile || !*szFile) {
+        outputl(_("You must specify a file name, or `off'. See \"help set cachefile\"."));
+        return;
+    }
+
+    if (!StrCaseCmp(szFile, "off")) {
+        EvalCacheFile(NULL, 0);
+        outputl(_("Evaluations will not be shared with other processes."));
+        return;
+    }
+
+    if ((n = ParseNumber(&sz)) <= 0)
+        n = 1 << 22;
+
+    if ((n = EvalCacheFile(szFile, (unsigned int) n)) < 0) {
+        if (errno == EINVAL)
+            outputerrf(_("%s is not an empty file nor an evaluation cache of this version of GNU Backgammon\n"),
+                       szFile);
+        else
+            outputerr(szFile);
+    } else
+        outputf(_("Evaluations will be shared through %s (%d entries).\n"), szFile, n);
+}
+
+extern void
+CommandSetHugePages(char *sz)
+{
+    int f = fCacheHugePages;
+
+    if (SetToggle("hugepages", &f, sz,
+                  _("The evaluation cache will be allocated in huge pages when available."),
+                  _("The evaluation cache will be allocated in normal pages.")) < 0 || f == fCacheHugePages)
+        return;
+
+    if (EvalCacheHugePages(f) < 0)
+        outputerr(_("Evaluation cache allocation failed"));
+}
+
 #if defined(USE_MULTITHREAD)
+extern void
+CommandSetNuma(char *sz)
+{
+    int f = fNumaReplicas;
+
+    if (SetToggle("numa", &f, sz,
+                  _("Calculation threads will be bound to NUMA nodes, each with its own copy of the neural nets."),
+                  _("Calculation threads will share one copy of the neural nets.")) < 0)
+        return;
+
+    MT_SetNumaReplicas(f);
+
+    if (f && MT_GetNumaNodes() < 2)
+        outputl(_("Only one NUMA node was found; the setting has no effect on this machine."));
+}
+
 extern void
 CommandSetThreads(char *sz)
 {
@@ -1796,6 +1856,32 @@ CommandSetRolloutLate(char *sz)
 
 }
 
+extern void
+CommandSetRolloutDeterministic(char *sz)
+{
+    SetToggle("rollout deterministic", &fRolloutDeterministic, sz,
+              _("Rollout results will not depend on the number of threads."),
+              _("Rollout trials will be scheduled freely between threads."));
+}
+
+extern void
+CommandSetRolloutLockstep(char *sz)
+{
+    int n = ParseNumber(&sz);
+
+    if (n < 0) {
+        outputl(_("You must specify a valid number of trials (see `help set rollout lockstep')."));
+        return;
+    }
+
+    nRolloutLockstep = n;
+
+    if (n < 2)
+        outputl(_("Each thread will play one rollout trial at a time."));
+    else
+        outputf(_("Each thread will play %d rollout trials in lockstep.\n"), n);
+}
+
 extern void
 CommandSetRolloutLogEnable(char *sz)
 {
@@ -4298,6 +4384,74 @@ CommandSetExportPNGSize(char *sz)
 
 }
 
+extern void
+CommandSetExternalInFlight(char *sz)
+{
+    int n;
+
+    if ((n = ParseNumber(&sz)) < 1) {
+        outputl(_("You must specify a positive number of requests (see `help set external inflight')."));
+        return;
+    }
+
+    nExternalInFlight = n;
+
+    outputf(_("The external server will evaluate up to %d requests at once.\n"), n);
+}
+
+extern void
+CommandSetExternalQueue(char *sz)
+{
+    int n;
+
+    if ((n = ParseNumber(&sz)) < 1) {
+        outputl(_("You must specify a positive number of requests (see `help set external queue')."));
+        return;
+    }
+
+    nExternalQueue = n;
+
+    outputf(_("The external server will hold up to %d requests for each client.\n"), n);
+}
+
+extern void
+CommandSetExternalLineLength(char *sz)
+{
+    int n;
+
+    if ((n = ParseNumber(&sz)) < 1) {
+        outputl(_("You must specify a positive number of characters (see `help set external linelength')."));
+        return;
+    }
+
+    nExternalLineLength = n;
+
+    outputf(_("The external server will accept lines of up to %d characters.\n"), n);
+}
+
+extern void
+CommandSetExternalOutput(char *sz)
+{
+    int n;
+
+    if ((n = ParseNumber(&sz)) < 1) {
+        outputl(_("You must specify a positive number of bytes (see `help set external output')."));
+        return;
+    }
+
+    nExternalOutput = n;
+
+    outputf(_("The external server will hold up to %d bytes of answers for each client.\n"), n);
+}
+
+extern void
+CommandSetExternalServer(char *sz)
+{
+    SetToggle("external server", &fExternalServer, sz,
+              _("`external' will serve many connections at once."),
+              _("`external' will serve one connection at a time."));
+}
+
 static void
 SetVariation(const bgvariation bgvx)
 {
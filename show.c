@@ -525,8 +525,10 @@ extern void
 CommandShowCache(char *UNUSED(sz))
 {
     unsigned int c[2], cHit[2], cLookup[2];
+    unsigned int acHitPly[CACHE_STATS_PLIES], acLookupPly[CACHE_STATS_PLIES];
+    unsigned int i;
 
-    EvalCacheStats(c, cLookup, cHit);
+    EvalCacheStats(c, cLookup, cHit, acLookupPly, acHitPly);
 
     outputf(_("%10u regular eval entries used %10u lookups %10u hits"), c[0], cLookup[0], cHit[0]);
 
@@ -537,6 +539,12 @@ CommandShowCache(char *UNUSED(sz))
 
     outputc('\n');
 
+    for (i = 0; i < CACHE_STATS_PLIES; i++)
+        if (acLookupPly[i])
+            outputf(_("%10s %u%s ply %10u lookups %10u hits (%4.1f%%).\n"), "",
+                    i, i == CACHE_STATS_PLIES - 1 ? "+" : "", acLookupPly[i], acHitPly[i],
+                    (float) acHitPly[i] * 100.0f / (float) acLookupPly[i]);
+
     outputf(_("%10u pruning eval entries used %10u lookups %10u hits"), c[1], cLookup[1], cHit[1]);
 
     if (cLookup[1])
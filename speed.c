@@ -20,6 +20,8 @@
 
 #include "backgammon.h"
 #include "multithread.h"
+#include "positionid.h"
+#include <glib/gstdio.h>
 
 #if defined(USE_GTK)
 #include "gtkgame.h"
@@ -34,39 +36,48 @@
 
 #define EVALS_PER_ITERATION 1024
 
+#define MOVEGEN_POSITIONS 256
+
 static randctx rc;
 static double timeTaken;
 
+static void
+RandomBoard(randctx * prc, TanBoard anBoard)
+{
+    unsigned int j, k;
+
+    /* Generate a random board.  Don't allow chequers on the bar
+     * or borne off, so we can trivially guarantee the position
+     * is legal. */
+    for (j = 0; j < 25; j++)
+        anBoard[0][j] = anBoard[1][j] = 0;
+
+    for (j = 0; j < 15; j++) {
+        do {
+            k = irand(prc) % 24;
+        } while (anBoard[1][23 - k]);
+        anBoard[0][k]++;
+
+        do {
+            k = irand(prc) % 24;
+        } while (anBoard[0][23 - k]);
+        anBoard[1][k]++;
+    }
+}
+
 static void
 RunEvals(void *UNUSED(notused))
 {
-    int aanBoard[EVALS_PER_ITERATION][2][25];
-    int i, j, k;
+    TanBoard aanBoard[EVALS_PER_ITERATION];
+    unsigned int i;
     double t;
     SSE_ALIGN(float ar[NUM_OUTPUTS]);
 
 #if defined(USE_MULTITHREAD)
     MT_Exclusive();
 #endif
-    for (i = 0; i < EVALS_PER_ITERATION; i++) {
-        /* Generate a random board.  Don't allow chequers on the bar
-         * or borne off, so we can trivially guarantee the position
-         * is legal. */
-        for (j = 0; j < 25; j++)
-            aanBoard[i][0][j] = aanBoard[i][1][j] = 0;
-
-        for (j = 0; j < 15; j++) {
-            do {
-                k = irand(&rc) % 24;
-            } while (aanBoard[i][1][23 - k]);
-            aanBoard[i][0][k]++;
-
-            do {
-                k = irand(&rc) % 24;
-            } while (aanBoard[i][0][23 - k]);
-            aanBoard[i][1][k]++;
-        }
-    }
+    for (i = 0; i < EVALS_PER_ITERATION; i++)
+        RandomBoard(&rc, aanBoard[i]);
 
 #if defined(USE_MULTITHREAD)
     MT_Release();
@@ -87,6 +98,915 @@ RunEvals(void *UNUSED(notused))
 #endif
 }
 
+/* Compare a move list with the reference moves amRef[0..c-1] */
+static int
+SameMoves(const movelist * pml, const int cGenerated, const move * amRef, const unsigned int c,
+          const unsigned int cMaxMoves, const unsigned int cMaxPips)
+{
+    unsigned int j;
+
+    if (cGenerated != (int) c || pml->cMaxMoves != cMaxMoves || pml->cMaxPips != cMaxPips)
+        return FALSE;
+
+    for (j = 0; j < c; j++)
+        if (!EqualKeys(amRef[j].key, pml->amMoves[j].key) || amRef[j].cMoves != pml->amMoves[j].cMoves
+            || amRef[j].cPips != pml->amMoves[j].cPips
+            || memcmp(amRef[j].anMove, pml->amMoves[j].anMove, sizeof(amRef[j].anMove)))
+            return FALSE;
+
+    return TRUE;
+}
+
+/*
+ * Time GenerateMoves() against the recursive generator it replaced on
+ * the same random positions (a quarter of them with a chequer on the
+ * bar), and check that both find the same moves.
+ */
+static void
+CalibrateMoveGen(char *sz)
+{
+    int n = 100;
+    unsigned int i, iIter, c, cMismatch = 0;
+    TanBoard aanBoard[MOVEGEN_POSITIONS];
+    move *amRef = g_new(move, MAX_INCOMPLETE_MOVES);
+    double tRecursive = 0.0, tIterative = 0.0;
+
+    if (sz && *sz) {
+        n = ParseNumber(&sz);
+
+        if (n < 1) {
+            outputl(_("If you specify a parameter to `calibrate movegen', "
+                      "it must be a number of iterations to run."));
+            g_free(amRef);
+            return;
+        }
+    }
+
+    rc.randrsl[0] = (ub4) time(NULL);
+    for (i = 0; i < RANDSIZ; i++)
+        rc.randrsl[i] = rc.randrsl[0];
+    irandinit(&rc, TRUE);
+
+    for (iIter = 0; iIter < (unsigned int) n && !MT_SafeGet(&fInterrupt); iIter++) {
+        movelist ml;
+        int anDice[2];
+        double t;
+
+        for (i = 0; i < MOVEGEN_POSITIONS; i++) {
+            RandomBoard(&rc, aanBoard[i]);
+            if (!(i % 4)) {
+                unsigned int k;
+
+                for (k = 0; !aanBoard[i][1][k]; k++);
+                aanBoard[i][1][k]--;
+                aanBoard[i][1][24]++;
+            }
+        }
+
+        t = get_time();
+        for (i = 0; i < MOVEGEN_POSITIONS; i++)
+            for (anDice[0] = 1; anDice[0] <= 6; anDice[0]++)
+                for (anDice[1] = 1; anDice[1] <= anDice[0]; anDice[1]++)
+                    GenerateMovesRecursive(&ml, (ConstTanBoard) aanBoard[i], anDice[0], anDice[1], FALSE);
+        tRecursive += get_time() - t;
+
+        t = get_time();
+        for (i = 0; i < MOVEGEN_POSITIONS; i++)
+            for (anDice[0] = 1; anDice[0] <= 6; anDice[0]++)
+                for (anDice[1] = 1; anDice[1] <= anDice[0]; anDice[1]++)
+                    GenerateMoves(&ml, (ConstTanBoard) aanBoard[i], anDice[0], anDice[1], FALSE);
+        tIterative += get_time() - t;
+
+        for (i = 0; i < MOVEGEN_POSITIONS; i++)
+            for (anDice[0] = 1; anDice[0] <= 6; anDice[0]++)
+                for (anDice[1] = 1; anDice[1] <= anDice[0]; anDice[1]++) {
+                    unsigned int cMaxMoves, cMaxPips;
+
+                    c = (unsigned int) GenerateMovesRecursive(&ml, (ConstTanBoard) aanBoard[i], anDice[0], anDice[1],
+                                                              FALSE);
+                    cMaxMoves = ml.cMaxMoves;
+                    cMaxPips = ml.cMaxPips;
+                    memcpy(amRef, ml.amMoves, c * sizeof(move));
+
+                    if (!SameMoves(&ml, GenerateMoves(&ml, (ConstTanBoard) aanBoard[i], anDice[0], anDice[1], FALSE),
+                                   amRef, c, cMaxMoves, cMaxPips))
+                        cMismatch++;
+                }
+    }
+
+    g_free(amRef);
+
+    if (tRecursive <= 0.0 || tIterative <= 0.0) {
+        outputl(_("Calibration incomplete."));
+        return;
+    }
+
+    c = iIter * MOVEGEN_POSITIONS * 21;
+    outputf(_("Move generation: %.0f rolls/second (recursive generator: %.0f rolls/second, speed-up %.2f)\n"),
+            c * 1000.0 / tIterative, c * 1000.0 / tRecursive, tRecursive / tIterative);
+    if (cMismatch)
+        outputf(_("%u of %u move lists differ from the recursive generator!\n"), cMismatch, c);
+}
+
+/*
+ * `calibrate bench': separate timings for the hot paths of the
+ * evaluator on a fixed corpus of positions.  The corpus comes from a
+ * seeded generator, so it is the same on every machine and every run;
+ * BENCH_CORPUS_VERSION must be bumped whenever the generator changes,
+ * since figures for different corpora cannot be compared.  The results
+ * are printed as CSV, can be saved and later compared with a new run.
+ */
+
+#define BENCH_CORPUS_VERSION 1
+#define BENCH_CORPUS_SEED 0x676e7562
+#define BENCH_POSITIONS 256
+#define BENCH_MAX_INPUTS 512 /* room for the inputs of any net */
+#define BENCH_CACHE_SIZE (1U << 18)
+#define BENCH_CACHE_CONTEXTS 16
+#define BENCH_TOLERANCE 0.10f
+
+typedef enum {
+    BENCH_CONTACT,              /* random, a quarter with a chequer on the bar */
+    BENCH_RACE,                 /* both sides in their own halves */
+    BENCH_BEAROFF,              /* up to six chequers each in the home boards */
+    NUM_BENCH_SETS
+} benchset;
+
+typedef struct {
+    TanBoard anBoard;
+    int anDice[2];
+} benchposition;
+
+static benchposition aabpCorpus[NUM_BENCH_SETS][BENCH_POSITIONS];
+static float *arBenchInputs;    /* inputs of a set for the net benchmarks */
+static unsigned int cBenchStride;
+static evalCache cBench;
+
+static void
+BenchSeed(randctx * prc)
+{
+    unsigned int i;
+
+    prc->randrsl[0] = BENCH_CORPUS_SEED;
+    for (i = 0; i < RANDSIZ; i++)
+        prc->randrsl[i] = prc->randrsl[0];
+    irandinit(prc, TRUE);
+}
+
+/* the i-th board of a set */
+static void
+BenchBoard(randctx * prc, const benchset bs, const unsigned int i, TanBoard anBoard)
+{
+    unsigned int j, k;
+
+    switch (bs) {
+    case BENCH_CONTACT:
+        RandomBoard(prc, anBoard);
+        if (!(i % 4)) {
+            for (k = 0; !anBoard[1][k]; k++);
+            anBoard[1][k]--;
+            anBoard[1][24]++;
+        }
+        break;
+
+    case BENCH_RACE:
+        memset(anBoard, 0, sizeof(TanBoard));
+        for (j = 0; j < 2; j++)
+            for (k = 8 + irand(prc) % 8; k; k--)
+                anBoard[j][irand(prc) % 12]++;
+        break;
+
+    default:
+        memset(anBoard, 0, sizeof(TanBoard));
+        for (j = 0; j < 2; j++)
+            for (k = 1 + irand(prc) % 6; k; k--)
+                anBoard[j][irand(prc) % 6]++;
+        break;
+    }
+}
+
+static void
+BenchCorpus(void)
+{
+    randctx rcCorpus;
+    unsigned int i, j;
+
+    BenchSeed(&rcCorpus);
+
+    for (i = 0; i < BENCH_POSITIONS; i++)
+        for (j = 0; j < NUM_BENCH_SETS; j++)
+            BenchBoard(&rcCorpus, (benchset) j, i, aabpCorpus[j][i].anBoard);
+
+    for (j = 0; j < NUM_BENCH_SETS; j++)
+        for (i = 0; i < BENCH_POSITIONS; i++) {
+            aabpCorpus[j][i].anDice[0] = 1 + (int) (irand(&rcCorpus) % 6);
+            aabpCorpus[j][i].anDice[1] = 1 + (int) (irand(&rcCorpus) % 6);
+        }
+}
+
+static unsigned int
+BenchMoveGen(int UNUSED(n))
+{
+    movelist ml;
+    unsigned int i, j;
+    int anDice[2];
+
+    for (j = BENCH_CONTACT; j <= BENCH_RACE; j++)
+        for (i = 0; i < BENCH_POSITIONS; i++)
+            for (anDice[0] = 1; anDice[0] <= 6; anDice[0]++)
+                for (anDice[1] = 1; anDice[1] <= anDice[0]; anDice[1]++)
+                    GenerateMoves(&ml, (ConstTanBoard) aabpCorpus[j][i].anBoard, anDice[0], anDice[1], FALSE);
+
+    return 2 * BENCH_POSITIONS * 21;
+}
+
+/* n is a net, as netid, for the input routine it is evaluated on */
+static unsigned int
+BenchInputs(int n)
+{
+    SSE_ALIGN(float arInput[BENCH_MAX_INPUTS]);
+    benchposition *abp = aabpCorpus[n % 3 == NET_RACE ? BENCH_RACE : BENCH_CONTACT];
+    unsigned int i;
+
+    for (i = 0; i < BENCH_POSITIONS; i++)
+        if (n >= NET_PRUNING_RACE)
+            baseInputs((ConstTanBoard) abp[i].anBoard, arInput);
+        else
+            CalculateInputs((positionclass) (CLASS_RACE + n), (ConstTanBoard) abp[i].anBoard, arInput);
+
+    return BENCH_POSITIONS;
+}
+
+/* compute the inputs once, so that only the net is timed */
+static void
+BenchNetSetup(int n)
+{
+    benchposition *abp = aabpCorpus[n % 3 == NET_RACE ? BENCH_RACE : BENCH_CONTACT];
+    SSE_ALIGN(float arInput[BENCH_MAX_INPUTS]);
+    unsigned int i;
+
+    g_assert(apnnEval[n]->cInput <= BENCH_MAX_INPUTS);
+
+    cBenchStride = (apnnEval[n]->cInput + 15) & ~15U;
+    sse_free(arBenchInputs);
+    arBenchInputs = sse_malloc(BENCH_POSITIONS * cBenchStride * sizeof(float));
+
+    for (i = 0; i < BENCH_POSITIONS; i++) {
+        if (n >= NET_PRUNING_RACE)
+            baseInputs((ConstTanBoard) abp[i].anBoard, arInput);
+        else
+            CalculateInputs((positionclass) (CLASS_RACE + n), (ConstTanBoard) abp[i].anBoard, arInput);
+        memcpy(arBenchInputs + i * cBenchStride, arInput, apnnEval[n]->cInput * sizeof(float));
+    }
+}
+
+static unsigned int
+BenchNet(int n)
+{
+    float arOutput[NUM_OUTPUTS];
+    unsigned int i;
+
+    for (i = 0; i < BENCH_POSITIONS; i++)
+#if defined(USE_SIMD_INSTRUCTIONS)
+        NeuralNetEvaluateSSE(apnnEval[n], arBenchInputs + i * cBenchStride, arOutput, NULL);
+#else
+        NeuralNetEvaluate(apnnEval[n], arBenchInputs + i * cBenchStride, arOutput, NULL);
+#endif
+
+    return BENCH_POSITIONS;
+}
+
+static void
+BenchCacheSetup(int UNUSED(n))
+{
+    if (!cBench.size && CacheCreate(&cBench, BENCH_CACHE_SIZE))
+        return;
+    CacheFlush(&cBench);
+}
+
+/* n is TRUE for the locking variants used by the threaded evaluator;
+ * each position is looked up (a miss) and added in several contexts */
+static unsigned int
+BenchCacheAdd(int n)
+{
+    cacheNodeDetail ec;
+    unsigned int i, j, k;
+    uint32_t l;
+    float arOutput[NUM_OUTPUTS];
+
+    if (!cBench.size)
+        return 0;
+
+    memset(&ec, 0, sizeof(ec));
+
+    for (j = 0; j < NUM_BENCH_SETS; j++)
+        for (i = 0; i < BENCH_POSITIONS; i++) {
+            PositionKey((ConstTanBoard) aabpCorpus[j][i].anBoard, &ec.key);
+            for (k = 0; k < BENCH_CACHE_CONTEXTS; k++) {
+                ec.nEvalContext = (int) k;
+                if (n) {
+                    if ((l = CacheLookupWithLocking(&cBench, &ec, arOutput, NULL)) != CACHEHIT)
+                        CacheAddWithLocking(&cBench, &ec, l);
+                } else if ((l = CacheLookupNoLocking(&cBench, &ec, arOutput, NULL)) != CACHEHIT)
+                    CacheAddNoLocking(&cBench, &ec, l);
+            }
+        }
+
+    return NUM_BENCH_SETS * BENCH_POSITIONS * BENCH_CACHE_CONTEXTS;
+}
+
+/* the entries BenchCacheAdd() made, all hits */
+static void
+BenchCacheLookupSetup(int n)
+{
+    BenchCacheSetup(n);
+    (void) BenchCacheAdd(n);
+}
+
+static unsigned int
+BenchCacheLookup(int n)
+{
+    cacheNodeDetail ec;
+    unsigned int i, j, k;
+    float arOutput[NUM_OUTPUTS];
+
+    if (!cBench.size)
+        return 0;
+
+    memset(&ec, 0, sizeof(ec));
+
+    for (j = 0; j < NUM_BENCH_SETS; j++)
+        for (i = 0; i < BENCH_POSITIONS; i++) {
+            PositionKey((ConstTanBoard) aabpCorpus[j][i].anBoard, &ec.key);
+            for (k = 0; k < BENCH_CACHE_CONTEXTS; k++) {
+                ec.nEvalContext = (int) k;
+                if (n)
+                    (void) CacheLookupWithLocking(&cBench, &ec, arOutput, NULL);
+                else
+                    (void) CacheLookupNoLocking(&cBench, &ec, arOutput, NULL);
+            }
+        }
+
+    return NUM_BENCH_SETS * BENCH_POSITIONS * BENCH_CACHE_CONTEXTS;
+}
+
+/* n is 0 for the one-sided and 1 for the two-sided database */
+static unsigned int
+BenchBearoff(int n)
+{
+    bearoffcontext *pbc = n ? pbc2 : pbc1;
+    float arOutput[NUM_OUTPUTS];
+    unsigned int i, c = 0;
+
+    if (!pbc)
+        return 0;
+
+    for (i = 0; i < BENCH_POSITIONS; i++)
+        if (isBearoff(pbc, (ConstTanBoard) aabpCorpus[BENCH_BEAROFF][i].anBoard)) {
+            BearoffEval(pbc, (ConstTanBoard) aabpCorpus[BENCH_BEAROFF][i].anBoard, arOutput);
+            c++;
+        }
+
+    return c;
+}
+
+static TanBoard aanBenchEval[BENCH_POSITIONS];
+static positionclass apcBenchEval[BENCH_POSITIONS];
+
+/* the contact set, with the positions of each class together */
+static void
+BenchEvalSetup(int UNUSED(n))
+{
+    positionclass apc[BENCH_POSITIONS];
+    unsigned int i, c = 0;
+    int pc;
+
+    for (i = 0; i < BENCH_POSITIONS; i++)
+        apc[i] = ClassifyPosition((ConstTanBoard) aabpCorpus[BENCH_CONTACT][i].anBoard, VARIATION_STANDARD);
+
+    for (pc = 0; pc < N_CLASSES; pc++)
+        for (i = 0; i < BENCH_POSITIONS; i++)
+            if (apc[i] == (positionclass) pc) {
+                memcpy(aanBenchEval[c], aabpCorpus[BENCH_CONTACT][i].anBoard, sizeof(TanBoard));
+                apcBenchEval[c++] = apc[i];
+            }
+}
+
+/* n is the most positions evaluated in one call of
+ * EvaluatePositionsBatch(); 1 evaluates them one at a time */
+static unsigned int
+BenchEval(int n)
+{
+    float aarOutput[NN_BATCH_SIZE][NUM_OUTPUTS];
+    unsigned int i, c;
+
+    for (i = 0; i < BENCH_POSITIONS; i += c) {
+        for (c = 1; c < (unsigned int) n && i + c < BENCH_POSITIONS && apcBenchEval[i + c] == apcBenchEval[i]; c++);
+
+        if (EvaluatePositionsBatch((const TanBoard *) (aanBenchEval + i), c, aarOutput, apcBenchEval[i],
+                                   VARIATION_STANDARD, NULL))
+            return 0;
+    }
+
+    return BENCH_POSITIONS;
+}
+
+/* every search starts from an empty evaluation cache */
+static void
+BenchFlushSetup(int UNUSED(n))
+{
+    EvalCacheFlush();
+}
+
+/* n is the number of plies; deeper searches take fewer positions */
+static unsigned int
+BenchFindBestMove(int n)
+{
+    evalcontext ec = { TRUE, 0, TRUE, TRUE, 0.0f };
+    cubeinfo ci;
+    unsigned int i, c = BENCH_POSITIONS >> (3 * n);
+    int anMove[8];
+
+    ec.nPlies = (unsigned int) n;
+    SetCubeInfoMoney(&ci, 1, -1, 0, FALSE, FALSE, VARIATION_STANDARD);
+
+    for (i = 0; i < c && !MT_SafeGet(&fInterrupt); i++) {
+        TanBoard anBoard;
+
+        memcpy(anBoard, aabpCorpus[BENCH_CONTACT][i].anBoard, sizeof(TanBoard));
+        FindBestMove(anMove, aabpCorpus[BENCH_CONTACT][i].anDice[0], aabpCorpus[BENCH_CONTACT][i].anDice[1],
+                     anBoard, &ci, &ec, defaultFilters);
+    }
+
+    return i;
+}
+
+/* n games of a cubeless 0-ply rollout truncated after 11 plies */
+static void
+BenchRolloutContext(rolloutcontext * prc, int n)
+{
+    evalcontext ec = { FALSE, 0, TRUE, TRUE, 0.0f };
+    int i;
+
+    *prc = rcRollout;
+    for (i = 0; i < 2; i++)
+        prc->aecCube[i] = prc->aecChequer[i] = ec;
+    prc->aecCubeTrunc = prc->aecChequerTrunc = ec;
+    prc->fCubeful = FALSE;
+    prc->fVarRedn = TRUE;
+    prc->fInitial = FALSE;
+    prc->fRotate = TRUE;
+    prc->fLateEvals = FALSE;
+    prc->fDoTruncate = TRUE;
+    prc->nTruncate = 11;
+    prc->fStopOnSTD = prc->fStopOnJsd = prc->fStopMoveOnJsd = FALSE;
+    prc->fTruncBearoff2 = prc->fTruncBearoffOS = FALSE;
+    prc->nTrials = (unsigned int) n;
+    prc->rngRollout = RNG_MERSENNE;
+    prc->nSeed = BENCH_CORPUS_SEED;
+    prc->nGamesDone = 0;
+    prc->nSkip = 0;
+}
+
+static unsigned int
+BenchRollout(int n)
+{
+    rolloutcontext rcBench;
+    float arOutput[NUM_ROLLOUT_OUTPUTS], arStdDev[NUM_ROLLOUT_OUTPUTS];
+    rolloutstat ars[2];
+    cubeinfo ci;
+    int i, fShowProgressSave = fShowProgress;
+
+    BenchRolloutContext(&rcBench, n);
+    SetCubeInfoMoney(&ci, 1, -1, 0, FALSE, FALSE, VARIATION_STANDARD);
+
+    fShowProgress = FALSE;
+    outputoff();
+    i = GeneralEvaluationR(arOutput, arStdDev, ars, (ConstTanBoard) aabpCorpus[BENCH_CONTACT][0].anBoard, &ci, &rcBench,
+                           NULL, NULL);
+    outputon();
+    fShowProgress = fShowProgressSave;
+
+    return i < 0 ? 0 : (unsigned int) n;
+}
+
+static const struct {
+    const char *szName;
+    void (*pfSetup) (int n);    /* not timed; may be NULL */
+    unsigned int (*pfRun) (int n);      /* returns the operations done */
+    int n;
+} abench[] = {
+    { "movegen", NULL, BenchMoveGen, 0 },
+    { "inputs-race", NULL, BenchInputs, NET_RACE },
+    { "inputs-crashed", NULL, BenchInputs, NET_CRASHED },
+    { "inputs-contact", NULL, BenchInputs, NET_CONTACT },
+    { "inputs-pruning", NULL, BenchInputs, NET_PRUNING_CONTACT },
+    { "nn-race", BenchNetSetup, BenchNet, NET_RACE },
+    { "nn-crashed", BenchNetSetup, BenchNet, NET_CRASHED },
+    { "nn-contact", BenchNetSetup, BenchNet, NET_CONTACT },
+    { "nn-pruning-race", BenchNetSetup, BenchNet, NET_PRUNING_RACE },
+    { "nn-pruning-crashed", BenchNetSetup, BenchNet, NET_PRUNING_CRASHED },
+    { "nn-pruning-contact", BenchNetSetup, BenchNet, NET_PRUNING_CONTACT },
+    { "eval-contact", BenchEvalSetup, BenchEval, 1 },
+    { "eval-batch-contact", BenchEvalSetup, BenchEval, NN_BATCH_SIZE },
+    { "cache-add", BenchCacheSetup, BenchCacheAdd, FALSE },
+    { "cache-lookup", BenchCacheLookupSetup, BenchCacheLookup, FALSE },
+    { "cache-add-locking", BenchCacheSetup, BenchCacheAdd, TRUE },
+    { "cache-lookup-locking", BenchCacheLookupSetup, BenchCacheLookup, TRUE },
+    { "bearoff-os", NULL, BenchBearoff, 0 },
+    { "bearoff-ts", NULL, BenchBearoff, 1 },
+    { "findbestmove-0ply", BenchFlushSetup, BenchFindBestMove, 0 },
+    { "findbestmove-1ply", BenchFlushSetup, BenchFindBestMove, 1 },
+    { "findbestmove-2ply", BenchFlushSetup, BenchFindBestMove, 2 },
+    { "rollout", BenchFlushSetup, BenchRollout, 36 }
+};
+
+#define NUM_BENCH (sizeof(abench) / sizeof(abench[0]))
+
+/* Reads the ops/s column of a file saved by `calibrate bench save';
+ * returns FALSE if it is unreadable or for another corpus */
+static int
+BenchReadBaseline(const char *szFile, float arBaseline[NUM_BENCH])
+{
+    FILE *pf;
+    char sz[256];
+    int nCorpus = -1;
+    unsigned int i;
+
+    if (!(pf = g_fopen(szFile, "r"))) {
+        outputerr(szFile);
+        return FALSE;
+    }
+
+    for (i = 0; i < NUM_BENCH; i++)
+        arBaseline[i] = 0.0f;
+
+    while (fgets(sz, sizeof(sz), pf)) {
+        char *pch = strchr(sz, ',');
+        float r;
+
+        if (*sz == '#') {
+            if ((pch = strstr(sz, "corpus=")))
+                nCorpus = atoi(pch + 7);
+            continue;
+        }
+
+        if (!pch)
+            continue;
+        *pch++ = 0;
+
+        /* ops,seconds,ops/s */
+        if (sscanf(pch, "%*u,%*f,%f", &r) != 1)
+            continue;
+
+        for (i = 0; i < NUM_BENCH; i++)
+            if (!strcmp(sz, abench[i].szName))
+                arBaseline[i] = r;
+    }
+
+    fclose(pf);
+
+    if (nCorpus != BENCH_CORPUS_VERSION) {
+        outputf(_("%s is for corpus version %d, not %d; it cannot be compared.\n"), szFile, nCorpus,
+                BENCH_CORPUS_VERSION);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+BenchSave(const char *szFile, const GString * gsz)
+{
+    FILE *pf = g_fopen(szFile, "w");
+
+    if (!pf || fputs(gsz->str, pf) < 0)
+        outputerr(szFile);
+    if (pf)
+        fclose(pf);
+}
+
+static void
+CalibrateBench(char *sz)
+{
+    int n = 1;
+    char *pch, *szSave = NULL, *szCompare = NULL;
+    float arBaseline[NUM_BENCH];
+    unsigned int i, cSlower = 0;
+    int fBaseline = FALSE;
+    GString *gsz;
+
+    while ((pch = NextToken(&sz))) {
+        char **psz = !StrCaseCmp(pch, "save") ? &szSave : !StrCaseCmp(pch, "compare") ? &szCompare : NULL;
+
+        if (psz ? !(*psz = NextToken(&sz)) : (n = atoi(pch)) < 1) {
+            outputl(_("Usage: calibrate bench [iterations] [save <file>] [compare <file>]"));
+            return;
+        }
+    }
+
+    if (szCompare && !(fBaseline = BenchReadBaseline(szCompare, arBaseline)))
+        return;
+
+    BenchCorpus();
+
+    gsz = g_string_new(NULL);
+    g_string_append_printf(gsz, "# gnubg-bench version=%s corpus=%d kernel=%s threads=%u iterations=%d\n", VERSION,
+                           BENCH_CORPUS_VERSION, SIMD_SelectKernel(), (unsigned int) MT_GetNumThreads(), n);
+    g_string_append(gsz, fBaseline ? "benchmark,ops,seconds,ops/s,baseline ops/s,ratio\n"
+                    : "benchmark,ops,seconds,ops/s\n");
+    outputf("%s", gsz->str);
+
+    for (i = 0; i < NUM_BENCH && !MT_SafeGet(&fInterrupt); i++) {
+        unsigned int c = 0;
+        double t = 0.0;
+        float r;
+        int iIter;
+        GString *gszLine;
+
+        for (iIter = 0; iIter < n && !MT_SafeGet(&fInterrupt); iIter++) {
+            double t0;
+
+            if (abench[i].pfSetup)
+                abench[i].pfSetup(abench[i].n);
+
+            t0 = get_time();
+            c += abench[i].pfRun(abench[i].n);
+            t += get_time() - t0;
+        }
+
+        if (!c || t <= 0.0)
+            /* e.g. no bearoff database of that kind */
+            continue;
+
+        r = (float) (c * 1000.0 / t);
+        gszLine = g_string_new(NULL);
+        g_string_append_printf(gszLine, "%s,%u,%.4f,%.1f", abench[i].szName, c, t / 1000.0, r);
+        if (fBaseline && arBaseline[i] > 0.0f) {
+            g_string_append_printf(gszLine, ",%.1f,%.3f", arBaseline[i], r / arBaseline[i]);
+            if (r < arBaseline[i] * (1.0f - BENCH_TOLERANCE))
+                cSlower++;
+        } else if (fBaseline)
+            g_string_append(gszLine, ",,");
+        g_string_append_c(gszLine, '\n');
+
+        outputf("%s", gszLine->str);
+        g_string_append(gsz, gszLine->str);
+        g_string_free(gszLine, TRUE);
+    }
+
+    if (cBench.size) {
+        CacheDestroy(&cBench);
+        memset(&cBench, 0, sizeof(cBench));
+    }
+    sse_free(arBenchInputs);
+    arBenchInputs = NULL;
+
+    if (fBaseline)
+        outputf(_("# %u benchmarks more than %.0f%% slower than %s\n"), cSlower, BENCH_TOLERANCE * 100.0f,
+                szCompare);
+
+    if (szSave)
+        BenchSave(szSave, gsz);
+
+    g_string_free(gsz, TRUE);
+}
+
+/*
+ * `calibrate scaling': the same fixed amount of 0-ply evaluation done
+ * with 1, 2, 4, ... threads, for contact and race positions and with
+ * the evaluation cache on and off.  Each task evaluates a run of
+ * positions from a pool that is gone through several times, so with
+ * the cache on most evaluations are hits, as in an analysis.
+ */
+
+#define SCALING_POSITIONS 16384
+#define SCALING_TASKS 256
+
+#if defined(USE_MULTITHREAD)
+static struct {
+    TanBoard *aanPool;
+    int iNextTask;
+} scaling;
+
+static void
+RunScalingTask(void *UNUSED(notused))
+{
+    unsigned int const iTask = (unsigned int) MT_SafeIncCheck(&scaling.iNextTask);
+    evalcontext ec = { FALSE, 0, TRUE, TRUE, 0.0f };
+    float arOutput[NUM_OUTPUTS];
+    unsigned int i;
+
+    for (i = 0; i < EVALS_PER_ITERATION; i++)
+        (void) EvaluatePosition(NULL,
+                                (ConstTanBoard) scaling.aanPool[(iTask * EVALS_PER_ITERATION + i) % SCALING_POSITIONS],
+                                arOutput, &ciCubeless, &ec);
+}
+#endif
+
+static void
+CalibrateScaling(char *sz)
+{
+#if defined(USE_MULTITHREAD)
+    unsigned int nMax = MT_GetNumThreads(), nThreadsSave = MT_GetNumThreads();
+    unsigned int iCacheSize = GetEvalCacheEntries();
+    char *pch, *szSave = NULL;
+    GString *gsz;
+    randctx rcPool;
+    int bs, fCache;
+
+#if GLIB_CHECK_VERSION(2,36,0)
+    nMax = g_get_num_processors();
+#endif
+
+    while ((pch = NextToken(&sz))) {
+        if (!StrCaseCmp(pch, "save") ? !(szSave = NextToken(&sz)) : (nMax = (unsigned int) atoi(pch)) < 1) {
+            outputl(_("Usage: calibrate scaling [maximum threads] [save <file>]"));
+            return;
+        }
+    }
+
+    if (nMax > MAX_NUMTHREADS)
+        nMax = MAX_NUMTHREADS;
+
+    scaling.aanPool = g_new(TanBoard, SCALING_POSITIONS);
+
+    gsz = g_string_new(NULL);
+    g_string_append_printf(gsz, "# gnubg-scaling version=%s kernel=%s evals/run=%u positions=%u\n", VERSION,
+                           SIMD_SelectKernel(), SCALING_TASKS * EVALS_PER_ITERATION, SCALING_POSITIONS);
+    g_string_append(gsz, "positions,cache,threads,evals/s,speed-up,efficiency,lock waits,lock wait ms,lock wait %\n");
+    outputf("%s", gsz->str);
+
+    for (bs = BENCH_CONTACT; bs <= BENCH_RACE; bs++) {
+        unsigned int i;
+
+        BenchSeed(&rcPool);
+        for (i = 0; i < SCALING_POSITIONS; i++)
+            BenchBoard(&rcPool, (benchset) bs, i, scaling.aanPool[i]);
+
+        for (fCache = FALSE; fCache <= TRUE; fCache++) {
+            unsigned int nThreads;
+            double rRate1 = 0.0;
+
+            EvalCacheResize(fCache ? iCacheSize : 0);
+
+            for (nThreads = 1; nThreads <= nMax && !MT_SafeGet(&fInterrupt);
+                 nThreads = nThreads < nMax && 2 * nThreads > nMax ? nMax : 2 * nThreads) {
+                double t, rRate, rWait;
+                unsigned int cWaits;
+                GString *gszLine;
+
+                MT_SetNumThreads(nThreads);
+                EvalCacheFlush();
+                scaling.iNextTask = 0;
+                td.cLockWaits = 0;
+                td.rLockWaitMs = 0.0;
+                MT_SafeSet(&td.fCountLockWaits, TRUE);
+
+                t = get_time();
+                mt_add_tasks(SCALING_TASKS, RunScalingTask, NULL, NULL);
+                (void) MT_WaitForTasks(NULL, 0, FALSE);
+                t = get_time() - t;
+
+                MT_SafeSet(&td.fCountLockWaits, FALSE);
+                Mutex_Lock(&td.lockWaitLock);
+                cWaits = td.cLockWaits;
+                rWait = td.rLockWaitMs;
+                Mutex_Release(&td.lockWaitLock);
+
+                if (t <= 0.0)
+                    continue;
+
+                rRate = SCALING_TASKS * EVALS_PER_ITERATION * 1000.0 / t;
+                if (nThreads == 1)
+                    rRate1 = rRate;
+
+                gszLine = g_string_new(NULL);
+                g_string_append_printf(gszLine, "%s,%s,%u,%.0f,%.2f,%.2f,%u,%.1f,%.2f\n",
+                                       bs == BENCH_CONTACT ? "contact" : "race", fCache ? "on" : "off", nThreads,
+                                       rRate, rRate1 > 0.0 ? rRate / rRate1 : 0.0,
+                                       rRate1 > 0.0 ? rRate / (rRate1 * nThreads) : 0.0, cWaits, rWait,
+                                       100.0 * rWait / (t * nThreads));
+                outputf("%s", gszLine->str);
+                g_string_append(gsz, gszLine->str);
+                g_string_free(gszLine, TRUE);
+
+                if (nThreads == nMax)
+                    break;
+            }
+        }
+    }
+
+    MT_SetNumThreads(nThreadsSave);
+    EvalCacheResize(iCacheSize);
+    g_free(scaling.aanPool);
+
+    if (szSave)
+        BenchSave(szSave, gsz);
+
+    g_string_free(gsz, TRUE);
+#else
+    (void) sz;
+    outputl(_("`calibrate scaling' needs a build with multithreading."));
+#endif
+}
+
+/*
+ * `calibrate rollout': a short rotated rollout of the initial position
+ * must give the same results bit for bit when it is rolled out
+ * deterministically with one thread and with several, and the same
+ * results again, but for the rounding of the batched neural net
+ * evaluations, when the trials are played in lockstep.
+ */
+
+#define CHECK_ROLLOUT_TRIALS 288        /* two blocks of deterministic trials */
+#define CHECK_ROLLOUT_LOCKSTEP 16
+
+#if defined(USE_MULTITHREAD)
+static int
+CheckRollout(float arOutput[NUM_ROLLOUT_OUTPUTS], float arStdDev[NUM_ROLLOUT_OUTPUTS], unsigned int nThreads)
+{
+    rolloutcontext rcCheck;
+    rolloutstat ars[2];
+    cubeinfo ci;
+    TanBoard anBoard;
+    int n, fShowProgressSave = fShowProgress;
+
+    BenchRolloutContext(&rcCheck, CHECK_ROLLOUT_TRIALS);
+    rcCheck.fInitial = TRUE;
+    InitBoard(anBoard, VARIATION_STANDARD);
+    SetCubeInfoMoney(&ci, 1, -1, 0, FALSE, FALSE, VARIATION_STANDARD);
+
+    MT_SetNumThreads(nThreads);
+
+    fShowProgress = FALSE;
+    outputoff();
+    n = GeneralEvaluationR(arOutput, arStdDev, ars, (ConstTanBoard) anBoard, &ci, &rcCheck, NULL, NULL);
+    outputon();
+    fShowProgress = fShowProgressSave;
+
+    return n;
+}
+#endif
+
+static void
+CalibrateRollout(char *sz)
+{
+#if defined(USE_MULTITHREAD)
+    unsigned int nThreads = MT_GetNumThreads(), nThreadsSave = MT_GetNumThreads();
+    int fDeterministicSave = fRolloutDeterministic;
+    int nLockstepSave = nRolloutLockstep;
+    float aarOutput[3][NUM_ROLLOUT_OUTPUTS], aarStdDev[3][NUM_ROLLOUT_OUTPUTS];
+    float rDiff = 0.0f;
+    int fOK, i;
+
+    if (sz && *sz) {
+        int n = ParseNumber(&sz);
+
+        if (n < 2) {
+            outputl(_("If you specify a parameter to `calibrate rollout', "
+                      "it must be a number of threads of at least 2."));
+            return;
+        }
+        nThreads = (unsigned int) n;
+    }
+
+    nThreads = MIN(MAX(nThreads, 2), MAX_NUMTHREADS);
+
+    fRolloutDeterministic = TRUE;
+    nRolloutLockstep = 0;
+    fOK = CheckRollout(aarOutput[0], aarStdDev[0], 1) >= 0 && CheckRollout(aarOutput[1], aarStdDev[1], nThreads) >= 0;
+    nRolloutLockstep = CHECK_ROLLOUT_LOCKSTEP;
+    fOK = fOK && CheckRollout(aarOutput[2], aarStdDev[2], nThreads) >= 0;
+    nRolloutLockstep = nLockstepSave;
+    fRolloutDeterministic = fDeterministicSave;
+    MT_SetNumThreads(nThreadsSave);
+
+    if (!fOK) {
+        outputl(_("Calibration incomplete."));
+        return;
+    }
+
+    if (!memcmp(aarOutput[0], aarOutput[1], sizeof(aarOutput[0]))
+        && !memcmp(aarStdDev[0], aarStdDev[1], sizeof(aarStdDev[0])))
+        outputf(_("Deterministic rollout of the initial position: the same results with 1 and %u threads\n"),
+                nThreads);
+    else
+        outputf(_("Deterministic rollout of the initial position: the results with 1 and %u threads differ!\n"),
+                nThreads);
+
+    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; i++)
+        rDiff = MAX(rDiff, fabsf(aarOutput[2][i] - aarOutput[0][i]));
+    if (rDiff == 0.0f)
+        outputf(_("Trials played %d in lockstep: the same results\n"), CHECK_ROLLOUT_LOCKSTEP);
+    else
+        outputf(_("Trials played %d in lockstep: the results differ by up to %g\n"), CHECK_ROLLOUT_LOCKSTEP, rDiff);
+#else
+    (void) sz;
+    outputl(_("`calibrate rollout' needs a build with multithreading."));
+#endif
+}
+
 extern void
 CommandCalibrate(char *sz)
 {
@@ -96,6 +1016,30 @@ CommandCalibrate(char *sz)
     void *pcc = NULL;
 #endif
 
+    if (sz && *sz && !StrNCaseCmp(sz, "movegen", strcspn(sz, " \t\n\r\v\f"))) {
+        NextToken(&sz);
+        CalibrateMoveGen(sz);
+        return;
+    }
+
+    if (sz && *sz && !StrNCaseCmp(sz, "bench", strcspn(sz, " \t\n\r\v\f"))) {
+        NextToken(&sz);
+        CalibrateBench(sz);
+        return;
+    }
+
+    if (sz && *sz && !StrNCaseCmp(sz, "scaling", strcspn(sz, " \t\n\r\v\f"))) {
+        NextToken(&sz);
+        CalibrateScaling(sz);
+        return;
+    }
+
+    if (sz && *sz && !StrNCaseCmp(sz, "rollout", strcspn(sz, " \t\n\r\v\f"))) {
+        NextToken(&sz);
+        CalibrateRollout(sz);
+        return;
+    }
+
     iCacheSize = GetEvalCacheEntries();
     EvalCacheResize(0);
 